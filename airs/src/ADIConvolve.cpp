@@ -0,0 +1,285 @@
+/**
+ * @file ADIConvolve.cpp ADIReduct使用的卷积滤波引擎
+ * @version 0.1
+ * @date 2020-11-10
+ */
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include "ADIConvolve.h"
+#include "FrameStat.h"
+#include "ADISimd.h"
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+ADIConvolve::ADIConvolve() {
+	mode_   = CONV_NONE;
+	width_  = height_ = 0;
+	nfft_   = 0;
+}
+
+ADIConvolve::~ADIConvolve() {
+
+}
+
+bool ADIConvolve::SetKernel(const double *mask, int width, int height) {
+	mode_ = CONV_NONE;
+	if (!mask || width < 1 || height < 1 || !(width & 1) || !(height & 1)) return false;
+
+	width_  = width;
+	height_ = height;
+	kernel_.assign(mask, mask + width * height);
+	kfft_.clear();
+	if (separate(mask)) mode_ = CONV_SEPARABLE;
+	else if (width * height <= 441) mode_ = CONV_DIRECT;
+	else {// 大于21*21的不可分离卷积核: 逐行卷积耗时超过分块FFT
+		mode_ = CONV_FFT;
+		init_fft();
+	}
+	return true;
+}
+
+int ADIConvolve::Mode() {
+	return mode_;
+}
+
+void ADIConvolve::DoIt(const float *src, float *dst, int wimg, int himg, int nthread) {
+	int wh = width_ / 2, hh = height_ / 2;
+	int y, ntask;
+
+	/* 卷积核超出图像的边缘像素保持原值 */
+	if (mode_ == CONV_NONE || wimg <= 2 * wh || himg <= 2 * hh) {
+		memcpy(dst, src, sizeof(float) * wimg * himg);
+		return;
+	}
+	memcpy(dst, src, sizeof(float) * wimg * hh);
+	memcpy(dst + (himg - hh) * wimg, src + (himg - hh) * wimg, sizeof(float) * wimg * hh);
+	for (y = hh; y < himg - hh; ++y) {
+		memcpy(dst + y * wimg, src + y * wimg, sizeof(float) * wh);
+		memcpy(dst + (y + 1) * wimg - wh, src + (y + 1) * wimg - wh, sizeof(float) * wh);
+	}
+
+	/* 按行或分块行并行 */
+	if (mode_ == CONV_FFT) ntask = (himg - 2 * hh + nfft_ - height_) / (nfft_ - height_ + 1);
+	else ntask = himg - 2 * hh;
+	if (nthread > ntask) nthread = ntask;
+	if (nthread < 1) nthread = 1;
+
+	if (nthread == 1) {
+		if      (mode_ == CONV_SEPARABLE) conv_separable(src, dst, wimg, himg, 0, 1);
+		else if (mode_ == CONV_DIRECT)    conv_direct(src, dst, wimg, himg, 0, 1);
+		else                              conv_fft(src, dst, wimg, himg, 0, 1);
+	}
+	else {
+		StatThreadGroup grp;
+		for (int i = 0; i < nthread; ++i) {
+			if (mode_ == CONV_SEPARABLE)
+				grp.create_thread(boost::bind(&ADIConvolve::conv_separable, this, src, dst, wimg, himg, i, nthread));
+			else if (mode_ == CONV_DIRECT)
+				grp.create_thread(boost::bind(&ADIConvolve::conv_direct, this, src, dst, wimg, himg, i, nthread));
+			else
+				grp.create_thread(boost::bind(&ADIConvolve::conv_fft, this, src, dst, wimg, himg, i, nthread));
+		}
+		grp.join_all();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/*
+ * 以绝对值最大的元素为主元, 检查卷积核是否为其所在行与所在列的外积
+ */
+bool ADIConvolve::separate(const double *mask) {
+	int n = width_ * height_, i, p, q, dx, dy;
+	double maxabs(0.0), pivot, err;
+
+	for (i = 0, p = 0; i < n; ++i) {
+		if (fabs(mask[i]) > maxabs) maxabs = fabs(mask[p = i]);
+	}
+	if (maxabs == 0.0) return false;
+	q = p % width_;
+	p = p / width_;
+	pivot = mask[p * width_ + q];
+
+	kx_.resize(width_);
+	ky_.resize(height_);
+	for (dx = 0; dx < width_; ++dx) kx_[dx] = float(mask[p * width_ + dx] / pivot);
+	for (dy = 0; dy < height_; ++dy) ky_[dy] = float(mask[dy * width_ + q]);
+	for (dy = 0; dy < height_; ++dy) {
+		for (dx = 0; dx < width_; ++dx) {
+			err = mask[dy * width_ + dx] - mask[dy * width_ + q] * mask[p * width_ + dx] / pivot;
+			if (fabs(err) > 1E-6 * maxabs) return false;
+		}
+	}
+	return true;
+}
+
+void ADIConvolve::conv_separable(const float *src, float *dst, int wimg, int himg, int y0, int step) {
+	int wh = width_ / 2, hh = height_ / 2;
+	int n = wimg - 2 * wh;
+	std::vector<float> col(wimg);
+	float *out;
+	int y, dx, dy;
+
+	for (y = hh + y0; y < himg - hh; y += step) {
+		/* Y方向: 累加相邻行 */
+		memset(&col[0], 0, sizeof(float) * wimg);
+		for (dy = 0; dy < height_; ++dy) {
+			if (ky_[dy] != 0.0) SimdRowAxpy(&col[0], src + (y - hh + dy) * wimg, wimg, ky_[dy]);
+		}
+		/* X方向: 累加平移后的中间结果 */
+		out = dst + y * wimg + wh;
+		memset(out, 0, sizeof(float) * n);
+		for (dx = 0; dx < width_; ++dx) {
+			if (kx_[dx] != 0.0) SimdRowAxpy(out, &col[dx], n, kx_[dx]);
+		}
+	}
+}
+
+void ADIConvolve::conv_direct(const float *src, float *dst, int wimg, int himg, int y0, int step) {
+	const int nblk = 2048;	// 列分块, 使累加结果驻留L1缓存
+	int wh = width_ / 2, hh = height_ / 2;
+	int n = wimg - 2 * wh;
+	const float *row;
+	float *out, k;
+	int y, x0, nx, dx, dy;
+
+	for (y = hh + y0; y < himg - hh; y += step) {
+		for (x0 = 0; x0 < n; x0 += nblk) {
+			nx  = std::min(nblk, n - x0);
+			out = dst + y * wimg + wh + x0;
+			memset(out, 0, sizeof(float) * nx);
+			for (dy = 0; dy < height_; ++dy) {
+				row = src + (y - hh + dy) * wimg + x0;
+				for (dx = 0; dx < width_; ++dx) {
+					if ((k = kernel_[dy * width_ + dx]) != 0.0) SimdRowAxpy(out, row + dx, nx, k);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * overlap-save: 每个分块输入nfft_*nfft_像素, 输出(nfft_-height_+1)*(nfft_-width_+1)像素
+ * 卷积核为实数, 相邻两个分块分别作为实部和虚部, 一次复数FFT完成两个分块
+ */
+void ADIConvolve::conv_fft(const float *src, float *dst, int wimg, int himg, int i0, int step) {
+	int wh = width_ / 2, hh = height_ / 2;
+	int bw = nfft_ - width_ + 1, bh = nfft_ - height_ + 1;	// 分块输出尺寸
+	int xe = wimg - wh, ye = himg - hh;	// 输出区域: [wh, xe)*[hh, ye)
+	int ntile = (xe - wh + bw - 1) / bw;
+	int nfft2 = nfft_ * nfft_;
+	cplxvec tile(nfft2);
+	int i, j, k, m, x, y, x0, y0, x1, y1;
+	double norm = 1.0 / nfft2;
+
+	for (i = i0; hh + i * bh < ye; i += step) {
+		y0 = hh + i * bh;		// 输出起始行
+		y1 = std::min(y0 + bh, ye);
+		for (j = 0; j < ntile; j += 2) {
+			/* 加载输入: 实部为第j块, 虚部为第j+1块. 图像外像素置零 */
+			std::fill(tile.begin(), tile.end(), cplx(0.0, 0.0));
+			for (k = 0; k < 2 && j + k < ntile; ++k) {
+				x0 = (j + k) * bw;	// 输入起始列
+				x1 = std::min(x0 + nfft_, wimg);
+				for (m = 0, y = y0 - hh; m < nfft_ && y < himg; ++m, ++y) {
+					const float *row = src + y * wimg;
+					cplx *ptr = &tile[m * nfft_];
+					if (k == 0) for (x = x0; x < x1; ++x) ptr[x - x0].real(row[x]);
+					else        for (x = x0; x < x1; ++x) ptr[x - x0].imag(row[x]);
+				}
+			}
+			/* 频域相乘 */
+			fft2(&tile[0], false);
+			for (k = 0; k < nfft2; ++k) {
+				double *a = reinterpret_cast<double*>(&tile[k]);
+				const double *b = reinterpret_cast<const double*>(&kfft_[k]);
+				double re = a[0] * b[0] - a[1] * b[1];
+				a[1] = a[0] * b[1] + a[1] * b[0];
+				a[0] = re;
+			}
+			fft2(&tile[0], true);
+			/* 输出有效区域 */
+			for (k = 0; k < 2 && j + k < ntile; ++k) {
+				x0 = wh + (j + k) * bw;
+				x1 = std::min(x0 + bw, xe);
+				for (y = y0; y < y1; ++y) {
+					const cplx *ptr = &tile[(y - y0 + 2 * hh) * nfft_ + 2 * wh - x0];
+					float *out = dst + y * wimg;
+					if (k == 0) for (x = x0; x < x1; ++x) out[x] = float(ptr[x].real() * norm);
+					else        for (x = x0; x < x1; ++x) out[x] = float(ptr[x].imag() * norm);
+				}
+			}
+		}
+	}
+}
+
+void ADIConvolve::init_fft() {
+	int n, i, j, bits, dx, dy;
+
+	/* 分块边长: 不小于卷积核的8倍, 范围[64, 256] */
+	n = std::max(width_, height_) * 8;
+	for (nfft_ = 64; nfft_ < n && nfft_ < 256; nfft_ <<= 1);
+	for (bits = 0; (1 << bits) < nfft_; ++bits);
+
+	twiddle_.resize(nfft_ / 2);
+	for (i = 0; i < nfft_ / 2; ++i) twiddle_[i] = std::polar(1.0, -2.0 * M_PI * i / nfft_);
+	bitrev_.resize(nfft_);
+	for (i = 0; i < nfft_; ++i) {
+		for (j = 0, n = i, bitrev_[i] = 0; j < bits; ++j, n >>= 1)
+			bitrev_[i] = (bitrev_[i] << 1) | (n & 1);
+	}
+	/* 相关运算等价于与翻转后的卷积核做卷积 */
+	kfft_.assign(nfft_ * nfft_, cplx(0.0, 0.0));
+	for (dy = 0; dy < height_; ++dy) {
+		for (dx = 0; dx < width_; ++dx)
+			kfft_[dy * nfft_ + dx] = kernel_[(height_ - 1 - dy) * width_ + width_ - 1 - dx];
+	}
+	fft2(&kfft_[0], false);
+}
+
+void ADIConvolve::fft1(cplx *data, int stride, bool inverse) {
+	int n = nfft_, i, j, k, half, tstep;
+	double wr, wi, tr, ti, *a, *b;
+
+	for (i = 0; i < n; ++i) {
+		if (i < (j = bitrev_[i])) std::swap(data[i * stride], data[j * stride]);
+	}
+	// 复数乘法展开为实数运算, 避免std::complex对NaN/Inf的额外处理
+	for (half = 1, tstep = n / 2; half < n; half <<= 1, tstep >>= 1) {
+		for (k = 0; k < half; ++k) {
+			wr = twiddle_[k * tstep].real();
+			wi = inverse ? -twiddle_[k * tstep].imag() : twiddle_[k * tstep].imag();
+			for (i = k; i < n; i += 2 * half) {
+				a = reinterpret_cast<double*>(data + i * stride);
+				b = reinterpret_cast<double*>(data + (i + half) * stride);
+				tr = b[0] * wr - b[1] * wi;
+				ti = b[0] * wi + b[1] * wr;
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
+
+/*
+ * 列变换前转置, 使一维变换访问连续内存; 两次转置后恢复原始排列
+ */
+void ADIConvolve::fft2(cplx *data, bool inverse) {
+	int i, j;
+	for (i = 0; i < nfft_; ++i) fft1(data + i * nfft_, 1, inverse);
+	for (i = 0; i < nfft_; ++i) {
+		for (j = i + 1; j < nfft_; ++j) std::swap(data[i * nfft_ + j], data[j * nfft_ + i]);
+	}
+	for (i = 0; i < nfft_; ++i) fft1(data + i * nfft_, 1, inverse);
+	for (i = 0; i < nfft_; ++i) {
+		for (j = i + 1; j < nfft_; ++j) std::swap(data[i * nfft_ + j], data[j * nfft_ + i]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+}
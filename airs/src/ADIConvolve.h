@@ -0,0 +1,112 @@
+/**
+ * @file ADIConvolve.h ADIReduct使用的卷积滤波引擎
+ * @version 0.1
+ * @date 2020-11-10
+ * @note
+ * - 与逐点卷积结果一致: 以卷积核中心对齐做相关运算, 卷积核超出图像的边缘像素保持原值
+ * - 依据卷积核选择算法:
+ *   可分离(秩为1, 如高斯核): 先沿Y方向、再沿X方向做一维卷积, 运算量与核宽度+高度成正比
+ *   不可分离的小卷积核: 逐行累加平移后的像素行, 行内运算使用AVX2(ADISimd)
+ *   不可分离的大卷积核: 分块FFT(overlap-save), 运算量与卷积核尺寸基本无关
+ * - 按行或按分块由多线程并行处理
+ */
+
+#ifndef ADICONVOLVE_H_
+#define ADICONVOLVE_H_
+
+#include <vector>
+#include <complex>
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+class ADIConvolve {
+public:
+	ADIConvolve();
+	virtual ~ADIConvolve();
+
+public:
+	/* 数据类型 */
+	enum {// 卷积算法
+		CONV_NONE,		//< 未设置卷积核
+		CONV_SEPARABLE,	//< 可分离: 两次一维卷积
+		CONV_DIRECT,	//< 逐行直接卷积
+		CONV_FFT		//< 分块FFT
+	};
+	typedef std::complex<double> cplx;
+	typedef std::vector<cplx> cplxvec;
+
+protected:
+	/* 成员变量 */
+	int mode_;		//< 卷积算法
+	int width_;		//< 卷积核宽度
+	int height_;	//< 卷积核高度
+	std::vector<float> kernel_;	//< 卷积核
+	std::vector<float> kx_;		//< 可分离卷积核: X方向
+	std::vector<float> ky_;		//< 可分离卷积核: Y方向
+	int nfft_;			//< FFT分块边长, 2的幂
+	cplxvec kfft_;		//< FFT分块: 卷积核频谱
+	cplxvec twiddle_;	//< FFT旋转因子
+	std::vector<int> bitrev_;	//< FFT位反序索引
+
+public:
+	/*!
+	 * @brief 设置卷积核, 并选择卷积算法
+	 * @param mask   卷积核, 按行存储
+	 * @param width  卷积核宽度, 奇数
+	 * @param height 卷积核高度, 奇数
+	 * @return
+	 * 卷积核有效性
+	 */
+	bool SetKernel(const double *mask, int width, int height);
+	/*!
+	 * @brief 查看卷积算法
+	 */
+	int Mode();
+	/*!
+	 * @brief 对图像做卷积
+	 * @param src     输入图像
+	 * @param dst     输出图像, 不可与输入图像相同
+	 * @param wimg    图像宽度
+	 * @param himg    图像高度
+	 * @param nthread 并行线程数
+	 */
+	void DoIt(const float *src, float *dst, int wimg, int himg, int nthread);
+
+protected:
+	/*!
+	 * @brief 检查卷积核是否可分离, 可分离时生成一维卷积核
+	 */
+	bool separate(const double *mask);
+	/*!
+	 * @brief 可分离卷积: 处理第y0行起, 间隔step的输出行
+	 */
+	void conv_separable(const float *src, float *dst, int wimg, int himg, int y0, int step);
+	/*!
+	 * @brief 逐行直接卷积: 处理第y0行起, 间隔step的输出行
+	 */
+	void conv_direct(const float *src, float *dst, int wimg, int himg, int y0, int step);
+	/*!
+	 * @brief 分块FFT卷积: 处理第i0行起, 间隔step的分块行
+	 */
+	void conv_fft(const float *src, float *dst, int wimg, int himg, int i0, int step);
+	/*!
+	 * @brief 生成FFT旋转因子、位反序索引和卷积核频谱
+	 */
+	void init_fft();
+	/*!
+	 * @brief 一维原位FFT
+	 * @param data    数据
+	 * @param stride  数据间隔
+	 * @param inverse 逆变换
+	 */
+	void fft1(cplx *data, int stride, bool inverse);
+	/*!
+	 * @brief 二维原位FFT, 数据尺寸为nfft_*nfft_
+	 */
+	void fft2(cplx *data, bool inverse);
+};
+
+//////////////////////////////////////////////////////////////////////////////
+}
+
+#endif /* ADICONVOLVE_H_ */
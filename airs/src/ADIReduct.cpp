@@ -0,0 +1,1177 @@
+/**
+ * @file ADIReduct.cpp 内置天文数字图像处理算法: 提取识别图像中的天体
+ * @version 0.2
+ * @date 2020-11-07
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <float.h>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "ADIReduct.h"
+#include "BadColumn.h"
+#include "FrameStat.h"
+#include "ADISimd.h"
+#include "GLog.h"
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+ADIReduct::ADIReduct(Parameter *param)
+	: nsigma_(5.0),		// 统计区间: ±5σ
+	  nmaxlevel_(4096),	// 最大分级数: 4096
+	  cntmin_(4),		// 区间最小数量: 4
+	  good_ (0.5),		// 阈值: 数据质量, 50%以上数据参与统计
+	  nmaxfo_(1024) {	// 卷积核最大存储空间: 32*32
+	param_  = param;
+	wimg_   = himg_ = 0;
+	pitch_  = xtrim_ = 0;
+	pixels_ = 0;
+	nbkw_   = nbkh_ = 0;
+	nbk_    = 0;
+	stephisto_ = sqrt(2.0 / API) * nsigma_ / cntmin_;
+	lastid_ = 0;
+	thscan_ = 0.0;
+	calibrate_ = false;
+	zplane_ = 1;
+	roi_ = false;
+	roix0_ = roiy0_ = roix1_ = roiy1_ = 0;
+	foconv_.loaded = false;
+	foconv_.width  = foconv_.height = 0;
+	if ((nthread_ = param->nThreadDip) <= 0)
+		nthread_ = boost::thread::hardware_concurrency();
+	if (nthread_ < 1) nthread_ = 1;
+}
+
+ADIReduct::~ADIReduct() {
+
+}
+
+bool ADIReduct::DoIt(FramePtr frame, NFObjVec &objs) {
+	objs_.clear();
+	if (param_->stripDip > 0) {// 流式处理
+		if (!stream_image(frame)) return false;
+		store_objects(objs);
+		return true;
+	}
+	if (!load_image(frame)) return false;
+	if (_gPreProc.use_count()) _gPreProc->Calibrate(frame, dataimg_.get(), wimg_, himg_, nthread_);
+	if (_gBadColumn.use_count()) _gBadColumn->Detect(frame, dataimg_.get(), wimg_, himg_);
+	scan_image();	// 识别overscan区和/或prescan区, 逐行估算偏置
+	set_roi(frame);
+	if (!alloc_buffer()) return false;
+	back_make();
+	sub_back();
+	if (param_->ufo && load_filter_conv(param_->pathfo))
+		filter_convolve();
+	// 信号提取与聚合
+	init_glob();
+	if (lastid_) group_glob();
+	store_objects(objs);
+	flagmap_.reset();
+
+	return true;
+}
+
+float ADIReduct::qmedian(float *x, int n) {
+	qsort(x, n, sizeof(float), [](const void *x1, const void *x2) {
+		float v1 = *((float*) x1);
+		float v2 = *((float*) x2);
+		return v1 > v2 ? 1 : (v1 < v2 ? -1 : 0);
+	});
+
+	if (n < 2) return *x;
+	return (n & 1 ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) * 0.5);
+}
+
+void ADIReduct::image_spline(int n, float *y, double yp1, double ypn, double *c) {
+	double *u = new double[n];
+	double qn, un, p;
+	int i, nm1(n - 1), nm2(n - 2);
+
+	if (yp1 >= AMAX) {
+		c[0] = u[0] = 0.0;
+	}
+	else {
+		c[0] = -0.5;
+		u[0] = 3.0 * (y[1] - y[0] - yp1);
+	}
+	for (i = 1; i < nm1; ++i) {
+		p   = 1.0 / (c[i - 1] + 4.0);
+		c[i] = -p;
+		u[i] = p * (6.0 * (y[i + 1] + y[i - 1] - 2 * y[i]) - u[i - 1]);
+	}
+	if (ypn >= AMAX) {
+		qn = un = 0.0;
+	}
+	else {
+		qn = 0.5;
+		un = 3.0 * (ypn - y[nm1] + y[nm2]);
+	}
+	c[nm1] = (un - qn * u[nm2]) / (qn * c[nm2] + 1.0);
+	for (i = nm2; i >= 0; --i) c[i] = c[i] * c[i + 1] + u[i];
+
+	delete []u;
+}
+
+float ADIReduct::image_splint(int n, float *y, double *c, double xo) {
+	int nx = int(xo);
+	double a, b, yo;
+
+	if (nx == (n - 1)) --nx;
+	b = xo - nx;
+	a = 1.0 - b;
+	yo = a * y[nx] + b * y[nx + 1] + (a * (a * a - 1.0) * c[nx] + b * (b * b - 1.0) * c[nx + 1]) / 6.0;
+	return float(yo);
+}
+
+void ADIReduct::image_spline2(int m, int n, float y[], double c[]) {
+	float *ytmp  = new float[m];
+	double *ctmp = new double[m];
+	int i, j, k;
+
+	for (i = 0; i < n; ++i) {
+		for (j = 0, k = i; j < m; ++j, k += n) ytmp[j] = y[k];
+		image_spline(m, ytmp, AMAX, AMAX, ctmp);
+		for (j = 0, k = i; j < m; ++j, k += n) c[k] = ctmp[j];
+	}
+	delete []ctmp;
+	delete []ytmp;
+}
+
+void ADIReduct::line_splint2(int m, int n, float y[], double c[], double line, float yx[]) {
+	int nx = int(line);
+	int i;
+	float *low, *high;
+	float *yx2  = new float[n];		// 参与计算X轴扰动量的拟合值
+	double xstep = 1.0 / param_->bkw;
+	double x = (xstep - 1.0) * 0.5;
+	double *cx2 = new double[n];
+	double *dlow, *dhigh;
+	double a, b, a3, b3;
+
+	if (nx == (m - 1)) --nx;
+	b = line - nx;
+	a = 1.0 - b;
+	a3 = a * (a * a - 1.0) / 6.0;
+	b3 = b * (b * b - 1.0) / 6.0;
+	low   = y + nx * n;
+	high  = low + n;
+	dlow  = c + nx * n;
+	dhigh = dlow + n;
+
+	for (i =0; i < n; ++i, ++low, ++high, ++dlow, ++dhigh) {
+		yx2[i] = a * *low + b * *high + a3 * *dlow + b3 * *dhigh;
+	}
+	image_spline(n, yx2, AMAX, AMAX, cx2);
+	for (i = 0; i < wimg_; ++i, x += xstep) {
+		yx[i] = float(image_splint(n, yx2, cx2, x));
+	}
+
+	delete []yx2;
+	delete []cx2;
+}
+
+float ADIReduct::pixel_splint2(int m, int n, float y[], double c[], double line, double col) {
+	// 将(col, line)转换为网格坐标系
+	line = (line + 0.5) / param_->bkh - 0.5;
+	col  = (col + 0.5) / param_->bkw - 0.5;
+	// 二元三次样条插值
+	int nx = int(line);
+	int i;
+	float rslt;
+	float *low, *high;
+	float *yx2  = new float[n];		// 参与计算X轴扰动量的拟合值
+	double *cx2 = new double[n];
+	double *dlow, *dhigh;
+	double a, b, a3, b3;
+
+	if (nx == (m - 1)) --nx;
+	b = line - nx;
+	a = 1.0 - b;
+	a3 = a * (a * a - 1.0) / 6.0;
+	b3 = b * (b * b - 1.0) / 6.0;
+	low   = y + nx * n;
+	high  = low + n;
+	dlow  = c + nx * n;
+	dhigh = dlow + n;
+
+	for (i =0; i < n; ++i, ++low, ++high, ++dlow, ++dhigh) {
+		yx2[i] = a * *low + b * *high + a3 * *dlow + b3 * *dhigh;
+	}
+	image_spline(n, yx2, AMAX, AMAX, cx2);
+	rslt = float(image_splint(n, yx2, cx2, col));
+	delete []yx2;
+	delete []cx2;
+
+	return rslt;
+}
+
+bool ADIReduct::load_image(FramePtr frame) {
+	fitsfile *fitsptr(NULL);
+	int status(0);
+	long naxes[2];
+
+	if (fmap_.Open(frame->filepath, 0, frame->plane)) {// 未压缩或瓦片压缩图像: 多线程转换映射区像素
+		pitch_ = wimg_ = fmap_.Width();
+		himg_ = fmap_.Height();
+		alloc_image();
+		bool rslt = fmap_.ReadImage(dataimg_.get(), nthread_);
+		fmap_.Close();
+		if (rslt) return true;
+		// 压缩数据损坏: 由cfitsio读取并报告错误
+	}
+
+	fits_open_image(&fitsptr, frame->filepath.c_str(), READONLY, &status);
+	fits_get_img_size(fitsptr, 2, naxes, &status);
+	select_plane(fitsptr, frame, status);
+	if (!status) {
+		pitch_ = wimg_ = int(naxes[0]);
+		himg_ = int(naxes[1]);
+		alloc_image();
+		fits_read_img(fitsptr, TFLOAT, LONGLONG(zplane_ - 1) * pixels_ + 1, pixels_, NULL, dataimg_.get(), NULL, &status);
+	}
+	if (fitsptr) fits_close_file(fitsptr, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "ADIReduct::load_image()", "failed to read [%s]: %s",
+				frame->filepath.c_str(), txt);
+		return false;
+	}
+	return true;
+}
+
+void ADIReduct::select_plane(fitsfile *fitsptr, FramePtr frame, int &status) {
+	int naxis(0);
+
+	fits_get_img_dim(fitsptr, &naxis, &status);
+	zplane_ = (naxis == 3 && frame->plane > 0) ? frame->plane : 1;
+}
+
+void ADIReduct::alloc_image() {
+	if (!(pitch_ * himg_ == pixels_ && dataimg_.unique())) {
+		pixels_ = pitch_ * himg_;
+		dataimg_.reset(new float[pixels_]);
+		databuf_.reset(new float[pixels_]);
+	}
+}
+
+bool ADIReduct::alloc_buffer() {
+	nbkw_ = wimg_ / param_->bkw;
+	nbkh_ = himg_ / param_->bkh;
+	if (nbkw_ * param_->bkw < wimg_) ++nbkw_;
+	if (nbkh_ * param_->bkh < himg_) ++nbkh_;
+	if (nbkw_ < 2 || nbkh_ < 2) {// 三次样条插值至少需要两个网格
+		_gLog->Write(LOG_FAULT, "ADIReduct::alloc_buffer()", "image [%d * %d] is smaller than two background meshes",
+				wimg_, himg_);
+		return false;
+	}
+	if (nbk_ < nbkw_ * nbkh_) {
+		nbk_ = nbkw_ * nbkh_;
+		bkmean_.reset  (new float[nbk_]);
+		bksig_.reset   (new float[nbk_]);
+		d2mean_.reset  (new double[nbk_]);
+		d2sig_.reset   (new double[nbk_]);
+	}
+	if (!foconv_.mask.unique()) foconv_.mask.reset(new double[nmaxfo_]);
+	return true;
+}
+
+/*
+ * overscan和prescan区为图像左右两侧贯穿全图的若干列. 只读取采样行和这些列,
+ * 不遍历全图: 行偏置在背景统计时按行修正, 在减背景时扣除并将图像紧缩为裁剪视图
+ */
+void ADIReduct::scan_image() {
+	int nrow = std::min(himg_, 64), step = himg_ / nrow;
+
+	scan_trim(dataimg_.get() + (step / 2) * pitch_, nrow, step * pitch_);
+	scan_rows(dataimg_.get(), 0, himg_);
+}
+
+void ADIReduct::scan_trim(const float *sample, int nrow, int stride) {
+	int x0(0), x1(pitch_), edge(pitch_ / 4), k, n;
+	double sum(0.0), sum2(0.0), mea, sig;
+	const float *row;
+
+	if (param_->ovsx2 > param_->ovsx1 && param_->ovsy2 > param_->ovsy1) {// 配置的过扫区位于图像左侧或右侧
+		if (param_->ovsx1 <= 0 && param_->ovsx2 < pitch_ - 1) x0 = param_->ovsx2 + 1;
+		else if (param_->ovsx1 > 0 && param_->ovsx1 < pitch_ && param_->ovsx2 >= pitch_ - 1) x1 = param_->ovsx1;
+	}
+	else {// 自动识别: 采样行列均值低于采样像素3σ裁剪下限的边缘连续列
+		std::vector<float> colm(pitch_, 0.0f);
+		float lo(-FLT_MAX), hi(FLT_MAX);
+
+		for (k = 0, row = sample; k < nrow; ++k, row += stride)
+			SimdRowAxpy(colm.data(), row, pitch_, 1.0f / nrow);
+		for (int i = 0; i < 3; ++i) {// 剔除亮星和低值区后的均值与噪声
+			sum = sum2 = 0.0;
+			for (k = 0, n = 0, row = sample; k < nrow; ++k, row += stride)
+				n += SimdRowStat(row, pitch_, lo, hi, sum, sum2);
+			if (!n) break;
+			mea = sum / n;
+			sig = (sig = sum2 / n - mea * mea) > 0.0 ? sqrt(sig) : 0.0;
+			lo  = float(mea - sig * 3.0);
+			hi  = float(mea + sig * 3.0);
+		}
+		float t(lo);
+		while (x0 < edge && colm[x0] <= t) ++x0;
+		while (x1 > pitch_ - edge && colm[x1 - 1] <= t) --x1;
+		// 低值区延伸至图像内部时视为图像内容
+		if (x0 == edge) x0 = 0;
+		if (x1 == pitch_ - edge) x1 = pitch_;
+	}
+	xtrim_ = x0;
+	wimg_  = x1 - x0;
+	rowbias_.assign(himg_, 0.0f);
+
+	// 统计阈值: 采样行扣除行偏置后的均值-3σ
+	double b, s, s2;
+	sum = sum2 = 0.0;
+	for (k = 0, n = 0, row = sample; k < nrow; ++k, row += stride) {
+		int cnt;
+		b = row_bias(row);
+		s = s2 = 0.0;
+		n += (cnt = SimdRowStat(row + xtrim_, wimg_, -FLT_MAX, FLT_MAX, s, s2));
+		sum  += s - b * cnt;
+		sum2 += s2 - 2.0 * b * s + b * b * cnt;
+	}
+	mea = n ? sum / n : 0.0;
+	sig = (n && (sig = sum2 / n - mea * mea) > 0.0) ? sqrt(sig) : 0.0;
+	thscan_ = float(mea - sig * 3.0);
+}
+
+float ADIReduct::row_bias(const float *row) {
+	const float *ovs = row + xtrim_ + wimg_;
+	int novs(pitch_ - xtrim_ - wimg_), n;
+	double sum, sum2, mean(0.0), sig;
+	float lo(-FLT_MAX), hi(FLT_MAX);
+
+	// 3σ裁剪均值, 迭代两次
+	for (int i = 0; i < 3; ++i) {
+		sum = sum2 = 0.0;
+		n = SimdRowStat(row, xtrim_, lo, hi, sum, sum2) + SimdRowStat(ovs, novs, lo, hi, sum, sum2);
+		if (!n) break;
+		mean = sum / n;
+		sig  = (sig = sum2 / n - mean * mean) > 0.0 ? sqrt(sig) : 0.0;
+		lo   = float(mean - 3.0 * sig);
+		hi   = float(mean + 3.0 * sig);
+	}
+	return float(mean);
+}
+
+void ADIReduct::scan_rows(const float *data, int y0, int y1) {
+	if (wimg_ == pitch_) return;	// 无overscan/prescan区, 行偏置为零
+
+	int nthread = nthread_ < y1 - y0 ? nthread_ : y1 - y0;
+	if (nthread <= 1) scan_bias(data, y0, y1, 0, 1);
+	else {
+		StatThreadGroup grp;
+		for (int i = 0; i < nthread; ++i)
+			grp.create_thread(boost::bind(&ADIReduct::scan_bias, this, data, y0, y1, i, nthread));
+		grp.join_all();
+	}
+}
+
+void ADIReduct::scan_bias(const float *data, int y0, int y1, int i0, int step) {
+	for (int y = y0 + i0; y < y1; y += step)
+		rowbias_[y] = row_bias(data + (y - y0) * pitch_);
+}
+
+void ADIReduct::back_make() {
+	back_rows(dataimg_.get() + xtrim_, 0, nbkh_);
+	back_model();
+}
+
+void ADIReduct::back_rows(const float *data, int iy0, int iy1) {
+	int nthread = nthread_ < iy1 - iy0 ? nthread_ : iy1 - iy0;
+
+	/* 多线程统计背景网格: 各线程交替处理网格行 */
+	if (nthread <= 1) back_mesh(data, iy0, iy1, 0, 1);
+	else {
+		StatThreadGroup grp;
+		for (int i = 0; i < nthread; ++i)
+			grp.create_thread(boost::bind(&ADIReduct::back_mesh, this, data, iy0, iy1, i, nthread));
+		grp.join_all();
+	}
+}
+
+void ADIReduct::back_model() {
+	/* 背景网格滤波 */
+	back_filter();
+	/* 生成图背景和图像背景噪声位图 */
+	image_spline2(nbkh_, nbkw_, bkmean_.get(), d2mean_.get());	// 生成三次样条插值的二阶扰动矩
+	image_spline2(nbkh_, nbkw_, bksig_.get(),  d2sig_.get());
+}
+
+void ADIReduct::back_mesh(const float *data, int iy0, int iy1, int i0, int step) {
+	int ix, iy, nlevel(0);
+	int bkw, bkh;
+	int remw(wimg_ % param_->bkw), remh(himg_ % param_->bkh);
+	const float *mesh, *bias;
+	float *bkmean, *bksig;
+	boost::shared_array<int> histo;
+	BackGrid grid;
+
+	for (iy = iy0 + i0; iy < iy1; iy += step) {
+		bkh = (iy == nbkh_ - 1 && remh) ? remh : param_->bkh;
+		bkmean = bkmean_.get() + iy * nbkw_;
+		bksig  = bksig_.get()  + iy * nbkw_;
+		mesh   = data + (iy - iy0) * param_->bkh * pitch_;
+		bias   = rowbias_.data() + iy * param_->bkh;
+		for (ix = 0; ix < nbkw_; ++ix, ++bkmean, ++bksig, mesh += param_->bkw) {
+			bkw = (ix == nbkw_ - 1 && remw) ? remw : param_->bkw;
+			if (!back_stat(mesh, bias, bkw, bkh, grid)) {
+				*bkmean = *bksig = -AMAX;
+				continue;
+			}
+			if (nlevel < grid.nlevel) {
+				nlevel = grid.nlevel;
+				histo.reset(new int[nlevel]);
+			}
+			back_histo(mesh, bias, bkw, bkh, histo.get(), grid);
+			back_guess(histo.get(), grid);
+			*bkmean = grid.mean;
+			*bksig  = grid.sigma;
+		}
+	}
+}
+
+/*
+ * 像素扣除行偏置bias[y]后参与统计: 区间上下限按行平移, 累加和按行修正
+ */
+bool ADIReduct::back_stat(const float *mesh, const float *bias, int bkw, int bkh, BackGrid &grid) {
+	const float *data = mesh;
+	double mean(0.0), sig(0.0), sigma(0.0), s, s2, b;
+	int y, n, npix(0);
+
+	// 初步统计: 剔除低于scan_image()统计阈值的像素
+	for (y = 0; y < bkh; ++y, data += pitch_) {
+		s = s2 = 0.0;
+		b = bias[y];
+		npix  += (n = SimdRowStat(data, bkw, nextafterf(float(thscan_ + b), FLT_MAX), FLT_MAX, s, s2));
+		mean  += s - b * n;
+		sigma += s2 - 2.0 * b * s + b * b * n;
+	}
+	if ((double) npix < bkw * bkh * good_) return false;
+	mean /= npix;
+	sigma = ((sig = sigma / npix - mean * mean) > 0.0) ? sqrt(sig) : 0.0;
+	// 进一步统计: ±2σ裁剪
+	double lcut = mean - 2.0 * sigma;
+	double hcut = mean + 2.0 * sigma;
+	npix = 0;
+	mean = sigma = 0.0;
+	for (y = 0, data = mesh; y < bkh; ++y, data += pitch_) {
+		s = s2 = 0.0;
+		b = bias[y];
+		npix  += (n = SimdRowStat(data, bkw, float(lcut + b), float(hcut + b), s, s2));
+		mean  += s - b * n;
+		sigma += s2 - 2.0 * b * s + b * b * n;
+	}
+	if (!npix) return false;
+	mean /= npix;
+	sigma = ((sig = sigma / npix - mean * mean) > 0.0) ? sqrt(sig) : 0.0;
+	if ((grid.nlevel = int(stephisto_ * npix + 1)) > nmaxlevel_) grid.nlevel = nmaxlevel_;
+	grid.scale = float(sigma > 0.0 ? 0.5 * grid.nlevel / (nsigma_ * sigma) : 1.0);
+	grid.zero  = float(mean - nsigma_ * sigma);
+	grid.mean  = float(mean);
+	grid.sigma = float(sigma);
+	grid.npix  = npix;
+	return true;
+}
+
+void ADIReduct::back_histo(const float *mesh, const float *bias, int bkw, int bkh, int *histo, BackGrid &grid) {
+	float scale(grid.scale), zero(grid.zero);
+	float cste = 0.5 - zero * scale;
+	const float *data = mesh;
+
+	memset(histo, 0, sizeof(int) * grid.nlevel);
+	for (int y = 0; y < bkh; ++y, data += pitch_)
+		SimdRowHisto(data, bkw, scale, cste - bias[y] * scale, grid.nlevel, histo);
+}
+
+void ADIReduct::back_guess(int *histo, BackGrid &grid) {
+	int lcut, hcut, nlevelm1, lowsum, hisum, sum, i;
+	int *hilow, *hihigh;
+	double mean(0.0), med(0.0), sig0, sig1, t;
+
+	lcut = 0;
+	hcut = nlevelm1 = grid.nlevel - 1;
+	sig0 = 10 * nlevelm1;
+	sig1 = 1.0;
+	// 最大迭代次数: 99
+	for (int n = 100; --n && sig0 >= 0.1 && fabs(sig0 / sig1 - 1) > AEPS;) {
+		sig1 = sig0;
+		mean = sig0 = 0.0;
+		lowsum = hisum = 0;
+		hilow  = histo + lcut;
+		hihigh = histo + hcut;
+
+		for (i = lcut; i <= hcut; ++i) {
+			if (lowsum < hisum) lowsum += (*hilow++);
+			else hisum += (*hihigh--);
+		}
+		sum = SimdHistoMoments(histo, lcut, hcut, mean, sig0);
+		med = hihigh < histo ? 0.0 :
+				((hihigh - histo) + 0.5 + 0.5 * (hisum - lowsum) / (*hilow > *hihigh ? *hilow : *hihigh));
+		if (sum) {
+			mean /= sum;
+			sig0  = sig0 / sum - mean * mean;
+		}
+		sig0 = sig0 > 0.0 ? sqrt(sig0) : 0.0;
+		lcut = (t = med - 3.0 * sig0) > 0.0 ? int(t + 0.5) : 0;
+		hcut = (t = med + 3.0 * sig0) < nlevelm1 ? int(t > 0.0 ? t + 0.5 : t - 0.5) : nlevelm1;
+	}
+
+	t = grid.zero + mean / grid.scale;
+	grid.mean = (sig0 == 0.0 || sig0 / grid.scale == grid.sigma) ? t :
+				(fabs((mean - med)) < 0.3 * sig0 ? grid.zero + (2.5 * med - 1.5 * mean) / grid.scale :
+					grid.zero + med / grid.scale);
+	grid.sigma = sig0 / grid.scale;
+}
+
+void ADIReduct::back_filter() {
+	double d2, d2min, sum(0.0), sigsum(0.0);
+	float med;
+	int i, j, k, n, ix, iy, px, py, px1, px2, py1, py2;
+	int npx = param_->bkfw / 2;
+	int npy = param_->bkfh / 2;
+	int np;
+	float *bufmean, *bufsig;
+	float *maskmean, *masksig;
+
+	if (npx <= 0) npx = 1;
+	if (npy <= 0) npy = 1;
+	np = (2 * npx + 1) * (2 * npy + 1);
+	maskmean = new float[np];
+	masksig  = new float[np];
+	bufmean  = new float[nbk_];
+	bufsig   = new float[nbk_];
+
+	memcpy(bufmean, bkmean_.get(), sizeof(float) * nbk_);
+	memcpy(bufsig,  bksig_.get(),  sizeof(float) * nbk_);
+	// 修复"坏像素": 取距离最近的有效网格均值
+	for (iy = k = i = 0; iy < nbkh_; ++iy) {
+		for (ix = 0; ix < nbkw_; ++ix, ++k) {
+			if (bkmean_[k] > -AMAX) continue;
+			++i;
+			d2min = AMAX;
+			n = 0;
+			for (py = j = 0; py < nbkh_; ++py) {
+				for (px = 0; px < nbkw_; ++px, ++j) {
+					if (bkmean_[j] <= -AMAX) continue;
+					d2 = (px - ix) * (px - ix) + (py - iy) * (py - iy);
+					if (d2 < d2min) {
+						d2min = d2;
+						n = 1;
+						sum    = bkmean_[j];
+						sigsum = bksig_[j];
+					}
+					else if (d2 == d2min) {
+						sum    += bkmean_[j];
+						sigsum += bksig_[j];
+						++n;
+					}
+				}
+			}
+			bufmean[k] = n ? sum / n : 0.0;
+			bufsig[k]  = n ? sigsum / n : 1.0;
+		}
+	}
+	if (i) {
+		memcpy(bkmean_.get(), bufmean, sizeof(float) * nbk_);
+		memcpy(bksig_.get(),  bufsig,  sizeof(float) * nbk_);
+	}
+	// 中值滤波
+	for (iy = k = 0; iy < nbkh_; ++iy) {
+		if ((py1 = iy - npy) < 0)      py1 = 0;
+		if ((py2 = iy + npy) >= nbkh_) py2 = nbkh_ - 1;
+		py1 *= nbkw_;
+		py2 *= nbkw_;
+		for (ix = 0; ix < nbkw_; ++ix, ++k) {
+			if ((px1 = ix - npx) < 0)      px1 = 0;
+			if ((px2 = ix + npx) >= nbkw_) px2 = nbkw_ - 1;
+			for (py = py1, i = 0; py <= py2; py += nbkw_) {
+				for (px = px1; px <= px2; ++px, ++i) {
+					maskmean[i] = bkmean_[py + px];
+					masksig[i]  = bksig_[py + px];
+				}
+			}
+
+			if ((med = qmedian(maskmean, i)) != bkmean_[k]) {
+				bufmean[k] = med;
+				bufsig[k]  = qmedian(masksig, i);
+			}
+		}
+	}
+	memcpy(bkmean_.get(), bufmean, sizeof(float) * nbk_);
+	memcpy(bksig_.get(),  bufsig,  sizeof(float) * nbk_);
+
+	delete []bufmean;
+	delete []bufsig;
+	delete []maskmean;
+	delete []masksig;
+}
+
+void ADIReduct::sub_back() {
+	sub_back(dataimg_.get(), 0, himg_);
+	memcpy(databuf_.get(), dataimg_.get(), sizeof(float) * wimg_ * himg_);
+}
+
+/*
+ * 逐行扣除行偏置和背景, 结果按裁剪视图紧缩存储: 输出行首不超过输入行首, 可原位处理
+ */
+void ADIReduct::sub_back(float *data, int y0, int y1) {
+	int i, j;
+	float *mean = bkmean_.get();
+	float *line = new float[wimg_];
+	double *c   = d2mean_.get();
+	double ystep(1.0 / param_->bkh);
+	const float *src;
+	float *dst, b, v;
+
+	for (j = y0; j < y1; ++j) {
+		src = data + (j - y0) * pitch_ + xtrim_;
+		dst = data + (j - y0) * wimg_;
+		b   = rowbias_[j];
+		line_splint2(nbkh_, nbkw_, mean, c, (ystep - 1.0) * 0.5 + j * ystep, line);
+		for (i = 0; i < wimg_; ++i) {
+			v = src[i] - b;
+			dst[i] = v <= thscan_ ? 0.0 : v - line[i];
+		}
+	}
+	delete []line;
+}
+
+/*
+ * 卷积核文件格式:
+ * 1. 文本文件, 行为单位
+ * 2. 首行: CONV (NO)NORM
+ * 3. 二行: 注释, #起首作为标志符
+ * 4. 其它: 卷积核
+ */
+bool ADIReduct::load_filter_conv(const string &filepath) {
+	if (foconv_.loaded) return true;
+	/* 尝试从文件中加载滤波器 */
+	FILE *fp = fopen(filepath.c_str(), "r");
+	if (!fp) {
+		_gLog->Write(LOG_WARN, "ADIReduct::load_filter_conv()", "failed to open [%s]", filepath.c_str());
+		return false;
+	}
+
+	bool flag_norm(true);
+	int i(0), j(0), k(0), n(0);
+	const int MAXCHAR = 512;
+	char line[MAXCHAR], seps[] = " \t\r\n", *tok;
+	double *mask = foconv_.mask.get();
+
+	if (!fgets(line, MAXCHAR, fp) || strncmp(line, "CONV", 4)) {
+		fclose(fp);
+		return false;
+	}
+	if (strstr(line, "NORM")) flag_norm = strstr(line, "NONORM") == NULL;
+
+	while (fgets(line, MAXCHAR, fp)) {
+		tok = strtok(line, seps);
+		if (!tok || tok[0] == '#') continue;
+		++j;
+		for (k = 0; tok; ++k, tok = strtok(NULL, seps)) {
+			// 滤波器限制: 32*32
+			if (i >= nmaxfo_) {
+				fclose(fp);
+				return false;
+			}
+			mask[i++] = atof(tok);
+		}
+		if (k > n) n = k;
+	}
+	fclose(fp);
+	/* 检查滤波器: 各行等长, 宽度和高度为奇数 */
+	if (n < 1 || j * n != i || !(n & 1) || !(j & 1)) return false;
+	foconv_.width  = n;
+	foconv_.height = j;
+
+	if (flag_norm) {/* 归一化 */
+		double t, sum, var;
+		for (j = 0, sum = var = 0.0; j < i; ++j) {
+			sum += (t = mask[j]);
+			var += t * t;
+		}
+		var = sqrt(var);
+		if (sum <= 0.0) sum = var;
+		for (j = 0; j < i; ++j) mask[j] /= sum;
+	}
+
+	foconv_.loaded = conv_.SetKernel(mask, foconv_.width, foconv_.height);
+	return foconv_.loaded;
+}
+
+void ADIReduct::filter_convolve() {
+	// databuf_存储滤波后结果, 用于信号提取及目标聚合; dataimg_存储滤波前结果, 用于特征计算
+	if (!roi_) conv_.DoIt(dataimg_.get(), databuf_.get(), wimg_, himg_, nthread_);
+	else {// 只滤波目标窗口所在行, 上下各扩展卷积核半高. 其它行保持sub_back()复制的未滤波数据
+		int margin = foconv_.height / 2;
+		int r0 = std::max(roiy0_ - margin, 0), r1 = std::min(roiy1_ + margin, himg_);
+		conv_.DoIt(dataimg_.get() + r0 * wimg_, databuf_.get() + r0 * wimg_, wimg_, r1 - r0, nthread_);
+	}
+}
+
+void ADIReduct::set_roi(FramePtr frame) {
+	int x0, y0, x1, y1;
+
+	roi_ = param_->roiEnable && frame->typeTrack && param_->RoiWindow(pitch_, himg_, x0, y0, x1, y1);
+	if (roi_) {// 转换为裁剪视图坐标
+		roix0_ = std::max(x0 - xtrim_, 0);
+		roix1_ = std::min(x1 - xtrim_, wimg_);
+		roiy0_ = y0;
+		roiy1_ = y1;
+		roi_ = roix0_ < roix1_;
+	}
+}
+
+bool ADIReduct::in_roi(double x, double y) {
+	return x >= roix0_ && x < roix1_ && y >= roiy0_ && y < roiy1_;
+}
+
+void ADIReduct::detect_thresh(int y, float *line) {
+	const float deep(1.5f);
+	int i, x0(wimg_), x1(wimg_);
+
+	if (!roi_) x0 = 0;
+	else if (y >= roiy0_ && y < roiy1_) {
+		x0 = roix0_;
+		x1 = roix1_;
+	}
+	float shallow = roi_ ? float(param_->roiShallow) : deep;
+	for (i = 0; i < x0; ++i) line[i] *= shallow;
+	for (; i < x1; ++i) line[i] *= deep;
+	for (; i < wimg_; ++i) line[i] *= shallow;
+}
+
+bool ADIReduct::shape_clip(ADIObject &obj) {
+	double x2 = obj.xxsum / obj.flux - obj.xc * obj.xc;
+	double y2 = obj.yysum / obj.flux - obj.yc * obj.yc;
+	double xy = obj.xysum / obj.flux - obj.xc * obj.yc;
+	double t1 = 0.5 * (x2 + y2);
+	double t2 = sqrt(0.25 * (x2 - y2) * (x2 - y2) + xy * xy);
+	double A2 = t1 + t2;
+	double B2 = t1 - t2;
+
+	if (t1 > t2) {
+		obj.ellip = 1.0 - sqrt(B2 / A2);
+		obj.fwhm  = 2.35482 * sqrt(t1);	// 高斯轮廓: FWHM = 2.35482σ
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * 并查集: 查找根标签, 路径折半压缩. 合并时根标签取较小值
+ */
+static int find_label(std::vector<int> &parent, int l) {
+	while (parent[l] != l) l = parent[l] = parent[parent[l]];
+	return l;
+}
+
+void ADIReduct::init_glob() {
+	int nstrip = nthread_ < himg_ ? nthread_ : 1;
+	std::vector<GlobStrip> strips(nstrip);
+	int i, j, l, n, base;
+
+	flagmap_.reset(new int[wimg_ * himg_]);
+	for (i = 0; i < nstrip; ++i) {
+		strips[i].y0 = himg_ * i / nstrip;
+		strips[i].y1 = himg_ * (i + 1) / nstrip;
+	}
+	// 1: 各条带独立标记, 并累加候选体测量信息
+	if (nstrip == 1) label_strip(&strips[0]);
+	else {
+		StatThreadGroup grp;
+		for (i = 0; i < nstrip; ++i)
+			grp.create_thread(boost::bind(&ADIReduct::label_strip, this, &strips[i]));
+		grp.join_all();
+	}
+
+	// 2: 条带标签映射为全局标签
+	for (i = 0, n = 1; i < nstrip; ++i) n += int(strips[i].parent.size()) - 1;
+	labels_.resize(n);
+	cans_.resize(n);
+	labels_[0] = 0;
+	for (i = 0, base = 0; i < nstrip; ++i) {
+		GlobStrip &strip = strips[i];
+		strip.base = base;
+		for (l = 1, n = int(strip.parent.size()); l < n; ++l) {
+			labels_[base + l] = base + strip.parent[l];
+			cans_[base + l]   = strip.cans[l];
+		}
+		base += n - 1;
+		ADIObjVec().swap(strip.cans);
+	}
+	lastid_ = base;
+
+	// 3: 在条带接缝处合并跨条带的候选体
+	for (i = 1; i < nstrip; ++i) {
+		GlobStrip &strip = strips[i];
+		int *flag = flagmap_.get() + strip.y0 * wimg_;
+		int *up   = flag - wimg_;
+		int x, xb, xe, ra, rb;
+
+		for (j = 0; j < wimg_; ++j) {
+			if (!flag[j]) continue;
+			xb = j ? j - 1 : 0;
+			xe = j < wimg_ - 1 ? j + 1 : j;
+			for (x = xb; x <= xe; ++x) {
+				if (!up[x]) continue;
+				ra = find_label(labels_, strip.base + flag[j]);
+				rb = find_label(labels_, strips[i - 1].base + up[x]);
+				if (ra == rb) continue;
+				if (ra > rb) std::swap(ra, rb);
+				labels_[rb] = ra;
+				cans_[ra] += cans_[rb];
+				cans_[rb].flag = true;
+			}
+		}
+	}
+}
+
+void ADIReduct::label_strip(GlobStrip *strip) {
+	std::vector<int> &parent = strip->parent;
+	ADIObjVec &cans = strip->cans;
+	float *sig  = bksig_.get();
+	float *line = new float[wimg_];
+	double *c   = d2sig_.get();
+	double ystep(1.0 / param_->bkh);
+	int i, j, x, xb, xe, l, n, r;
+
+	parent.assign(1, 0);
+	cans.assign(1, ADIObject());
+	for (j = strip->y0; j < strip->y1; ++j) {
+		float *data = databuf_.get() + j * wimg_;	// 使用滤波后数据提取信号
+		float *img  = dataimg_.get() + j * wimg_;	// 使用减背景数据累加测量信息
+		int *flag   = flagmap_.get() + j * wimg_;
+		int *up     = j > strip->y0 ? flag - wimg_ : NULL;
+
+		line_splint2(nbkh_, nbkw_, sig, c, (ystep - 1.0) * 0.5 + j * ystep, line);
+		detect_thresh(j, line);
+		for (i = 0; i < wimg_; ++i) {
+			if (data[i] < line[i]) {// ADU小于阈值, 不参与聚合候选体
+				flag[i] = 0;
+				continue;
+			}
+			// 8连通域: 左侧、左上、正上、右上
+			l = i ? flag[i - 1] : 0;
+			if (up) {
+				xb = i ? i - 1 : 0;
+				xe = i < wimg_ - 1 ? i + 1 : i;
+				for (x = xb; x <= xe; ++x) {
+					if (!(n = up[x]) || n == l) continue;
+					if (!l) l = n;
+					else {// 相邻的两个标签属于同一候选体
+						l = find_label(parent, l);
+						n = find_label(parent, n);
+						if (l < n) parent[n] = l;
+						else if (n < l) {
+							parent[l] = n;
+							l = n;
+						}
+					}
+				}
+			}
+			if (!l) {
+				l = int(parent.size());
+				parent.push_back(l);
+				cans.push_back(ADIObject());
+			}
+			flag[i] = l;
+			cans[l].AddPoint(i, j, img[i]);
+		}
+	}
+	delete []line;
+
+	// 合并条带内同一候选体的测量信息. 根标签小于其它标签, 升序遍历时根标签已确定
+	for (l = 1, n = int(parent.size()); l < n; ++l) {
+		if ((r = find_label(parent, l)) != l) {
+			cans[r] += cans[l];
+			cans[l].flag = true;
+			parent[l] = r;
+		}
+	}
+}
+
+void ADIReduct::group_glob() {
+	for (int i = 1; i <= lastid_; ++i) {
+		if (!cans_[i].flag) test_object(cans_[i]);
+	}
+	ADIObjVec().swap(cans_);
+	std::vector<int>().swap(labels_);
+}
+
+void ADIReduct::test_object(ADIObject &can) {
+	double snr, sig;
+
+	if (can.npix == 0 || can.flux <= 0.0) return;
+	// 单像素点或流量异常点, 判定为热点或假信号
+	if (param_->ucs && can.zpeak >= can.flux) return;
+
+	can.UpdateCenter();
+	if ((param_->area0 && can.npix < param_->area0)		// 面积下限
+		|| (param_->area1 && can.npix > param_->area1)		// 面积上限
+		|| shape_clip(can))	// 基本形状
+		return;
+	sig = pixel_splint2(nbkh_, nbkw_, bksig_.get(), d2sig_.get(), can.yc, can.xc);
+	snr = can.flux / sig / sqrt(can.npix * 1.0);
+	if (snr >= param_->snrp && (!roi_ || snr >= param_->roiShallow || in_roi(can.xc, can.yc))) {
+		can.back = pixel_splint2(nbkh_, nbkw_, bkmean_.get(), d2mean_.get(), can.yc, can.xc);
+		can.sig  = sig;
+		can.snr  = snr;
+		objs_.push_back(can);
+	}
+}
+
+/*
+ * 流式处理: 按条带三次读取图像, 依次统计全图、统计背景网格、减背景/滤波/提取信号
+ * 内存占用与条带高度成正比, 与图像面积无关
+ */
+bool ADIReduct::stream_image(FramePtr frame) {
+	fitsfile *fitsptr(NULL);
+	int status(0);
+	long naxes[2];
+	bool rslt(false);
+
+	if (fmap_.Open(frame->filepath, 0, frame->plane)) {
+		naxes[0] = fmap_.Width();
+		naxes[1] = fmap_.Height();
+	}
+	else {
+		fits_open_image(&fitsptr, frame->filepath.c_str(), READONLY, &status);
+		fits_get_img_size(fitsptr, 2, naxes, &status);
+		select_plane(fitsptr, frame, status);
+	}
+	if (!status) {
+		pitch_ = wimg_ = int(naxes[0]);
+		himg_ = int(naxes[1]);
+		pixels_ = pitch_ * himg_;
+		// 释放整帧处理的缓存区
+		dataimg_.reset();
+		databuf_.reset();
+		flagmap_.reset();
+		if (stream_calib(frame, fitsptr, status) && stream_scan(frame, fitsptr, status)) {
+			set_roi(frame);
+			rslt = alloc_buffer() && stream_back(fitsptr, status) && stream_glob(fitsptr, status);
+		}
+	}
+	calibrate_ = false;
+	calib_.master.reset();
+	fmap_.Close();
+	if (fitsptr) fits_close_file(fitsptr, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "ADIReduct::stream_image()", "failed to read [%s]: %s",
+				frame->filepath.c_str(), txt);
+		return false;
+	}
+	return rslt;
+}
+
+bool ADIReduct::read_rows(fitsfile *fitsptr, int y0, int y1, float *data, int &status) {
+	if (fmap_.IsOpen()) {
+		if (!fmap_.ReadRows(y0, y1, data)) status = DATA_DECOMPRESSION_ERR;
+	}
+	else fits_read_img(fitsptr, TFLOAT, (LONGLONG(zplane_ - 1) * himg_ + y0) * pitch_ + 1, LONGLONG(y1 - y0) * pitch_,
+			NULL, data, NULL, &status);
+	if (!status && calibrate_) _gPreProc->Apply(calib_, data, y0, y1, nthread_);
+	return !status;
+}
+
+/*
+ * 过扫区通常为贯穿全图的若干列, 只读取该区域: 映射区按行截取或只解压相交瓦片
+ */
+bool ADIReduct::stream_calib(FramePtr frame, fitsfile *fitsptr, int &status) {
+	int x0, y0, x1, y1;
+
+	if (!(_gPreProc.use_count() && _gPreProc->Prepare(frame, wimg_, himg_, calib_))) return true;
+	if (_gPreProc->OverscanZone(wimg_, himg_, x0, y0, x1, y1)) {
+		int n = (x1 - x0) * (y1 - y0);
+		boost::shared_array<float> zone(new float[n]);
+		if (fmap_.IsOpen()) {
+			if (!fmap_.ReadRect(x0, y0, x1, y1, zone.get())) status = DATA_DECOMPRESSION_ERR;
+		}
+		else {
+			long fpixel[] = { x0 + 1, y0 + 1, zplane_ }, lpixel[] = { x1, y1, zplane_ }, inc[] = { 1, 1, 1 };
+			fits_read_subset(fitsptr, TFLOAT, fpixel, lpixel, inc, NULL, zone.get(), NULL, &status);
+		}
+		if (status) return false;
+		_gPreProc->SetOverscan(calib_, zone.get(), n);
+	}
+	calibrate_ = true;
+	return true;
+}
+
+/*
+ * 采样行逐行读取: 映射区直接转换, cfitsio只解压采样行所在瓦片
+ * 流式处理不保留整帧数据, 坏列识别使用已改正的采样行
+ */
+bool ADIReduct::stream_scan(FramePtr frame, fitsfile *fitsptr, int &status) {
+	int nrow = std::min(himg_, 64), step = himg_ / nrow;
+	boost::shared_array<float> sample(new float[nrow * pitch_]);
+
+	for (int k = 0; k < nrow; ++k) {
+		int y = step / 2 + k * step;
+		if (!read_rows(fitsptr, y, y + 1, sample.get() + k * pitch_, status)) return false;
+	}
+	if (_gBadColumn.use_count()) _gBadColumn->Detect(frame, sample.get(), pitch_, nrow);
+	scan_trim(sample.get(), nrow, pitch_);
+	return true;
+}
+
+bool ADIReduct::stream_back(fitsfile *fitsptr, int &status) {
+	int nmesh = param_->stripDip / param_->bkh;	// 条带包含的网格行数
+	int nrow, y0, y1, iy0, iy1;
+
+	if (nmesh < 1) nmesh = 1;
+	nrow = nmesh * param_->bkh;
+	boost::shared_array<float> strip(new float[nrow * pitch_]);
+	// 逐条带估算行偏置, 统计背景网格
+	for (iy0 = 0; iy0 < nbkh_; iy0 += nmesh) {
+		iy1 = std::min(iy0 + nmesh, nbkh_);
+		y0  = iy0 * param_->bkh;
+		y1  = std::min(iy1 * param_->bkh, himg_);
+		if (!read_rows(fitsptr, y0, y1, strip.get(), status)) return false;
+		scan_rows(strip.get(), y0, y1);
+		back_rows(strip.get() + xtrim_, iy0, iy1);
+	}
+	back_model();
+	return true;
+}
+
+bool ADIReduct::stream_glob(fitsfile *fitsptr, int &status) {
+	int margin = param_->ufo && load_filter_conv(param_->pathfo) ? foconv_.height / 2 : 0;
+	int nrow = param_->stripDip, r0, r1, y0, y1, y, i, n;
+	float *sig = new float[wimg_];
+	double ystep(1.0 / param_->bkh);
+	GlobStream gs;
+
+	if (nrow < 1) nrow = 1;
+	boost::shared_array<float> strip(new float[(nrow + 2 * margin) * pitch_]);
+	boost::shared_array<float> filtered(margin ? new float[(nrow + 2 * margin) * wimg_] : NULL);
+	gs.prev.assign(wimg_, 0);
+	gs.cur.assign(wimg_, 0);
+	cans_.assign(1, ADIObject());
+	labels_.assign(1, 0);
+
+	for (y0 = 0; y0 < himg_; y0 = y1) {
+		y1 = std::min(y0 + nrow, himg_);
+		// 条带上下各扩展卷积核半高, 使条带内各行的卷积结果与整帧处理一致
+		r0 = std::max(y0 - margin, 0);
+		r1 = std::min(y1 + margin, himg_);
+		if (!read_rows(fitsptr, r0, r1, strip.get(), status)) break;
+		float *data = strip.get();
+		sub_back(data, r0, r1);
+		// 目标窗口模式: 只滤波与窗口行相交的条带
+		bool conv = margin && (!roi_ || (y0 < roiy1_ && y1 > roiy0_));
+		if (conv) conv_.DoIt(data, filtered.get(), wimg_, r1 - r0, nthread_);
+		float *buff = conv ? filtered.get() : data;
+		for (y = y0; y < y1; ++y) {
+			line_splint2(nbkh_, nbkw_, bksig_.get(), d2sig_.get(), (ystep - 1.0) * 0.5 + y * ystep, sig);
+			detect_thresh(y, sig);
+			stream_label(gs, buff + (y - r0) * wimg_, data + (y - r0) * wimg_, sig, y);
+		}
+	}
+	// 图像结束时仍在延伸的候选体
+	for (i = 1, n = int(cans_.size()); !status && i < n; ++i) test_object(cans_[i]);
+	ADIObjVec().swap(cans_);
+	std::vector<int>().swap(labels_);
+	delete []sig;
+
+	return !status;
+}
+
+void ADIReduct::stream_label(GlobStream &gs, const float *data, const float *img, const float *thresh, int y) {
+	std::vector<int> &prev = gs.prev, &cur = gs.cur, &newid = gs.newid;
+	int nprev = int(cans_.size()) - 1;	// 上一行结束时仍在延伸的候选体
+	int i, x, xb, xe, l, n;
+
+	for (i = 0; i < wimg_; ++i) {
+		if (data[i] < thresh[i]) {// ADU小于阈值, 不参与聚合候选体
+			cur[i] = 0;
+			continue;
+		}
+		// 8连通域: 左侧、左上、正上、右上. 合并标签时同时合并测量信息
+		l = i && cur[i - 1] ? find_label(labels_, cur[i - 1]) : 0;
+		if (y) {
+			xb = i ? i - 1 : 0;
+			xe = i < wimg_ - 1 ? i + 1 : i;
+			for (x = xb; x <= xe; ++x) {
+				if (!prev[x] || (n = find_label(labels_, prev[x])) == l) continue;
+				if (!l) l = n;
+				else {
+					if (n < l) std::swap(l, n);
+					labels_[n] = l;
+					cans_[l] += cans_[n];
+					cans_[n].flag = true;
+				}
+			}
+		}
+		if (!l) {
+			l = int(labels_.size());
+			labels_.push_back(l);
+			cans_.push_back(ADIObject());
+		}
+		cur[i] = l;
+		cans_[l].AddPoint(i, y, img[i]);
+	}
+
+	// 行结束: 当前行的候选体重新编号; 上一行未延伸至当前行的候选体已完整, 评估后释放
+	newid.assign(cans_.size(), 0);
+	gs.live.assign(1, ADIObject());
+	for (i = 0; i < wimg_; ++i) {
+		if (!(l = cur[i])) continue;
+		l = find_label(labels_, l);
+		if (!newid[l]) {
+			newid[l] = int(gs.live.size());
+			gs.live.push_back(cans_[l]);
+		}
+		cur[i] = newid[l];
+	}
+	for (l = 1; l <= nprev; ++l) {
+		if (labels_[l] == l && !newid[l]) test_object(cans_[l]);
+	}
+	cans_.swap(gs.live);
+	labels_.resize(cans_.size());
+	for (l = 0, n = int(labels_.size()); l < n; ++l) labels_[l] = l;
+	prev.swap(cur);
+}
+
+void ADIReduct::store_objects(NFObjVec &objs) {
+	int id(0);
+
+	objs.clear();
+	objs.reserve(objs_.size());
+	for (ADIObjVec::iterator it = objs_.begin(); it != objs_.end(); ++it) {
+		NFObjPtr body = boost::make_shared<ObjectInfo>();
+		double *features = body->features;
+
+		body->id = ++id;
+		// 与SExtractor一致: 像素中心坐标从1开始
+		features[NDX_X]      = it->xc + xtrim_ + 1.0;	// 裁剪视图坐标转换为图像坐标
+		features[NDX_Y]      = it->yc + 1.0;
+		features[NDX_FLUX]   = it->flux;
+		features[NDX_MAG]    = 25.0 - 2.5 * log10(it->flux);
+		features[NDX_MAGERR] = 1.0857 * sqrt(double(it->npix)) * it->sig / it->flux;
+		features[NDX_FWHM]   = it->fwhm;
+		features[NDX_ELLIP]  = it->ellip;
+		features[NDX_BACK]   = it->back;
+		objs.push_back(body);
+	}
+	objs_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,492 @@
+/**
+ * @file ADIReduct.h 内置天文数字图像处理算法: 提取识别图像中的天体
+ * @version 0.2
+ * @date 2020-11-07
+ * @note
+ * - 移植自airs1, 作为AstroDIP的可选后端, 替代多进程调用SExtractor
+ * - 像素数据只读取一次, 在内存中完成背景拟合、滤波、8连通域聚合和特征测量
+ * - 输出特征与SExtractor参数文件一致:
+ *   X_IMAGE, Y_IMAGE, FLUX, MAG, MAGERR, FWHM_IMAGE, ELLIPTICITY, BACKGROUND
+ * - 流量为等照度区域内减背景后的累加和, FWHM由二阶矩按高斯轮廓换算
+ * - 背景网格由多线程并行统计, 逐行像素运算使用AVX2(ADISimd)
+ * - 8连通域由多线程分条带标记, 并查集合并, 标记同时累加测量信息
+ * - 卷积滤波由ADIConvolve按卷积核选择可分离、逐行或分块FFT算法
+ * - 未压缩及RICE/GZIP瓦片压缩图像由FitsMMap映射后多线程转换像素或解压瓦片,
+ *   其它图像使用cfitsio读取
+ * - 数据立方体的平面直接由立方体文件读取, 不生成平面文件
+ * - 启用预处理时, 读取像素后由PreProcess完成本底、暗场与平场改正. 流式处理逐条带改正
+ * - overscan/prescan列由采样行识别或由配置的过扫区给定, 多线程逐行估算偏置(3σ裁剪均值).
+ *   背景统计按行修正偏置, 减背景时扣除偏置并紧缩为裁剪视图, 不增加遍历全图的次数
+ * - 跟踪图像可启用目标窗口: 窗口内以1.5σ完整提取; 窗口外的检测阈值和信噪比下限提高为
+ *   ROI/Shallow, 只提取用于天文定位的亮星. 只滤波窗口所在行
+ */
+
+#ifndef ADIREDUCT_H_
+#define ADIREDUCT_H_
+
+#include <vector>
+#include <limits.h>
+#include <boost/smart_ptr.hpp>
+#include "airsdata.h"
+#include "Parameter.h"
+#include "ADIConvolve.h"
+#include "FitsMMap.h"
+#include "PreProcess.h"
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+typedef boost::shared_array<float> fltarr;
+typedef boost::shared_array<double> dblarr;
+typedef boost::shared_array<int> intarr;
+
+/*!
+ * @struct BackGrid 背景网格统计数据
+ */
+struct BackGrid {
+	int npix;		//< 参与统计的像素数
+	int nlevel;		//< 参与统计的区域数
+	float mean;		//< 统计均值
+	float sigma;	//< 统计噪声
+	float scale;	//< 比例
+	float zero;		//< 零点
+};
+
+/*!
+ * @struct FilterConv 卷积滤波
+ */
+struct FilterConv {
+	bool loaded;	//< 加载标志
+	int width;		//< 宽度
+	int height;		//< 高度
+	dblarr mask;	//< 卷积模板
+};
+
+/*!
+ * @struct ADIObject 聚合候选体的测量信息
+ * @note
+ * airs1中的同名结构ObjectInfo与airsdata.h冲突, 更名为ADIObject
+ */
+struct ADIObject {
+	bool flag;			//< false: 初始构建; true: 被合并进入其它候选体
+	int npix;			//< 像素数
+	int xmin, ymin;		//< 构成目标的坐标: 最小值
+	int xmax, ymax;		//< 构成目标的坐标: 最大值
+	double xpeak, ypeak, zpeak;	//< 峰值位置与峰值
+	double xc, yc;		//< 质心
+	float back;			//< 质心的统计背景
+	float sig;			//< 质心的统计噪声
+	double xsum, ysum;	//< 加权和
+	double xxsum, xysum, yysum;	//< 加权和
+	double flux;		//< 流量. sum(v)
+	double fwhm;		//< FWHM
+	double ellip;		//< 椭率
+	double snr;			//< 信噪比
+
+public:
+	ADIObject() {
+		memset(this, 0, sizeof(ADIObject));
+		xmin = ymin = INT_MAX;
+		xmax = ymax = -1;
+	}
+
+	/*!
+	 * @brief 合并两个候选体
+	 */
+	ADIObject &operator+=(const ADIObject &other) {
+		if (this != &other) {
+			npix  += other.npix;
+			flux  += other.flux;
+			xsum  += other.xsum;
+			ysum  += other.ysum;
+			xxsum += other.xxsum;
+			xysum += other.xysum;
+			yysum += other.yysum;
+			if (xmin > other.xmin) xmin = other.xmin;
+			if (xmax < other.xmax) xmax = other.xmax;
+			if (ymin > other.ymin) ymin = other.ymin;
+			if (ymax < other.ymax) ymax = other.ymax;
+			if (zpeak < other.zpeak) {
+				xpeak = other.xpeak;
+				ypeak = other.ypeak;
+				zpeak = other.zpeak;
+			}
+		}
+
+		return *this;
+	}
+
+	void AddPoint(int x, int y, double z) {
+		double zx = z * x;
+		double zy = z * y;
+
+		++npix;
+		flux  += z;
+		xsum  += zx;
+		ysum  += zy;
+		xxsum += (zx * x);
+		xysum += (zx * y);
+		yysum += (zy * y);
+
+		if (xmin > x) xmin = x;
+		if (xmax < x) xmax = x;
+		if (ymin > y) ymin = y;
+		if (ymax < y) ymax = y;
+		if (z > zpeak) {
+			xpeak = x;
+			ypeak = y;
+			zpeak = z;
+		}
+	}
+
+	void UpdateCenter() {
+		xc = xsum / flux;
+		yc = ysum / flux;
+	}
+};
+typedef std::vector<ADIObject> ADIObjVec;
+
+/*!
+ * @struct GlobStrip 并行标记8连通域的图像条带
+ */
+struct GlobStrip {
+	int y0, y1;		//< 行范围: [y0, y1)
+	int base;		//< 条带标签在全局标签中的偏移量
+	std::vector<int> parent;	//< 并查集: 条带标签的父标签
+	ADIObjVec cans;	//< 条带标签对应的候选体
+};
+
+/*!
+ * @struct GlobStream 流式处理时逐行标记8连通域的工作区
+ */
+struct GlobStream {
+	std::vector<int> prev;	//< 上一行像素标签
+	std::vector<int> cur;	//< 当前行像素标签
+	std::vector<int> newid;	//< 行结束时的标签重编号
+	ADIObjVec live;			//< 行结束时仍在延伸的候选体
+};
+
+class ADIReduct {
+public:
+	ADIReduct(Parameter *param);
+	virtual ~ADIReduct();
+
+protected:
+	Parameter *param_;	//< 配置参数
+	const double nsigma_;	//< 统计区间
+	const int nmaxlevel_;	//< 分级数: 最大
+	const int cntmin_;		//< 统计区间计数: 最小
+	const double good_;		//< 阈值: 数据质量
+	const int nmaxfo_;		//< 信号提取卷积核的最大存储空间
+	double stephisto_;	//< 直方图统计步长
+	int nthread_;		//< 并行处理线程数
+	float thscan_;		//< 全图统计阈值: 扣除行偏置后低于该值的像素不参与统计
+	int wimg_, himg_;	//< 图像宽度和高度. 识别overscan/prescan区后为裁剪视图宽度
+	int pitch_;			//< 图像行长度, 即文件中的图像宽度
+	int xtrim_;			//< 裁剪视图起始列, 即prescan区宽度
+	std::vector<float> rowbias_;	//< 行偏置: overscan/prescan区的3σ裁剪均值
+	int pixels_;		//< 图像存储区像素数
+	int nbkw_;			//< 宽度方向网格数量
+	int nbkh_;			//< 高度方向网格数量
+	int nbk_;			//< 网格数量
+	fltarr dataimg_;	//< 缓存区: 图像数据. 减背景后紧缩为裁剪视图, 用于特征测量
+	fltarr databuf_;	//< 缓存区: 减背景/滤波后数据, 用于信号提取
+	fltarr bkmean_;		//< 缓存区: 背景网格
+	fltarr bksig_;		//< 缓存区: 网格噪声
+	dblarr d2mean_;		//< 缓存区: 背景网格二元三次样条二阶扰动矩, Y方向快速变化样条插值系数矩阵
+	dblarr d2sig_;		//< 缓存区: 网格噪声二元三次样条二阶扰动矩, Y方向快速变化样条插值系数矩阵
+	FilterConv foconv_;	//< 卷积滤波
+	ADIConvolve conv_;	//< 卷积滤波引擎
+	FitsMMap fmap_;		//< 内存映射的图像文件
+	int zplane_;		//< cfitsio读取的立方体平面, 从1开始. 二维图像为1
+	bool calibrate_;	//< 流式处理: 读取像素后执行预处理
+	PreProcess::CalibFrame calib_;	//< 流式处理: 预处理改正参数
+	bool roi_;			//< 目标窗口模式
+	int roix0_, roiy0_;	//< 目标窗口[roix0_, roix1_)*[roiy0_, roiy1_), 裁剪视图坐标
+	int roix1_, roiy1_;
+
+	int lastid_;		//< 疑似目标的最大标记
+	intarr flagmap_;	//< 疑似目标标记位图. 存储条带标签
+	std::vector<int> labels_;	//< 并查集: 全局标签的父标签
+	ADIObjVec cans_;	//< 全局标签对应的候选体
+	ADIObjVec objs_;	//< 识别的目标
+
+public:
+	/*!
+	 * @brief 处理图像, 并提取识别图像中的聚合目标
+	 * @param frame 图像. 已加载文件头
+	 * @param objs  识别的目标, 未经筛选
+	 * @return
+	 * 处理结果
+	 */
+	bool DoIt(FramePtr frame, NFObjVec &objs);
+	/*!
+	 * @brief 查看最近一次处理的行偏置
+	 * @return
+	 * 逐行偏置, 长度为图像高度. 无overscan/prescan区时全为零
+	 * @note
+	 * 目标的NDX_BACK以扣除行偏置后的图像为基准, 由原图像继续测量时需先扣除行偏置
+	 */
+	const std::vector<float> &RowBias() const {
+		return rowbias_;
+	}
+
+protected:
+	/*!
+	 * @brief 使用快速排序算法计算数组中值
+	 */
+	float qmedian(float *x, int n);
+	/**
+	 * @brief image_xxxx 对一维/二维图像数组封装三次样条插值
+	 * @note
+	 * 图像数组的特征是: 索引位置严格递增排序, 步长==1
+	 */
+	/*!
+	 * @brief 采用三次样条插值, 生成二阶导数矢量
+	 * @param n      参与拟合的样本数量
+	 * @param y      样本因变量, 1*n数组
+	 * @param yp1     >=AMAX时, 起始点单边一阶导数为0
+	 * @param ypn     >=AMAX时, 结束点单边一阶导数为0
+	 * @param c      拟合结果, 1*n数组
+	 */
+	void image_spline(int n, float *y, double yp1, double ypn, double *c);
+	/*!
+	 * @brief 三次样条插值
+	 * @param n     样本数量
+	 * @param y     样本数据
+	 * @param c     二阶导数
+	 * @param xo    待拟合位置
+	 * @return
+	 * 插值结果
+	 */
+	float image_splint(int n, float *y, double *c, double xo);
+	/*!
+	 * @brief 沿Y轴生成二元三次样条内插系数
+	 * @param m   慢速自变量长度
+	 * @param n   快速自变量长度
+	 * @param y   样本: 因变量数组, m*n数组
+	 * @param c   内插系数拟合结果, m*n数组, 行优先存储
+	 */
+	void image_spline2(int m, int n, float y[], double c[]);
+	/*!
+	 * @brief 使用二元三次样条插值, 计算图像各行的插值
+	 * @param m     慢速自变量数组长度
+	 * @param n     快速自变量数组长度
+	 * @param y     样本: 因变量数组, m*n数组, 指向bkmean_或bksig_
+	 * @param c     内插系数拟合结果, n*m数组, 列优先存储, 指向d2mean_或d2sig_
+	 * @param line  行编号, 对应图像中Y轴
+	 * @param yx    行line中各x位置的拟合值, 1*n数组
+	 */
+	void line_splint2(int m, int n, float y[], double c[], double line, float yx[]);
+	/*!
+	 * @brief 使用二元三次样条插值, 计算像素位置的插值
+	 * @param m     慢速自变量数组长度
+	 * @param n     快速自变量数组长度
+	 * @param y     样本: 因变量数组, m*n数组, 指向bkmean_或bksig_
+	 * @param c     内插系数拟合结果, n*m数组, 列优先存储, 指向d2mean_或d2sig_
+	 * @param line  行编号, 对应图像中Y轴
+	 * @param col   列编号, 对应图像中X轴
+	 */
+	float pixel_splint2(int m, int n, float y[], double c[], double line, double col);
+	/*!
+	 * @brief 加载卷积滤波核
+	 * @param filepath 文件路径
+	 * @return
+	 * 卷积核加载结果
+	 * @note
+	 * 卷积滤波核以文本文件存储, 格式与SExtractor相同
+	 */
+	bool load_filter_conv(const string &filepath);
+	/*!
+	 * @brief 对图像数据做卷积, 用于信号提取
+	 */
+	void filter_convolve();
+	/*!
+	 * @brief 跟踪图像启用目标窗口时, 计算窗口在裁剪视图中的范围
+	 */
+	void set_roi(FramePtr frame);
+	/*!
+	 * @brief 检查坐标是否位于目标窗口内
+	 */
+	bool in_roi(double x, double y);
+	/*!
+	 * @brief 由背景噪声计算一行的检测阈值
+	 * @param y    行编号
+	 * @param line 输入: 该行背景噪声; 输出: 检测阈值
+	 */
+	void detect_thresh(int y, float *line);
+
+protected:
+	/*!
+	 * @brief 读取图像数据
+	 */
+	bool load_image(FramePtr frame);
+	/*!
+	 * @brief 由cfitsio读取时确定平面: 数据立方体取frame->plane, 二维图像取1
+	 */
+	void select_plane(fitsfile *fitsptr, FramePtr frame, int &status);
+	/*!
+	 * @brief 依据图像尺寸分配图像数据存储区
+	 */
+	void alloc_image();
+	/*!
+	 * @brief 生成缓存区
+	 */
+	bool alloc_buffer();
+	/*!
+	 * @brief 识别overscan或/和prescan区, 逐行估算偏置
+	 * @note
+	 * overscan和prescan区数值等效于BIAS, 对图像拟合造成干扰
+	 */
+	void scan_image();
+	/*!
+	 * @brief 由采样行确定裁剪视图和统计阈值
+	 * @param sample 采样行
+	 * @param nrow   采样行数
+	 * @param stride 相邻采样行的间距, 量纲: 像素
+	 */
+	void scan_trim(const float *sample, int nrow, int stride);
+	/*!
+	 * @brief 计算一行的偏置: overscan与prescan区像素的3σ裁剪均值
+	 */
+	float row_bias(const float *row);
+	/*!
+	 * @brief 多线程估算[y0, y1)行的偏置
+	 * @param data 像素数据, 起始于图像第y0行
+	 */
+	void scan_rows(const float *data, int y0, int y1);
+	/*!
+	 * @brief 线程: 估算行偏置
+	 * @param i0   线程处理的首行相对y0的偏移
+	 * @param step 行步长
+	 */
+	void scan_bias(const float *data, int y0, int y1, int i0, int step);
+	/*!
+	 * @brief 生成背景
+	 */
+	void back_make();
+	/*!
+	 * @brief 多线程统计背景网格行
+	 * @param data 像素数据, 起始于网格行iy0首行的裁剪视图首列, 行长度为pitch_
+	 * @param iy0  起始网格行
+	 * @param iy1  结束网格行, 不含
+	 */
+	void back_rows(const float *data, int iy0, int iy1);
+	/*!
+	 * @brief 背景网格滤波, 生成样条插值系数
+	 */
+	void back_model();
+	/*!
+	 * @brief 线程: 统计背景网格行
+	 * @param data 像素数据, 起始于网格行iy0首行的裁剪视图首列, 行长度为pitch_
+	 * @param iy0  起始网格行
+	 * @param iy1  结束网格行, 不含
+	 * @param i0   线程处理的首个网格行相对iy0的偏移
+	 * @param step 网格行步长
+	 */
+	void back_mesh(const float *data, int iy0, int iy1, int i0, int step);
+	/*!
+	 * @brief 统计单点网格
+	 * @param[in]  mesh 网格左上角像素
+	 * @param[in]  bias 网格各行的行偏置
+	 * @param[in]  bkw  网格宽度
+	 * @param[in]  bkh  网格高度
+	 * @param[out] grid 网格统计结果
+	 */
+	bool back_stat(const float *mesh, const float *bias, int bkw, int bkh, BackGrid &grid);
+	/*!
+	 * @brief 生成单点网格直方图
+	 */
+	void back_histo(const float *mesh, const float *bias, int bkw, int bkh, int *histo, BackGrid &grid);
+	/*!
+	 * @brief 计算单点网格背景
+	 */
+	void back_guess(int *histo, BackGrid &grid);
+	/*!
+	 * @brief 背景滤波
+	 */
+	void back_filter();
+	/*!
+	 * @brief 减去背景, 用于信号提取
+	 */
+	void sub_back();
+	/*!
+	 * @brief 扣除行偏置并减去背景, 结果原位紧缩为裁剪视图
+	 * @param data 像素数据, 起始于图像第y0行
+	 * @param y0   起始行
+	 * @param y1   结束行, 不含
+	 */
+	void sub_back(float *data, int y0, int y1);
+	/*!
+	 * @brief 使用8连通域, 聚合疑似目标
+	 * @note
+	 * - 图像按行分为条带, 由多线程并行标记
+	 * - 在条带接缝处以并查集合并跨条带的候选体
+	 */
+	void init_glob();
+	/*!
+	 * @brief 标记条带内的8连通域
+	 * @param strip 图像条带
+	 * @note
+	 * - 顺序扫描像素左侧、左上、正上、右上四个像素, 继承已标记点的标签
+	 * - 相邻像素标签不同时, 以并查集合并标签
+	 * - 标记的同时累加候选体测量信息, 扫描结束后合并至根标签
+	 */
+	void label_strip(GlobStrip *strip);
+	/*!
+	 * @brief 评估init_glob()聚合的候选体, 剔除不符合条件的目标
+	 */
+	void group_glob();
+	/*!
+	 * @brief 评估候选体, 符合条件时存入识别结果
+	 */
+	void test_object(ADIObject &can);
+	/*!
+	 * @brief 流式处理图像
+	 */
+	bool stream_image(FramePtr frame);
+	/*!
+	 * @brief 读取图像[y0, y1)行. 优先从内存映射读取
+	 */
+	bool read_rows(fitsfile *fitsptr, int y0, int y1, float *data, int &status);
+	/*!
+	 * @brief 流式处理: 准备预处理改正参数, 读取过扫区设置偏置
+	 */
+	bool stream_calib(FramePtr frame, fitsfile *fitsptr, int &status);
+	/*!
+	 * @brief 流式处理: 读取采样行, 识别坏列, 确定裁剪视图和统计阈值
+	 */
+	bool stream_scan(FramePtr frame, fitsfile *fitsptr, int &status);
+	/*!
+	 * @brief 流式处理: 逐条带估算行偏置, 统计背景网格, 生成背景
+	 */
+	bool stream_back(fitsfile *fitsptr, int &status);
+	/*!
+	 * @brief 流式处理: 逐条带减背景、滤波, 提取信号并聚合目标
+	 */
+	bool stream_glob(fitsfile *fitsptr, int &status);
+	/*!
+	 * @brief 流式处理: 标记一行像素的8连通域
+	 * @param gs     工作区
+	 * @param data   滤波后数据, 用于信号提取
+	 * @param img    减背景数据, 用于累加测量信息
+	 * @param thresh 该行检测阈值
+	 * @param y      行编号
+	 */
+	void stream_label(GlobStream &gs, const float *data, const float *img, const float *thresh, int y);
+	/*!
+	 * @brief 评估候选体星像形状, 计算FWHM和椭率
+	 * @return
+	 * 形状异常标志
+	 */
+	bool shape_clip(ADIObject &obj);
+	/*!
+	 * @brief 将识别结果转换为目标特征
+	 */
+	void store_objects(NFObjVec &objs);
+};
+typedef boost::shared_ptr<ADIReduct> ADIReductPtr;
+
+//////////////////////////////////////////////////////////////////////////////
+}
+
+#endif /* ADIREDUCT_H_ */
@@ -0,0 +1,541 @@
+/**
+ * @file ADISimd.cpp ADIReduct使用的向量化像素运算
+ * @version 0.1
+ * @date 2020-11-09
+ */
+
+#include <math.h>
+#include <string.h>
+#include "ADISimd.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ADI_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+/* 标量实现 */
+static int row_stat_scalar(const float *row, int n, float lo, float hi, double &sum, double &sum2) {
+	int count(0);
+	float pix;
+
+	for (int i = 0; i < n; ++i) {
+		if (lo <= (pix = row[i]) && pix <= hi) {
+			sum  += pix;
+			sum2 += double(pix) * pix;
+			++count;
+		}
+	}
+	return count;
+}
+
+static void row_histo_scalar(const float *row, int n, float scale, float cste, int nlevel, int *histo) {
+	int i, j;
+
+	for (j = 0; j < n; ++j) {
+		i = int(row[j] * scale + cste);
+		if (i >= 0 && i < nlevel) ++histo[i];
+	}
+}
+
+static int histo_moments_scalar(const int *histo, int lcut, int hcut, double &m1, double &m2) {
+	int sum(0), pix, i;
+	double dpix;
+
+	for (i = lcut; i <= hcut; ++i) {
+		sum += (pix = histo[i]);
+		m1  += (dpix = double(pix) * i);
+		m2  += (dpix * i);
+	}
+	return sum;
+}
+
+static void row_axpy_scalar(float *acc, const float *row, int n, float k) {
+	for (int i = 0; i < n; ++i) acc[i] += k * row[i];
+}
+
+static void swap_i16_scalar(const unsigned char *src, int n, float zero, float *dst) {
+	for (int i = 0; i < n; ++i, src += 2)
+		dst[i] = float(short((src[0] << 8) | src[1])) + zero;
+}
+
+static void swap_f32_scalar(const unsigned char *src, int n, float *dst) {
+	unsigned int u;
+	for (int i = 0; i < n; ++i, src += 4) {
+		u = (unsigned(src[0]) << 24) | (unsigned(src[1]) << 16) | (unsigned(src[2]) << 8) | src[3];
+		memcpy(dst + i, &u, 4);
+	}
+}
+
+/*
+ * 改正顺序固定为: 减本底, 减暗场, 减偏置, 乘平场倒数. 不使用FMA, 各实现结果一致
+ */
+static inline float calib_pixel(float v, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, int i) {
+	if (bias) v -= bias[i];
+	if (dark) v -= kdark * dark[i];
+	v -= offset;
+	if (flat) v *= flat[i];
+	return v;
+}
+
+static void calib_f32_scalar(const float *src, int n, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst) {
+	for (int i = 0; i < n; ++i)
+		dst[i] = calib_pixel(src[i], bias, dark, kdark, flat, offset, i);
+}
+
+static void calib_i16_scalar(const short *src, int n, float zero, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst) {
+	for (int i = 0; i < n; ++i)
+		dst[i] = calib_pixel(float(src[i]) + zero, bias, dark, kdark, flat, offset, i);
+}
+
+static void stack_range_scalar(const float *row, int n, float k, float *lo, float *hi) {
+	float v;
+	for (int i = 0; i < n; ++i) {
+		v = k * row[i];
+		if (v < lo[i]) lo[i] = v;
+		if (v > hi[i]) hi[i] = v;
+	}
+}
+
+static void stack_dev_scalar(const float *row, int n, float k, const float *mean, float *acc) {
+	float d;
+	for (int i = 0; i < n; ++i) {
+		d = k * row[i] - mean[i];
+		acc[i] += d * d;
+	}
+}
+
+static void min_max_scalar(float *lo, float *hi, int n) {
+	float a, b;
+	for (int i = 0; i < n; ++i) {
+		a = lo[i];
+		b = hi[i];
+		if (b < a) {
+			lo[i] = b;
+			hi[i] = a;
+		}
+	}
+}
+
+static double dot_scalar(const float *a, const float *b, int n) {
+	double sum(0.0);
+	for (int i = 0; i < n; ++i) sum += double(a[i]) * b[i];
+	return sum;
+}
+
+static void abs_dev_scalar(const float *row, int n, const float *center, float *dst) {
+	for (int i = 0; i < n; ++i) dst[i] = fabsf(row[i] - center[i]);
+}
+
+static void stack_clip_scalar(const float *row, int n, float k, const float *lo, const float *hi,
+		float *sum, float *count) {
+	float v;
+	for (int i = 0; i < n; ++i) {
+		if (lo[i] <= (v = k * row[i]) && v <= hi[i]) {
+			sum[i]   += v;
+			count[i] += 1.0f;
+		}
+	}
+}
+
+#ifdef ADI_X86_SIMD
+/* AVX2实现 */
+__attribute__((target("avx2")))
+static int row_stat_avx2(const float *row, int n, float lo, float hi, double &sum, double &sum2) {
+	__m256 vlo = _mm256_set1_ps(lo);
+	__m256 vhi = _mm256_set1_ps(hi);
+	__m256d vsum1 = _mm256_setzero_pd(), vsum2 = _mm256_setzero_pd();
+	__m256d vsq1  = _mm256_setzero_pd(), vsq2  = _mm256_setzero_pd();
+	__m256i vcnt  = _mm256_setzero_si256();
+	double buf[4];
+	int cnt[8];
+	int i, count;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_loadu_ps(row + i);
+		__m256 mask = _mm256_and_ps(_mm256_cmp_ps(v, vlo, _CMP_GE_OQ), _mm256_cmp_ps(v, vhi, _CMP_LE_OQ));
+		v = _mm256_and_ps(v, mask);		// 区间外像素置零
+		vcnt = _mm256_sub_epi32(vcnt, _mm256_castps_si256(mask));	// mask = -1
+		// 以双精度累加, 与标量实现一致
+		__m256d d1 = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+		__m256d d2 = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+		vsum1 = _mm256_add_pd(vsum1, d1);
+		vsum2 = _mm256_add_pd(vsum2, d2);
+		vsq1  = _mm256_add_pd(vsq1, _mm256_mul_pd(d1, d1));
+		vsq2  = _mm256_add_pd(vsq2, _mm256_mul_pd(d2, d2));
+	}
+	_mm256_storeu_pd(buf, _mm256_add_pd(vsum1, vsum2));
+	sum  += buf[0] + buf[1] + buf[2] + buf[3];
+	_mm256_storeu_pd(buf, _mm256_add_pd(vsq1, vsq2));
+	sum2 += buf[0] + buf[1] + buf[2] + buf[3];
+	_mm256_storeu_si256((__m256i*) cnt, vcnt);
+	count = cnt[0] + cnt[1] + cnt[2] + cnt[3] + cnt[4] + cnt[5] + cnt[6] + cnt[7];
+
+	return count + row_stat_scalar(row + i, n - i, lo, hi, sum, sum2);
+}
+
+__attribute__((target("avx2")))
+static void row_histo_avx2(const float *row, int n, float scale, float cste, int nlevel, int *histo) {
+	__m256 vscale = _mm256_set1_ps(scale);
+	__m256 vcste  = _mm256_set1_ps(cste);
+	__m256i vmax  = _mm256_set1_epi32(nlevel);
+	int ndx[8];
+	int i, j;
+
+	for (j = 0; j + 8 <= n; j += 8) {
+		__m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(row + j), vscale), vcste);
+		__m256i vi = _mm256_cvttps_epi32(v);	// 截断取整, 与int()一致
+		// 区间外的分级置为-1
+		__m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(vi, _mm256_set1_epi32(-1)),
+				_mm256_cmpgt_epi32(vmax, vi));
+		vi = _mm256_or_si256(vi, _mm256_andnot_si256(valid, _mm256_set1_epi32(-1)));
+		_mm256_storeu_si256((__m256i*) ndx, vi);
+		for (i = 0; i < 8; ++i) {
+			if (ndx[i] >= 0) ++histo[ndx[i]];
+		}
+	}
+	row_histo_scalar(row + j, n - j, scale, cste, nlevel, histo);
+}
+
+__attribute__((target("avx2")))
+static int histo_moments_avx2(const int *histo, int lcut, int hcut, double &m1, double &m2) {
+	__m256d vm1 = _mm256_setzero_pd(), vm2 = _mm256_setzero_pd();
+	__m256d vi  = _mm256_set_pd(lcut + 3, lcut + 2, lcut + 1, lcut);
+	__m256d vstep = _mm256_set1_pd(4.0);
+	__m128i vsum  = _mm_setzero_si128();
+	double buf[4];
+	int cnt[4];
+	int i;
+
+	// 直方图计数与分级均为整数, 双精度累加无舍入误差, 结果与标量实现一致
+	for (i = lcut; i + 3 <= hcut; i += 4, vi = _mm256_add_pd(vi, vstep)) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (histo + i));
+		__m256d d = _mm256_mul_pd(_mm256_cvtepi32_pd(v), vi);
+		vsum = _mm_add_epi32(vsum, v);
+		vm1  = _mm256_add_pd(vm1, d);
+		vm2  = _mm256_add_pd(vm2, _mm256_mul_pd(d, vi));
+	}
+	_mm256_storeu_pd(buf, vm1);
+	m1 += buf[0] + buf[1] + buf[2] + buf[3];
+	_mm256_storeu_pd(buf, vm2);
+	m2 += buf[0] + buf[1] + buf[2] + buf[3];
+	_mm_storeu_si128((__m128i*) cnt, vsum);
+
+	return cnt[0] + cnt[1] + cnt[2] + cnt[3] + histo_moments_scalar(histo, i, hcut, m1, m2);
+}
+
+__attribute__((target("avx2")))
+static void row_axpy_avx2(float *acc, const float *row, int n, float k) {
+	__m256 vk = _mm256_set1_ps(k);
+	int i;
+
+	// 乘法与加法分开执行, 不使用FMA, 与标量实现一致
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256 v1 = _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(vk, _mm256_loadu_ps(row + i)));
+		__m256 v2 = _mm256_add_ps(_mm256_loadu_ps(acc + i + 8), _mm256_mul_ps(vk, _mm256_loadu_ps(row + i + 8)));
+		_mm256_storeu_ps(acc + i, v1);
+		_mm256_storeu_ps(acc + i + 8, v2);
+	}
+	row_axpy_scalar(acc + i, row + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static void swap_i16_avx2(const unsigned char *src, int n, float zero, float *dst) {
+	const __m128i shuf = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+	__m256 vzero = _mm256_set1_ps(zero);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + 2 * i)), shuf);
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)), vzero));
+	}
+	swap_i16_scalar(src + 2 * i, n - i, zero, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void swap_f32_avx2(const unsigned char *src, int n, float *dst) {
+	const __m256i shuf = _mm256_set_epi8(
+			12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+			12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (src + 4 * i));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(v, shuf));
+	}
+	swap_f32_scalar(src + 4 * i, n - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 calib_avx2(__m256 v, const float *bias, const float *dark, __m256 vk,
+		const float *flat, __m256 voffset, int i) {
+	if (bias) v = _mm256_sub_ps(v, _mm256_loadu_ps(bias + i));
+	if (dark) v = _mm256_sub_ps(v, _mm256_mul_ps(vk, _mm256_loadu_ps(dark + i)));
+	v = _mm256_sub_ps(v, voffset);
+	if (flat) v = _mm256_mul_ps(v, _mm256_loadu_ps(flat + i));
+	return v;
+}
+
+__attribute__((target("avx2")))
+static void calib_f32_avx2(const float *src, int n, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst) {
+	__m256 vk = _mm256_set1_ps(kdark);
+	__m256 voffset = _mm256_set1_ps(offset);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, calib_avx2(_mm256_loadu_ps(src + i), bias, dark, vk, flat, voffset, i));
+	calib_f32_scalar(src + i, n - i, bias ? bias + i : NULL, dark ? dark + i : NULL, kdark,
+			flat ? flat + i : NULL, offset, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void calib_i16_avx2(const short *src, int n, float zero, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst) {
+	__m256 vk = _mm256_set1_ps(kdark);
+	__m256 voffset = _mm256_set1_ps(offset);
+	__m256 vzero = _mm256_set1_ps(zero);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (src + i)));
+		_mm256_storeu_ps(dst + i, calib_avx2(_mm256_add_ps(_mm256_cvtepi32_ps(v), vzero),
+				bias, dark, vk, flat, voffset, i));
+	}
+	calib_i16_scalar(src + i, n - i, zero, bias ? bias + i : NULL, dark ? dark + i : NULL, kdark,
+			flat ? flat + i : NULL, offset, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void stack_range_avx2(const float *row, int n, float k, float *lo, float *hi) {
+	__m256 vk = _mm256_set1_ps(k);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_mul_ps(vk, _mm256_loadu_ps(row + i));
+		_mm256_storeu_ps(lo + i, _mm256_min_ps(_mm256_loadu_ps(lo + i), v));
+		_mm256_storeu_ps(hi + i, _mm256_max_ps(_mm256_loadu_ps(hi + i), v));
+	}
+	stack_range_scalar(row + i, n - i, k, lo + i, hi + i);
+}
+
+__attribute__((target("avx2")))
+static void stack_dev_avx2(const float *row, int n, float k, const float *mean, float *acc) {
+	__m256 vk = _mm256_set1_ps(k);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 d = _mm256_sub_ps(_mm256_mul_ps(vk, _mm256_loadu_ps(row + i)), _mm256_loadu_ps(mean + i));
+		_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(d, d)));
+	}
+	stack_dev_scalar(row + i, n - i, k, mean + i, acc + i);
+}
+
+__attribute__((target("avx2")))
+static void min_max_avx2(float *lo, float *hi, int n) {
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_loadu_ps(lo + i);
+		__m256 b = _mm256_loadu_ps(hi + i);
+		_mm256_storeu_ps(lo + i, _mm256_min_ps(a, b));
+		_mm256_storeu_ps(hi + i, _mm256_max_ps(a, b));
+	}
+	min_max_scalar(lo + i, hi + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static double dot_avx2(const float *a, const float *b, int n) {
+	__m256d vsum1 = _mm256_setzero_pd(), vsum2 = _mm256_setzero_pd();
+	double buf[4];
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		vsum1 = _mm256_add_pd(vsum1, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+		vsum2 = _mm256_add_pd(vsum2, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+	}
+	_mm256_storeu_pd(buf, _mm256_add_pd(vsum1, vsum2));
+	return buf[0] + buf[1] + buf[2] + buf[3] + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void abs_dev_avx2(const float *row, int n, const float *center, float *dst) {
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(row + i), _mm256_loadu_ps(center + i));
+		_mm256_storeu_ps(dst + i, _mm256_andnot_ps(sign, d));
+	}
+	abs_dev_scalar(row + i, n - i, center + i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void stack_clip_avx2(const float *row, int n, float k, const float *lo, const float *hi,
+		float *sum, float *count) {
+	__m256 vk  = _mm256_set1_ps(k);
+	__m256 one = _mm256_set1_ps(1.0f);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_mul_ps(vk, _mm256_loadu_ps(row + i));
+		__m256 mask = _mm256_and_ps(_mm256_cmp_ps(v, _mm256_loadu_ps(lo + i), _CMP_GE_OQ),
+				_mm256_cmp_ps(v, _mm256_loadu_ps(hi + i), _CMP_LE_OQ));
+		_mm256_storeu_ps(sum + i, _mm256_add_ps(_mm256_loadu_ps(sum + i), _mm256_and_ps(v, mask)));
+		_mm256_storeu_ps(count + i, _mm256_add_ps(_mm256_loadu_ps(count + i), _mm256_and_ps(one, mask)));
+	}
+	stack_clip_scalar(row + i, n - i, k, lo + i, hi + i, sum + i, count + i);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+bool SimdHasAVX2() {
+#ifdef ADI_X86_SIMD
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+#else
+	return false;
+#endif
+}
+
+int SimdRowStat(const float *row, int n, float lo, float hi, double &sum, double &sum2) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) return row_stat_avx2(row, n, lo, hi, sum, sum2);
+#endif
+	return row_stat_scalar(row, n, lo, hi, sum, sum2);
+}
+
+void SimdRowHisto(const float *row, int n, float scale, float cste, int nlevel, int *histo) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		row_histo_avx2(row, n, scale, cste, nlevel, histo);
+		return;
+	}
+#endif
+	row_histo_scalar(row, n, scale, cste, nlevel, histo);
+}
+
+int SimdHistoMoments(const int *histo, int lcut, int hcut, double &m1, double &m2) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) return histo_moments_avx2(histo, lcut, hcut, m1, m2);
+#endif
+	return histo_moments_scalar(histo, lcut, hcut, m1, m2);
+}
+
+void SimdSwapI16(const unsigned char *src, int n, float zero, float *dst) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		swap_i16_avx2(src, n, zero, dst);
+		return;
+	}
+#endif
+	swap_i16_scalar(src, n, zero, dst);
+}
+
+void SimdSwapF32(const unsigned char *src, int n, float *dst) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		swap_f32_avx2(src, n, dst);
+		return;
+	}
+#endif
+	swap_f32_scalar(src, n, dst);
+}
+
+void SimdCalibF32(const float *src, int n, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		calib_f32_avx2(src, n, bias, dark, kdark, flat, offset, dst);
+		return;
+	}
+#endif
+	calib_f32_scalar(src, n, bias, dark, kdark, flat, offset, dst);
+}
+
+void SimdCalibI16(const short *src, int n, float zero, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		calib_i16_avx2(src, n, zero, bias, dark, kdark, flat, offset, dst);
+		return;
+	}
+#endif
+	calib_i16_scalar(src, n, zero, bias, dark, kdark, flat, offset, dst);
+}
+
+void SimdRowAxpy(float *acc, const float *row, int n, float k) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		row_axpy_avx2(acc, row, n, k);
+		return;
+	}
+#endif
+	row_axpy_scalar(acc, row, n, k);
+}
+
+void SimdStackRange(const float *row, int n, float k, float *lo, float *hi) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		stack_range_avx2(row, n, k, lo, hi);
+		return;
+	}
+#endif
+	stack_range_scalar(row, n, k, lo, hi);
+}
+
+void SimdStackDev(const float *row, int n, float k, const float *mean, float *acc) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		stack_dev_avx2(row, n, k, mean, acc);
+		return;
+	}
+#endif
+	stack_dev_scalar(row, n, k, mean, acc);
+}
+
+void SimdMinMax(float *lo, float *hi, int n) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		min_max_avx2(lo, hi, n);
+		return;
+	}
+#endif
+	min_max_scalar(lo, hi, n);
+}
+
+double SimdDot(const float *a, const float *b, int n) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) return dot_avx2(a, b, n);
+#endif
+	return dot_scalar(a, b, n);
+}
+
+void SimdAbsDev(const float *row, int n, const float *center, float *dst) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		abs_dev_avx2(row, n, center, dst);
+		return;
+	}
+#endif
+	abs_dev_scalar(row, n, center, dst);
+}
+
+void SimdStackClip(const float *row, int n, float k, const float *lo, const float *hi,
+		float *sum, float *count) {
+#ifdef ADI_X86_SIMD
+	if (SimdHasAVX2()) {
+		stack_clip_avx2(row, n, k, lo, hi, sum, count);
+		return;
+	}
+#endif
+	stack_clip_scalar(row, n, k, lo, hi, sum, count);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,151 @@
+/**
+ * @file ADISimd.h ADIReduct使用的向量化像素运算
+ * @version 0.1
+ * @date 2020-11-09
+ * @note
+ * - x86-64平台运行时检测AVX2, 不支持时使用标量实现
+ * - 不依赖编译选项: AVX2实现以函数属性单独编译
+ */
+
+#ifndef ADISIMD_H_
+#define ADISIMD_H_
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ * @brief 检查处理器是否支持AVX2
+ */
+extern bool SimdHasAVX2();
+/*!
+ * @brief 统计一行像素中落在[lo, hi]区间内的数据
+ * @param row   像素
+ * @param n     像素数量
+ * @param lo    区间下限
+ * @param hi    区间上限
+ * @param sum   累加: 数值和
+ * @param sum2  累加: 数值平方和
+ * @return
+ * 区间内像素数量
+ */
+extern int SimdRowStat(const float *row, int n, float lo, float hi, double &sum, double &sum2);
+/*!
+ * @brief 将一行像素累加至直方图
+ * @param row    像素
+ * @param n      像素数量
+ * @param scale  比例
+ * @param cste   偏置. 直方图分级 = int(像素 * scale + cste)
+ * @param nlevel 直方图分级数
+ * @param histo  直方图
+ */
+extern void SimdRowHisto(const float *row, int n, float scale, float cste, int nlevel, int *histo);
+/*!
+ * @brief 计算直方图[lcut, hcut]区间的零阶、一阶和二阶矩
+ * @param histo 直方图
+ * @param lcut  区间下限
+ * @param hcut  区间上限
+ * @param m1    一阶矩: sum(histo[i] * i)
+ * @param m2    二阶矩: sum(histo[i] * i * i)
+ * @return
+ * 零阶矩: sum(histo[i])
+ */
+extern int SimdHistoMoments(const int *histo, int lcut, int hcut, double &m1, double &m2);
+/*!
+ * @brief 将一行像素乘以系数后累加: acc[i] += k * row[i]
+ * @param acc 累加结果
+ * @param row 像素
+ * @param n   像素数量
+ * @param k   系数
+ */
+extern void SimdRowAxpy(float *acc, const float *row, int n, float k);
+/*!
+ * @brief 将大端序16位整数转换为浮点数: dst[i] = swap(src[i]) + zero
+ * @param src  大端序16位有符号整数
+ * @param n    像素数量
+ * @param zero 偏置, 即FITS BZERO. 转换结果需可由单精度浮点数精确表示
+ * @param dst  转换结果
+ */
+extern void SimdSwapI16(const unsigned char *src, int n, float zero, float *dst);
+/*!
+ * @brief 将大端序单精度浮点数转换为本机字节序
+ * @param src 大端序单精度浮点数
+ * @param n   像素数量
+ * @param dst 转换结果
+ */
+extern void SimdSwapF32(const unsigned char *src, int n, float *dst);
+/*!
+ * @brief 本底、暗场与平场改正:
+ * dst[i] = (src[i] - bias[i] - kdark * dark[i] - offset) * flat[i]
+ * @param src    待改正像素
+ * @param n      像素数量
+ * @param bias   合并本底. NULL: 不减本底
+ * @param dark   单位曝光时间暗流. NULL: 不减暗场
+ * @param kdark  暗场系数
+ * @param flat   归一化平场的倒数. NULL: 不除平场
+ * @param offset 标量偏置, 如过扫区电平
+ * @param dst    改正结果, 可与src相同
+ */
+extern void SimdCalibF32(const float *src, int n, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst);
+/*!
+ * @brief 改正本机字节序16位整数像素, 结果为浮点数. 像素值 = src[i] + zero, 其余同SimdCalibF32
+ * @param zero 偏置, 即FITS BZERO. 无符号16位图像为32768
+ */
+extern void SimdCalibI16(const short *src, int n, float zero, const float *bias, const float *dark, float kdark,
+		const float *flat, float offset, float *dst);
+/*!
+ * @brief 逐像素更新极值: v = k * row[i], lo[i] = min(lo[i], v), hi[i] = max(hi[i], v)
+ * @param row 像素
+ * @param n   像素数量
+ * @param k   归一化系数
+ * @param lo  逐像素最小值
+ * @param hi  逐像素最大值
+ */
+extern void SimdStackRange(const float *row, int n, float k, float *lo, float *hi);
+/*!
+ * @brief 逐像素累加与均值之差的平方: acc[i] += (k * row[i] - mean[i])^2
+ * @param row  像素
+ * @param n    像素数量
+ * @param k    归一化系数
+ * @param mean 逐像素均值
+ * @param acc  累加结果
+ */
+extern void SimdStackDev(const float *row, int n, float k, const float *mean, float *acc);
+/*!
+ * @brief 逐像素比较交换: lo[i], hi[i] = min(lo[i], hi[i]), max(lo[i], hi[i]). 用于沿列方向的排序网络
+ * @param lo 较小值
+ * @param hi 较大值
+ * @param n  像素数量
+ */
+extern void SimdMinMax(float *lo, float *hi, int n);
+/*!
+ * @brief 内积: sum(a[i] * b[i]), 以双精度累加乘积. 用于最小二乘法方程
+ * @param a 向量
+ * @param b 向量
+ * @param n 长度
+ */
+extern double SimdDot(const float *a, const float *b, int n);
+/*!
+ * @brief 逐像素绝对偏差: dst[i] = |row[i] - center[i]|
+ * @param row    像素
+ * @param n      像素数量
+ * @param center 逐像素中心值
+ * @param dst    绝对偏差
+ */
+extern void SimdAbsDev(const float *row, int n, const float *center, float *dst);
+/*!
+ * @brief 逐像素累加落在[lo[i], hi[i]]区间内的数据: v = k * row[i], sum[i] += v, count[i] += 1
+ * @param row   像素
+ * @param n     像素数量
+ * @param k     归一化系数
+ * @param lo    逐像素区间下限
+ * @param hi    逐像素区间上限
+ * @param sum   累加: 数值和
+ * @param count 累加: 区间内数量
+ */
+extern void SimdStackClip(const float *row, int n, float k, const float *lo, const float *hi,
+		float *sum, float *count);
+
+//////////////////////////////////////////////////////////////////////////////
+}
+
+#endif /* ADISIMD_H_ */
@@ -12,6 +12,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "AFindPV.h"
 #include "GLog.h"
+#include "ATrace.h"
 #include "ATimeSpace.h"
 #include "ADefine.h"
 
@@ -23,6 +24,7 @@ namespace AstroUtil {
 AFindPV::AFindPV(Parameter *param) {
 	param_ = param;
 	last_fno_ = INT_MAX;
+	hdu_      = 0;
 	mjdold_   = 0;
 	idpv_     = 0;
 	SID_      = 0;
@@ -36,14 +38,17 @@ AFindPV::~AFindPV() {
 	thrd_newfrm_->join();
 }
 
-void AFindPV::SetIDs(const string& gid, const string& uid, const string& cid) {
+void AFindPV::SetIDs(const string& gid, const string& uid, const string& cid, int hdu) {
 	gid_ = gid;
 	uid_ = uid;
 	cid_ = cid;
+	hdu_ = hdu;
+	// 拼接相机的各图像扩展分别记录坏列/坏点
+	badcid_ = hdu ? cid + "#" + std::to_string(hdu) : cid;
 }
 
-bool AFindPV::IsMatched(const string& gid, const string& uid, const string& cid) {
-	return (gid_ == gid && uid_ == uid && cid_ == cid);
+bool AFindPV::IsMatched(const string& gid, const string& uid, const string& cid, int hdu) {
+	return (gid_ == gid && uid_ == uid && cid_ == cid && hdu_ == hdu);
 }
 
 void AFindPV::NewFrame(FramePtr frame) {
@@ -258,7 +263,7 @@ bool AFindPV::test_badcol(int col) {
 	if (it != uncbadcol_.end()) {
 		if ((hit = (*it).inc()) >= BADCNT) {
 			uncbadcol_.erase(it);
-			param_->AddBadcol(gid_, uid_, cid_, col);
+			param_->AddBadcol(gid_, uid_, badcid_, col);
 		}
 	}
 	else {
@@ -269,16 +274,13 @@ bool AFindPV::test_badcol(int col) {
 }
 
 void AFindPV::remove_badpix(FramePtr frame) {
-	string gid = frame->gid;
-	string uid = frame->uid;
-	string cid = frame->cid;
 	NFObjVec& objs = frame->nfobjs;
 	int col;
-	CameraBadcol* badcol = param_->GetBadcol(gid, uid, cid);
-	if (badcol) {
+	CameraBadcol badcol;
+	if (param_->CopyBadcol(gid_, uid_, badcid_, badcol)) {
 		for (NFObjVec::iterator it = objs.begin(); it != objs.end(); ) {
 			col = int((*it)->features[NDX_X] + 0.5);
-			if (badcol->test(col)) it = objs.erase(it);
+			if (badcol.test(col)) it = objs.erase(it);
 			else ++it;
 		}
 	}
@@ -347,7 +349,10 @@ void AFindPV::candidate2object(PvCanPtr can) {
 		DoubtPixPtr ptr;
 		if (doubtable) {
 			ptr = doubtPixSet_.get(col, row);
+			bool bad = ptr->is_bad();
 			ptr->inc(pts[0]->fno, pts[n-1]->fno);
+			// 新确认的坏点记入坏元素标记, 预处理据此在检测前修补该像素
+			if (!bad && ptr->is_bad()) param_->AddBadpix(gid_, uid_, badcid_, ptr->col, ptr->row);
 		}
 		if (!(ptr.use_count() && ptr->is_bad())) {
 			for (PvPtVec::iterator it = pts.begin(); it != pts.end(); ++it) {
@@ -426,9 +431,12 @@ void AFindPV::upload_ot(FramePtr frame) {
 void AFindPV::upload_orbit(PvObjPtr obj, DoubtPixPtr ptr) {
 	PvPtVec &pts = obj->pts;
 	int npts = pts.size(), i;
-	string objname = utcdate_ + "_" + std::to_string(++idpv_);
+	string objname = utcdate_ + "_";
 	path objpath(dirname_);
 
+	if (hdu_) objname += std::to_string(hdu_) + "_";	// 多扩展图像: 文件名包含HDU编号
+	objname += std::to_string(++idpv_);
+
 	objname = objname + ".obj";
 	objpath /= objname;
 	// 上传文件
@@ -631,13 +639,17 @@ void AFindPV::thread_newframe() {
 		}
 		if (!frame.use_count()) {// 无图像可处理, 则结束序列
 			if (last_fno_ != INT_MAX) {
+				string camid = gid_ + ":" + uid_ + ":" + badcid_;
+				TraceSpan span("findpv.idle_end", "findpv", NULL, camid.c_str());
 				end_sequence();
 				recheck_doubt();
 				last_fno_ = INT_MAX;
 			}
 		}
 		else {// 开始处理新的图像帧
+			TraceSpan span("findpv.frame", "findpv", frame.get());
 			if (frame->fno < last_fno_) {
+				TraceSpan span1("findpv.end_sequence", "findpv", frame.get());
 				end_sequence();
 				new_sequence();
 				create_dir(frame);
@@ -646,6 +658,7 @@ void AFindPV::thread_newframe() {
 			new_frame(frame);
 			if (cross_match()) {
 				upload_ot(frame);
+				TraceSpan span1("findpv.end_frame", "findpv", frame.get());
 				end_frame();
 			}
 		}
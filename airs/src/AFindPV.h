@@ -402,6 +402,8 @@ protected:
 	string gid_;		//< 组标志
 	string uid_;		//< 单元标志
 	string cid_;		//< 相机标志
+	int hdu_;			//< HDU编号. > 0: 多扩展图像的子帧, 各图像扩展独立关联
+	string badcid_;		//< 坏列/坏点记录使用的相机标志
 
 	int last_fno_;		//< 最后一个帧编号
 	PvFrmPtr frmprev_;	//< 帧数据
@@ -523,8 +525,8 @@ protected:
 	void mag_convert(double mag, string &str);
 
 public:
-	void SetIDs(const string& gid, const string& uid, const string& cid);
-	bool IsMatched(const string& gid, const string& uid, const string& cid);	/*!
+	void SetIDs(const string& gid, const string& uid, const string& cid, int hdu = 0);
+	bool IsMatched(const string& gid, const string& uid, const string& cid, int hdu = 0);	/*!
 	 * @brief 处理新的数据帧
 	 */
 	void NewFrame(FramePtr frame);
@@ -0,0 +1,198 @@
+/*!
+ * @file ATrace.cpp 处理流程跟踪记录, 输出为Chrome trace event格式
+ * @version 0.1
+ * @date 2020-11-06
+ */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <boost/bind/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "ATrace.h"
+#include "FrameStat.h"
+#include "GLog.h"
+
+using namespace boost::filesystem;
+using namespace boost::posix_time;
+
+/*
+ * 复制字符串, 替换JSON中需转义的字符
+ */
+static void copy_field(char *dst, int size, const char *src) {
+	int i;
+	for (i = 0; i < size - 1 && src[i]; ++i)
+		dst[i] = (src[i] == '"' || src[i] == '\\' || src[i] < ' ') ? '_' : src[i];
+	dst[i] = 0;
+}
+
+ATrace::ATrace()
+	: enabled_(false), tls_(&ATrace::retire_buffer) {
+	fp_     = NULL;
+	first_  = true;
+	period_ = 10;
+}
+
+ATrace::~ATrace() {
+	Stop();
+	/*
+	 * 仍在运行的线程在结束时会访问其缓冲区, 只释放已结束线程的缓冲区
+	 */
+	mutex_lock lck(mtx_bufs_);
+	for (TraceBufVec::iterator it = bufs_.begin(); it != bufs_.end(); ++it) {
+		if ((*it)->retired) delete *it;
+	}
+	bufs_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool ATrace::Start(const string &pathroot, int period) {
+	if (fp_) return true;
+
+	boost::system::error_code ec;
+	path filepath(pathroot);
+	filepath /= string("Trace");
+	if (!(exists(filepath, ec) || create_directories(filepath, ec))) {
+		_gLog->Write(LOG_WARN, "ATrace::Start()", "%s", ec.message().c_str());
+		return false;
+	}
+	filepath /= (boost::format("trace-%s.json") % to_iso_string(second_clock::universal_time())).str();
+	if (!(fp_ = fopen(filepath.c_str(), "w"))) {
+		_gLog->Write(LOG_WARN, "ATrace::Start()", "failed to create [%s]", filepath.c_str());
+		return false;
+	}
+
+	fprintf(fp_, "[\n");
+	first_  = true;
+	period_ = period < 1 ? 1 : period;
+	enabled_.store(true);
+	thrd_flush_.reset(new boost::thread(boost::bind(&ATrace::thread_flush, this)));
+	_gLog->Write("trace is recorded in [%s]", filepath.c_str());
+	return true;
+}
+
+void ATrace::Stop() {
+	if (!fp_) return;
+
+	enabled_.store(false);
+	if (thrd_flush_.unique()) {
+		thrd_flush_->interrupt();
+		thrd_flush_->join();
+		thrd_flush_.reset();
+	}
+	flush();
+	fprintf(fp_, "\n]\n");
+	fclose(fp_);
+	fp_ = NULL;
+
+	unsigned long dropped(0);
+	mutex_lock lck(mtx_bufs_);
+	for (TraceBufVec::iterator it = bufs_.begin(); it != bufs_.end(); ++it)
+		dropped += (*it)->dropped;
+	if (dropped) _gLog->Write(LOG_WARN, "ATrace::Stop()", "%lu trace events were dropped", dropped);
+}
+
+void ATrace::Complete(const char *name, const char *cat, double t0, double t1,
+		const OneFrame *frame, const char *camera) {
+	if (!IsEnabled()) return;
+
+	TraceBuffer *buf = thread_buffer();
+	unsigned head = buf->head.load(boost::memory_order_relaxed);
+	if (head - buf->tail.load(boost::memory_order_acquire) >= TraceBuffer::SIZE) {// 缓冲区满
+		++buf->dropped;
+		return;
+	}
+
+	TraceEvent &ev = buf->events[head % TraceBuffer::SIZE];
+	ev.name = name;
+	ev.cat  = cat;
+	ev.ts   = t0 * 1E6;
+	ev.dur  = (t1 - t0) * 1E6;
+	if (frame) {
+		char cid[40];
+		if (frame->hdu) snprintf(cid, 40, "%s:%s:%s#%d", frame->gid.c_str(), frame->uid.c_str(), frame->cid.c_str(), frame->hdu);
+		else snprintf(cid, 40, "%s:%s:%s", frame->gid.c_str(), frame->uid.c_str(), frame->cid.c_str());
+		copy_field(ev.frame,  sizeof(ev.frame),  frame->filename.c_str());
+		copy_field(ev.camera, sizeof(ev.camera), cid);
+	}
+	else {
+		ev.frame[0] = 0;
+		copy_field(ev.camera, sizeof(ev.camera), camera ? camera : "");
+	}
+	buf->head.store(head + 1, boost::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+TraceBuffer *ATrace::thread_buffer() {
+	TraceBuffer *buf = tls_.get();
+	if (!buf) {// 线程首次记录时创建缓冲区
+		buf = new TraceBuffer;
+		buf->tid = syscall(SYS_gettid);
+		tls_.reset(buf);
+
+		mutex_lock lck(mtx_bufs_);
+		bufs_.push_back(buf);
+	}
+	return buf;
+}
+
+void ATrace::retire_buffer(TraceBuffer *buf) {
+	buf->retired.store(true, boost::memory_order_release);
+}
+
+void ATrace::flush() {
+	int pid = getpid();
+	mutex_lock lck(mtx_bufs_);
+
+	for (TraceBufVec::iterator it = bufs_.begin(); it != bufs_.end();) {
+		TraceBuffer *buf = *it;
+		// 先读取结束标志: 标志之后不再有新记录
+		bool retired  = buf->retired.load(boost::memory_order_acquire);
+		unsigned tail = buf->tail.load(boost::memory_order_relaxed);
+		unsigned head = buf->head.load(boost::memory_order_acquire);
+
+		for (; tail != head; ++tail) {
+			const TraceEvent &ev = buf->events[tail % TraceBuffer::SIZE];
+			fprintf(fp_, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,"
+					"\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"frame\":\"%s\",\"camera\":\"%s\"}}",
+					first_ ? "" : ",\n", ev.name, ev.cat, pid, buf->tid,
+					ev.ts, ev.dur, ev.frame, ev.camera);
+			first_ = false;
+		}
+		buf->tail.store(tail, boost::memory_order_release);
+
+		if (retired) {
+			delete buf;
+			it = bufs_.erase(it);
+		}
+		else ++it;
+	}
+	fflush(fp_);
+}
+
+void ATrace::thread_flush() {
+	boost::chrono::seconds period(period_);
+
+	try {
+		while (1) {
+			boost::this_thread::sleep_for(period);
+			flush();
+		}
+	}
+	catch(boost::thread_interrupted &ex) {
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+TraceSpan::TraceSpan(const char *name, const char *cat, const OneFrame *frame, const char *camera) {
+	name_   = name;
+	cat_    = cat;
+	frame_  = frame;
+	camera_ = camera;
+	t0_     = _gTrace.use_count() && _gTrace->IsEnabled() ? StatClock() : 0.0;
+}
+
+TraceSpan::~TraceSpan() {
+	if (t0_ > 0.0) _gTrace->Complete(name_, cat_, t0_, StatClock(), frame_, camera_);
+}
@@ -0,0 +1,158 @@
+/*!
+ * @file ATrace.h 处理流程跟踪记录, 输出为Chrome trace event格式
+ * @version 0.1
+ * @date 2020-11-06
+ * @note
+ * - 记录处理步骤、外部程序和AFindPV各环节的起止时刻, 附带图像文件名和相机标志
+ * - 每个线程独占一个环形缓冲区, 写入时无锁. 缓冲区满时丢弃记录并计数
+ * - 后台线程周期性地将缓冲区写入文件. 文件可由chrome://tracing或Perfetto查看
+ * - 未启用时, 记录接口只检查一个原子标志
+ * - 文件路径结构: <path root>/Trace/trace-CCYYMMDDThhmmss.json
+ */
+
+#ifndef ATRACE_H_
+#define ATRACE_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include "airsdata.h"
+
+using std::string;
+
+/*!
+ * @struct TraceEvent 一条跟踪记录: 持续事件(ph = X)
+ */
+struct TraceEvent {
+	const char *name;	//< 事件名称. 须为静态字符串
+	const char *cat;	//< 事件分类. 须为静态字符串
+	double ts;			//< 起始时刻, 量纲: 微秒
+	double dur;			//< 持续时间, 量纲: 微秒
+	char frame[64];		//< 图像文件名
+	char camera[40];	//< 相机标志: gid:uid:cid
+};
+
+/*!
+ * @struct TraceBuffer 单个线程的环形缓冲区
+ * @note
+ * 单生产者(所属线程)单消费者(写文件线程)
+ */
+struct TraceBuffer {
+	enum {
+		SIZE = 1024		//< 缓冲区容量
+	};
+
+	TraceEvent events[SIZE];	//< 记录
+	boost::atomic<unsigned> head;	//< 写入位置, 由所属线程更新
+	boost::atomic<unsigned> tail;	//< 读出位置, 由写文件线程更新
+	boost::atomic<bool> retired;	//< 所属线程已结束
+	unsigned long dropped;	//< 丢弃的记录数
+	long tid;				//< 线程编号
+
+public:
+	TraceBuffer() : head(0), tail(0), retired(false) {
+		dropped = 0;
+		tid     = 0;
+	}
+};
+
+class ATrace {
+public:
+	ATrace();
+	virtual ~ATrace();
+
+protected:
+	/* 数据类型 */
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+	typedef boost::shared_ptr<boost::thread> threadptr;
+	typedef std::vector<TraceBuffer*> TraceBufVec;
+
+protected:
+	/* 成员变量 */
+	boost::atomic<bool> enabled_;	//< 启用标志
+	boost::mutex mtx_bufs_;		//< 互斥锁: 缓冲区集合
+	TraceBufVec bufs_;			//< 各线程的缓冲区
+	boost::thread_specific_ptr<TraceBuffer> tls_;	//< 当前线程的缓冲区
+	FILE *fp_;			//< 文件指针
+	bool first_;		//< 文件中尚未写入记录
+	int period_;		//< 写入文件周期, 量纲: 秒
+	threadptr thrd_flush_;	//< 线程: 写入文件
+
+public:
+	/*!
+	 * @brief 创建跟踪文件并启用记录
+	 * @param pathroot 文件根目录
+	 * @param period   写入文件周期, 量纲: 秒
+	 * @return
+	 * 操作结果
+	 */
+	bool Start(const string &pathroot, int period);
+	/*!
+	 * @brief 停止记录, 将缓冲区写入文件并关闭文件
+	 */
+	void Stop();
+	/*!
+	 * @brief 检查是否启用记录
+	 */
+	bool IsEnabled() {
+		return enabled_.load(boost::memory_order_relaxed);
+	}
+	/*!
+	 * @brief 记录一个持续事件
+	 * @param name   事件名称. 静态字符串
+	 * @param cat    事件分类. 静态字符串
+	 * @param t0     起始时刻, 单调时钟, 量纲: 秒
+	 * @param t1     结束时刻, 单调时钟, 量纲: 秒
+	 * @param frame  相关图像. 可为NULL
+	 * @param camera 相机标志. frame为NULL时使用, 可为NULL
+	 */
+	void Complete(const char *name, const char *cat, double t0, double t1,
+			const OneFrame *frame, const char *camera = NULL);
+
+protected:
+	/*!
+	 * @brief 查找或创建当前线程的缓冲区
+	 */
+	TraceBuffer *thread_buffer();
+	/*!
+	 * @brief 线程结束时回收缓冲区: 标记后由写文件线程释放
+	 */
+	static void retire_buffer(TraceBuffer *buf);
+	/*!
+	 * @brief 将所有缓冲区写入文件, 释放已结束线程的缓冲区
+	 */
+	void flush();
+	/*!
+	 * @brief 线程: 周期性写入文件
+	 */
+	void thread_flush();
+};
+
+extern boost::shared_ptr<ATrace> _gTrace;	//< 处理流程跟踪
+
+/*!
+ * @class TraceSpan 记录作用域内的持续事件
+ */
+class TraceSpan {
+public:
+	/*!
+	 * @param name   事件名称. 静态字符串
+	 * @param cat    事件分类. 静态字符串
+	 * @param frame  相关图像. 可为NULL
+	 * @param camera 相机标志. frame为NULL时使用, 可为NULL
+	 */
+	TraceSpan(const char *name, const char *cat, const OneFrame *frame = NULL, const char *camera = NULL);
+	~TraceSpan();
+
+protected:
+	const char *name_;
+	const char *cat_;
+	const OneFrame *frame_;
+	const char *camera_;
+	double t0_;		//< 起始时刻. 0: 未启用
+};
+
+#endif /* ATRACE_H_ */
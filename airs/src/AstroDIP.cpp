@@ -6,24 +6,43 @@
 
 #include <boost/make_shared.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <stdio.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <float.h>
 #include <vector>
 #include <algorithm>
 #include "AstroDIP.h"
+#include "FrameStat.h"
+#include "ExtractPool.h"
+#include "PreProcess.h"
+#include "BrightMask.h"
+#include "BadColumn.h"
+#include "FitsMMap.h"
+#include "MosaicReduct.h"
 #include "GLog.h"
 
 using std::vector;
 using namespace boost::filesystem;
 using namespace boost::posix_time;
 
+/*
+ * SExtractor配置文件: 跟踪与凝视模式使用不同的探测阈值
+ */
+static const char *sex_config(bool typeTrack) {
+	return typeTrack ? "/usr/local/etc/sex-param/low.sex" : "/usr/local/etc/sex-param/high.sex";
+}
+
 //////////////////////////////////////////////////////////////////////////////
-AstroDIP::AstroDIP(Parameter *param) {
+AstroDIP::AstroDIP(Parameter *param)
+	: psf_(param) {
 	param_   = param;
 	working_ = false;
 	pid_     = 0;
+	tmexec_  = 0.0;
 }
 
 AstroDIP::~AstroDIP() {
@@ -42,9 +61,32 @@ void AstroDIP::RegisterReductResult(const ReductResultSlot &slot) {
 bool AstroDIP::DoIt(FramePtr frame) {
 	if (working_) return false;
 	frame_ = frame;
+	StageBegin(frame_, STAGE_REDUCT);
+	if (param_->dipNative) {// 内置算法, 在线程中处理图像
+		if (!adi_.unique()) adi_ = boost::make_shared<ADIReduct>(param_);
+		working_ = true;
+		thrd_mntr_.reset(new boost::thread(boost::bind(&AstroDIP::thread_native, this)));
+		return true;
+	}
+	double cpu0 = StatThreadCPU();
 	create_monitor();
+	calib_image();
+	if (_gBadColumn.use_count()) _gBadColumn->DetectFile(frame_, fileimg_);
+	StageCPU(frame_, STAGE_REDUCT, StatThreadCPU() - cpu0);
+	if (roi_mode() || param_->tileCols * param_->tileRows > 1) {// 目标窗口或分块并行处理
+		working_ = true;
+		thrd_mntr_.reset(new boost::thread(boost::bind(&AstroDIP::thread_tiles, this)));
+		return true;
+	}
+	if (_gExtract.use_count() && _gExtract->IsRunning()) {// 由预先启动的工作进程处理图像
+		pid_ = 0;
+		working_ = true;
+		thrd_mntr_.reset(new boost::thread(boost::bind(&AstroDIP::thread_monitor, this)));
+		return true;
+	}
 
 	/* 以多进程模式启动图像处理 */
+	tmexec_ = StatClock();
 	if ((pid_ = fork()) > 0) {// 主进程, 启动监测线程
 		working_ = true;
 		thrd_mntr_.reset(new boost::thread(boost::bind(&AstroDIP::thread_monitor, this)));
@@ -52,12 +94,14 @@ bool AstroDIP::DoIt(FramePtr frame) {
 	}
 	else if (pid_ < 0) {// 无法启动多进程
 		_gLog->Write(LOG_FAULT, "AstroDIP::DoIt()", "failed to fork multi-process");
+		remove_calib();
 		return false;
 	}
-	execl(param_->pathExeSex.c_str(), "sex", frame_->filepath.c_str(),
+	execl(param_->pathExeSex.c_str(), "sex", fileimg_.c_str(),
 //		"-c", param_->pathCfgSex.c_str(),
-		"-c", frame->typeTrack ? "/usr/local/etc/sex-param/low.sex" : "/usr/local/etc/sex-param/high.sex",
+		"-c", sex_config(frame->typeTrack),
 		"-CATALOG_NAME", filemntr_.c_str(),
+		"-CATALOG_TYPE", param_->sexCatType.c_str(),
 		NULL);
 	exit(1);
 }
@@ -73,93 +117,275 @@ void AstroDIP::create_monitor() {
 	filemntr_ = filepath.string();
 }
 
+void AstroDIP::calib_image() {
+	int nthread = param_->nThreadDip > 0 ? param_->nThreadDip : boost::thread::hardware_concurrency();
+	if (nthread < 1) nthread = 1;
+	fileimg_ = frame_->filepath;
+	if (_gPreProc.use_count()) {
+		path filepath = param_->pathWork;
+		filepath /= path(frame_->filename).stem().string() + "_cal.fit";
+		if (_gPreProc->CalibrateFile(frame_, filepath.string(), nthread)) {
+			fileimg_ = filepath.string();
+			return;
+		}
+	}
+	// 瓦片压缩图像: SExtractor读取解压副本
+	if (frame_->compressed) DecompressFrame(frame_, param_->pathWork, nthread, fileimg_);
+}
+
+void AstroDIP::remove_calib() {
+	if (fileimg_ != frame_->filepath) {
+		remove(path(fileimg_));
+		fileimg_ = frame_->filepath;
+	}
+}
+
 void AstroDIP::load_catalog() {
+	NFObjVec objs;
+	load_catalog(filemntr_, objs);
+	filter_objects(objs);
+}
+
+void AstroDIP::load_catalog(const string &filepath, NFObjVec &objs, const ImageTile *tile, double tol) {
+	if (boost::istarts_with(param_->sexCatType, "FITS")) load_catalog_fits(filepath, objs, tile, tol);
+	else load_catalog_ascii(filepath, objs, tile, tol);
+}
+
+void AstroDIP::load_catalog_ascii(const string &filepath, NFObjVec &objs, const ImageTile *tile, double tol) {
 	char line[200];
 	char seps[] = " \r", *token;
+	int pos;
+	double features[NDX_MAX], *ptr;
+	FILE *fp = fopen(filepath.c_str(), "r");
+
+	if (!fp) {
+		_gLog->Write(LOG_FAULT, "AstroDIP::load_catalog_ascii()", "failed to open catalog [%s]",
+				filepath.c_str());
+		return;
+	}
+	/*
+	 * 行信息构成:
+	 * 1. 注释行: 以#为第一个字符
+	 * 2. 数据行各列依次为:
+	 * X_IMAGE_DBL, Y_IMAGE_DBL, FLUX_AUTO, MAG_AUTO, MAGERR_AUTO, FWHM_IMAGE, ELLIPTICITY, BACKGROUND
+	 */
+	while (!feof(fp)) {
+		if (NULL == fgets(line, 200, fp) || line[0] == '#') continue;
+
+		for (token = strtok(line, seps), pos = 0, ptr = features; token && pos < NDX_MAX;
+				token = strtok(NULL, seps), ++pos, ++ptr) {
+			*ptr = atof(token);
+		}
+		if (pos == NDX_MAX && keep_object(features, tile, tol)) {
+			NFObjPtr body = boost::make_shared<ObjectInfo>();
+			memcpy(body->features, features, sizeof(features));
+			objs.push_back(body);
+		}
+	}
+	fclose(fp);
+}
+
+void AstroDIP::load_catalog_fits(const string &filepath, NFObjVec &objs, const ImageTile *tile, double tol) {
+	/* 列名与default.param一致, 顺序与NDX_xxx一致 */
+	static const char *colname[] = {
+		"X_IMAGE", "Y_IMAGE", "FLUX_AUTO", "MAG_AUTO", "MAGERR_AUTO", "FWHM_IMAGE", "ELLIPTICITY", "BACKGROUND"
+	};
+	char extname[] = "LDAC_OBJECTS";
+	fitsfile *fitsptr(NULL);
+	int status(0), anynul, colnum[NDX_MAX], i;
+	long nrows(0), j;
+	double features[NDX_MAX];
+	boost::shared_array<double> cols;
+
+	fits_open_file(&fitsptr, filepath.c_str(), READONLY, &status);
+	/* FITS_LDAC: 目标表名称为LDAC_OBJECTS; FITS_1.0: 目标表位于第二个HDU */
+	if (!status && fits_movnam_hdu(fitsptr, BINARY_TBL, extname, 0, &status)) {
+		status = 0;
+		fits_movabs_hdu(fitsptr, 2, NULL, &status);
+	}
+	for (i = 0; i < NDX_MAX && !status; ++i)
+		fits_get_colnum(fitsptr, CASEINSEN, (char*) colname[i], &colnum[i], &status);
+	fits_get_num_rows(fitsptr, &nrows, &status);
+	if (!status && nrows > 0) {// 按列整体读取
+		cols.reset(new double[nrows * NDX_MAX]);
+		for (i = 0; i < NDX_MAX && !status; ++i)
+			fits_read_col(fitsptr, TDOUBLE, colnum[i], 1, 1, nrows, NULL, cols.get() + i * nrows, &anynul, &status);
+	}
+	if (fitsptr) fits_close_file(fitsptr, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "AstroDIP::load_catalog_fits()", "failed to read catalog [%s]: %s",
+				filepath.c_str(), txt);
+		return;
+	}
+
+	for (j = 0; j < nrows; ++j) {
+		for (i = 0; i < NDX_MAX; ++i) features[i] = cols[i * nrows + j];
+		if (keep_object(features, tile, tol)) {
+			NFObjPtr body = boost::make_shared<ObjectInfo>();
+			memcpy(body->features, features, sizeof(features));
+			objs.push_back(body);
+		}
+	}
+}
+
+/*
+ * 读取星表时的预筛选, 只剔除后续改正后仍不满足accept_object的目标:
+ * - FWHM不被改正
+ * - 窗口质心偏移不超过σ(≤10像素), PSF拟合偏移不超过拟合半径, 边缘条件按最大偏移放宽
+ * - PSF拟合重新测量流量和背景, 启用时不检查二者
+ */
+bool AstroDIP::keep_object(double *features, const ImageTile *tile, double tol) {
+	if (tile) {// 分块星表: 转换为全图坐标, 只保留质心位于核心区(外扩容差)内的目标
+		features[NDX_X] += tile->x0;
+		features[NDX_Y] += tile->y0;
+		double x = features[NDX_X] - 0.5;
+		double y = features[NDX_Y] - 0.5;
+		if (x < tile->cx0 - tol || x >= tile->cx1 + tol || y < tile->cy0 - tol || y >= tile->cy1 + tol)
+			return false;
+	}
+
+	bool win = param_->winEnable && !frame_->plane;
+	bool psf = param_->psfEnable && !frame_->plane;
+	if (!(win || psf)) return accept_object(features);
+
+	double edge = 20.0 - (win ? 10.0 : 0.0) - (psf ? param_->psfFit : 0.0);
+	double x = features[NDX_X];
+	double y = features[NDX_Y];
+	return (x >= edge && x <= frame_->wimg - edge
+			&& y >= edge && y <= frame_->himg - edge
+			&& (psf || features[NDX_FLUX] > 1.0)
+			&& features[NDX_FWHM] > 0.5
+			&& (psf || features[NDX_BACK] < 25000.0));
+}
+
+bool AstroDIP::accept_object(const double *features) {
+	double x = features[NDX_X];
+	double y = features[NDX_Y];
+
+	return (x >= 20 && x <= frame_->wimg - 20
+			&& y >= 20 && y <= frame_->himg - 20
+			&& features[NDX_FLUX] > 1.0
+			&& features[NDX_FWHM] > 0.5
+			&& features[NDX_BACK] < 25000.0);
+}
+
+void AstroDIP::filter_objects(NFObjVec &objs) {
+	NFObjVec &nfobjs = frame_->nfobjs;
+
+	if (_gBrightMask.use_count()) _gBrightMask->Apply(frame_, objs);
+	if ((param_->winEnable || param_->psfEnable) && !frame_->plane) {
+		boost::shared_array<float> data;
+		int width, height;
+		int nthread = param_->nThreadDip > 0 ? param_->nThreadDip : boost::thread::hardware_concurrency();
+		if (nthread < 1) nthread = 1;
+		if (read_image(data, width, height, nthread)) {
+			if (param_->winEnable) centroid_.Refine(data.get(), width, height, objs, nthread);
+			if (param_->psfEnable) psf_.DoIt(data.get(), width, height, objs, nthread);
+		}
+	}
+	for (NFObjVec::iterator it = objs.begin(); it != objs.end(); ++it) {
+		if (accept_object((*it)->features)) nfobjs.push_back(*it);
+	}
+	objs.clear();
+	sort_objects();
+}
+
+bool AstroDIP::read_image(boost::shared_array<float> &data, int &width, int &height, int nthread) {
+	const string &filepath = param_->dipNative ? frame_->filepath : fileimg_;
+	FitsMMap fmap;
+	if (!fmap.Open(filepath)) {
+		_gLog->Write(LOG_WARN, "AstroDIP::read_image()", "failed to map %s", filepath.c_str());
+		return false;
+	}
+
+	width  = fmap.Width();
+	height = fmap.Height();
+	data.reset(new float[size_t(width) * height]);
+	if (!fmap.ReadImage(data.get(), nthread)) {
+		_gLog->Write(LOG_WARN, "AstroDIP::read_image()", "failed to read %s", filepath.c_str());
+		return false;
+	}
+	if (param_->dipNative) {// 内置算法不生成改正后图像, 由原图像改正并扣除行偏置, 与NDX_BACK的基准一致
+		if (_gPreProc.use_count()) _gPreProc->Calibrate(frame_, data.get(), width, height, nthread);
+		const std::vector<float> &bias = adi_->RowBias();
+		if (int(bias.size()) == height) {
+			float *row = data.get();
+			for (int y = 0; y < height; ++y, row += width) {
+				if (bias[y] == 0.0f) continue;
+				for (int x = 0; x < width; ++x) row[x] -= bias[y];
+			}
+		}
+	}
+	return true;
+}
+
+void AstroDIP::sort_objects() {
 	int size = param_->sizeNear;
 	int x1 = frame_->wimg / 2 - size;
 	int x2 = x1 + size * 2 + 1;
 	int y1 = frame_->himg / 2 - size;
 	int y2 = y1 + size * 2 + 1;
-	int pos;
 	NFObjVec &nfobjs = frame_->nfobjs;
 	vector<double> buff;
 	double *features;
-	FILE *fp = fopen(filemntr_.c_str(), "r");
+	double x, y;
 
-	if (!fp) {
-		_gLog->Write(LOG_FAULT, "AstroDIP::load_catalog()", "failed to open catalog [%s]",
-				filemntr_.c_str());
-	}
-	else {
-		if (x1 < 20) x1 = 20;
-		if (x2 > (frame_->wimg - 20)) x2 = frame_->wimg - 20;
-		if (y1 < 20) y1 = 20;
-		if (y2 > (frame_->himg)) y2 = frame_->himg - 20;
-		double xmin(20), xmax(frame_->wimg - 20);
-		double ymin(20), ymax(frame_->himg - 20);
-		double x, y;
-		/*
-		 * 行信息构成:
-		 * 1. 注释行: 以#为第一个字符
-		 * 2. 数据行各列依次为:
-		 * X_IMAGE_DBL, Y_IMAGE_DBL, FLUX_AUTO, MAG_AUTO, MAGERR_AUTO, FWHM_IMAGE, ELLIPTICITY, BACKGROUND
-		 */
-		while (!feof(fp)) {
-			if (NULL == fgets(line, 200, fp) || line[0] == '#') continue;
-			NFObjPtr body = boost::make_shared<ObjectInfo>();
+	if (x1 < 20) x1 = 20;
+	if (x2 > (frame_->wimg - 20)) x2 = frame_->wimg - 20;
+	if (y1 < 20) y1 = 20;
+	if (y2 > (frame_->himg)) y2 = frame_->himg - 20;
+	/*
+	 * 参与统计FWHM条件:
+	 * - 圆形度小于0.2
+	 * - 在中心区域内
+	 */
+	for (NFObjVec::iterator it = nfobjs.begin(); it != nfobjs.end(); ++it) {
+		features = (*it)->features;
+		x = features[NDX_X];
+		y = features[NDX_Y];
+		if (features[NDX_ELLIP] < 0.1
+				&& x > x1 && x < x2
+				&& y > y1 && y < y2)
+			buff.push_back(features[NDX_FWHM]);
+	}
+	std::stable_sort(nfobjs.begin(), nfobjs.end(), [](NFObjPtr x1, NFObjPtr x2) {
+		return x1->features[NDX_FLUX] > x2->features[NDX_FLUX];
+	});
 
-			for (token = strtok(line, seps), pos = 0, features = body->features; token && pos < NDX_MAX;
-					token = strtok(NULL, seps), ++pos, ++features) {
-				*features = atof(token);
-			}
-			features = body->features;
-			x = features[NDX_X];
-			y = features[NDX_Y];
-			if (pos == NDX_MAX
-					&& x >= xmin && x <= xmax
-					&& y >= ymin && y <= ymax
-					&& features[NDX_FLUX] > 1.0
-					&& features[NDX_FWHM] > 0.5
-					&& features[NDX_BACK] < 25000.0) {
-				nfobjs.push_back(body);
-				/*
-				 * 参与统计FWHM条件:
-				 * - 圆形度小于0.2
-				 * - 在中心区域内
-				 */
-				if (features[NDX_ELLIP] < 0.1
-						&& x > x1 && x < x2
-						&& y > y1 && y < y2)
-					buff.push_back(features[NDX_FWHM]);
-			}
-		}
-		fclose(fp);
-		std::stable_sort(nfobjs.begin(), nfobjs.end(), [](NFObjPtr x1, NFObjPtr x2) {
-			return x1->features[NDX_FLUX] > x2->features[NDX_FLUX];
-		});
-
-		double fwhm(-1.0);
-		if ((size = buff.size()) > 5) {
-			int half = size / 2;
-			std::nth_element(buff.begin(), buff.begin() + half, buff.end());
-			fwhm = buff[half];
-			buff.clear();
-		}
-		frame_->fwhm = fwhm;
-		if (fwhm > 1.0) _gLog->Write("%s. FWHM = %.2f", frame_->filename.c_str(), fwhm);
+	double fwhm(-1.0);
+	if ((size = buff.size()) > 5) {
+		int half = size / 2;
+		std::nth_element(buff.begin(), buff.begin() + half, buff.end());
+		fwhm = buff[half];
+		buff.clear();
 	}
+	frame_->fwhm = fwhm;
+	if (fwhm > 1.0) _gLog->Write("%s. FWHM = %.2f", frame_->filename.c_str(), fwhm);
 }
 
 void AstroDIP::thread_monitor() {
-	bool success(false);
+	bool success(false), done(false);
 	int status;
 	pid_t pid;
+	struct rusage ru;
+	double cpu0;
 
-	while (pid_ != (pid = waitpid(pid_, &status, WNOHANG | WUNTRACED)) && pid != -1);
-	if (pid == pid_) load_catalog();
+	if (pid_ > 0) {
+		// 阻塞等待子进程结束, 避免轮询占用处理器
+		while ((pid = wait4(pid_, &status, WUNTRACED, &ru)) == -1 && errno == EINTR);
+		done = pid == pid_;
+	}
+	else done = extract_pool(ru);
+	cpu0 = StatThreadCPU();
+	if (done) {
+		StageChild(frame_, STAGE_REDUCT, ru, tmexec_);
+		load_catalog();
+	}
 #ifndef DEBUG
 	remove(path(filemntr_));	// 删除监视点
+	remove_calib();
 #endif
 	working_ = false;
 	/**
@@ -167,5 +393,314 @@ void AstroDIP::thread_monitor() {
 	 * 判定: 有效目标数量不得少于100
 	 */
 	success = frame_->nfobjs.size() > 20;
+	StageEnd(frame_, STAGE_REDUCT, StatThreadCPU() - cpu0);
+	rsltReduct_(success);
+}
+
+bool AstroDIP::extract_pool(struct rusage &ru) {
+	ExtractRequest req;
+	ExtractReply reply;
+
+	snprintf(req.pathExe,     sizeof(req.pathExe),     "%s", param_->pathExeSex.c_str());
+	snprintf(req.pathImage,   sizeof(req.pathImage),   "%s", fileimg_.c_str());
+	snprintf(req.pathConfig,  sizeof(req.pathConfig),  "%s", sex_config(frame_->typeTrack));
+	snprintf(req.pathCatalog, sizeof(req.pathCatalog), "%s", filemntr_.c_str());
+	snprintf(req.catType,     sizeof(req.catType),     "%s", param_->sexCatType.c_str());
+	if (!_gExtract->Extract(req, reply)) return false;
+	ru = reply.ru;
+	tmexec_ = reply.tmexec;
+	return true;
+}
+
+void AstroDIP::thread_native() {
+	bool success(false);
+	double cpu0 = StatThreadCPU();
+	NFObjVec objs;
+
+	if (adi_->DoIt(frame_, objs)) filter_objects(objs);
+	working_ = false;
+	success = frame_->nfobjs.size() > 20;
+	StageEnd(frame_, STAGE_REDUCT, StatThreadCPU() - cpu0);
 	rsltReduct_(success);
 }
+
+void AstroDIP::thread_tiles() {
+	bool success(false);
+	double cpu0 = StatThreadCPU();
+	NFObjVec objs;
+	bool roi = roi_mode();
+
+	if (roi ? cut_roi() : cut_tiles()) {
+		boost::thread_group grp;
+		for (TileVec::iterator it = tiles_.begin(); it != tiles_.end(); ++it)
+			grp.create_thread(boost::bind(&AstroDIP::extract_tile, this, &(*it)));
+		grp.join_all();
+		for (TileVec::iterator it = tiles_.begin(); it != tiles_.end(); ++it) {
+			if (it->done) StageChild(frame_, STAGE_REDUCT, it->ru, it->tmexec);
+		}
+		if (roi) merge_roi(objs);
+		else merge_tiles(objs);
+		filter_objects(objs);
+	}
+#ifndef DEBUG
+	for (TileVec::iterator it = tiles_.begin(); it != tiles_.end(); ++it) {
+		if (it->image != fileimg_) remove(path(it->image));	// 目标窗口模式的全图分块即输入图像
+		remove(path(it->catalog));
+	}
+	remove_calib();
+#endif
+	tiles_.clear();
+	working_ = false;
+	success = frame_->nfobjs.size() > 20;
+	StageEnd(frame_, STAGE_REDUCT, StatThreadCPU() - cpu0);
+	rsltReduct_(success);
+}
+
+bool AstroDIP::cut_tiles() {
+	fitsfile *fitsptr(NULL), *tileptr;
+	int status(0), cols(param_->tileCols), rows(param_->tileRows), overlap(param_->tileOverlap);
+	int i, j, wimg, himg;
+	long naxes[2];
+	char section[80];
+	path filepath;
+
+	tiles_.clear();
+	fits_open_file(&fitsptr, fileimg_.c_str(), READONLY, &status);
+	fits_get_img_size(fitsptr, 2, naxes, &status);
+	wimg = int(naxes[0]);
+	himg = int(naxes[1]);
+	for (j = 0; j < rows && !status; ++j) {
+		for (i = 0; i < cols && !status; ++i) {
+			ImageTile tile;
+			tile.cx0 = wimg * i / cols;
+			tile.cx1 = wimg * (i + 1) / cols;
+			tile.cy0 = himg * j / rows;
+			tile.cy1 = himg * (j + 1) / rows;
+			tile.x0  = std::max(tile.cx0 - overlap, 0);
+			tile.x1  = std::min(tile.cx1 + overlap, wimg);
+			tile.y0  = std::max(tile.cy0 - overlap, 0);
+			tile.y1  = std::min(tile.cy1 + overlap, himg);
+			tile.done = false;
+			tile.config = sex_config(frame_->typeTrack);
+			memset(&tile.ru, 0, sizeof(tile.ru));
+			tile.tmexec = 0.0;
+			filepath = param_->pathWork;
+			filepath /= path(frame_->filename).stem().string() + "_t" + std::to_string(tiles_.size()) + ".fit";
+			tile.image = filepath.string();
+			tile.catalog = filepath.replace_extension("cat").string();
+			// 图像段语法起始于1, 含结束位置. 以!前缀覆盖已有文件
+			snprintf(section, sizeof(section), "%d:%d,%d:%d", tile.x0 + 1, tile.x1, tile.y0 + 1, tile.y1);
+			tileptr = NULL;
+			fits_create_file(&tileptr, ("!" + tile.image).c_str(), &status);
+			fits_copy_image_section(fitsptr, tileptr, section, &status);
+			if (tileptr) fits_close_file(tileptr, &status);
+			tiles_.push_back(tile);
+		}
+	}
+	if (fitsptr) fits_close_file(fitsptr, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "AstroDIP::cut_tiles()", "failed to cut [%s]: %s",
+				fileimg_.c_str(), txt);
+		return false;
+	}
+	return true;
+}
+
+bool AstroDIP::roi_mode() {
+	return param_->roiEnable && frame_->typeTrack && !param_->dipNative;
+}
+
+/*
+ * 目标窗口模式:
+ * - 分块0为输入图像全图, 以high.sex只提取用于天文定位的亮星
+ * - 分块1为目标窗口外扩重叠区, 以low.sex完整提取. 窗口位于图像外时只处理全图, 使用low.sex
+ */
+bool AstroDIP::cut_roi() {
+	fitsfile *fitsptr(NULL), *tileptr(NULL);
+	int status(0), overlap(param_->tileOverlap), wimg, himg;
+	long naxes[2];
+	char section[80];
+	path filepath;
+	ImageTile full, roi;
+
+	tiles_.clear();
+	fits_open_file(&fitsptr, fileimg_.c_str(), READONLY, &status);
+	fits_get_img_size(fitsptr, 2, naxes, &status);
+	if (!status) {
+		wimg = int(naxes[0]);
+		himg = int(naxes[1]);
+		bool window = param_->RoiWindow(wimg, himg, roi.cx0, roi.cy0, roi.cx1, roi.cy1);
+		string stem = path(frame_->filename).stem().string();
+
+		full.x0 = full.cx0 = full.y0 = full.cy0 = 0;
+		full.x1 = full.cx1 = wimg;
+		full.y1 = full.cy1 = himg;
+		full.image   = fileimg_;
+		full.catalog = (path(param_->pathWork) / (stem + "_t0.cat")).string();
+		full.config  = sex_config(!window);
+		full.done    = false;
+		memset(&full.ru, 0, sizeof(full.ru));
+		full.tmexec  = 0.0;
+		tiles_.push_back(full);
+
+		if (window) {
+			roi.x0 = std::max(roi.cx0 - overlap, 0);
+			roi.x1 = std::min(roi.cx1 + overlap, wimg);
+			roi.y0 = std::max(roi.cy0 - overlap, 0);
+			roi.y1 = std::min(roi.cy1 + overlap, himg);
+			filepath = param_->pathWork;
+			filepath /= stem + "_t1.fit";
+			roi.image   = filepath.string();
+			roi.catalog = filepath.replace_extension("cat").string();
+			roi.config  = sex_config(true);
+			roi.done    = false;
+			memset(&roi.ru, 0, sizeof(roi.ru));
+			roi.tmexec  = 0.0;
+			snprintf(section, sizeof(section), "%d:%d,%d:%d", roi.x0 + 1, roi.x1, roi.y0 + 1, roi.y1);
+			fits_create_file(&tileptr, ("!" + roi.image).c_str(), &status);
+			fits_copy_image_section(fitsptr, tileptr, section, &status);
+			if (tileptr) fits_close_file(tileptr, &status);
+			tiles_.push_back(roi);
+		}
+	}
+	if (fitsptr) fits_close_file(fitsptr, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "AstroDIP::cut_roi()", "failed to cut [%s]: %s",
+				fileimg_.c_str(), txt);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 后一分块优先: 目标位于已完成的后续分块核心区内时, 采用后续分块的结果
+ */
+void AstroDIP::merge_roi(NFObjVec &objs) {
+	NFObjVec tileobjs;
+	int i, j, n(int(tiles_.size()));
+	double x, y;
+
+	for (i = 0; i < n; ++i) {
+		ImageTile &tile = tiles_[i];
+		if (!tile.done) continue;
+		tileobjs.clear();
+		load_catalog(tile.catalog, tileobjs, &tile, 0.0);
+		for (NFObjVec::iterator it = tileobjs.begin(); it != tileobjs.end(); ++it) {
+			x = (*it)->features[NDX_X] - 0.5;
+			y = (*it)->features[NDX_Y] - 0.5;
+			for (j = i + 1; j < n; ++j) {
+				ImageTile &next = tiles_[j];
+				if (next.done && x >= next.cx0 && x < next.cx1 && y >= next.cy0 && y < next.cy1) break;
+			}
+			if (j == n) objs.push_back(*it);
+		}
+	}
+}
+
+void AstroDIP::extract_tile(ImageTile *tile) {
+	const char *config = tile->config;
+	int status;
+	pid_t pid;
+
+	if (_gExtract.use_count() && _gExtract->IsRunning()) {// 由预先启动的工作进程处理分块
+		ExtractRequest req;
+		ExtractReply reply;
+
+		snprintf(req.pathExe,     sizeof(req.pathExe),     "%s", param_->pathExeSex.c_str());
+		snprintf(req.pathImage,   sizeof(req.pathImage),   "%s", tile->image.c_str());
+		snprintf(req.pathConfig,  sizeof(req.pathConfig),  "%s", config);
+		snprintf(req.pathCatalog, sizeof(req.pathCatalog), "%s", tile->catalog.c_str());
+		snprintf(req.catType,     sizeof(req.catType),     "%s", param_->sexCatType.c_str());
+		if ((tile->done = _gExtract->Extract(req, reply))) {
+			tile->ru     = reply.ru;
+			tile->tmexec = reply.tmexec;
+		}
+		return;
+	}
+
+	tile->tmexec = StatClock();
+	if ((pid = fork()) == 0) {
+		execl(param_->pathExeSex.c_str(), "sex", tile->image.c_str(),
+			"-c", config,
+			"-CATALOG_NAME", tile->catalog.c_str(),
+			"-CATALOG_TYPE", param_->sexCatType.c_str(),
+			NULL);
+		_exit(1);
+	}
+	else if (pid < 0) {
+		_gLog->Write(LOG_FAULT, "AstroDIP::extract_tile()", "failed to fork multi-process");
+		return;
+	}
+	while (wait4(pid, &status, 0, &tile->ru) == -1 && errno == EINTR);
+	tile->done = true;
+}
+
+/*
+ * 分块合并:
+ * - 各分块只保留质心位于其核心区(外扩容差)内的目标. 接缝两侧分块各自完整覆盖接缝附近的目标
+ * - 质心位于核心区边界容差内的目标可能被相邻分块重复识别. 不同分块测量的质心存在偏差,
+ *   因此核心区边界两倍容差内的目标参与比对: 质心距离小于容差时视为同一目标,
+ *   保留距离分块切割边较远的识别结果
+ */
+void AstroDIP::merge_tiles(NFObjVec &objs) {
+	const double tol = 2.0;		// 质心容差, 量纲: 像素
+	struct SeamObject {
+		NFObjPtr body;
+		int tile;		// 分块索引
+		double edge;	// 至分块切割边的距离
+	};
+	vector<SeamObject> seam;
+	NFObjVec tileobjs;
+	int wimg(0), himg(0), i, n;
+	double x, y, d;
+
+	for (TileVec::iterator it = tiles_.begin(); it != tiles_.end(); ++it) {
+		if (it->x1 > wimg) wimg = it->x1;
+		if (it->y1 > himg) himg = it->y1;
+	}
+	for (i = 0, n = int(tiles_.size()); i < n; ++i) {
+		ImageTile &tile = tiles_[i];
+		if (!tile.done) continue;
+		tileobjs.clear();
+		load_catalog(tile.catalog, tileobjs, &tile, tol);
+		for (NFObjVec::iterator it = tileobjs.begin(); it != tileobjs.end(); ++it) {
+			// 星表坐标起始于1; x, y为全图中起始于0的坐标
+			x = (*it)->features[NDX_X] - 0.5;
+			y = (*it)->features[NDX_Y] - 0.5;
+			if (x >= tile.cx0 + 2 * tol && x < tile.cx1 - 2 * tol && y >= tile.cy0 + 2 * tol && y < tile.cy1 - 2 * tol) {
+				objs.push_back(*it);
+				continue;
+			}
+			// 接缝附近目标
+			SeamObject obj;
+			obj.body = *it;
+			obj.tile = i;
+			obj.edge = DBL_MAX;
+			if (tile.x0 > 0    && (d = x - tile.x0) < obj.edge) obj.edge = d;
+			if (tile.x1 < wimg && (d = tile.x1 - x) < obj.edge) obj.edge = d;
+			if (tile.y0 > 0    && (d = y - tile.y0) < obj.edge) obj.edge = d;
+			if (tile.y1 < himg && (d = tile.y1 - y) < obj.edge) obj.edge = d;
+			seam.push_back(obj);
+		}
+	}
+
+	double tol2 = tol * tol, dx, dy;
+	for (i = 0, n = int(seam.size()); i < n; ++i) {
+		if (!seam[i].body) continue;
+		double *f1 = seam[i].body->features;
+		for (int j = i + 1; j < n && seam[i].body; ++j) {
+			if (!seam[j].body || seam[j].tile == seam[i].tile) continue;
+			double *f2 = seam[j].body->features;
+			dx = f1[NDX_X] - f2[NDX_X];
+			dy = f1[NDX_Y] - f2[NDX_Y];
+			if (dx * dx + dy * dy >= tol2) continue;
+			if (seam[j].edge > seam[i].edge) seam[i].body.reset();
+			else seam[j].body.reset();
+		}
+		if (seam[i].body) objs.push_back(seam[i].body);
+	}
+}
@@ -3,7 +3,17 @@
  * @version 0.1
  * @date 2019/10/14
  * @note
- * - 多进程调用SExtractor处理图像
+ * - 多进程调用SExtractor处理图像. 启用工作进程池时, 由预先启动的工作进程调用SExtractor
+ * - 或在线程中调用内置算法ADIReduct处理图像, 由配置参数Reduction/Backend选择
+ * - SExtractor输出星表可以是文本(ASCII_HEAD)或二进制(FITS_1.0, FITS_LDAC)格式
+ * - 两种方式的输出经相同条件筛选
+ * - 可将大幅面图像分为相互重叠的分块, 由多个SExtractor并行处理, 按分块核心区合并目标,
+ *   并依据质心剔除接缝处的重复目标
+ * - 启用预处理时, 内置算法在内存中改正图像; SExtractor处理写入工作目录的改正后图像
+ * - 跟踪图像启用目标窗口时, SExtractor以low.sex处理目标窗口分块, 同时以high.sex处理全图
+ *   只提取亮星, 窗口内采用前者的结果. 内置算法由ADIReduct在窗口外提高检测阈值
+ * - 启用亮星掩模时, 筛选前由BrightMask剔除亮星光晕与溢出列中的伪目标
+ * - 启用窗口质心或PSF拟合测光时, 筛选前重新读取图像, 依次改正目标质心、拟合测光
  */
 
 #ifndef ASTRODIP_H_
@@ -12,8 +22,12 @@
 #include <boost/signals2.hpp>
 #include <boost/thread.hpp>
 #include <unistd.h>
+#include <sys/resource.h>
 #include "airsdata.h"
 #include "Parameter.h"
+#include "ADIReduct.h"
+#include "PsfPhot.h"
+#include "WinCentroid.h"
 
 class AstroDIP {
 public:
@@ -26,15 +40,33 @@ public:
 	typedef ReductResult::slot_type ReductResultSlot;			//< 图像处理结果回调函数插槽
 	typedef boost::shared_ptr<boost::thread> threadptr;			//< 线程指针
 
+	struct ImageTile {// 分块
+		int x0, y0, x1, y1;		//< 分块范围: [x0, x1)*[y0, y1), 图像坐标, 起始于0
+		int cx0, cy0, cx1, cy1;	//< 核心区范围: 相邻分块的核心区互不重叠
+		string image;	//< 分块图像文件路径
+		string catalog;	//< 分块星表文件路径
+		const char *config;	//< SExtractor配置文件
+		bool done;		//< SExtractor已执行
+		struct rusage ru;	//< SExtractor资源占用
+		double tmexec;	//< SExtractor启动时刻
+	};
+	typedef std::vector<ImageTile> TileVec;
+
 protected:
 	/* 成员变量 */
 	Parameter *param_;	//< 配置参数
 	ReductResult rsltReduct_;	//< 图像处理结果回调函数
 	bool working_;		//< 工作标志
 	FramePtr frame_;	//< 待处理图像文件信息
+	string fileimg_;	//< SExtractor输入图像文件路径: 原图像或改正后图像
 	string filemntr_;	//< 建立多进程监测对象, 对象类型: 数据处理结果文件
 	threadptr thrd_mntr_;	//< 线程: 监测处理结果
 	pid_t pid_;			//< 进程ID
+	double tmexec_;		//< SExtractor启动时刻
+	ADIReductPtr adi_;	//< 内置图像处理算法
+	TileVec tiles_;		//< 分块
+	PsfPhot psf_;		//< 经验PSF拟合测光
+	WinCentroid centroid_;	//< 窗口质心
 
 public:
 	/*!
@@ -63,16 +95,109 @@ protected:
 	 * @brief 创建监测点
 	 */
 	void create_monitor();
+	/*!
+	 * @brief 预处理: 改正图像并写入工作目录, 作为SExtractor输入
+	 * 未改正的瓦片压缩图像写入解压副本
+	 */
+	void calib_image();
+	/*!
+	 * @brief 删除改正后图像或解压副本
+	 */
+	void remove_calib();
 	/*!
 	 * @brief 将处理结果导入内存
-	 * @return
-	 * 中心区域统计FWHM. <= 0: 无统计结果
 	 */
 	void load_catalog();
+	/*!
+	 * @brief 读取星表文件, 通过预筛选的目标存入objs
+	 * @param tile 分块. NULL表示全图星表
+	 * @param tol  分块核心区外扩容差, 量纲: 像素
+	 */
+	void load_catalog(const string &filepath, NFObjVec &objs, const ImageTile *tile = NULL, double tol = 0.0);
+	/*!
+	 * @brief 逐行解析文本格式星表
+	 */
+	void load_catalog_ascii(const string &filepath, NFObjVec &objs, const ImageTile *tile, double tol);
+	/*!
+	 * @brief 按列整体读取二进制格式星表
+	 */
+	void load_catalog_fits(const string &filepath, NFObjVec &objs, const ImageTile *tile, double tol);
+	/*!
+	 * @brief 预筛选星表行, 在创建目标前剔除无效行
+	 * @param features 目标特征. 分块星表转换为全图坐标
+	 * @return
+	 * 目标可能通过质心改正后的accept_object时返回true
+	 */
+	bool keep_object(double *features, const ImageTile *tile, double tol);
+	/*!
+	 * @brief 检查目标是否满足筛选条件: 边缘、流量、FWHM和背景
+	 * @param features 目标特征
+	 */
+	bool accept_object(const double *features);
+	/*!
+	 * @brief 筛选目标并存入图像
+	 * @param objs 已预筛选的目标
+	 */
+	void filter_objects(NFObjVec &objs);
+	/*!
+	 * @brief 读取目标提取所用图像: SExtractor读取改正后图像; 内置算法读取原图像, 在内存中改正并扣除行偏置
+	 * @param data    图像数据
+	 * @param width   宽度
+	 * @param height  高度
+	 * @param nthread 并行线程数
+	 * @return
+	 * 读取成功返回true
+	 */
+	bool read_image(boost::shared_array<float> &data, int &width, int &height, int nthread);
+	/*!
+	 * @brief 按流量降序排序, 统计中心区域FWHM
+	 */
+	void sort_objects();
 	/*!
 	 * @brief 线程: 监测处理结果
 	 */
 	void thread_monitor();
+	/*!
+	 * @brief 由工作进程池执行SExtractor, 阻塞等待结果
+	 * @param ru SExtractor资源占用
+	 * @return
+	 * SExtractor已执行
+	 */
+	bool extract_pool(struct rusage &ru);
+	/*!
+	 * @brief 线程: 调用内置算法处理图像
+	 */
+	void thread_native();
+	/*!
+	 * @brief 线程: 分块或目标窗口模式下并行调用SExtractor处理图像
+	 */
+	void thread_tiles();
+	/*!
+	 * @brief 生成分块图像文件
+	 */
+	bool cut_tiles();
+	/*!
+	 * @brief 检查是否以目标窗口模式处理当前图像
+	 */
+	bool roi_mode();
+	/*!
+	 * @brief 目标窗口模式: 生成全图和目标窗口两个分块
+	 */
+	bool cut_roi();
+	/*!
+	 * @brief 合并目标窗口模式的星表: 目标窗口内采用窗口分块的结果
+	 * @param objs 合并后的目标, 已预筛选
+	 */
+	void merge_roi(NFObjVec &objs);
+	/*!
+	 * @brief 线程: 调用SExtractor处理分块. 启用工作进程池时由工作进程执行
+	 */
+	void extract_tile(ImageTile *tile);
+	/*!
+	 * @brief 合并分块星表: 转换为全图坐标, 保留核心区内目标, 剔除接缝处的重复目标
+	 * @param objs 合并后的目标, 已预筛选
+	 */
+	void merge_tiles(NFObjVec &objs);
 };
 
 #endif /* ASTRODIP_H_ */
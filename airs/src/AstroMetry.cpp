@@ -10,10 +10,14 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <errno.h>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "AstroMetry.h"
+#include "FrameStat.h"
+#include "BrightMask.h"
+#include "MosaicReduct.h"
 #include "GLog.h"
 
 using namespace boost::filesystem;
@@ -31,6 +35,7 @@ AstroMetry::AstroMetry(Parameter *param) {
 	param_     = param;
 	working_   = false;
 	pid_       = 0;
+	tmexec_    = 0.0;
 }
 
 AstroMetry::~AstroMetry() {
@@ -49,16 +54,30 @@ void AstroMetry::RegisterAstrometryResult(const AstrometryResultSlot &slot) {
 bool AstroMetry::DoIt(FramePtr frame) {
 	if (working_) return false;
 	frame_     = frame;
+	StageBegin(frame_, STAGE_ASTRO);
+	fileimg_ = frame_->filepath;
+	if (frame_->compressed) {
+		double cpu0 = StatThreadCPU();
+		DecompressFrame(frame_, param_->pathWork, param_->nThreadDip, fileimg_);
+		StageCPU(frame_, STAGE_ASTRO, StatThreadCPU() - cpu0);
+	}
 	create_monitor();
-	return start_process();
+	if (start_process()) return true;
+	remove_image();
+	return false;
 }
 
 FramePtr AstroMetry::GetFrame() {
 	return frame_;
 }
 
+const wcsinfo& AstroMetry::GetWCS() {
+	return wcs_;
+}
+
 bool AstroMetry::start_process() {
 	/* 以多进程模式启动天文定位 */
+	tmexec_ = StatClock();
 	if ((pid_ = fork()) > 0) {// 主进程, 启动监测线程
 		working_ = true;
 		thrd_mntr_.reset(new boost::thread(boost::bind(&AstroMetry::thread_monitor, this)));
@@ -75,13 +94,13 @@ bool AstroMetry::start_process() {
 	"-p", "-K", "-J",
 	"-L", (fmt2 % param_->scale_low).str().c_str(), "-H", (fmt2 % param_->scale_high).str().c_str(),
 	"-u", "app",
-	frame_->filepath.c_str(), NULL);
+	fileimg_.c_str(), NULL);
 #else
 	execl(param_->pathAstrometry.c_str(), "solve-field", "--use-source-extractor",
 		"-p", "-K", "-J",
 		"-L", (fmt2 % param_->scale_low).str().c_str(), "-H", (fmt2 % param_->scale_high).str().c_str(),
 		"-u", "app",
-		frame_->filepath.c_str(), NULL);
+		fileimg_.c_str(), NULL);
 #endif
 
 	char errmsg[200];
@@ -90,9 +109,17 @@ bool AstroMetry::start_process() {
 	exit(0);
 }
 
+void AstroMetry::remove_image() {
+	if (fileimg_ != frame_->filepath) {
+		boost::system::error_code ec;
+		remove(path(fileimg_), ec);
+		fileimg_ = frame_->filepath;
+	}
+}
+
 void AstroMetry::create_monitor() {
-	path filepath(frame_->filepath);
-	string filename = frame_->filename;
+	path filepath(fileimg_);
+	string filename = filepath.filename().string();
 	string dirname = filepath.parent_path().string();
 
 	for (int i = 0; i < PTMNTR_MAX - 1; ++i) {
@@ -112,20 +139,21 @@ void AstroMetry::thread_monitor() {
 	int status;
 	pid_t pid;
 	wcsinfo wcs;
+	struct rusage ru;
+	double cpu0;
 
-	while (pid_ != (pid = waitpid(pid_, &status, WNOHANG | WUNTRACED)) && pid != -1);
+	// 阻塞等待子进程结束, 避免轮询占用处理器
+	while ((pid = wait4(pid_, &status, WUNTRACED, &ru)) == -1 && errno == EINTR);
 	boost::this_thread::sleep_for(boost::chrono::seconds(1));
-	if (pid_ == pid) success = wcs.load_wcs(ptMntr_[PTMNTR_WCS]);
+	cpu0 = StatThreadCPU();
+	if (pid_ == pid) {
+		StageChild(frame_, STAGE_ASTRO, ru, tmexec_);
+		success = wcs.load_wcs(ptMntr_[PTMNTR_WCS]);
+	}
 	if (success) {
-		/* 计算像元比例尺 */
-		double *cd = &wcs.cd[0][0];
-		double k = cd[2] / cd[0];
-		frame_->scale = 3600. * sqrt(cd[0] * (cd[3] - k * cd[1]));
-		/* 计算星象位置 */
-		NFObjVec &objs = frame_->nfobjs;
-		for (NFObjVec::iterator it = objs.begin(); it != objs.end(); ++it) {
-			wcs.image_to_wcs((*it)->features[NDX_X], (*it)->features[NDX_Y], (*it)->ra_fit, (*it)->dec_fit);
-		}
+		wcs.apply_frame(frame_);
+		wcs_ = wcs;
+		if (_gBrightMask.use_count()) _gBrightMask->SetWCS(frame_, wcs);
 	}
 	else {
 		_gLog->Write(LOG_WARN, NULL, "astrometry failed");
@@ -133,6 +161,8 @@ void AstroMetry::thread_monitor() {
 #ifndef NDEBUG
 	for (int i = 0; i < PTMNTR_MAX; ++i) remove(ptMntr_[i]);
 #endif
+	remove_image();
 	working_ = false;
+	StageEnd(frame_, STAGE_ASTRO, StatThreadCPU() - cpu0);
 	rsltAstrometry_(success);
 }
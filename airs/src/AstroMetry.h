@@ -30,6 +30,11 @@ public:
 		A = B = NULL;
 	}
 
+	wcsinfo(const wcsinfo &other) {
+		A = B = NULL;
+		*this = other;
+	}
+
 	virtual ~wcsinfo() {
 		if (A) {
 			delete[] A;
@@ -43,6 +48,14 @@ public:
 
 	wcsinfo &operator=(const wcsinfo &other) {
 		if (this != &other) {
+			if (A) {
+				delete[] A;
+				A = NULL;
+			}
+			if (B) {
+				delete[] B;
+				B = NULL;
+			}
 			x0   = other.x0;
 			y0   = other.y0;
 			r0   = other.r0;
@@ -81,7 +94,7 @@ protected:
 	 * @param ptr 系数存储地址
 	 */
 	void alloc_coef(int n, double **ptr) {
-		if ((ptr == &A && n != ncoefA) || (ptr == &B && n != ncoefA)) {
+		if ((ptr == &A && n != ncoefA) || (ptr == &B && n != ncoefB)) {
 			if (ptr == &A)
 				ncoefA = n;
 			else
@@ -206,6 +219,58 @@ public:
 	void image_to_wcs(double x, double y, double &ra, double &dec) {
 		image_to_wcs(x, y, r0, d0, ra, dec);
 	}
+
+	/*!
+	 * @brief 世界坐标转换为图像坐标, 迭代求解SIP改正的逆变换
+	 * @param ra    世界坐标赤经, 量纲: 角度
+	 * @param dec   世界坐标赤纬, 量纲: 角度
+	 * @param newr  参考点(x0, y0)对应的新的赤经, 量纲: 弧度
+	 * @param newd  参考点(x0, y0)对应的新的赤纬, 量纲: 弧度
+	 * @param x     图像X坐标, 量纲: 像素
+	 * @param y     图像Y坐标, 量纲: 像素
+	 * @return
+	 * 位置在参考点所在半球之外时返回false
+	 */
+	bool wcs_to_image(double ra, double dec, double newr, double newd, double &x, double &y) {
+		double dr = ra * D2R - newr;
+		double sd = sin(dec * D2R), cd0 = cos(dec * D2R);
+		double fract = sin(newd) * sd + cos(newd) * cd0 * cos(dr);
+		if (fract <= 0.0) return false;
+
+		double xi  = cd0 * sin(dr) / fract * R2D;
+		double eta = (cos(newd) * sd - sin(newd) * cd0 * cos(dr)) / fract * R2D;
+		double det = cd[0][0] * cd[1][1] - cd[0][1] * cd[1][0];
+		double u = (cd[1][1] * xi - cd[0][1] * eta) / det;
+		double v = (cd[0][0] * eta - cd[1][0] * xi) / det;
+		double u1(u), v1(v);
+
+		for (int i = 0; i < 5; ++i) {
+			x = u1;
+			y = v1;
+			project_correct(x, y);
+			u1 += u - x;
+			v1 += v - y;
+		}
+		x = u1 + x0;
+		y = v1 + y0;
+		return true;
+	}
+
+	/*!
+	 * @brief 使用定位结果计算图像的像元比例尺及目标的赤道坐标
+	 * @param frame 图像
+	 */
+	void apply_frame(FramePtr frame) {
+		/* 计算像元比例尺 */
+		double *c = &cd[0][0];
+		double k = c[2] / c[0];
+		frame->scale = 3600. * sqrt(c[0] * (c[3] - k * c[1]));
+		/* 计算星象位置 */
+		NFObjVec &objs = frame->nfobjs;
+		for (NFObjVec::iterator it = objs.begin(); it != objs.end(); ++it) {
+			image_to_wcs((*it)->features[NDX_X], (*it)->features[NDX_Y], (*it)->ra_fit, (*it)->dec_fit);
+		}
+	}
 };
 
 class AstroMetry {
@@ -243,10 +308,13 @@ protected:
 	Parameter *param_;	//< 配置参数
 	bool working_;		//< 工作标志
 	FramePtr frame_;	//< 待处理图像文件信息
+	string fileimg_;	//< solve-field输入图像: 原图像或瓦片压缩图像的解压副本
 	string ptMntr_[PTMNTR_MAX];	//< 监视点
 	threadptr thrd_mntr_;	//< 线程: 监测处理结果
 	pid_t pid_;				//< 进程ID
+	double tmexec_;			//< solve-field启动时刻
 	AstrometryResult rsltAstrometry_;	//< 天文定位结果回调函数
+	wcsinfo wcs_;			//< 最近一次成功的定位结果
 
 public:
 	/*!
@@ -266,6 +334,10 @@ public:
 	 * @brief 查看当前处理图像
 	 */
 	FramePtr GetFrame();
+	/*!
+	 * @brief 查看最近一次成功的定位结果
+	 */
+	const wcsinfo& GetWCS();
 
 protected:
 	/*!
@@ -276,6 +348,10 @@ protected:
 	 * @brief 创建监视点
 	 */
 	void create_monitor();
+	/*!
+	 * @brief 删除解压副本
+	 */
+	void remove_image();
 	/*!
 	 * @brief 线程: 监测处理结果
 	 */
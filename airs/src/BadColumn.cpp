@@ -0,0 +1,170 @@
+/*!
+ * @file BadColumn.cpp 由列统计识别坏列
+ * @version 0.1
+ * @date 2020-11-24
+ */
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "BadColumn.h"
+#include "ADISimd.h"
+#include "FitsMMap.h"
+#include "GLog.h"
+
+typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+#define BADCOL_ROWS		128		// 抽样行数上限
+#define BADCOL_WINDOW	7		// 滑动中值半宽度
+
+BadColumn::BadColumn(Parameter *param) {
+	param_ = param;
+}
+
+BadColumn::~BadColumn() {
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int BadColumn::Detect(FramePtr frame, const float *data, int width, int height) {
+	int nrow = sample_rows(height);
+	if (!nrow || width < 4 * BADCOL_WINDOW) return 0;
+
+	std::vector<float> rows(size_t(nrow) * width);
+	for (int i = 0; i < nrow; ++i) {
+		int y = int((i + 0.5) * height / nrow);
+		memcpy(&rows[size_t(i) * width], data + size_t(y) * width, sizeof(float) * width);
+	}
+	return detect(frame, rows.data(), nrow, width);
+}
+
+int BadColumn::DetectFile(FramePtr frame, const string &filepath) {
+	FitsMMap fmap;
+	if (!fmap.Open(filepath)) return 0;
+
+	int width(fmap.Width()), height(fmap.Height());
+	int nrow = sample_rows(height);
+	if (!nrow || width < 4 * BADCOL_WINDOW) return 0;
+
+	std::vector<float> rows(size_t(nrow) * width);
+	for (int i = 0; i < nrow; ++i) {
+		int y = int((i + 0.5) * height / nrow);
+		if (!fmap.ReadRows(y, y + 1, &rows[size_t(i) * width])) {
+			_gLog->Write(LOG_WARN, "BadColumn::DetectFile()", "failed to read row %d of %s",
+					y, filepath.c_str());
+			return 0;
+		}
+	}
+	return detect(frame, rows.data(), nrow, width);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int BadColumn::sample_rows(int height) {
+	int n;
+	for (n = BADCOL_ROWS; n > height; n >>= 1);
+	return n < 16 ? 0 : n;
+}
+
+/*
+ * 列中值偏离: 坏列/热列/暗列
+ * MAD偏高:    噪声异常的列
+ * 稳健σ以单列统计量的理论误差为下限, 避免整数像素值使中值差大量为0时阈值过低
+ */
+int BadColumn::detect(FramePtr frame, float *rows, int nrow, int width) {
+	std::vector<float> med(width), mad(width), dmed, dmad;
+	std::vector<char> flag(width, 0);
+	float *lo = rows + size_t(nrow / 2 - 1) * width, *hi = lo + width;
+	double k(param_->badcolSigma), smed, smad, noise;
+	int x, y, x0, x1, added(0);
+
+	sort_columns(rows, nrow, width);
+	for (x = 0; x < width; ++x) med[x] = (lo[x] + hi[x]) * 0.5f;
+	for (y = 0; y < nrow; ++y) SimdAbsDev(rows + size_t(y) * width, width, med.data(), rows + size_t(y) * width);
+	sort_columns(rows, nrow, width);
+	for (x = 0; x < width; ++x) mad[x] = (lo[x] + hi[x]) * 0.5f;
+
+	smed = local_deviation(med, dmed);
+	smad = local_deviation(mad, dmad);
+	std::vector<float> tmp(mad);
+	std::nth_element(tmp.begin(), tmp.begin() + width / 2, tmp.end());
+	noise = 1.4826 * tmp[width / 2] / sqrt(double(nrow));
+	if (smed < 1.253 * noise) smed = 1.253 * noise;
+	if (smad < 0.6745 * noise) smad = 0.6745 * noise;
+	if (smed <= 0.0 || smad <= 0.0) return 0;
+
+	for (x = 0; x < width; ++x)
+		flag[x] = fabs(dmed[x]) > k * smed || dmad[x] > k * smad;
+	for (x = 0; x < width && flag[x]; ++x) flag[x] = 0;	// 与边缘相连: 过扫区/预扫区
+	for (x = width - 1; x >= 0 && flag[x]; --x) flag[x] = 0;
+	if (param_->ovsx2 > param_->ovsx1 && param_->ovsy2 > param_->ovsy1
+			&& (param_->ovsy2 - param_->ovsy1 + 1) * 2 >= frame->himg) {// 列方向的过扫区
+		x0 = std::max(param_->ovsx1, 0);
+		x1 = std::min(param_->ovsx2 + 1, width);
+		for (x = x0; x < x1; ++x) flag[x] = 0;
+	}
+
+	string cid = frame->hdu ? frame->cid + "#" + std::to_string(frame->hdu) : frame->cid;
+	string key = frame->gid + ":" + frame->uid + ":" + cid;
+	std::vector<int> found;
+	{
+		mutex_lock lck(mtx_);
+		ColumnHits &cam = cameras_[key];
+		if (cam.width != width) {
+			cam.width = width;
+			cam.hits.assign(width, 0);
+		}
+		for (x = 0; x < width; ++x) {
+			unsigned char &hit = cam.hits[x];
+			if (!flag[x]) {
+				if (hit) --hit;
+			}
+			else if (hit < 255 && ++hit == param_->badcolFrames) {
+				found.push_back(x + 1);
+			}
+		}
+	}
+	if (found.empty()) return 0;
+
+	CameraBadcol badcol;
+	bool exist = param_->CopyBadcol(frame->gid, frame->uid, cid, badcol);
+	for (std::vector<int>::iterator it = found.begin(); it != found.end(); ++it) {
+		if (exist && badcol.test(*it)) continue;
+		param_->AddBadcol(frame->gid, frame->uid, cid, *it);
+		++added;
+		_gLog->Write("bad column %d of %s is detected from column statistics", *it, key.c_str());
+	}
+	return added;
+}
+
+void BadColumn::sort_columns(float *rows, int nrow, int width) {
+	int p, k, i, j, m;
+
+	for (p = 1; p < nrow; p <<= 1) {
+		for (k = p; k >= 1; k >>= 1) {
+			for (j = k % p; j + k < nrow; j += 2 * k) {
+				m = std::min(k, nrow - j - k);
+				for (i = 0; i < m; ++i) {
+					if ((i + j) / (2 * p) == (i + j + k) / (2 * p))
+						SimdMinMax(rows + size_t(i + j) * width, rows + size_t(i + j + k) * width, width);
+				}
+			}
+		}
+	}
+}
+
+double BadColumn::local_deviation(const std::vector<float> &val, std::vector<float> &dev) {
+	int n(int(val.size())), x, x0, x1;
+	float win[2 * BADCOL_WINDOW + 1];
+	std::vector<float> absdev(n);
+
+	dev.resize(n);
+	for (x = 0; x < n; ++x) {
+		x0 = std::max(x - BADCOL_WINDOW, 0);
+		x1 = std::min(x + BADCOL_WINDOW + 1, n);
+		std::copy(val.begin() + x0, val.begin() + x1, win);
+		std::nth_element(win, win + (x1 - x0) / 2, win + (x1 - x0));
+		dev[x] = val[x] - win[(x1 - x0) / 2];
+		absdev[x] = fabs(dev[x]);
+	}
+	std::nth_element(absdev.begin(), absdev.begin() + n / 2, absdev.end());
+	return 1.4826 * absdev[n / 2];
+}
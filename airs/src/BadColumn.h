@@ -0,0 +1,98 @@
+/**
+ * @class BadColumn 由列统计识别坏列
+ * @version 0.1
+ * @date 2020-11-24
+ * @note
+ * - 在图像中均匀抽取2的幂次行(16~128行), 以排序网络逐列计算中值与绝对偏差中值(MAD)
+ * - 以相邻15列的滑动中值为参考, 列中值偏离或MAD偏高超过阈值的列为候选坏列
+ * - 与图像边缘相连的候选列视为过扫区/预扫区, 不计入
+ * - 同一列在连续多帧中为候选时写入坏列标记(CameraBadcol), 由缺陷修补和AFindPV使用
+ * - 按相机(及HDU)统计, 相机标志与AFindPV一致
+ */
+
+#ifndef SRC_BADCOLUMN_H_
+#define SRC_BADCOLUMN_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+
+using std::string;
+
+class BadColumn {
+public:
+	BadColumn(Parameter *param);
+	virtual ~BadColumn();
+
+public:
+	/* 数据类型 */
+	/*!
+	 * @struct ColumnHits 一台相机的候选坏列计数
+	 */
+	struct ColumnHits {
+		int width;		//< 图像宽度
+		std::vector<unsigned char> hits;	//< 各列计数: 为候选时加1, 否则减1
+	};
+	typedef std::map<string, ColumnHits> ColumnHitsMap;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;		//< 配置参数
+	boost::mutex mtx_;		//< 互斥锁: 候选坏列计数
+	ColumnHitsMap cameras_;	//< 按相机统计的候选坏列计数
+
+public:
+	/*!
+	 * @brief 由内存中的图像识别坏列
+	 * @param frame  图像
+	 * @param data   已改正图像数据
+	 * @param width  宽度
+	 * @param height 高度
+	 * @return
+	 * 新增坏列数量
+	 */
+	int Detect(FramePtr frame, const float *data, int width, int height);
+	/*!
+	 * @brief 由FITS文件识别坏列
+	 * @param frame    图像
+	 * @param filepath 已改正图像文件路径
+	 * @return
+	 * 新增坏列数量
+	 */
+	int DetectFile(FramePtr frame, const string &filepath);
+
+protected:
+	/*!
+	 * @brief 抽样行数: 不超过图像高度与128的2的幂次. 图像过小时返回0
+	 */
+	int sample_rows(int height);
+	/*!
+	 * @brief 由抽样行识别坏列并累计
+	 * @param frame  图像
+	 * @param rows   抽样行, 计算过程中被改写
+	 * @param nrow   抽样行数, 2的幂次
+	 * @param width  宽度
+	 */
+	int detect(FramePtr frame, float *rows, int nrow, int width);
+	/*!
+	 * @brief 沿列方向排序: Batcher奇偶归并网络, 每次比较交换处理一整行
+	 */
+	void sort_columns(float *rows, int nrow, int width);
+	/*!
+	 * @brief 与相邻列滑动中值之差, 及其稳健σ
+	 * @param val 逐列统计量
+	 * @param dev 与滑动中值之差
+	 * @return
+	 * 稳健σ: 1.4826 * median(|dev|)
+	 */
+	double local_deviation(const std::vector<float> &val, std::vector<float> &dev);
+};
+typedef boost::shared_ptr<BadColumn> BadColumnPtr;
+
+extern BadColumnPtr _gBadColumn;	//< 坏列识别, 未启用时为空
+
+#endif /* SRC_BADCOLUMN_H_ */
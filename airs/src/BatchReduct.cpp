@@ -0,0 +1,288 @@
+/*!
+ * @file BatchReduct.cpp 离线批处理: 并行处理一个目录下的全部图像
+ * @version 0.1
+ * @date 2020-11-02
+ */
+
+#include <set>
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/chrono/include.hpp>
+#include "BatchReduct.h"
+#include "FrameHeader.h"
+#include "FrameStat.h"
+#include "ATrace.h"
+#include "PreProcess.h"
+#include "FrameReduct.h"
+#include "MosaicReduct.h"
+#include "GLog.h"
+
+using namespace boost::filesystem;
+
+BatchReduct::BatchReduct(Parameter *param, boost::shared_ptr<LogCalibrated> logcal) {
+	param_     = param;
+	logcal_    = logcal;
+	nworker_   = 1;
+	nextfile_  = 0;
+	nextframe_ = 0;
+	nextsub_   = 0;
+	nextlog_   = 0;
+}
+
+BatchReduct::~BatchReduct() {
+	for (CameraBatchVec::iterator it = cameras_.begin(); it != cameras_.end(); ++it) {
+		FindPVVec &finders = (*it)->finders;
+		for (FindPVVec::iterator it1 = finders.begin(); it1 != finders.end(); ++it1)
+			(*it1).reset(); // 强制执行AFindPV的析构函数
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool BatchReduct::Start() {
+	if ((nworker_ = param_->nThreadBatch) <= 0)
+		nworker_ = boost::thread::hardware_concurrency();
+	if (nworker_ < 1) nworker_ = 1;
+	return true;
+}
+
+void BatchReduct::ProcessFiles(const vecstr &files) {
+	files_ = files;
+	frames_.clear();
+	nextfile_ = nextframe_ = nextsub_ = nextlog_ = 0;
+
+	scan_headers();
+	if (_gPreProc.use_count()) _gPreProc->CombineFlats();	// 先合并平场, 用于改正其它图像
+	group_frames();
+	_gLog->Write("batch: %d files, %d valid frames, %d cameras, %d threads",
+			int(files_.size()), int(frames_.size()), int(cameras_.size()), nworker_);
+	reduct_frames();
+	wait_finders();
+	param_->SaveBadmark();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void BatchReduct::copy_sexcfg(const string& dstdir) {
+	path srcpath(param_->pathCfgSex);
+	path dstpath(dstdir);
+	dstpath /= "default.sex";
+	if (!exists(dstpath)) copy_file(srcpath, dstpath);
+}
+
+void BatchReduct::scan_headers() {
+	int n = files_.size(), i;
+	std::set<string> dirs;
+
+	for (i = 0; i < n; ++i) {// 每个目录只检查一次
+		string dirname = path(files_[i]).parent_path().string();
+		if (dirs.insert(dirname).second) copy_sexcfg(dirname);
+	}
+
+	validhdr_.assign(n, 0);
+	frames_.resize(n);
+	boost::thread_group thrds;
+	for (i = 0; i < nworker_ && i < n; ++i)
+		thrds.create_thread(boost::bind(&BatchReduct::thread_header, this));
+	thrds.join_all();
+
+	// 剔除无效文件, 展开数据立方体, 保持文件名顺序
+	BatchFrameVec valid;
+	for (i = 0; i < n; ++i) {
+		if (!validhdr_[i]) continue;
+		if (_gPreProc.use_count() && _gPreProc->AddFlat(frames_[i]->frame)) continue;	// 平场
+		if (frames_[i]->frame->nplane) expand_cube(frames_[i]->frame, valid);
+		else valid.push_back(frames_[i]);
+	}
+	frames_.swap(valid);
+	validhdr_.clear();
+}
+
+void BatchReduct::expand_cube(FramePtr cube, BatchFrameVec &frames) {
+	std::vector<FramePtr> planes;
+	CubeAnchorPtr anchor = boost::make_shared<CubeAnchor>();
+
+	ExpandCubePlanes(cube, planes, planeno_.Assign(cube));
+	for (std::vector<FramePtr>::iterator it = planes.begin(); it != planes.end(); ++it) {
+		BatchFramePtr bf = boost::make_shared<BatchFrame>();
+		bf->frame  = *it;
+		bf->anchor = anchor;
+		frames.push_back(bf);
+	}
+}
+
+void BatchReduct::group_frames() {
+	for (BatchFrameVec::iterator it = frames_.begin(); it != frames_.end(); ++it) {
+		BatchFramePtr bf = *it;
+		CameraBatch *camera = get_camera(bf->frame);
+		/*
+		 * 划分序列的规则与AFindPV一致: 帧编号减小时开始新的序列
+		 */
+		if (camera->seqs.empty()
+				|| bf->frame->fno < camera->seqs.back()->frames.back()->frame->fno)
+			camera->seqs.push_back(boost::make_shared<Sequence>());
+		bf->camera = camera;
+		bf->seq    = camera->seqs.back().get();
+		bf->seq->frames.push_back(bf);
+		bf->subok.assign(bf->frame->subfrms.size(), 0);
+		// 排队时间自分组完成起算
+		std::vector<FramePtr> &subfrms = bf->frame->subfrms;
+		if (subfrms.empty()) StageEnqueue(bf->frame, STAGE_REDUCT);
+		for (std::vector<FramePtr>::iterator it1 = subfrms.begin(); it1 != subfrms.end(); ++it1)
+			StageEnqueue(*it1, STAGE_REDUCT);
+	}
+}
+
+BatchReduct::CameraBatch* BatchReduct::get_camera(FramePtr frame) {
+	CameraBatchVec::iterator it;
+	for (it = cameras_.begin(); it != cameras_.end(); ++it) {
+		if ((*it)->is_matched(frame->gid, frame->uid, frame->cid)) return (*it).get();
+	}
+
+	CameraBatchPtr camera = boost::make_shared<CameraBatch>();
+	camera->gid = frame->gid;
+	camera->uid = frame->uid;
+	camera->cid = frame->cid;
+	cameras_.push_back(camera);
+	return camera.get();
+}
+
+BatchReduct::FindPVPtr BatchReduct::get_finder(CameraBatch *camera, int hdu) {
+	FindPVVec &finders = camera->finders;
+	FindPVVec::iterator it;
+	for (it = finders.begin(); it != finders.end(); ++it) {
+		if ((*it)->IsMatched(camera->gid, camera->uid, camera->cid, hdu)) return *it;
+	}
+
+	FindPVPtr finder = boost::make_shared<AFindPV>(param_);
+	finder->SetIDs(camera->gid, camera->uid, camera->cid, hdu);
+	finders.push_back(finder);
+	return finder;
+}
+
+void BatchReduct::reduct_frames() {
+	boost::thread_group thrds;
+	int n = frames_.size();
+	for (int i = 0; i < nworker_ && i < n; ++i)
+		thrds.create_thread(boost::bind(&BatchReduct::thread_reduct, this));
+	thrds.join_all();
+}
+
+void BatchReduct::frame_done(BatchFramePtr bf, bool success) {
+	FramePtr frame = bf->frame; // 处理过程中可能释放bf->frame
+	TraceSpan span("batch.frame_done", "lock", frame.get()); // 含等待互斥锁的时间
+	mutex_lock lck(mtx_batch_);
+	bf->done    = true;
+	bf->success = success;
+	++bf->seq->ndone;
+	flush_log();
+	feed_camera(bf->camera);
+}
+
+void BatchReduct::subframe_done(BatchFramePtr bf, int isub, bool success) {
+	{
+		mutex_lock lck(mtx_batch_);
+		bf->subok[isub] = success;
+		if (++bf->nsubdone < (int) bf->subok.size()) return;
+	}
+	frame_done(bf, MergeFrameHDU(bf->frame, bf->subok));
+}
+
+void BatchReduct::feed_camera(CameraBatch *camera) {
+	SequenceVec &seqs = camera->seqs;
+	int n = seqs.size();
+
+	while (camera->nextseq < n) {
+		Sequence *seq = seqs[camera->nextseq].get();
+		if (seq->ndone < (int) seq->frames.size()) break;
+
+		for (BatchFrameVec::iterator it = seq->frames.begin(); it != seq->frames.end(); ++it) {
+			BatchFrame *bf = (*it).get();
+			if (bf->success) {
+				std::vector<FramePtr> &subfrms = bf->frame->subfrms;
+				int nsub = subfrms.size();
+				if (!nsub) get_finder(camera, 0)->NewFrame(bf->frame);
+				for (int i = 0; i < nsub; ++i) {// 多扩展图像: 各图像扩展独立关联
+					if (bf->subok[i]) get_finder(camera, subfrms[i]->hdu)->NewFrame(subfrms[i]);
+				}
+			}
+			bf->fed = true;
+			release_frame(bf);
+		}
+		++camera->nextseq;
+	}
+}
+
+void BatchReduct::flush_log() {
+	int n = frames_.size();
+
+	for (; nextlog_ < n && frames_[nextlog_]->done; ++nextlog_) {
+		BatchFrame *bf = frames_[nextlog_].get();
+		if (bf->success) logcal_->Write(bf->frame); // 输出定标结果
+		else logcal_->Account(bf->frame);
+		bf->logged = true;
+		release_frame(bf);
+	}
+}
+
+void BatchReduct::release_frame(BatchFrame *bf) {
+	if (bf->logged && bf->fed) bf->frame.reset();
+}
+
+void BatchReduct::wait_finders() {
+	FindPVVec finders;
+	FindPVVec::iterator it;
+	bool over(false);
+
+	for (CameraBatchVec::iterator it1 = cameras_.begin(); it1 != cameras_.end(); ++it1)
+		finders.insert(finders.end(), (*it1)->finders.begin(), (*it1)->finders.end());
+	while (!over) {
+		for (it = finders.begin(); it != finders.end() && (*it)->IsOver(); ++it);
+		if (!(over = it == finders.end()))
+			boost::this_thread::sleep_for(boost::chrono::seconds(30));
+	}
+}
+
+void BatchReduct::thread_header() {
+	int n = files_.size(), i;
+
+	while (1) {
+		{
+			mutex_lock lck(mtx_batch_);
+			if ((i = nextfile_) >= n) break;
+			++nextfile_;
+		}
+
+		BatchFramePtr bf = boost::make_shared<BatchFrame>();
+		bf->frame = boost::make_shared<OneFrame>();
+		bf->frame->filepath = files_[i];
+		frames_[i]   = bf;
+		TraceSpan span("header", "batch", bf->frame.get());
+		validhdr_[i] = LoadFrameHeader(bf->frame);
+	}
+}
+
+void BatchReduct::thread_reduct() {
+	FrameReduct reduct(param_);
+	int n = frames_.size(), nsub, isub;
+	BatchFramePtr bf;
+
+	while (1) {
+		{// 按文件名顺序分配, 使序列尽早完整
+			mutex_lock lck(mtx_batch_);
+			if (nextframe_ >= n) break;
+			bf   = frames_[nextframe_];
+			isub = -1;
+			if ((nsub = bf->frame->subfrms.size())) {// 多扩展图像: 以子帧为单位分配
+				isub = nextsub_;
+				if (++nextsub_ == nsub) {
+					nextsub_ = 0;
+					++nextframe_;
+				}
+			}
+			else ++nextframe_;
+		}
+		if (bf->anchor) frame_done(bf, reduct.DoPlane(bf->frame, bf->anchor));
+		else if (isub < 0) frame_done(bf, reduct.DoIt(bf->frame));
+		else subframe_done(bf, isub, reduct.DoIt(bf->frame->subfrms[isub]));
+	}
+}
@@ -0,0 +1,212 @@
+/*!
+ * @file BatchReduct.h 离线批处理: 并行处理一个目录下的全部图像
+ * @version 0.1
+ * @date 2020-11-02
+ * @note
+ * 两阶段处理流程:
+ * - 阶段一: 多线程读取文件头, 按相机分组, 按帧编号划分观测序列
+ * - 阶段二: 工作线程池并行执行图像处理/天文定位/匹配星表/测光, 帧间无先后约束
+ * - 多扩展图像以子帧为单位分配给工作线程, 子帧全部结束后合并
+ * - 数据立方体展开为平面, 每个平面作为独立的一帧参与分配、日志输出和运动目标关联
+ * - 序列内所有帧处理结束后, 按帧编号顺序送入该相机的AFindPV
+ * - 定标日志按文件名顺序输出, 与DoProcess逐帧处理的结果一致
+ * - 配置参数、定标日志与全局服务(预处理、亮星掩模、坏列识别、工作进程池、追踪)由调用者
+ *   创建一次, 由各目录的批处理共享: 合并本底/平场、定位结果与坏列计数不因目录边界丢失
+ */
+
+#ifndef BATCHREDUCT_H_
+#define BATCHREDUCT_H_
+
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+#include "LogCalibrated.h"
+#include "AFindPV.h"
+#include "CubeReduct.h"
+
+class BatchReduct {
+public:
+	/*!
+	 * @param param  配置参数, 由调用者加载并初始化全局服务
+	 * @param logcal 定标日志
+	 */
+	BatchReduct(Parameter *param, boost::shared_ptr<LogCalibrated> logcal);
+	virtual ~BatchReduct();
+
+protected:
+	/* 数据类型 */
+	typedef std::vector<string> vecstr;
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+	typedef boost::shared_ptr<AFindPV> FindPVPtr;
+	typedef std::vector<FindPVPtr> FindPVVec;
+
+	struct CameraBatch;
+	struct Sequence;
+
+	/*!
+	 * @struct BatchFrame 批处理中的单帧图像及其处理状态
+	 */
+	struct BatchFrame {
+		FramePtr frame;		//< 图像信息
+		CameraBatch *camera;//< 所属相机
+		Sequence *seq;		//< 所属观测序列
+		bool done;		//< 处理结束标志
+		bool success;	//< 处理成功标志: 完成测光
+		bool logged;	//< 已写入定标日志
+		bool fed;		//< 已送入AFindPV
+		int nsubdone;	//< 多扩展图像: 处理结束的子帧数
+		std::vector<char> subok;	//< 多扩展图像: 子帧处理结果
+		CubeAnchorPtr anchor;		//< 数据立方体的平面: 锚定平面的定位结果
+
+	public:
+		BatchFrame() {
+			camera  = NULL;
+			seq     = NULL;
+			done    = false;
+			success = false;
+			logged  = false;
+			fed     = false;
+			nsubdone = 0;
+		}
+	};
+	typedef boost::shared_ptr<BatchFrame> BatchFramePtr;
+	typedef std::vector<BatchFramePtr> BatchFrameVec;
+
+	/*!
+	 * @struct Sequence 观测序列: 同一相机帧编号不减的一组连续图像
+	 */
+	struct Sequence {
+		BatchFrameVec frames;	//< 序列中的图像, 按文件名排序
+		int ndone;				//< 处理结束的帧数
+
+	public:
+		Sequence() {
+			ndone = 0;
+		}
+	};
+	typedef boost::shared_ptr<Sequence> SequencePtr;
+	typedef std::vector<SequencePtr> SequenceVec;
+
+	/*!
+	 * @struct CameraBatch 单台相机的批处理数据
+	 */
+	struct CameraBatch {
+		string gid, uid, cid;	//< 相机标志
+		SequenceVec seqs;		//< 观测序列
+		int nextseq;			//< 下一个送入AFindPV的序列
+		FindPVVec finders;		//< 运动目标关联. 多扩展图像的每个图像扩展对应一个
+
+	public:
+		CameraBatch() {
+			nextseq = 0;
+		}
+
+		bool is_matched(const string& _gid, const string& _uid, const string& _cid) {
+			return (gid == _gid && uid == _uid && cid == _cid);
+		}
+	};
+	typedef boost::shared_ptr<CameraBatch> CameraBatchPtr;
+	typedef std::vector<CameraBatchPtr> CameraBatchVec;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;	//< 配置参数
+	boost::shared_ptr<LogCalibrated> logcal_;	//< 日志: 定标结果
+	int nworker_;		//< 工作线程数量
+
+	boost::mutex mtx_batch_;	//< 互斥锁: 批处理状态
+	vecstr files_;				//< 待处理文件
+	BatchFrameVec frames_;		//< 有效图像, 按文件名排序
+	CameraBatchVec cameras_;	//< 相机
+	CubePlaneNo planeno_;		//< 立方体平面帧编号
+	int nextfile_;		//< 下一个读取文件头的文件
+	int nextframe_;		//< 下一个分配给工作线程的图像
+	int nextsub_;		//< 多扩展图像: 下一个分配给工作线程的子帧
+	int nextlog_;		//< 下一个写入定标日志的图像
+	std::vector<char> validhdr_;	//< 文件头检查结果
+
+public:
+	/*!
+	 * @brief 规划本目录的处理: 工作线程数量
+	 */
+	bool Start();
+	/*!
+	 * @brief 处理一组文件
+	 * @param files 文件路径, 按文件名排序
+	 * @note
+	 * 阻塞直至所有处理结束
+	 */
+	void ProcessFiles(const vecstr &files);
+
+protected:
+	/*!
+	 * @brief 将SEx的配置文件default.sex复制至目标目录
+	 * @param dstdir 目标目录名
+	 */
+	void copy_sexcfg(const string& dstdir);
+	/*!
+	 * @brief 阶段一: 并行读取文件头
+	 */
+	void scan_headers();
+	/*!
+	 * @brief 将数据立方体展开为平面, 按平面序号追加至图像集合
+	 */
+	void expand_cube(FramePtr cube, BatchFrameVec &frames);
+	/*!
+	 * @brief 按相机分组, 按帧编号划分观测序列
+	 */
+	void group_frames();
+	/*!
+	 * @brief 查找或创建相机
+	 */
+	CameraBatch* get_camera(FramePtr frame);
+	/*!
+	 * @brief 查找或创建相机中与HDU对应的AFindPV
+	 */
+	FindPVPtr get_finder(CameraBatch *camera, int hdu);
+	/*!
+	 * @brief 阶段二: 并行处理图像
+	 */
+	void reduct_frames();
+	/*!
+	 * @brief 一帧图像处理结束
+	 * @param bf      图像
+	 * @param success 处理结果
+	 */
+	void frame_done(BatchFramePtr bf, bool success);
+	/*!
+	 * @brief 多扩展图像的一个子帧处理结束
+	 * @param bf      图像
+	 * @param isub    子帧序号
+	 * @param success 处理结果
+	 */
+	void subframe_done(BatchFramePtr bf, int isub, bool success);
+	/*!
+	 * @brief 将处理结束的完整序列按顺序送入AFindPV
+	 */
+	void feed_camera(CameraBatch *camera);
+	/*!
+	 * @brief 按文件名顺序输出定标日志
+	 */
+	void flush_log();
+	/*!
+	 * @brief 释放已完成所有输出的图像
+	 */
+	void release_frame(BatchFrame *bf);
+	/*!
+	 * @brief 等待所有AFindPV处理结束
+	 */
+	void wait_finders();
+	/*!
+	 * @brief 线程: 读取文件头
+	 */
+	void thread_header();
+	/*!
+	 * @brief 线程: 处理图像
+	 */
+	void thread_reduct();
+};
+
+#endif /* BATCHREDUCT_H_ */
@@ -0,0 +1,189 @@
+/*!
+ * @file BrightMask.cpp 亮星掩模
+ * @version 0.1
+ * @date 2020-11-20
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include "BrightMask.h"
+#include "AMath.h"
+#include "GLog.h"
+
+using namespace AstroUtil;
+
+typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+/*
+ * UCAC4星等: 优先使用APASS V, 缺失时使用UCAC拟合星等. 无效值: 20000毫星等
+ */
+static double ucac4_mag(const ucac4_item &item) {
+	if (item.apasm[1] > 0 && item.apasm[1] < 20000) return item.apasm[1] * 0.001;
+	if (item.magm > 0 && item.magm < 20000) return item.magm * 0.001;
+	return 20.0;
+}
+
+static bool less_mag(const BrightMask::MaskStar &a, const BrightMask::MaskStar &b) {
+	return a.mag < b.mag;
+}
+
+BrightMask::BrightMask(Parameter *param) {
+	param_ = param;
+	ucac4_.SetPathRoot(param->pathCatalog.c_str());
+}
+
+BrightMask::~BrightMask() {
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void BrightMask::SetWCS(FramePtr frame, const wcsinfo &wcs) {
+	mutex_lock lck(mtx_);
+	CameraWCSPtr &cam = cameras_[camera_key(frame)];
+	if (!cam) {
+		cam = boost::make_shared<CameraWCS>();
+		cam->rcat = 0.0;
+	}
+	cam->wcs    = wcs;
+	cam->width  = frame->wimg;
+	cam->height = frame->himg;
+	cam->raobj  = frame->raobj;
+	cam->decobj = frame->decobj;
+	cam->mjd    = frame->mjd;
+}
+
+/*
+ * 以预测位置附近最亮的目标为亮星本身, 剔除其光晕与溢出列中的其它目标.
+ * 亮星按星等排序, 较暗亮星即使落在较亮亮星的光晕内也予以保留
+ */
+int BrightMask::Apply(FramePtr frame, NFObjVec &objs) {
+	MaskZoneVec zones;
+	if (objs.empty() || !predict(frame, zones)) return 0;
+
+	int n(int(objs.size())), i, core, removed(0);
+	std::vector<char> flag(n, 0);	// 0: 保留; 1: 亮星本身; 2: 剔除
+	double x, y, dx, dy, rs, r2, fmax;
+
+	for (MaskZoneVec::iterator z = zones.begin(); z != zones.end(); ++z) {
+		rs = z->r + param_->maskRadius;
+		rs *= rs;
+		for (i = 0, core = -1, fmax = 0.0; i < n; ++i) {
+			const double *features = objs[i]->features;
+			dx = features[NDX_X] - z->x;
+			dy = features[NDX_Y] - z->y;
+			if (flag[i] != 1 && dx * dx + dy * dy <= rs && features[NDX_FLUX] > fmax) {
+				core = i;
+				fmax = features[NDX_FLUX];
+			}
+		}
+		if (core < 0) continue;
+
+		flag[core] = 1;
+		x  = objs[core]->features[NDX_X];
+		y  = objs[core]->features[NDX_Y];
+		r2 = z->r * z->r;
+		for (i = 0; i < n; ++i) {
+			if (flag[i]) continue;
+			dx = objs[i]->features[NDX_X] - x;
+			dy = objs[i]->features[NDX_Y] - y;
+			if (dx * dx + dy * dy <= r2 || (fabs(dx) <= z->hw && fabs(dy) <= z->hl)) flag[i] = 2;
+		}
+	}
+	for (i = 0, n = 0; i < int(objs.size()); ++i) {
+		if (flag[i] == 2) ++removed;
+		else objs[n++] = objs[i];
+	}
+	objs.resize(n);
+	return removed;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+string BrightMask::camera_key(FramePtr frame) {
+	string key = frame->gid + "_" + frame->uid + "_" + frame->cid;
+	if (frame->hdu) key += "_" + boost::lexical_cast<string>(frame->hdu);
+	return key;
+}
+
+bool BrightMask::predict(FramePtr frame, MaskZoneVec &zones) {
+	int w(frame->wimg), h(frame->himg);
+	double newr, newd, rac, decc, radius, scale, x, y;
+	double rmax = std::min(w, h) * 0.125;
+	double hmax = h * 0.5;
+	CameraWCSPtr cam;
+	wcsinfo wcs;
+	MaskStarVecPtr stars;
+
+	{// 复制定位结果和缓存的检索结果
+		mutex_lock lck(mtx_);
+		CameraWCSMap::iterator it = cameras_.find(camera_key(frame));
+		if (it == cameras_.end()) return false;
+
+		cam = it->second;
+		if (cam->width != frame->wimg || cam->height != frame->himg
+				|| fabs(frame->mjd - cam->mjd) * 86400.0 > param_->maskAge)
+			return false;
+
+		wcs  = cam->wcs;
+		newr = wcs.r0;
+		newd = wcs.d0;
+		if (frame->raobj < 1E20 && cam->raobj < 1E20) {// 指向变化: 平移参考点
+			newr += (frame->raobj - cam->raobj) * D2R;
+			newd += (frame->decobj - cam->decobj) * D2R;
+		}
+		scale  = 3600.0 * sqrt(fabs(wcs.cd[0][0] * wcs.cd[1][1] - wcs.cd[0][1] * wcs.cd[1][0]));
+		radius = 0.5 * sqrt(double(w) * w + double(h) * h) * scale / 60.0;
+		wcs.image_to_wcs((w + 1) * 0.5, (h + 1) * 0.5, newr, newd, rac, decc);
+		if (cam->rcat > 0.0
+				&& SphereRange(rac * D2R, decc * D2R, cam->racat * D2R, cam->deccat * D2R) * R2D * 60.0 <= cam->rcat * 0.1)
+			stars = cam->stars;
+	}
+	if (!stars) {// 视场移出缓存范围: 在锁外检索星表, 替换缓存
+		stars = find_stars(rac, decc, radius * 1.1);
+		mutex_lock lck(mtx_);
+		cam->racat  = rac;
+		cam->deccat = decc;
+		cam->rcat   = radius * 1.1;
+		cam->stars  = stars;
+	}
+
+	for (MaskStarVec::const_iterator star = stars->begin(); star != stars->end(); ++star) {
+		if (!wcs.wcs_to_image(star->ra, star->dec, newr, newd, x, y)
+				|| x < 0.5 || x > w + 0.5 || y < 0.5 || y > h + 0.5)
+			continue;
+
+		MaskZone zone;
+		zone.x  = x;
+		zone.y  = y;
+		zone.r  = std::min(param_->maskRadius * pow(10.0, 0.2 * (param_->maskMag - star->mag)), rmax);
+		zone.hw = std::max(2.0, zone.r * 0.1);
+		zone.hl = star->mag < param_->maskSatMag
+				? std::min(param_->maskBleed * (pow(10.0, 0.4 * (param_->maskSatMag - star->mag)) - 1.0), hmax)
+				: 0.0;
+		zones.push_back(zone);
+	}
+	return true;
+}
+
+BrightMask::MaskStarVecPtr BrightMask::find_stars(double ra, double dec, double radius) {
+	boost::shared_ptr<MaskStarVec> stars = boost::make_shared<MaskStarVec>();
+	ucac4item_ptr starptr;
+	int nfound, i;
+	MaskStar star;
+
+	mutex_lock lck(mtx_cat_);
+	if ((nfound = ucac4_.FindStar(ra, dec, radius))) {
+		starptr = ucac4_.GetResult();
+		for (i = 0; i < nfound; ++i) {
+			if ((star.mag = ucac4_mag(starptr[i])) > param_->maskMag) continue;
+			star.ra  = (double) starptr[i].ra / MILLIAS;
+			star.dec = (double) starptr[i].spd / MILLIAS - 90.0;
+			stars->push_back(star);
+		}
+		std::sort(stars->begin(), stars->end(), less_mag);
+	}
+	else {
+		_gLog->Write(LOG_WARN, "BrightMask::find_stars()", "no catalog star around [%.4f, %.4f]", ra, dec);
+	}
+	return stars;
+}
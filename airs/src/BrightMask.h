@@ -0,0 +1,123 @@
+/**
+ * @class BrightMask 亮星掩模
+ * @version 0.1
+ * @date 2020-11-20
+ * @note
+ * - 按相机(及HDU)缓存最近一次成功的天文定位结果
+ * - 由定位结果和UCAC4星表预测新图像中亮星的光晕与溢出列, 剔除其中的伪目标
+ * - 指向目标位置(OBJCTRA/OBJCTDEC)变化时平移参考点; 定位结果超过有效期后不再使用
+ * - 光晕半径与流量的平方根成正比; 比饱和星等更亮的恒星沿列方向溢出, 半长度与超出饱和的流量成正比
+ * - 预测位置以附近最亮的目标为准, 该目标保留, 未找到时不掩模
+ * - 星表检索结果按相机缓存, 视场中心移动超过检索半径的1/10时重新检索
+ */
+
+#ifndef SRC_BRIGHTMASK_H_
+#define SRC_BRIGHTMASK_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+#include "AstroMetry.h"
+#include "ACatUCAC4.h"
+
+using std::string;
+
+class BrightMask {
+public:
+	BrightMask(Parameter *param);
+	virtual ~BrightMask();
+
+public:
+	/* 数据类型 */
+	/*!
+	 * @struct MaskStar 参与掩模的亮星
+	 */
+	struct MaskStar {
+		double ra, dec;	//< 赤道坐标, J2000, 量纲: 角度
+		double mag;		//< V星等
+	};
+	typedef std::vector<MaskStar> MaskStarVec;
+	typedef boost::shared_ptr<const MaskStarVec> MaskStarVecPtr;
+
+	/*!
+	 * @struct MaskZone 一颗亮星的掩模区
+	 */
+	struct MaskZone {
+		double x, y;	//< 预测位置, 与目标特征值坐标系一致
+		double r;		//< 光晕半径, 量纲: 像素
+		double hw;		//< 溢出列半宽度, 量纲: 像素
+		double hl;		//< 溢出列半长度, 量纲: 像素. 0: 无溢出
+	};
+	typedef std::vector<MaskZone> MaskZoneVec;
+
+	/*!
+	 * @struct CameraWCS 一台相机最近一次的定位结果与星表检索结果
+	 */
+	struct CameraWCS {
+		wcsinfo wcs;		//< 定位结果
+		int width, height;	//< 图像尺寸
+		double raobj, decobj;	//< 指向目标位置, 量纲: 角度
+		double mjd;			//< 曝光中间时刻
+		double racat, deccat;	//< 星表检索中心, 量纲: 角度
+		double rcat;		//< 星表检索半径, 量纲: 角分. 0: 未检索
+		MaskStarVecPtr stars;	//< 星表检索结果. 检索后整体替换, 不原位修改
+	};
+	typedef boost::shared_ptr<CameraWCS> CameraWCSPtr;
+	typedef std::map<string, CameraWCSPtr> CameraWCSMap;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;		//< 配置参数
+	boost::mutex mtx_;		//< 互斥锁: 定位结果与星表检索结果
+	boost::mutex mtx_cat_;	//< 互斥锁: UCAC4接口
+	CameraWCSMap cameras_;	//< 按相机缓存的定位结果
+	AstroUtil::ACatUCAC4 ucac4_;	//< UCAC4接口
+
+public:
+	/*!
+	 * @brief 记录成功的定位结果
+	 * @param frame 图像
+	 * @param wcs   定位结果
+	 */
+	void SetWCS(FramePtr frame, const wcsinfo &wcs);
+	/*!
+	 * @brief 剔除亮星光晕与溢出列中的伪目标
+	 * @param frame 图像
+	 * @param objs  图像处理结果, 原位剔除
+	 * @return
+	 * 剔除的目标数量
+	 */
+	int Apply(FramePtr frame, NFObjVec &objs);
+
+protected:
+	/*!
+	 * @brief 相机标志
+	 */
+	string camera_key(FramePtr frame);
+	/*!
+	 * @brief 预测图像中的亮星掩模区
+	 * @return
+	 * 无有效定位结果时返回false
+	 * @note
+	 * 只在查看和替换缓存时持有mtx_, 星表检索与位置预测不阻塞其它相机
+	 */
+	bool predict(FramePtr frame, MaskZoneVec &zones);
+	/*!
+	 * @brief 检索视场内的亮星
+	 * @param ra     视场中心赤经, 量纲: 角度
+	 * @param dec    视场中心赤纬, 量纲: 角度
+	 * @param radius 视场半径, 量纲: 角分
+	 * @return
+	 * 按星等排序的亮星
+	 */
+	MaskStarVecPtr find_stars(double ra, double dec, double radius);
+};
+typedef boost::shared_ptr<BrightMask> BrightMaskPtr;
+
+extern BrightMaskPtr _gBrightMask;	//< 亮星掩模, 未启用时为空
+
+#endif /* SRC_BRIGHTMASK_H_ */
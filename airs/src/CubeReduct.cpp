@@ -0,0 +1,152 @@
+/*!
+ * @file CubeReduct.cpp 数据立方体(NAXIS3)的流式处理
+ * @version 0.1
+ * @date 2020-11-04
+ */
+
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "CubeReduct.h"
+#include "FrameHeader.h"
+#include "GLog.h"
+
+using namespace boost::filesystem;
+using namespace boost::posix_time;
+
+//////////////////////////////////////////////////////////////////////////////
+int CubePlaneNo::Assign(FramePtr cube) {
+	string camid = cube->gid + ":" + cube->uid + ":" + cube->cid;
+	std::map<string, CameraNo>::iterator it = cameras_.find(camid);
+	int fno0;
+
+	if (it == cameras_.end() || cube->fno < it->second.fnocube) fno0 = cube->fno;
+	else fno0 = it->second.fnonext;
+	CameraNo &camno = cameras_[camid];
+	camno.fnocube = cube->fno;
+	camno.fnonext = fno0 + cube->nplane;
+	return fno0;
+}
+
+void ExpandCubePlanes(FramePtr cube, std::vector<FramePtr> &planes, int fno0) {
+	ptime tmobs = from_iso_extended_string(cube->tmobs);
+	boost::format fmt("%s_p%04d.fit");
+	string stem = path(cube->filepath).stem().string();
+	int n = cube->nplane;
+
+	planes.clear();
+	for (int k = 0; k < n; ++k) {
+		FramePtr plane = boost::make_shared<OneFrame>();
+		plane->filepath  = cube->filepath;
+		plane->filename  = (fmt % stem % (k + 1)).str();
+		plane->typeTrack = cube->typeTrack;
+		plane->wimg      = cube->wimg;
+		plane->himg      = cube->himg;
+		plane->expdur    = cube->expdur;
+		plane->raobj     = cube->raobj;
+		plane->decobj    = cube->decobj;
+		plane->gid       = cube->gid;
+		plane->uid       = cube->uid;
+		plane->cid       = cube->cid;
+		plane->nplane    = n;
+		plane->plane     = k + 1;
+		plane->cadence   = cube->cadence;
+		plane->fno       = fno0 + k;
+		SetFrameTime(plane, to_iso_extended_string(tmobs + microsec(long(k * cube->cadence * 1E6))));
+		planes.push_back(plane);
+	}
+}
+
+bool WriteCubePlane(FramePtr plane, const string &pathWork) {
+	fitsfile *fitsin, *fitsout;
+	int status(0), status1(0);
+	long fpixel[3] = {1, 1, plane->plane};
+	long naxes[2]  = {plane->wimg, plane->himg};
+	LONGLONG npix  = (LONGLONG) plane->wimg * plane->himg;
+	boost::shared_array<float> data;
+	path pathplane(pathWork);
+
+	pathplane /= plane->filename;
+	fits_open_file(&fitsin, plane->filepath.c_str(), READONLY, &status);
+	if (status) {
+		_gLog->Write(LOG_FAULT, "WriteCubePlane()", "failed to open [%s]", plane->filepath.c_str());
+		return false;
+	}
+	data.reset(new float[npix]);
+	fits_read_pix(fitsin, TFLOAT, fpixel, npix, NULL, data.get(), NULL, &status);
+	fits_close_file(fitsin, &status1);
+	if (!status) {
+		// 文件名前缀'!': 覆盖已存在文件
+		fits_create_file(&fitsout, ("!" + pathplane.string()).c_str(), &status);
+		if (!status) {
+			fits_create_img(fitsout, FLOAT_IMG, 2, naxes, &status);
+			fits_write_img(fitsout, TFLOAT, 1, npix, data.get(), &status);
+			fits_close_file(fitsout, &status1);
+		}
+	}
+
+	if (status) {
+		_gLog->Write(LOG_FAULT, "WriteCubePlane()", "failed to write plane#%d of [%s]. status = %d",
+				plane->plane, plane->filepath.c_str(), status);
+		boost::system::error_code ec;
+		remove(pathplane, ec);
+		return false;
+	}
+	plane->filepath = pathplane.string();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+CubeReduct::CubeReduct(Parameter *param, int nworker) {
+	param_     = param;
+	nextplane_ = 0;
+	if (nworker < 1) nworker = 1;
+	for (int i = 0; i < nworker; ++i)
+		workers_.push_back(boost::make_shared<FrameReduct>(param_));
+}
+
+CubeReduct::~CubeReduct() {
+}
+
+int CubeReduct::DoIt(FramePtr cube) {
+	int nworker = workers_.size(), n, i, nok(0);
+	boost::thread_group thrds;
+
+	ExpandCubePlanes(cube, planes_, planeno_.Assign(cube));
+	n = planes_.size();
+	planeok_.assign(n, 0);
+	anchor_    = boost::make_shared<CubeAnchor>();
+	nextplane_ = 0;
+	for (i = 0; i < nworker && i < n; ++i)
+		thrds.create_thread(boost::bind(&CubeReduct::thread_reduct, this, workers_[i]));
+	thrds.join_all();
+
+	for (i = 0; i < n; ++i) {
+		if (planeok_[i]) ++nok;
+	}
+	_gLog->Write("%s. %d of %d planes reduced", cube->filename.c_str(), nok, n);
+	return nok;
+}
+
+const std::vector<FramePtr>& CubeReduct::GetPlanes() {
+	return planes_;
+}
+
+const std::vector<char>& CubeReduct::GetResult() {
+	return planeok_;
+}
+
+void CubeReduct::thread_reduct(FrameReductPtr reduct) {
+	int n = planes_.size(), i;
+
+	while (1) {
+		{// 按平面序号分配: 序号靠前的平面先成为锚定平面
+			mutex_lock lck(mtx_plane_);
+			if ((i = nextplane_) >= n) break;
+			++nextplane_;
+		}
+		planeok_[i] = reduct->DoPlane(planes_[i], anchor_);
+	}
+}
@@ -0,0 +1,168 @@
+/*!
+ * @file CubeReduct.h 数据立方体(NAXIS3)的流式处理
+ * @version 0.1
+ * @date 2020-11-04
+ * @note
+ * - 立方体的每个平面作为独立的一帧, 时标为DATE-OBS加平面间隔与平面序号之积
+ * - 平面间隔取关键字CADENCE或FRAMETIM, 缺省与曝光时间相同
+ * - 首个完成图像处理的平面(锚定平面)执行天文定位, 定位结果传递给其它平面. 各平面独立匹配星表并测光
+ * - 锚定平面定位失败时, 由下一个完成图像处理的平面接替执行天文定位
+ * - 工作线程各自读取平面并执行图像处理, 不必等待锚定平面的天文定位
+ * - 内置算法由立方体文件直接读取平面; SExtractor与天文定位读取写入工作目录的平面文件
+ */
+
+#ifndef CUBEREDUCT_H_
+#define CUBEREDUCT_H_
+
+#include <vector>
+#include <map>
+#include <boost/thread.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+#include "AstroMetry.h"
+#include "FrameReduct.h"
+
+/*!
+ * @struct CubeAnchor 锚定平面的天文定位结果, 由同一立方体的所有平面共享
+ * @note
+ * 同一时刻只有一个平面执行天文定位. 定位失败后由下一个调用acquire()的平面接替
+ */
+struct CubeAnchor {
+	boost::mutex mtx;				//< 互斥锁
+	boost::condition_variable cv;	//< 条件: 锚定平面结束天文定位
+	bool solving;	//< 锚定平面正在执行天文定位
+	bool success;	//< 天文定位成功
+	wcsinfo wcs;	//< 定位结果
+
+public:
+	CubeAnchor() {
+		solving = false;
+		success = false;
+	}
+
+	/*!
+	 * @brief 获取定位结果, 或成为锚定平面
+	 * @param wcsrslt 定位结果的副本
+	 * @return
+	 * true:  已有定位结果
+	 * false: 调用者成为锚定平面, 须执行天文定位并调用set()
+	 * @note
+	 * 其它平面正在执行天文定位时等待其结果
+	 */
+	bool acquire(wcsinfo &wcsrslt) {
+		boost::unique_lock<boost::mutex> lck(mtx);
+		while (solving) cv.wait(lck);
+		if (success) {
+			wcsrslt = wcs;
+			return true;
+		}
+		solving = true;
+		return false;
+	}
+
+	/*!
+	 * @brief 记录锚定平面的天文定位结果
+	 * @param rslt    定位结果
+	 * @param wcsrslt 定位成功时的WCS参数
+	 */
+	void set(bool rslt, const wcsinfo *wcsrslt) {
+		boost::unique_lock<boost::mutex> lck(mtx);
+		if ((success = rslt)) wcs = *wcsrslt;
+		solving = false;
+		cv.notify_all();
+	}
+};
+typedef boost::shared_ptr<CubeAnchor> CubeAnchorPtr;
+
+/*!
+ * @class CubePlaneNo 按相机为立方体平面分配帧编号
+ * @note
+ * - 平面帧编号在同一相机的相邻立方体间连续递增, 与各立方体的平面数量无关,
+ *   使AFindPV将相邻立方体视为同一序列
+ * - 立方体帧编号减小时开始新的序列, 平面帧编号自立方体帧编号重新计数
+ */
+class CubePlaneNo {
+protected:
+	struct CameraNo {
+		int fnocube;	//< 上一立方体的帧编号
+		int fnonext;	//< 下一平面的帧编号
+	};
+	std::map<string, CameraNo> cameras_;	//< 相机标志: gid:uid:cid
+
+public:
+	/*!
+	 * @brief 为立方体的平面分配帧编号
+	 * @param cube 数据立方体
+	 * @return
+	 * 首个平面的帧编号. 其余平面依次加1
+	 */
+	int Assign(FramePtr cube);
+};
+
+/*!
+ * @brief 将数据立方体展开为平面
+ * @param cube   数据立方体
+ * @param planes 平面. 未读取像素数据, filepath仍指向立方体文件
+ * @param fno0   首个平面的帧编号, 由CubePlaneNo分配
+ */
+extern void ExpandCubePlanes(FramePtr cube, std::vector<FramePtr> &planes, int fno0);
+/*!
+ * @brief 将平面写入工作目录下的二维图像文件
+ * @param plane    平面. 成功后filepath指向平面文件
+ * @param pathWork 工作目录
+ * @return
+ * 操作结果
+ */
+extern bool WriteCubePlane(FramePtr plane, const string &pathWork);
+
+class CubeReduct {
+public:
+	/*!
+	 * @param param   配置参数
+	 * @param nworker 并行处理的平面数量
+	 */
+	CubeReduct(Parameter *param, int nworker);
+	virtual ~CubeReduct();
+
+protected:
+	/* 数据类型 */
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;		//< 配置参数
+	std::vector<FrameReductPtr> workers_;	//< 平面处理流程
+	boost::mutex mtx_plane_;	//< 互斥锁: 平面分配
+	std::vector<FramePtr> planes_;	//< 当前立方体的平面
+	std::vector<char> planeok_;		//< 平面处理结果
+	CubeAnchorPtr anchor_;	//< 锚定平面的定位结果
+	int nextplane_;			//< 下一个待处理平面
+	CubePlaneNo planeno_;	//< 平面帧编号
+
+public:
+	/*!
+	 * @brief 处理数据立方体
+	 * @return
+	 * 处理成功的平面数量
+	 * @note
+	 * 阻塞直至所有平面处理结束
+	 */
+	int DoIt(FramePtr cube);
+	/*!
+	 * @brief 查看平面, 按平面序号排列
+	 */
+	const std::vector<FramePtr>& GetPlanes();
+	/*!
+	 * @brief 查看平面处理结果
+	 */
+	const std::vector<char>& GetResult();
+
+protected:
+	/*!
+	 * @brief 线程: 处理平面
+	 */
+	void thread_reduct(FrameReductPtr reduct);
+};
+typedef boost::shared_ptr<CubeReduct> CubeReductPtr;
+
+#endif /* CUBEREDUCT_H_ */
@@ -10,6 +10,13 @@
 #include <boost/chrono/include.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "DoProcess.h"
+#include "FrameHeader.h"
+#include "FrameStat.h"
+#include "ATrace.h"
+#include "ExtractPool.h"
+#include "PreProcess.h"
+#include "BrightMask.h"
+#include "BadColumn.h"
 #include "GLog.h"
 #include "globaldef.h"
 
@@ -33,6 +40,11 @@ bool DoProcess::StartService(bool asdaemon, boost::asio::io_service *ios) {
 	ios_ = ios;
 	param_.LoadFile(gConfigPath);
 	logcal_ = boost::make_shared<LogCalibrated>(param_.pathOutput);
+	if (param_.traceEnable) _gTrace->Start(param_.pathOutput, param_.tracePeriod);
+	if (param_.sexWorkers > 0 && !param_.dipNative) _gExtract->Start(param_.sexWorkers, param_.sexRecycle);
+	if (param_.calibEnable) _gPreProc = boost::make_shared<PreProcess>(&param_);
+	if (param_.maskEnable) _gBrightMask = boost::make_shared<BrightMask>(&param_);
+	if (param_.badcolEnable) _gBadColumn = boost::make_shared<BadColumn>(&param_);
 
 	/* 启动服务 */
 	create_objects();
@@ -58,6 +70,7 @@ void DoProcess::StopService() {
 	interrupt_thread(thrd_reconn_fileserver_);
 	param_.SaveBadmark();
 
+	mutex_lock lck(mtx_finders_);
 	for (FindPVVec::iterator it = finders_.begin(); it != finders_.end(); ++it) {
 		(*it).reset(); // 强制执行AFindPV的析构函数
 	}
@@ -67,6 +80,7 @@ void DoProcess::ProcessImage(const string &filepath) {
 	mutex_lock lck(mtx_frm_reduct_);
 	FramePtr frame = boost::make_shared<OneFrame>();
 	frame->filepath = filepath;
+	StageEnqueue(frame, STAGE_REDUCT);
 	queReduct_.push_back(frame);
 	cv_reduct_.notify_one();
 }
@@ -74,6 +88,7 @@ void DoProcess::ProcessImage(const string &filepath) {
 bool DoProcess::IsOver() {
 	if (queReduct_.size() || queAstro_.size() || queMatch_.size() || quePhoto_.size())
 		return false;
+	mutex_lock lck(mtx_finders_);
 	for (FindPVVec::iterator it = finders_.begin(); it != finders_.end(); ++it) {
 		if (!(*it)->IsOver()) return false;
 	}
@@ -86,22 +101,12 @@ void DoProcess::ImageReductResult(bool rslt) {
 	FramePtr frame = reduct_->GetFrame();
 	if (rslt && param_.doAstrometry) {
 		mutex_lock lck(mtx_frm_astro_);
+		StageEnqueue(frame, STAGE_ASTRO);
 		queAstro_.push_back(frame);
 		cv_astro_.notify_one();
 	}
-	if (rslt && frame->fwhm > 1E-4) {// 通知服务器FWHM
-		if (tcpc_gc_.unique()) {
-			apfwhm proto = boost::make_shared<ascii_proto_fwhm>();
-			proto->gid   = frame->gid;
-			proto->uid   = frame->uid;
-			proto->cid   = frame->cid;
-			proto->value = frame->fwhm;
-
-			int n;
-			const char *s = ascproto_->CompactFWHM(proto, n);
-			tcpc_gc_->Write(s, n);
-		}
-	}
+	if (rslt) send_fwhm(frame);
+	if (!rslt || !param_.doAstrometry) logcal_->Account(frame);
 	cv_reduct_.notify_one();
 }
 
@@ -123,9 +128,11 @@ void DoProcess::AstrometryResult(int rslt) {
 	}
 	if (rslt && param_.doPhotometry) {// 匹配星表
 		mutex_lock lck(mtx_frm_match_);
+		StageEnqueue(frame, STAGE_MATCH);
 		queMatch_.push_back(frame);
 		cv_match_.notify_one();
 	}
+	else logcal_->Account(frame);
 	cv_astro_.notify_one();
 }
 
@@ -133,9 +140,11 @@ void DoProcess::MatchCatalogResult(bool rslt) {
 	FramePtr frame = match_->GetFrame();
 	if (rslt) {// 测光
 		mutex_lock lck(mtx_frm_photo_);
+		StageEnqueue(frame, STAGE_PHOTO);
 		quePhoto_.push_back(frame);
 		cv_photo_.notify_one();
 	}
+	else logcal_->Account(frame);
 	if (rslt && tcpc_gc_.unique()
 			&& valid_ra(frame->rac) && valid_dec(frame->decc)
 			&& valid_ra(frame->raobj) && valid_dec(frame->decobj)) {
@@ -167,9 +176,39 @@ void DoProcess::PhotometryResult(bool rslt) {
 					frame->gid.c_str(), frame->uid.c_str(), frame->cid.c_str());
 		}
 	}
+	else logcal_->Account(frame);
 	cv_photo_.notify_one();
 }
 
+void DoProcess::MosaicResult(FramePtr frame, bool rslt) {
+	if (!rslt) {
+		logcal_->Account(frame);
+		return;
+	}
+	send_fwhm(frame);
+	logcal_->Write(frame); // 输出定标结果
+
+	// 各图像扩展独立关联运动目标
+	const std::vector<char> &subok = mosaic_->GetSubResult();
+	std::vector<FramePtr> &subfrms = frame->subfrms;
+	for (int i = 0; i < (int) subfrms.size(); ++i) {
+		if (subok[i]) get_finder(subfrms[i])->NewFrame(subfrms[i]);
+	}
+}
+
+void DoProcess::CubeResult() {
+	const std::vector<FramePtr> &planes = cube_->GetPlanes();
+	const std::vector<char> &planeok = cube_->GetResult();
+	for (int i = 0; i < (int) planes.size(); ++i) {
+		if (!planeok[i]) {
+			logcal_->Account(planes[i]);
+			continue;
+		}
+		logcal_->Write(planes[i]); // 输出定标结果
+		get_finder(planes[i])->NewFrame(planes[i]);
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////////
 void DoProcess::copy_sexcfg(const string& dstdir) {
 	path srcpath(param_.pathCfgSex);
@@ -178,8 +217,25 @@ void DoProcess::copy_sexcfg(const string& dstdir) {
 	if (!exists(dstpath)) copy_file(srcpath, dstpath);
 }
 
+void DoProcess::send_fwhm(FramePtr frame) {
+	if (frame->fwhm > 1E-4 && tcpc_gc_.unique()) {// 通知服务器FWHM
+		apfwhm proto = boost::make_shared<ascii_proto_fwhm>();
+		proto->gid   = frame->gid;
+		proto->uid   = frame->uid;
+		proto->cid   = frame->cid;
+		proto->value = frame->fwhm;
+
+		int n;
+		const char *s = ascproto_->CompactFWHM(proto, n);
+		tcpc_gc_->Write(s, n);
+	}
+}
+
 /* 数据处理 */
 void DoProcess::create_objects() {
+	int nworker = param_.nThreadBatch > 0 ? param_.nThreadBatch : int(thread::hardware_concurrency());
+	mosaic_  = boost::make_shared<MosaicReduct>(&param_, nworker);
+	cube_    = boost::make_shared<CubeReduct>(&param_, nworker);
 	reduct_  = boost::make_shared<AstroDIP>(&param_);
 	astro_   = boost::make_shared<AstroMetry>(&param_);
 	match_   = boost::make_shared<MatchCatalog>(&param_);
@@ -206,103 +262,24 @@ bool DoProcess::check_image(FramePtr frame) {
 	// 检查并准备环境
 	path filepath(frame->filepath);
 	copy_sexcfg(filepath.parent_path().string());
-
-	try {
-		// 读取文件头信息
-		fitsfile *fitsptr;	//< 基于cfitsio接口的文件操作接口
-		int status(0);
-		char dateobs[30], timeobs[30], temp[30], objname[30], plan_type[30];
-		bool datefull;
-		double expdur;
-
-		fits_open_file(&fitsptr, frame->filepath.c_str(), 0, &status);
-		fits_read_key(fitsptr, TINT, "NAXIS1", &frame->wimg, NULL, &status);
-		fits_read_key(fitsptr, TINT, "NAXIS2", &frame->himg, NULL, &status);
-		fits_read_key(fitsptr, TSTRING, "DATE-OBS", dateobs,  NULL, &status);
-		if (!(datefull = NULL != strstr(dateobs, "T")))
-			fits_read_key(fitsptr, TSTRING, "TIME-OBS", timeobs,  NULL, &status);
-		if (status) {// Andor Solis格式
-			status = 0;
-			fits_read_key(fitsptr, TSTRING, "DATE", dateobs,  NULL, &status);
-			datefull = true;
-		}
-		fits_read_key(fitsptr, TDOUBLE, "EXPTIME",  &expdur, NULL, &status);
-		if (status) {// Andor Solis格式
-			status = 0;
-			fits_read_key(fitsptr, TDOUBLE, "EXPOSURE",  &expdur, NULL, &status);
-		}
-		if (!status) {
-			fits_read_key(fitsptr, TINT, "FRAMENO",  &frame->fno, NULL, &status);
-			status = 0;
-		}
-		frame->expdur = expdur;
-		fits_read_key(fitsptr, TSTRING, "PLANTYPE", plan_type, NULL, &status);
-		if (!status) {
-			frame->typeTrack = strcasecmp(plan_type, "TRACK") == 0;
-		}
-		else {
-			status = 0;
-			fits_read_key(fitsptr, TSTRING, "OBJECT", objname, NULL, &status);
-			frame->typeTrack = strcasecmp(objname, "point") != 0;
-		}
-		if (!status) {// 不存在关键字的特殊处理
-			fits_read_key(fitsptr, TSTRING, "GROUP_ID", temp, NULL, &status);
-			frame->gid = temp;
-			fits_read_key(fitsptr, TSTRING, "UNIT_ID", temp, NULL, &status);
-			frame->uid = temp;
-			fits_read_key(fitsptr, TSTRING, "CAM_ID", temp, NULL, &status);
-			frame->cid = temp;
-
-			fits_read_key(fitsptr, TDOUBLE, "OBJCTRA",  &frame->raobj,  NULL, &status);
-			fits_read_key(fitsptr, TDOUBLE, "OBJCTDEC", &frame->decobj, NULL, &status);
-
-			status = 0;
-		}
-		fits_close_file(fitsptr, &status);
-
-		if (!status) {
-			path filepath(frame->filepath);
-			char tmfull[40];
-
-			frame->filename = filepath.filename().string();
-			if (!datefull) sprintf(tmfull, "%sT%s", dateobs, timeobs);
-			frame->tmobs = datefull ? dateobs : tmfull;
-			ptime tmobs  = from_iso_extended_string(frame->tmobs);
-			// QHY CMOS 4040的两个时标(毫秒)
-			// 300: 曝光指令执行延迟 => 低轨数据偏差约45毫秒, 修正为340
-			// 120: 读出时间延迟
-			ptime tmmid  = tmobs + millisec(int(expdur * 500.0 + 340));
-			frame->tmmid = to_iso_extended_string(tmmid);
-			frame->secofday = tmmid.time_of_day().total_milliseconds() / 86400000.0;
-			frame->mjd      = tmmid.date().modjulian_day() + frame->secofday;
-
-			if (frame->gid.empty() || frame->uid.empty() || frame->cid.empty()) {
-				_gLog->Write(LOG_FAULT, NULL, "File[%s] doesn't give right IDs[%s:%s:%s]",
-						frame->filename.c_str(),
-						frame->gid.c_str(), frame->uid.c_str(), frame->cid.c_str());
-				status = -1;
-			}
-		}
-		return (status == 0);
-	}
-	catch(...) {// 尝试捕获异常: 文件可能为空
-		return false;
-	}
+	return LoadFrameHeader(frame);
 }
 
 DoProcess::FindPVPtr DoProcess::get_finder(FramePtr frame) {
+	mutex_lock lck(mtx_finders_);
 	FindPVVec::iterator itend = finders_.end();
 	FindPVVec::iterator it;
 	string gid = frame->gid;
 	string uid = frame->uid;
 	string cid = frame->cid;
+	int hdu = frame->hdu;
 	FindPVPtr finder;
 
-	for (it = finders_.begin(); it != itend && (*it)->IsMatched(gid, uid, cid) == false; ++it);
+	for (it = finders_.begin(); it != itend && (*it)->IsMatched(gid, uid, cid, hdu) == false; ++it);
 	if (it != itend) finder = *it;
 	else {
 		finder = boost::make_shared<AFindPV>(&param_);
-		finder->SetIDs(gid, uid, cid);
+		finder->SetIDs(gid, uid, cid, hdu);
 		finders_.push_back(finder);
 	}
 
@@ -317,11 +294,23 @@ void DoProcess::thread_reduct() {
 		cv_reduct_.wait(lck);
 
 		while (!reduct_->IsWorking() && queReduct_.size()) {
-			mutex_lock lck1(mtx_frm_reduct_);
 			FramePtr frame;
-			frame = queReduct_.front();
-			queReduct_.pop_front();
-			if (check_image(frame)) reduct_->DoIt(frame);
+			{
+				mutex_lock lck1(mtx_frm_reduct_);
+				frame = queReduct_.front();
+				queReduct_.pop_front();
+			}
+			if (!check_image(frame)) continue;
+			// 平场由预处理收集并合并
+			if (_gPreProc.use_count() && _gPreProc->AddFlat(frame)) continue;
+			// 多扩展图像: 各图像扩展并行完成全部流程
+			if (frame->subfrms.size()) MosaicResult(frame, mosaic_->DoIt(frame));
+			// 数据立方体: 各平面并行完成全部流程
+			else if (frame->nplane) {
+				cube_->DoIt(frame);
+				CubeResult();
+			}
+			else reduct_->DoIt(frame);
 		}
 	}
 }
@@ -529,6 +518,7 @@ void DoProcess::on_receive_fileserver(const long, const long) {
 
 				// 通知可以处理数据
 				mutex_lock lck(mtx_frm_reduct_);
+				StageEnqueue(frame, STAGE_REDUCT);
 				queReduct_.push_back(frame);
 				cv_reduct_.notify_one();
 			}
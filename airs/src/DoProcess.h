@@ -30,6 +30,8 @@
 #include "AsciiProtocol.h"
 #include "LogCalibrated.h"
 #include "AFindPV.h"
+#include "MosaicReduct.h"
+#include "CubeReduct.h"
 
 class DoProcess : public MessageQueue {
 public:
@@ -66,6 +68,7 @@ protected:
 	boost::mutex mtx_frm_astro_;	//< 互斥锁: 天文定位
 	boost::mutex mtx_frm_match_;	//< 互斥锁: 匹配星表
 	boost::mutex mtx_frm_photo_;	//< 互斥锁: 测光
+	boost::mutex mtx_finders_;		//< 互斥锁: 运动目标关联. 测光线程与图像处理线程(多扩展图像、数据立方体)同时访问
 	FrameQueue queReduct_;		//< 队列: 图像处理
 	FrameQueue queAstro_;		//< 队列: 天文定位
 	FrameQueue queMatch_;		//< 队列: 与星表匹配并重新建立定位关系
@@ -74,6 +77,8 @@ protected:
 	AstroMetryPtr astro_;		//< 接口: 天文定位
 	MatchCatPtr   match_;		//< 接口: 匹配星表
 	PhotoMetryPtr photo_;		//< 接口: 测光
+	MosaicReductPtr mosaic_;	//< 接口: 多扩展图像
+	CubeReductPtr   cube_;		//< 接口: 数据立方体
 	FindPVVec finders_;			//< 接口: 运动目标关联
 	threadptr thrd_reduct_;		//< 线程: 图像处理
 	threadptr thrd_astro_;		//< 线程: 天文定位
@@ -134,6 +139,18 @@ public:
 	 * @param rslt 流量定标结果. true: 成功; false: 失败
 	 */
 	void PhotometryResult(bool rslt);
+	/*!
+	 * @brief 多扩展图像处理结果
+	 * @param frame 图像
+	 * @param rslt  合并结果. true: 至少一个图像扩展完成测光
+	 */
+	void MosaicResult(FramePtr frame, bool rslt);
+	/*!
+	 * @brief 数据立方体处理结果
+	 * @note
+	 * 按平面序号输出定标日志并关联运动目标. 平面及其处理结果取自cube_
+	 */
+	void CubeResult();
 
 protected:
 	/*!
@@ -141,6 +158,10 @@ protected:
 	 * @param dstdir 目标目录名
 	 */
 	void copy_sexcfg(const string& dstdir);
+	/*!
+	 * @brief 向总控服务器发送图像FWHM
+	 */
+	void send_fwhm(FramePtr frame);
 	/* 数据处理 */
 	/*!
 	 * @breif 创建AstroDIP/AstroMetry/PhotoMetry对象
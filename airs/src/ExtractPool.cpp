@@ -0,0 +1,315 @@
+/*!
+ * @file ExtractPool.cpp 预先启动的SExtractor工作进程池
+ * @version 0.1
+ * @date 2020-11-08
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <boost/make_shared.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "ExtractPool.h"
+#include "FrameStat.h"
+#include "GLog.h"
+
+/*
+ * 完整读取/写入定长消息. 返回false表示对端已关闭或出错
+ */
+static bool read_full(int fd, void *buf, size_t size) {
+	char *ptr = (char*) buf;
+	ssize_t n;
+
+	while (size) {
+		if ((n = recv(fd, ptr, size, 0)) > 0) {
+			ptr  += n;
+			size -= n;
+		}
+		else if (n == 0 || errno != EINTR) return false;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t size) {
+	const char *ptr = (const char*) buf;
+	ssize_t n;
+
+	while (size) {
+		// 对端已关闭时不产生SIGPIPE
+		if ((n = send(fd, ptr, size, MSG_NOSIGNAL)) > 0) {
+			ptr  += n;
+			size -= n;
+		}
+		else if (n == 0 || errno != EINTR) return false;
+	}
+	return true;
+}
+
+/*
+ * 经UNIX域套接字传递文件描述符及进程ID
+ */
+static bool send_fd(int fd, pid_t pid, int fdsend) {
+	struct msghdr msg;
+	struct iovec iov;
+	char ctrl[CMSG_SPACE(sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	memset(ctrl, 0, sizeof(ctrl));
+	iov.iov_base = &pid;
+	iov.iov_len  = sizeof(pid_t);
+	msg.msg_iov  = &iov;
+	msg.msg_iovlen = 1;
+	if (fdsend >= 0) {
+		msg.msg_control    = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fdsend, sizeof(int));
+	}
+	ssize_t n;
+	while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+	return n == sizeof(pid_t);
+}
+
+static bool recv_fd(int fd, pid_t &pid, int &fdrecv) {
+	struct msghdr msg;
+	struct iovec iov;
+	char ctrl[CMSG_SPACE(sizeof(int))];
+
+	fdrecv = -1;
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &pid;
+	iov.iov_len  = sizeof(pid_t);
+	msg.msg_iov  = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control    = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	ssize_t n;
+	while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+	if (n != sizeof(pid_t)) return false;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&fdrecv, CMSG_DATA(cmsg), sizeof(int));
+	return pid > 0 && fdrecv >= 0;
+}
+
+ExtractPool::ExtractPool() {
+	recycle_ = 0;
+	server_  = 0;
+	srvfd_   = -1;
+}
+
+ExtractPool::~ExtractPool() {
+	Stop();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool ExtractPool::Start(int n, int recycle) {
+	mutex_lock lck(mtx_);
+	if (!workers_.empty()) return true;
+	if (srvfd_ < 0 && !start_server()) return false;
+
+	recycle_ = recycle < 0 ? 0 : recycle;
+	for (int i = 0; i < n; ++i) {
+		WorkerPtr worker = boost::make_shared<Worker>();
+		if (spawn(*worker)) workers_.push_back(worker);
+	}
+	if (workers_.empty()) return false;
+	_gLog->Write("%d extractor workers started, recycled after %d frames", int(workers_.size()), recycle_);
+	return true;
+}
+
+void ExtractPool::Stop() {
+	mutex_lock lck(mtx_);
+
+	while (!workers_.empty()) {
+		WorkerVec::iterator it = workers_.begin();
+		for (; it != workers_.end() && (*it)->busy; ++it);
+		if (it == workers_.end()) cv_idle_.wait(lck);	// 等待处理中的工作进程
+		else {
+			retire(**it);
+			workers_.erase(it);
+		}
+	}
+	if (srvfd_ >= 0) {// 派生服务进程读到EOF后退出
+		int status;
+		mutex_lock lck1(mtx_srv_);
+		close(srvfd_);
+		srvfd_ = -1;
+		while (waitpid(server_, &status, 0) == -1 && errno == EINTR);
+		server_ = 0;
+	}
+}
+
+bool ExtractPool::IsRunning() {
+	mutex_lock lck(mtx_);
+	return !workers_.empty();
+}
+
+bool ExtractPool::Extract(const ExtractRequest &req, ExtractReply &reply) {
+	WorkerPtr worker;
+	bool success, renew;
+
+	{// 取出空闲工作进程
+		mutex_lock lck(mtx_);
+		while (!worker) {
+			if (workers_.empty()) return false;
+			for (WorkerVec::iterator it = workers_.begin(); it != workers_.end() && !worker; ++it) {
+				if (!(*it)->busy) worker = *it;
+			}
+			if (!worker) cv_idle_.wait(lck);
+		}
+		worker->busy = true;
+	}
+
+	success = write_full(worker->fd, &req, sizeof(ExtractRequest))
+			&& read_full(worker->fd, &reply, sizeof(ExtractReply));
+
+	{
+		mutex_lock lck(mtx_);
+		if (!success) {
+			_gLog->Write(LOG_WARN, "ExtractPool::Extract()", "extractor worker %d exited unexpectedly", worker->pid);
+			retire(*worker);
+		}
+		else if (recycle_ && ++worker->nframe >= recycle_) retire(*worker);
+		if (!(renew = worker->fd < 0)) {
+			worker->busy = false;
+			cv_idle_.notify_all();
+		}
+	}
+	if (renew) {// 替换工作进程: 在锁外等待派生服务进程, 替换期间该工作进程保持忙碌
+		Worker fresh;
+		bool spawned = spawn(fresh);
+		mutex_lock lck(mtx_);
+		if (spawned) *worker = fresh;
+		else {
+			WorkerVec::iterator it = std::find(workers_.begin(), workers_.end(), worker);
+			if (it != workers_.end()) workers_.erase(it);
+		}
+		cv_idle_.notify_all();
+	}
+
+	return success;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool ExtractPool::start_server() {
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		_gLog->Write(LOG_FAULT, "ExtractPool::start_server()", "socketpair: %s", strerror(errno));
+		return false;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	pid_t pid = fork();
+	if (pid == 0) {// 派生服务进程
+		close(fds[0]);
+		server_loop(fds[1]);
+	}
+
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		_gLog->Write(LOG_FAULT, "ExtractPool::start_server()", "failed to fork extractor server");
+		return false;
+	}
+	server_ = pid;
+	srvfd_  = fds[0];
+	return true;
+}
+
+bool ExtractPool::spawn(Worker &worker) {
+	char cmd(1);
+	bool rslt;
+
+	worker.pid    = 0;
+	worker.fd     = -1;
+	worker.nframe = 0;
+	worker.busy   = false;
+	{
+		mutex_lock lck(mtx_srv_);
+		rslt = srvfd_ >= 0 && write_full(srvfd_, &cmd, 1) && recv_fd(srvfd_, worker.pid, worker.fd);
+	}
+	if (!rslt) {
+		_gLog->Write(LOG_FAULT, "ExtractPool::spawn()", "failed to create extractor worker");
+		if (worker.fd >= 0) close(worker.fd);
+		worker.pid = 0;
+		worker.fd  = -1;
+	}
+	return rslt;
+}
+
+void ExtractPool::retire(Worker &worker) {
+	if (worker.fd >= 0) {// 工作进程读到EOF后退出
+		close(worker.fd);
+		worker.fd = -1;
+	}
+	worker.pid = 0;
+}
+
+/*
+ * 忽略SIGCHLD: 退出的工作进程由内核自动回收. 主进程关闭套接字后, 等待剩余工作进程退出
+ * 工作进程恢复缺省处理, 以便等待SExtractor的退出状态
+ */
+void ExtractPool::server_loop(int fd) {
+	char cmd;
+	int fds[2];
+	pid_t pid;
+
+	signal(SIGCHLD, SIG_IGN);
+	while (read_full(fd, &cmd, 1)) {
+		pid = 0;
+		fds[0] = fds[1] = -1;
+		if (!socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+			fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+			fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+			if ((pid = fork()) == 0) {// 工作进程
+				signal(SIGCHLD, SIG_DFL);
+				close(fd);
+				close(fds[0]);
+				worker_loop(fds[1]);
+			}
+			close(fds[1]);
+		}
+		bool sent = send_fd(fd, pid > 0 ? pid : 0, pid > 0 ? fds[0] : -1);
+		if (fds[0] >= 0) close(fds[0]);
+		if (!sent) break;
+	}
+	// 等待全部工作进程退出, 避免其成为孤儿进程
+	while (wait(NULL) != -1 || errno == EINTR);
+	_exit(0);
+}
+
+void ExtractPool::worker_loop(int fd) {
+	ExtractRequest req;
+	ExtractReply reply;
+	pid_t pid;
+
+	while (read_full(fd, &req, sizeof(ExtractRequest))) {
+		memset(&reply, 0, sizeof(ExtractReply));
+		reply.status = -1;
+		reply.tmexec = StatClock();
+		if ((pid = fork()) == 0) {
+			execl(req.pathExe, "sex", req.pathImage,
+				"-c", req.pathConfig,
+				"-CATALOG_NAME", req.pathCatalog,
+				"-CATALOG_TYPE", req.catType,
+				NULL);
+			_exit(1);
+		}
+		else if (pid > 0) {
+			while (wait4(pid, &reply.status, 0, &reply.ru) == -1 && errno == EINTR);
+		}
+		if (!write_full(fd, &reply, sizeof(ExtractReply))) break;
+	}
+	_exit(0);
+}
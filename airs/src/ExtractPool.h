@@ -0,0 +1,126 @@
+/*!
+ * @file ExtractPool.h 预先启动的SExtractor工作进程池
+ * @version 0.1
+ * @date 2020-11-08
+ * @note
+ * - 在载入星表等大块内存之前创建派生服务进程, 所有工作进程(包括替换的工作进程)均由其fork()
+ *   由工作进程启动SExtractor, 避免从占用大量内存的多线程主进程fork()
+ * - 主进程与工作进程之间使用UNIX域套接字对传递请求和结果. 派生服务进程创建套接字对,
+ *   将主进程端经SCM_RIGHTS传回主进程
+ * - 工作进程处理指定帧数后回收并重新创建; 工作进程异常退出时也重新创建
+ * - 回收工作进程只需关闭套接字: 工作进程读到EOF后退出, 由派生服务进程自动回收
+ * - 在互斥锁外申请替换的工作进程, 不阻塞其它调用者
+ * - SExtractor仍然逐帧启动并解析配置文件: 其命令行接口不支持常驻处理多帧
+ */
+
+#ifndef EXTRACTPOOL_H_
+#define EXTRACTPOOL_H_
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/smart_ptr.hpp>
+
+/*!
+ * @struct ExtractRequest 工作进程请求: SExtractor命令行参数
+ */
+struct ExtractRequest {
+	char pathExe[256];		//< SExtractor执行文件路径
+	char pathImage[512];	//< 图像文件路径
+	char pathConfig[256];	//< 配置文件路径
+	char pathCatalog[256];	//< 输出星表路径
+	char catType[16];		//< 输出星表格式
+};
+
+/*!
+ * @struct ExtractReply 工作进程应答
+ */
+struct ExtractReply {
+	int status;			//< SExtractor退出状态. -1: 无法启动
+	struct rusage ru;	//< SExtractor资源占用
+	double tmexec;		//< SExtractor启动时刻, 由StatClock()取得
+};
+
+class ExtractPool {
+public:
+	ExtractPool();
+	virtual ~ExtractPool();
+
+protected:
+	/* 数据类型 */
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+	struct Worker {
+		pid_t pid;		//< 进程ID
+		int fd;			//< 套接字: 主进程端
+		int nframe;		//< 已处理帧数
+		bool busy;		//< 工作标志
+	};
+	typedef boost::shared_ptr<Worker> WorkerPtr;
+	typedef std::vector<WorkerPtr> WorkerVec;
+
+protected:
+	/* 成员变量 */
+	boost::mutex mtx_;		//< 互斥锁: 工作进程
+	boost::condition_variable cv_idle_;	//< 条件: 有空闲工作进程
+	WorkerVec workers_;		//< 工作进程集合
+	int recycle_;			//< 工作进程处理该帧数后回收. 0: 不回收
+	boost::mutex mtx_srv_;	//< 互斥锁: 派生服务请求
+	pid_t server_;			//< 派生服务进程ID
+	int srvfd_;				//< 套接字: 派生服务进程的主进程端
+
+public:
+	/*!
+	 * @brief 创建工作进程
+	 * @param n       工作进程数量
+	 * @param recycle 工作进程处理该帧数后回收. 0: 不回收
+	 * @return
+	 * 操作结果. 至少创建一个工作进程时返回true
+	 */
+	bool Start(int n, int recycle);
+	/*!
+	 * @brief 结束所有工作进程
+	 */
+	void Stop();
+	/*!
+	 * @brief 检查是否有可用的工作进程
+	 */
+	bool IsRunning();
+	/*!
+	 * @brief 由空闲工作进程执行SExtractor, 阻塞等待结果
+	 * @param req   请求
+	 * @param reply 应答
+	 * @return
+	 * 工作进程完成请求时返回true; 工作进程异常时返回false, 并重新创建工作进程
+	 */
+	bool Extract(const ExtractRequest &req, ExtractReply &reply);
+
+protected:
+	/*!
+	 * @brief 创建派生服务进程
+	 */
+	bool start_server();
+	/*!
+	 * @brief 由派生服务进程创建工作进程. 调用者不必持有mtx_
+	 */
+	bool spawn(Worker &worker);
+	/*!
+	 * @brief 关闭套接字, 工作进程读到EOF后退出. 调用者持有互斥锁
+	 */
+	void retire(Worker &worker);
+	/*!
+	 * @brief 派生服务进程主循环: 每收到一个请求创建一个工作进程, 返回其进程ID与套接字
+	 * @param fd 套接字: 派生服务进程端
+	 */
+	static void server_loop(int fd);
+	/*!
+	 * @brief 工作进程主循环: 读取请求, 启动SExtractor并等待其结束, 返回应答
+	 * @param fd 套接字: 工作进程端
+	 */
+	static void worker_loop(int fd);
+};
+
+extern boost::shared_ptr<ExtractPool> _gExtract;	//< SExtractor工作进程池
+
+#endif /* EXTRACTPOOL_H_ */
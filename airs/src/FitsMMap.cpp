@@ -0,0 +1,736 @@
+/**
+ * @file FitsMMap.cpp 以内存映射方式读取FITS图像像素
+ * @version 0.2
+ * @date 2020-11-13
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <zlib.h>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include "FitsMMap.h"
+#include "FrameStat.h"
+#include "ADISimd.h"
+
+using std::string;
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+#define FITS_CARD	80		// 关键字记录长度
+#define FITS_BLOCK	2880	// 头单元和数据单元的块长度
+
+/*!
+ * @struct FitsHDU 头单元中与图像相关的关键字
+ */
+struct FitsHDU {
+	bool simple;		//< 主HDU
+	string xtension;	//< 扩展类型
+	int bitpix;			//< 像素位数
+	int naxis;			//< 维度
+	std::vector<long long> naxes;	//< 各维度长度
+	long long pcount, gcount;	//< 附加数据
+	double bzero, bscale;	//< 像素换算
+	/* 瓦片压缩图像 */
+	bool zimage;		//< 瓦片压缩图像
+	bool quantized;		//< 浮点数据经量化: 二进制表含ZSCALE列
+	string zcmptype;	//< 压缩算法
+	int zbitpix, znaxis, znaxis1, znaxis2;	//< 图像参数
+	int ztile1, ztile2;	//< 瓦片尺寸
+	std::map<int, string> zname, zval;	//< 压缩参数
+	/* 二进制表 */
+	std::map<int, string> ttype, tform;	//< 列名与格式
+	long long theap;	//< 堆偏移量
+
+public:
+	FitsHDU() {
+		simple = zimage = quantized = false;
+		bitpix = naxis = 0;
+		pcount = 0;
+		gcount = 1;
+		bzero  = 0.0;
+		bscale = 1.0;
+		zbitpix = znaxis = znaxis1 = znaxis2 = 0;
+		ztile1 = ztile2 = 0;
+		theap  = -1;
+	}
+
+	/*!
+	 * @brief 数据单元长度, 不含填充
+	 */
+	unsigned long long DataSize() {
+		if (!naxis) return 0;
+		unsigned long long n(1);
+		for (int i = 0; i < naxis; ++i) n *= naxes[i];
+		return (unsigned long long) (abs(bitpix) / 8) * gcount * (pcount + n);
+	}
+};
+
+/*
+ * 字符串型关键字: 单引号内的内容, 两个连续单引号表示一个单引号, 删除尾部空格
+ */
+static string card_string(const char *value) {
+	string str;
+	const char *p = value;
+
+	while (*p == ' ') ++p;
+	if (*p++ != '\'') return str;
+	for (; *p; ++p) {
+		if (*p == '\'') {
+			if (p[1] != '\'') break;
+			++p;
+		}
+		str += *p;
+	}
+	while (str.size() && str[str.size() - 1] == ' ') str.erase(str.size() - 1);
+	return str;
+}
+
+/*!
+ * @brief 解析一个HDU的头单元
+ * @return
+ * 头单元长度, 含填充. 头单元不完整时返回0
+ */
+static size_t parse_hdu(const unsigned char *start, size_t avail, FitsHDU &hdu) {
+	const char *card = (const char*) start;
+	const char *end  = card + avail;
+	char key[9], value[72];
+	int n;
+
+	for (; card + FITS_CARD <= end; card += FITS_CARD) {
+		memcpy(key, card, 8);
+		key[8] = 0;
+		for (int i = 7; i >= 0 && key[i] == ' '; --i) key[i] = 0;
+		if (!strcmp(key, "END")) break;
+		if (card[8] != '=' || card[9] != ' ') continue;
+		memcpy(value, card + 10, 70);
+		value[70] = 0;
+		if (value[strspn(value, " ")] == '\'') {// 字符串型关键字
+			string str = card_string(value);
+			if      (!strcmp(key, "XTENSION")) hdu.xtension = str;
+			else if (!strcmp(key, "ZCMPTYPE")) hdu.zcmptype = str;
+			else if (!strncmp(key, "ZNAME", 5) && (n = atoi(key + 5)) > 0) hdu.zname[n] = str;
+			else if (!strncmp(key, "TTYPE", 5) && (n = atoi(key + 5)) > 0) hdu.ttype[n] = str;
+			else if (!strncmp(key, "TFORM", 5) && (n = atoi(key + 5)) > 0) hdu.tform[n] = str;
+			continue;
+		}
+		if (char *slash = strchr(value, '/')) *slash = 0;	// 数值型关键字的注释
+		for (char *p = value; *p; ++p) {// 双精度指数D改为E
+			if (*p == 'D') *p = 'E';
+		}
+
+		if      (!strcmp(key, "SIMPLE"))  hdu.simple  = strchr(value, 'T') != NULL;
+		else if (!strcmp(key, "ZIMAGE"))  hdu.zimage  = strchr(value, 'T') != NULL;
+		else if (!strcmp(key, "BITPIX"))  hdu.bitpix  = atoi(value);
+		else if (!strcmp(key, "NAXIS")) {
+			if ((hdu.naxis = atoi(value)) < 0 || hdu.naxis > 999) return 0;
+			hdu.naxes.assign(hdu.naxis, 0);
+		}
+		else if (!strncmp(key, "NAXIS", 5) && (n = atoi(key + 5)) > 0 && n <= hdu.naxis)
+			hdu.naxes[n - 1] = atoll(value);
+		else if (!strcmp(key, "PCOUNT"))  hdu.pcount  = atoll(value);
+		else if (!strcmp(key, "GCOUNT"))  hdu.gcount  = atoll(value);
+		else if (!strcmp(key, "BZERO"))   hdu.bzero   = atof(value);
+		else if (!strcmp(key, "BSCALE"))  hdu.bscale  = atof(value);
+		else if (!strcmp(key, "THEAP"))   hdu.theap   = atoll(value);
+		else if (!strcmp(key, "ZBITPIX")) hdu.zbitpix = atoi(value);
+		else if (!strcmp(key, "ZNAXIS"))  hdu.znaxis  = atoi(value);
+		else if (!strcmp(key, "ZNAXIS1")) hdu.znaxis1 = atoi(value);
+		else if (!strcmp(key, "ZNAXIS2")) hdu.znaxis2 = atoi(value);
+		else if (!strcmp(key, "ZTILE1"))  hdu.ztile1  = atoi(value);
+		else if (!strcmp(key, "ZTILE2"))  hdu.ztile2  = atoi(value);
+		else if (!strncmp(key, "ZVAL", 4) && (n = atoi(key + 4)) > 0) hdu.zval[n] = value;
+	}
+	if (card + FITS_CARD > end) return 0;
+
+	size_t length = card + FITS_CARD - (const char*) start;
+	return (length + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK;
+}
+
+/*!
+ * @brief 二进制表列宽度, 量纲: 字节
+ */
+static int column_width(const string &tform) {
+	const char *p = tform.c_str();
+	int repeat = isdigit(*p) ? atoi(p) : 1;
+
+	while (isdigit(*p)) ++p;
+	switch (*p) {
+	case 'L':
+	case 'B':
+	case 'A': return repeat;
+	case 'X': return (repeat + 7) / 8;
+	case 'I': return repeat * 2;
+	case 'J':
+	case 'E': return repeat * 4;
+	case 'K':
+	case 'D':
+	case 'C':
+	case 'P': return repeat * 8;
+	case 'M':
+	case 'Q': return repeat * 16;
+	default:  return -1;
+	}
+}
+
+static inline uint32_t get_be32(const unsigned char *p) {
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static inline uint64_t get_be64(const unsigned char *p) {
+	return (uint64_t(get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+/*!
+ * @brief 将大端序数据原位转换为本机字节序
+ */
+static void swap_native(unsigned char *data, size_t n, int elem) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (elem == 2) {
+		uint16_t *p = (uint16_t*) data;
+		for (size_t i = 0; i < n; ++i) p[i] = __builtin_bswap16(p[i]);
+	}
+	else if (elem == 4) {
+		uint32_t *p = (uint32_t*) data;
+		for (size_t i = 0; i < n; ++i) p[i] = __builtin_bswap32(p[i]);
+	}
+	else if (elem == 8) {
+		uint64_t *p = (uint64_t*) data;
+		for (size_t i = 0; i < n; ++i) p[i] = __builtin_bswap64(p[i]);
+	}
+#endif
+}
+
+/*!
+ * @struct RiceBits RICE_1码流, 高位在前
+ */
+struct RiceBits {
+	const unsigned char *ptr, *end;
+	uint64_t buf;	//< 位缓存: 低nbits位有效
+	int nbits;
+
+public:
+	RiceBits(const unsigned char *start, const unsigned char *stop) {
+		ptr = start;
+		end = stop;
+		buf = 0;
+		nbits = 0;
+	}
+
+	void Fill() {
+		while (nbits <= 56 && ptr < end) {
+			buf = (buf << 8) | *ptr++;
+			nbits += 8;
+		}
+	}
+
+	/*!
+	 * @brief 读取k位, k <= 32
+	 */
+	bool Get(int k, uint32_t &v) {
+		if (nbits < k) {
+			Fill();
+			if (nbits < k) return false;
+		}
+		nbits -= k;
+		v = uint32_t((buf >> nbits) & ((uint64_t(1) << k) - 1));
+		return true;
+	}
+
+	/*!
+	 * @brief 读取一元编码: 统计1之前0的数量
+	 */
+	bool Unary(uint32_t &nzero) {
+		uint64_t x;
+		int lz;
+
+		for (nzero = 0; ; ) {
+			if (!nbits) {
+				Fill();
+				if (!nbits) return false;
+			}
+			if (!(x = buf << (64 - nbits))) {
+				nzero += nbits;
+				nbits = 0;
+			}
+			else {
+				lz = __builtin_clzll(x);
+				nzero += lz;
+				nbits -= lz + 1;
+				return true;
+			}
+		}
+	}
+};
+
+/*
+ * RICE_1解码, 与cfitsio的fits_rdecomp一致:
+ * - 首像素以bytepix字节原码存储
+ * - 每nblock个像素共用编码参数fs, 像素差值按符号折叠为非负整数
+ * - fs < 0: 差值全部为0; fs = fsmax: 差值以原码存储; 否则高位为一元编码, 低fs位为原码
+ * - 解码值按bytepix截断: 1字节无符号, 2或4字节有符号
+ */
+template <typename T>
+static bool rice_decode(const unsigned char *src, size_t len, int bytepix, int nblock, size_t npix, T *array) {
+	int fsbits, fsmax, bbits, fs;
+	uint32_t lastpix(0), diff, nzero, low;
+	size_t i, imax;
+
+	if (bytepix == 1) {
+		fsbits = 3;
+		fsmax  = 6;
+		bbits  = 8;
+	}
+	else if (bytepix == 2) {
+		fsbits = 4;
+		fsmax  = 14;
+		bbits  = 16;
+	}
+	else {
+		fsbits = 5;
+		fsmax  = 25;
+		bbits  = 32;
+	}
+	if (len < size_t(bytepix)) return false;
+	for (int j = 0; j < bytepix; ++j) lastpix = (lastpix << 8) | *src++;
+
+	RiceBits bits(src, src + len - bytepix);
+	for (i = 0; i < npix; ) {
+		if (!bits.Get(fsbits, diff)) return false;
+		fs   = int(diff) - 1;
+		imax = std::min(i + nblock, npix);
+		for (; i < imax; ++i) {
+			if (fs < 0) diff = 0;
+			else if (fs == fsmax) {
+				if (!bits.Get(bbits, diff)) return false;
+			}
+			else {
+				if (!bits.Unary(nzero) || !bits.Get(fs, low)) return false;
+				diff = (nzero << fs) | low;
+			}
+			lastpix += (diff & 1) ? ~(diff >> 1) : (diff >> 1);
+			if (bytepix == 1)      array[i] = T(uint8_t(lastpix));
+			else if (bytepix == 2) array[i] = T(int16_t(uint16_t(lastpix)));
+			else                   array[i] = T(int32_t(lastpix));
+		}
+	}
+	return true;
+}
+
+/*!
+ * @brief GZIP解压, 解压长度需与预期一致
+ */
+static bool gzip_decode(const unsigned char *src, size_t len, unsigned char *dst, size_t n) {
+	z_stream zs;
+	bool rslt;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, MAX_WBITS + 32) != Z_OK) return false;	// +32: 自动识别gzip或zlib格式
+	zs.next_in   = (Bytef*) src;
+	zs.avail_in  = uInt(len);
+	zs.next_out  = dst;
+	zs.avail_out = uInt(n);
+	rslt = inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == n;
+	inflateEnd(&zs);
+	return rslt;
+}
+
+/*!
+ * @brief 本机字节序存储值换算为浮点数
+ */
+template <typename T>
+static void scale_native(const T *src, int n, double bscale, double bzero, float *dst) {
+	if (bscale == 1.0 && bzero == 0.0) {
+		for (int i = 0; i < n; ++i) dst[i] = float(src[i]);
+	}
+	else {
+		for (int i = 0; i < n; ++i) dst[i] = float(src[i] * bscale + bzero);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+FitsMMap::FitsMMap() {
+	map_    = NULL;
+	szmap_  = 0;
+	data_   = NULL;
+	bitpix_ = 0;
+	width_  = height_ = 0;
+	bzero_  = 0.0;
+	bscale_ = 1.0;
+	zcmp_   = ZCMP_NONE;
+	tilew_  = tileh_ = 0;
+	ntilex_ = ntiley_ = 0;
+	blocksize_ = bytepix_ = 0;
+	rowlen_ = colofs_ = 0;
+	desc64_ = false;
+	heap_   = NULL;
+	szheap_ = 0;
+}
+
+FitsMMap::~FitsMMap() {
+	Close();
+}
+
+bool FitsMMap::Open(const std::string &filepath, int hdu, int plane) {
+	struct stat st;
+	void *ptr;
+	int fd;
+
+	Close();
+	if ((fd = open(filepath.c_str(), O_RDONLY)) < 0) return false;
+	if (fstat(fd, &st) || st.st_size < FITS_BLOCK) {
+		close(fd);
+		return false;
+	}
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return false;
+	map_   = (unsigned char*) ptr;
+	szmap_ = st.st_size;
+	if (!parse_file(hdu, plane)) {
+		Close();
+		return false;
+	}
+	madvise(map_, szmap_, MADV_SEQUENTIAL);
+	return true;
+}
+
+void FitsMMap::Close() {
+	if (map_) {
+		munmap(map_, szmap_);
+		map_   = NULL;
+		szmap_ = 0;
+		data_  = NULL;
+		heap_  = NULL;
+	}
+}
+
+bool FitsMMap::IsOpen() {
+	return data_ != NULL;
+}
+
+bool FitsMMap::IsCompressed() {
+	return zcmp_ != ZCMP_NONE;
+}
+
+int FitsMMap::Width() {
+	return width_;
+}
+
+int FitsMMap::Height() {
+	return height_;
+}
+
+int FitsMMap::Bitpix() {
+	return bitpix_;
+}
+
+double FitsMMap::Bzero() {
+	return bzero_;
+}
+
+double FitsMMap::Bscale() {
+	return bscale_;
+}
+
+bool FitsMMap::ReadRows(int y0, int y1, float *data) {
+	return ReadRect(0, y0, width_, y1, data);
+}
+
+bool FitsMMap::ReadRect(int x0, int y0, int x1, int y1, float *data) {
+	int w = x1 - x0, elem = abs(bitpix_) / 8;
+
+	if (!data_ || x0 < 0 || y0 < 0 || x1 > width_ || y1 > height_) return false;
+	if (x0 >= x1 || y0 >= y1) return true;
+	if (zcmp_ == ZCMP_NONE) {
+		size_t szrow = size_t(width_) * elem;
+		const unsigned char *src = data_ + szrow * y0 + size_t(x0) * elem;
+
+		// 逐行转换: 一行原始数据与转换结果同时驻留缓存
+		for (int y = y0; y < y1; ++y, src += szrow, data += w)
+			convert_row(src, w, data);
+		return true;
+	}
+
+	std::vector<unsigned char> buf, tmp;
+	int tx0, ty0, tw, th, cx0, cx1, cy0, cy1;
+
+	for (int ty = y0 / tileh_; ty <= (y1 - 1) / tileh_; ++ty) {
+		for (int tx = x0 / tilew_; tx <= (x1 - 1) / tilew_; ++tx) {
+			if (!decode_tile(ty * ntilex_ + tx, buf, tmp)) return false;
+			tx0 = tx * tilew_;
+			ty0 = ty * tileh_;
+			tw  = std::min(tilew_, width_ - tx0);
+			th  = std::min(tileh_, height_ - ty0);
+			cx0 = std::max(x0, tx0);
+			cx1 = std::min(x1, tx0 + tw);
+			cy0 = std::max(y0, ty0);
+			cy1 = std::min(y1, ty0 + th);
+			for (int y = cy0; y < cy1; ++y) {
+				convert_native(&buf[0] + (size_t(y - ty0) * tw + cx0 - tx0) * elem, cx1 - cx0,
+						data + size_t(y - y0) * w + cx0 - x0);
+			}
+		}
+	}
+	return true;
+}
+
+bool FitsMMap::ReadImage(float *data, int nthread) {
+	return read_all(data, false, nthread);
+}
+
+bool FitsMMap::ReadRaw(void *data, int nthread) {
+	return read_all(data, true, nthread);
+}
+
+/*
+ * 主HDU须为SIMPLE = T, 图像须为二维. 压缩图像的主HDU的NAXIS为0, 图像在随后的二进制表中
+ * 未压缩的三维图像按平面偏移数据单元首地址, 其余平面不访问
+ */
+bool FitsMMap::parse_file(int hdu, int plane) {
+	const unsigned char *ptr = map_, *end = map_ + szmap_, *data;
+	unsigned long long ndata, offset(0);
+	size_t nhead;
+	int target(hdu);
+
+	zcmp_ = ZCMP_NONE;
+	for (int i = 0; ptr < end; ++i, ptr = data + (ndata + FITS_BLOCK - 1) / FITS_BLOCK * FITS_BLOCK) {
+		FitsHDU h;
+
+		if (!(nhead = parse_hdu(ptr, end - ptr, h))) return false;
+		if ((i == 0 && !h.simple) || (i > 0 && h.xtension.empty())) return false;
+		data  = ptr + nhead;
+		ndata = h.DataSize();
+		if (ndata > (unsigned long long) (end - data)) return false;	// 文件被截断
+		if (i < target) continue;
+		if (i == 0 && hdu == 0 && h.naxis == 0) {// 主HDU不含图像: 取随后的图像扩展
+			target = 1;
+			continue;
+		}
+		if (target != hdu && !h.zimage && h.xtension != "IMAGE") return false;
+
+		if (!h.zimage) {// 未压缩图像
+			if (i > 0 && h.xtension != "IMAGE") return false;
+			if (h.naxis == 3) {// 数据立方体: 映射指定平面
+				if (plane < 1 || plane > h.naxes[2]) return false;
+				offset = (unsigned long long) h.naxes[0] * h.naxes[1] * (abs(h.bitpix) / 8) * (plane - 1);
+			}
+			else if (h.naxis != 2) return false;
+			bitpix_ = h.bitpix;
+			width_  = int(h.naxes[0]);
+			height_ = int(h.naxes[1]);
+		}
+		else {// 瓦片压缩图像
+			if (h.xtension != "BINTABLE" || h.naxis != 2 || h.znaxis != 2) return false;
+			if      (h.zcmptype == "RICE_1" || h.zcmptype == "RICE_ONE") zcmp_ = ZCMP_RICE;
+			else if (h.zcmptype == "GZIP_1") zcmp_ = ZCMP_GZIP1;
+			else if (h.zcmptype == "GZIP_2") zcmp_ = ZCMP_GZIP2;
+			else return false;
+			bitpix_ = h.zbitpix;
+			width_  = h.znaxis1;
+			height_ = h.znaxis2;
+			tilew_  = h.ztile1 > 0 ? h.ztile1 : width_;
+			tileh_  = h.ztile2 > 0 ? h.ztile2 : 1;
+			if (width_ < 1 || height_ < 1) return false;
+			ntilex_ = (width_ + tilew_ - 1) / tilew_;
+			ntiley_ = (height_ + tileh_ - 1) / tileh_;
+			blocksize_ = 32;
+			bytepix_   = abs(bitpix_) / 8;
+			for (std::map<int, string>::iterator it = h.zname.begin(); it != h.zname.end(); ++it) {
+				if (!h.zval.count(it->first)) continue;
+				if      (it->second == "BLOCKSIZE") blocksize_ = atoi(h.zval[it->first].c_str());
+				else if (it->second == "BYTEPIX")   bytepix_   = atoi(h.zval[it->first].c_str());
+			}
+			if (blocksize_ < 1 || !(bytepix_ == 1 || bytepix_ == 2 || bytepix_ == 4)) return false;
+			// 瓦片表: 每个瓦片一行, 压缩数据为变长数组
+			int nrow = int(h.naxes[1]), width;
+			rowlen_ = int(h.naxes[0]);
+			colofs_ = -1;
+			for (int col = 1, ofs = 0; col <= int(h.tform.size()); ++col, ofs += width) {
+				if ((width = column_width(h.tform[col])) < 0) return false;
+				if (h.ttype[col] == "ZSCALE" && bitpix_ < 0) h.quantized = true;
+				else if (h.ttype[col] == "COMPRESSED_DATA") {
+					desc64_ = h.tform[col].find('Q') != string::npos;
+					if (!desc64_ && h.tform[col].find('P') == string::npos) return false;
+					colofs_ = ofs;
+				}
+			}
+			// 浮点图像: 只处理无损GZIP
+			if (colofs_ < 0 || nrow != ntilex_ * ntiley_ || (bitpix_ < 0 && (zcmp_ == ZCMP_RICE || h.quantized)))
+				return false;
+			long long szmain = (long long) rowlen_ * nrow;
+			if (h.theap < 0) h.theap = szmain;
+			if (h.theap < szmain || (unsigned long long) h.theap > ndata) return false;
+			heap_   = data + h.theap;
+			szheap_ = size_t(ndata - h.theap);
+		}
+		if (!(bitpix_ == 8 || bitpix_ == 16 || bitpix_ == 32 || bitpix_ == -32 || bitpix_ == -64)
+				|| width_ < 1 || height_ < 1)
+			return false;
+		if (zcmp_ == ZCMP_NONE && ndata < offset + (unsigned long long) width_ * height_ * (abs(bitpix_) / 8))
+			return false;
+		bzero_  = h.bzero;
+		bscale_ = h.bscale;
+		data_   = data + offset;
+		return true;
+	}
+	return false;
+}
+
+bool FitsMMap::read_all(void *data, bool raw, int nthread) {
+	int nunit = zcmp_ == ZCMP_NONE ? height_ : ntilex_ * ntiley_;
+
+	if (!data_) return false;
+	if (nthread > nunit) nthread = nunit;
+	if (nthread < 1) nthread = 1;
+	std::vector<char> ok(nthread, 1);
+	if (nthread == 1) read_units(data, raw, 0, nunit, 1, &ok[0]);
+	else {
+		StatThreadGroup grp;
+		for (int i = 0; i < nthread; ++i) {
+			if (zcmp_ == ZCMP_NONE) {// 未压缩图像: 各线程处理连续的图像行
+				grp.create_thread(boost::bind(&FitsMMap::read_units, this, data, raw,
+						nunit * i / nthread, nunit * (i + 1) / nthread, 1, &ok[i]));
+			}
+			else {// 压缩图像: 瓦片压缩率不同, 各线程交替处理
+				grp.create_thread(boost::bind(&FitsMMap::read_units, this, data, raw,
+						i, nunit, nthread, &ok[i]));
+			}
+		}
+		grp.join_all();
+	}
+	return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+void FitsMMap::read_units(void *data, bool raw, int u0, int u1, int step, char *ok) {
+	int elem = abs(bitpix_) / 8;
+	unsigned char *out = (unsigned char*) data;
+
+	if (zcmp_ == ZCMP_NONE) {
+		size_t szrow = size_t(width_) * elem;
+		for (int y = u0; y < u1; y += step) {
+			if (!raw) convert_row(data_ + szrow * y, width_, (float*) data + size_t(y) * width_);
+			else {
+				memcpy(out + szrow * y, data_ + szrow * y, szrow);
+				swap_native(out + szrow * y, width_, elem);
+			}
+		}
+		return;
+	}
+
+	std::vector<unsigned char> buf, tmp;
+	int x0, y0, w, h, j;
+	size_t ofs;
+
+	for (int t = u0; t < u1; t += step) {
+		if (!decode_tile(t, buf, tmp)) {
+			*ok = 0;
+			return;
+		}
+		x0 = (t % ntilex_) * tilew_;
+		y0 = (t / ntilex_) * tileh_;
+		w  = std::min(tilew_, width_ - x0);
+		h  = std::min(tileh_, height_ - y0);
+		for (j = 0; j < h; ++j) {
+			ofs = size_t(y0 + j) * width_ + x0;
+			if (raw) memcpy(out + ofs * elem, &buf[0] + size_t(j) * w * elem, size_t(w) * elem);
+			else convert_native(&buf[0] + size_t(j) * w * elem, w, (float*) data + ofs);
+		}
+	}
+}
+
+bool FitsMMap::decode_tile(int tile, std::vector<unsigned char> &buf, std::vector<unsigned char> &tmp) {
+	const unsigned char *desc = data_ + size_t(rowlen_) * tile + colofs_;
+	int x0 = (tile % ntilex_) * tilew_;
+	int y0 = (tile / ntilex_) * tileh_;
+	size_t npix = size_t(std::min(tilew_, width_ - x0)) * std::min(tileh_, height_ - y0);
+	int elem = abs(bitpix_) / 8;
+	uint64_t nbytes, offset;
+
+	// 变长数组描述符: 元素数量, 堆内偏移量
+	nbytes = desc64_ ? get_be64(desc) : get_be32(desc);
+	offset = desc64_ ? get_be64(desc + 8) : get_be32(desc + 4);
+	if (!nbytes || offset > szheap_ || nbytes > szheap_ - offset) return false;	// 无压缩数据或数据越界
+	const unsigned char *src = heap_ + offset;
+
+	buf.resize(npix * elem);
+	if (zcmp_ == ZCMP_RICE) {
+		if (bitpix_ == 8)  return rice_decode(src, nbytes, bytepix_, blocksize_, npix, (uint8_t*) &buf[0]);
+		if (bitpix_ == 16) return rice_decode(src, nbytes, bytepix_, blocksize_, npix, (int16_t*) &buf[0]);
+		return rice_decode(src, nbytes, bytepix_, blocksize_, npix, (int32_t*) &buf[0]);
+	}
+	if (zcmp_ == ZCMP_GZIP1) {
+		if (!gzip_decode(src, nbytes, &buf[0], buf.size())) return false;
+	}
+	else {// GZIP_2: 各像素的第1字节、第2字节...依次连续存储
+		tmp.resize(buf.size());
+		if (!gzip_decode(src, nbytes, &tmp[0], tmp.size())) return false;
+		for (int b = 0; b < elem; ++b) {
+			const unsigned char *plane = &tmp[0] + npix * b;
+			for (size_t i = 0; i < npix; ++i) buf[i * elem + b] = plane[i];
+		}
+	}
+	swap_native(&buf[0], npix, elem);
+	return true;
+}
+
+/*
+ * 换算与cfitsio一致: 以双精度计算 v * BSCALE + BZERO 后转换为单精度
+ * 16位整数在BSCALE = 1且BZERO为整数时, 单精度运算结果精确, 使用向量化实现
+ */
+void FitsMMap::convert_row(const unsigned char *src, int n, float *dst) {
+	int i;
+
+	if (bitpix_ == 16) {
+		if (bscale_ == 1.0 && bzero_ == floor(bzero_) && fabs(bzero_) <= 16744448.0) // 2^24 - 2^15
+			SimdSwapI16(src, n, float(bzero_), dst);
+		else {
+			for (i = 0; i < n; ++i, src += 2)
+				dst[i] = float(short((src[0] << 8) | src[1]) * bscale_ + bzero_);
+		}
+	}
+	else if (bitpix_ == -32) {
+		SimdSwapF32(src, n, dst);
+		if (bscale_ != 1.0 || bzero_ != 0.0) {
+			for (i = 0; i < n; ++i) dst[i] = float(dst[i] * bscale_ + bzero_);
+		}
+	}
+	else if (bitpix_ == 8) {
+		for (i = 0; i < n; ++i) dst[i] = float(src[i] * bscale_ + bzero_);
+	}
+	else if (bitpix_ == 32) {
+		for (i = 0; i < n; ++i, src += 4)
+			dst[i] = float(int32_t(get_be32(src)) * bscale_ + bzero_);
+	}
+	else {// -64
+		uint64_t u;
+		double v;
+		for (i = 0; i < n; ++i, src += 8) {
+			u = get_be64(src);
+			memcpy(&v, &u, 8);
+			dst[i] = float(v * bscale_ + bzero_);
+		}
+	}
+}
+
+void FitsMMap::convert_native(const unsigned char *src, int n, float *dst) {
+	switch (bitpix_) {
+	case 8:   scale_native((const uint8_t*) src, n, bscale_, bzero_, dst); break;
+	case 16:  scale_native((const int16_t*) src, n, bscale_, bzero_, dst); break;
+	case 32:  scale_native((const int32_t*) src, n, bscale_, bzero_, dst); break;
+	case -32: scale_native((const float*) src,   n, bscale_, bzero_, dst); break;
+	default:  scale_native((const double*) src,  n, bscale_, bzero_, dst); break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+}
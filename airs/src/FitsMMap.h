@@ -0,0 +1,163 @@
+/**
+ * @file FitsMMap.h 以内存映射方式读取FITS图像像素
+ * @version 0.2
+ * @date 2020-11-13
+ * @note
+ * - 处理未压缩二维图像(主HDU或IMAGE扩展)和瓦片压缩二维图像(ZIMAGE二进制表)
+ * - 未压缩数据立方体(NAXIS3)按平面映射, 平面视为二维图像
+ * - 瓦片压缩: 支持RICE_1(整数图像)、GZIP_1和GZIP_2. 量化浮点图像及其它算法
+ *   由调用者改用cfitsio读取
+ * - 解析头单元获取图像参数, 数据单元映射后不复制
+ * - 像素按需转换: 读取指定区域时完成字节序转换或解压, 及BZERO/BSCALE换算,
+ *   结果与fits_read_img(TFLOAT)一致
+ * - 读取矩形区域时只解压与区域相交的瓦片
+ * - 读取全图时由多线程并行转换图像行或解压瓦片
+ * - 16位整数和单精度浮点数使用AVX2(ADISimd)转换, 按行分块以保持在缓存内
+ */
+
+#ifndef FITSMMAP_H_
+#define FITSMMAP_H_
+
+#include <string>
+#include <vector>
+
+namespace AstroUtil {
+//////////////////////////////////////////////////////////////////////////////
+class FitsMMap {
+public:
+	FitsMMap();
+	virtual ~FitsMMap();
+
+public:
+	/* 数据类型 */
+	enum {// 压缩算法
+		ZCMP_NONE,	//< 未压缩
+		ZCMP_RICE,	//< RICE_1
+		ZCMP_GZIP1,	//< GZIP_1
+		ZCMP_GZIP2	//< GZIP_2: 按字节重排后压缩
+	};
+
+protected:
+	/* 成员变量 */
+	unsigned char *map_;	//< 映射区首地址
+	size_t szmap_;			//< 映射区长度
+	const unsigned char *data_;	//< 数据单元首地址. 压缩图像: 二进制表首地址
+	int bitpix_;	//< 像素位数
+	int width_;		//< 图像宽度
+	int height_;	//< 图像高度
+	double bzero_;	//< 像素偏置
+	double bscale_;	//< 像素比例
+	/* 瓦片压缩图像 */
+	int zcmp_;		//< 压缩算法
+	int tilew_;		//< 瓦片宽度
+	int tileh_;		//< 瓦片高度
+	int ntilex_;	//< X方向瓦片数量
+	int ntiley_;	//< Y方向瓦片数量
+	int blocksize_;	//< RICE_1: 分组像素数
+	int bytepix_;	//< RICE_1: 编码字节数
+	int rowlen_;	//< 二进制表行长度
+	int colofs_;	//< COMPRESSED_DATA列在行内的偏移量
+	bool desc64_;	//< 变长数组描述符: true: 64位(Q); false: 32位(P)
+	const unsigned char *heap_;	//< 堆首地址
+	size_t szheap_;	//< 堆长度
+
+public:
+	/*!
+	 * @brief 映射FITS文件
+	 * @param filepath 文件路径
+	 * @param hdu      HDU编号, 0为主HDU. 主HDU不含图像时, 取紧随其后的图像扩展或瓦片压缩图像
+	 * @param plane    数据立方体的平面序号, 从1开始. HDU为二维图像时忽略
+	 * @return
+	 * HDU为可处理的二维图像或立方体平面, 且映射成功时返回true
+	 */
+	bool Open(const std::string &filepath, int hdu = 0, int plane = 0);
+	/*!
+	 * @brief 解除映射
+	 */
+	void Close();
+	/*!
+	 * @brief 检查映射状态
+	 */
+	bool IsOpen();
+	/*!
+	 * @brief 检查是否瓦片压缩图像
+	 */
+	bool IsCompressed();
+	/*!
+	 * @brief 查看图像尺寸
+	 */
+	int Width();
+	int Height();
+	/*!
+	 * @brief 查看像素位数, 即BITPIX. 压缩图像为ZBITPIX
+	 */
+	int Bitpix();
+	/*!
+	 * @brief 查看存储值换算参数: 像素值 = 存储值 * Bscale() + Bzero()
+	 */
+	double Bzero();
+	double Bscale();
+	/*!
+	 * @brief 读取图像[y0, y1)行, 转换为浮点数
+	 * @param y0   起始行
+	 * @param y1   结束行
+	 * @param data 转换结果, 存储空间不少于(y1-y0)*Width()
+	 * @return
+	 * 压缩数据损坏时返回false
+	 */
+	bool ReadRows(int y0, int y1, float *data);
+	/*!
+	 * @brief 读取图像区域[x0, x1)*[y0, y1), 转换为浮点数. 只解压与区域相交的瓦片
+	 * @param data 转换结果, 按行存储, 行长度为x1-x0
+	 */
+	bool ReadRect(int x0, int y0, int x1, int y1, float *data);
+	/*!
+	 * @brief 多线程读取全图, 转换为浮点数
+	 * @param data    转换结果, 存储空间不少于Width()*Height()
+	 * @param nthread 并行线程数
+	 */
+	bool ReadImage(float *data, int nthread);
+	/*!
+	 * @brief 多线程读取全图的存储值, 不做BZERO/BSCALE换算
+	 * @param data    本机字节序的存储值, 数据类型由Bitpix()决定
+	 * @param nthread 并行线程数
+	 */
+	bool ReadRaw(void *data, int nthread);
+
+protected:
+	/*!
+	 * @brief 解析映射区内的HDU, 建立图像参数
+	 */
+	bool parse_file(int hdu, int plane);
+	/*!
+	 * @brief 多线程读取全图
+	 */
+	bool read_all(void *data, bool raw, int nthread);
+	/*!
+	 * @brief 线程: 依次处理[u0, u1)中间隔step的单元. 未压缩图像的单元为行, 压缩图像为瓦片
+	 * @param data 全图存储区
+	 * @param raw  输出存储值
+	 * @param ok   处理结果
+	 */
+	void read_units(void *data, bool raw, int u0, int u1, int step, char *ok);
+	/*!
+	 * @brief 解压一个瓦片, 结果为本机字节序的存储值
+	 * @param tile 瓦片编号
+	 * @param buf  解压结果
+	 * @param tmp  临时存储区
+	 */
+	bool decode_tile(int tile, std::vector<unsigned char> &buf, std::vector<unsigned char> &tmp);
+	/*!
+	 * @brief 转换一行大端序像素
+	 */
+	void convert_row(const unsigned char *src, int n, float *dst);
+	/*!
+	 * @brief 转换一行本机字节序存储值
+	 */
+	void convert_native(const unsigned char *src, int n, float *dst);
+};
+
+//////////////////////////////////////////////////////////////////////////////
+}
+
+#endif /* FITSMMAP_H_ */
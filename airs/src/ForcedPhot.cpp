@@ -0,0 +1,246 @@
+/*!
+ * @file ForcedPhot.cpp 指定位置的强制孔径测光
+ * @version 0.1
+ * @date 2020-11-26
+ */
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include "ForcedPhot.h"
+#include "ADISimd.h"
+#include "FitsMMap.h"
+#include "PreProcess.h"
+#include "GLog.h"
+
+using namespace boost::placeholders;
+
+#define FORCED_SUBPIX	5		// 孔径边界像素的子像素采样数
+#define FORCED_MINBACK	10		// 背景环最少有效像素数
+#define FORCED_MINTASK	32		// 每个线程最少测量的目标数
+
+ForcedPhot::ForcedPhot(Parameter *param) {
+	param_ = param;
+	SetAperture(param->forcedAper, param->forcedInner, param->forcedOuter);
+}
+
+ForcedPhot::~ForcedPhot() {
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void ForcedPhot::SetAperture(double raper, double rin, double rout) {
+	raper_ = raper;
+	rin_   = rin;
+	rout_  = rout;
+}
+
+int ForcedPhot::SkyToImage(const wcsinfo &wcs, ForcedVec &objs) {
+	wcsinfo w(wcs);
+	int n(0);
+
+	for (ForcedVec::iterator it = objs.begin(); it != objs.end(); ++it) {
+		if (w.wcs_to_image(it->ra, it->dec, w.r0, w.d0, it->x, it->y)) ++n;
+		else it->flag |= FORCED_SKY;
+	}
+	return n;
+}
+
+void ForcedPhot::Measure(const float *data, int x0, int y0, int width, int height, ForcedVec &objs, int nthread) {
+	int n(int(objs.size())), step;
+
+	if (nthread > n / FORCED_MINTASK) nthread = n / FORCED_MINTASK;
+	if (nthread <= 1) {
+		measure_range(data, x0, y0, width, height, objs.data(), n);
+		return;
+	}
+
+	boost::thread_group grp;
+	step = (n + nthread - 1) / nthread;
+	for (int i = 0; i < n; i += step) {
+		grp.create_thread(boost::bind(&ForcedPhot::measure_range, this, data, x0, y0, width, height,
+				objs.data() + i, std::min(step, n - i)));
+	}
+	grp.join_all();
+}
+
+bool ForcedPhot::Measure(FramePtr frame, ForcedVec &objs, int nthread) {
+	if (objs.empty()) return true;
+
+	FitsMMap fmap;
+	if (!fmap.Open(frame->filepath)) {
+		_gLog->Write(LOG_WARN, "ForcedPhot::Measure()", "failed to map %s", frame->filepath.c_str());
+		return false;
+	}
+
+	int wimg(fmap.Width()), himg(fmap.Height());
+	int x0(0), y0(0), x1(wimg), y1(himg);
+	boost::shared_array<float> data;
+
+	if (!_gPreProc.use_count()) {// 只读取覆盖全部目标的区域
+		double margin = std::max(raper_, rout_) + 1.0;
+		double xmin(DBL_MAX), ymin(DBL_MAX), xmax(-DBL_MAX), ymax(-DBL_MAX);
+
+		for (ForcedVec::iterator it = objs.begin(); it != objs.end(); ++it) {
+			if (it->flag & FORCED_SKY) continue;
+			if (it->x < xmin) xmin = it->x;
+			if (it->x > xmax) xmax = it->x;
+			if (it->y < ymin) ymin = it->y;
+			if (it->y > ymax) ymax = it->y;
+		}
+		if (xmin > xmax) return true;
+		x0 = std::max(int(xmin - 1.0 - margin), 0);
+		y0 = std::max(int(ymin - 1.0 - margin), 0);
+		x1 = std::min(int(xmax + margin) + 1, wimg);
+		y1 = std::min(int(ymax + margin) + 1, himg);
+		if (x0 >= x1 || y0 >= y1) {
+			for (ForcedVec::iterator it = objs.begin(); it != objs.end(); ++it) it->flag |= FORCED_EDGE;
+			return true;
+		}
+	}
+
+	data.reset(new float[size_t(x1 - x0) * (y1 - y0)]);
+	if (_gPreProc.use_count()) {
+		if (!fmap.ReadImage(data.get(), nthread)) return false;
+		_gPreProc->Calibrate(frame, data.get(), wimg, himg, nthread);
+	}
+	else if (!fmap.ReadRect(x0, y0, x1, y1, data.get())) return false;
+	Measure(data.get(), x0, y0, x1 - x0, y1 - y0, objs, nthread);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void ForcedPhot::measure_range(const float *data, int x0, int y0, int width, int height, ForcedObject *objs, int n) {
+	std::vector<float> buff;
+	for (int i = 0; i < n; ++i) measure_one(data, x0, y0, width, height, objs[i], buff);
+}
+
+/*
+ * 像素(px, py)覆盖[px - 0.5, px + 0.5] * [py - 0.5, py + 0.5]
+ * 孔径: 每行由最远点确定完全覆盖区间, 由最近点确定相交区间, 两者之差为边界像素
+ * 背景环: 像素中心落在[rin, rout]内
+ */
+void ForcedPhot::measure_one(const float *data, int x0, int y0, int width, int height, ForcedObject &obj,
+		std::vector<float> &buff) {
+	double xc(obj.x - 1.0 - x0), yc(obj.y - 1.0 - y0);	// 区域内坐标, 像素中心为整数
+	double r2(raper_ * raper_), dy, dn, df, h, sum(0.0), sum2(0.0), area(0.0), back(0.0), sig(0.0);
+	double sx, sy, ds(1.0 / FORCED_SUBPIX);
+	int px, py, pa, pb, ia, ib, i, j, k, m, nback;
+	const float *row;
+
+	if ((obj.flag &= FORCED_SKY)) return;	// 保留换算坐标时的标志
+
+	/* 背景环 */
+	buff.clear();
+	pa = std::max(int(ceil(yc - rout_)), 0);
+	pb = std::min(int(floor(yc + rout_)), height - 1);
+	if (pa != int(ceil(yc - rout_)) || pb != int(floor(yc + rout_))) obj.flag |= FORCED_EDGE;
+	for (py = pa; py <= pb; ++py) {
+		row = data + size_t(py) * width;
+		dy  = py - yc;
+		h   = sqrt(std::max(rout_ * rout_ - dy * dy, 0.0));
+		ia  = int(ceil(xc - h));
+		ib  = int(floor(xc + h));
+		if (ia < 0 || ib >= width) {
+			obj.flag |= FORCED_EDGE;
+			ia = std::max(ia, 0);
+			ib = std::min(ib, width - 1);
+		}
+		if (fabs(dy) < rin_) {// 两段
+			h = sqrt(rin_ * rin_ - dy * dy);
+			i = std::min(int(floor(xc - h)), ib);
+			j = std::max(int(ceil(xc + h)), ia);
+			if (i >= ia) buff.insert(buff.end(), row + ia, row + i + 1);
+			if (j <= ib) buff.insert(buff.end(), row + j, row + ib + 1);
+		}
+		else if (ia <= ib) buff.insert(buff.end(), row + ia, row + ib + 1);
+	}
+	if ((nback = back_stat(buff, back, sig)) < FORCED_MINBACK) {
+		obj.flag |= FORCED_BACK;
+		nback = 0;
+	}
+
+	/* 孔径 */
+	pa = int(ceil(yc - raper_ - 0.5));
+	pb = int(floor(yc + raper_ + 0.5));
+	if (pa < 0 || pb >= height) {
+		obj.flag |= FORCED_EDGE;
+		pa = std::max(pa, 0);
+		pb = std::min(pb, height - 1);
+	}
+	for (py = pa; py <= pb; ++py) {
+		row = data + size_t(py) * width;
+		dy  = py - yc;
+		dn  = std::max(fabs(dy) - 0.5, 0.0);
+		df  = fabs(dy) + 0.5;
+		if (dn >= raper_) continue;
+		h   = sqrt(r2 - dn * dn);
+		i   = int(ceil(xc - h - 0.5));
+		j   = int(floor(xc + h + 0.5));
+		ia  = j + 1;
+		ib  = j;
+		if (df < raper_) {
+			h  = sqrt(r2 - df * df);
+			ia = int(ceil(xc - h + 0.5));
+			ib = int(floor(xc + h - 0.5));
+			if (ia > ib) ia = j + 1, ib = j;
+		}
+		if (i < 0 || j >= width) {
+			obj.flag |= FORCED_EDGE;
+			i  = std::max(i, 0);
+			j  = std::min(j, width - 1);
+			ia = std::max(ia, i);
+			ib = std::min(ib, j);
+		}
+		if (ia <= ib) area += SimdRowStat(row + ia, ib - ia + 1, -FLT_MAX, FLT_MAX, sum, sum2);
+		for (px = i; px <= j; ++px) {// 边界像素
+			if (px >= ia && px <= ib) continue;
+			for (k = 0, m = 0; m < FORCED_SUBPIX * FORCED_SUBPIX; ++m) {
+				sx = px - xc - 0.5 + (m % FORCED_SUBPIX + 0.5) * ds;
+				sy = dy - 0.5 + (m / FORCED_SUBPIX + 0.5) * ds;
+				if (sx * sx + sy * sy <= r2) ++k;
+			}
+			sum  += row[px] * double(k) / (FORCED_SUBPIX * FORCED_SUBPIX);
+			area += double(k) / (FORCED_SUBPIX * FORCED_SUBPIX);
+		}
+	}
+
+	obj.back    = back;
+	obj.backsig = sig;
+	obj.area    = area;
+	obj.flux    = sum - back * area;
+	obj.fluxerr = sig * sqrt(area + (nback ? area * area / nback : 0.0));
+	if (obj.flux > 0.0) {
+		obj.mag    = 25.0 - 2.5 * log10(obj.flux);
+		obj.magerr = 1.0857 * obj.fluxerr / obj.flux;
+	}
+	else {
+		obj.flag  |= FORCED_FAINT;
+		obj.mag    = obj.magerr = 99.0;
+	}
+}
+
+int ForcedPhot::back_stat(std::vector<float> &buff, double &back, double &sig) {
+	float lo(-FLT_MAX), hi(FLT_MAX);
+	double sum, sum2, mean(0.0), med;
+	int n(int(buff.size())), count(0), i;
+
+	back = sig = 0.0;
+	if (n < FORCED_MINBACK) return n;
+	for (i = 0; i < 5; ++i) {
+		sum = sum2 = 0.0;
+		if ((count = SimdRowStat(buff.data(), n, lo, hi, sum, sum2)) < FORCED_MINBACK) return count;
+		mean = sum / count;
+		sig  = sqrt(std::max(sum2 / count - mean * mean, 0.0));
+		lo   = float(mean - 3.0 * sig);
+		hi   = float(mean + 3.0 * sig);
+	}
+	std::vector<float>::iterator end = std::partition(buff.begin(), buff.end(),
+			[lo, hi](float v) { return v >= lo && v <= hi; });
+	if ((count = int(end - buff.begin())) < FORCED_MINBACK) return count;
+	std::nth_element(buff.begin(), buff.begin() + count / 2, end);
+	med  = buff[count / 2];
+	back = fabs(mean - med) < 0.3 * sig ? 2.5 * med - 1.5 * mean : med;
+	return count;
+}
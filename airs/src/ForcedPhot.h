@@ -0,0 +1,90 @@
+/**
+ * @class ForcedPhot 指定位置的强制孔径测光
+ * @version 0.1
+ * @date 2020-11-26
+ * @note
+ * - 在给定位置直接由像素测量圆孔径流量与环形区背景, 不依赖信号提取
+ * - 位置为图像坐标, 或由定位结果将赤道坐标换算为图像坐标
+ * - 孔径完全覆盖的像素逐行以SIMD累加; 孔径边界上的像素以5*5子像素采样计算覆盖比例
+ * - 背景: 环形区像素3σ迭代剔除后, 偏度较小时取2.5*中值-1.5*均值, 否则取中值
+ * - 目标按线程数分组并行测量
+ * - 仪器星等零点与误差定义与内置算法一致, 误差含孔径与背景估计的噪声
+ */
+
+#ifndef SRC_FORCEDPHOT_H_
+#define SRC_FORCEDPHOT_H_
+
+#include <vector>
+#include <boost/smart_ptr.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+#include "AstroMetry.h"
+
+class ForcedPhot {
+public:
+	ForcedPhot(Parameter *param);
+	virtual ~ForcedPhot();
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;	//< 配置参数
+	double raper_;		//< 孔径半径, 量纲: 像素
+	double rin_, rout_;	//< 背景环内外半径, 量纲: 像素
+
+public:
+	/*!
+	 * @brief 设置孔径与背景环. 缺省使用配置参数
+	 */
+	void SetAperture(double raper, double rin, double rout);
+	/*!
+	 * @brief 由定位结果计算目标的图像坐标
+	 * @param wcs  定位结果
+	 * @param objs 目标, 由ra/dec计算x/y
+	 * @return
+	 * 换算成功的目标数量. 换算失败的目标标记为FORCED_SKY, 不参与测量
+	 */
+	int SkyToImage(const wcsinfo &wcs, ForcedVec &objs);
+	/*!
+	 * @brief 测量内存中的图像区域
+	 * @param data    图像区域[x0, x0 + width) * [y0, y0 + height), 坐标起始于0
+	 * @param x0      区域在图像中的起始列
+	 * @param y0      区域在图像中的起始行
+	 * @param width   区域宽度
+	 * @param height  区域高度
+	 * @param objs    目标
+	 * @param nthread 并行线程数
+	 */
+	void Measure(const float *data, int x0, int y0, int width, int height, ForcedVec &objs, int nthread);
+	/*!
+	 * @brief 读取图像文件并测量
+	 * @param frame   图像
+	 * @param objs    目标
+	 * @param nthread 并行线程数
+	 * @return
+	 * 无法读取图像时返回false
+	 * @note
+	 * 启用预处理时读取并改正全图; 否则只读取覆盖全部目标的区域
+	 */
+	bool Measure(FramePtr frame, ForcedVec &objs, int nthread);
+
+protected:
+	/*!
+	 * @brief 测量一组目标
+	 */
+	void measure_range(const float *data, int x0, int y0, int width, int height, ForcedObject *objs, int n);
+	/*!
+	 * @brief 测量单个目标
+	 * @param buff 背景环像素缓存
+	 */
+	void measure_one(const float *data, int x0, int y0, int width, int height, ForcedObject &obj,
+			std::vector<float> &buff);
+	/*!
+	 * @brief 背景环像素的稳健统计
+	 * @return
+	 * 有效像素数量
+	 */
+	int back_stat(std::vector<float> &buff, double &back, double &sig);
+};
+typedef boost::shared_ptr<ForcedPhot> ForcedPhotPtr;
+
+#endif /* SRC_FORCEDPHOT_H_ */
@@ -0,0 +1,189 @@
+/*!
+ * @file FrameHeader.cpp 读取FITS文件头, 填充单帧图像的基本信息
+ * @version 0.1
+ * @date 2020-11-02
+ */
+
+#include <stdio.h>
+#include <strings.h>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "FrameHeader.h"
+#include "GLog.h"
+
+using namespace boost::filesystem;
+using namespace boost::posix_time;
+
+/*!
+ * @brief 查找多扩展FITS中的二维图像扩展, 为每个扩展建立子帧
+ * @note
+ * 只有一个图像扩展时(如fpack压缩的单帧图像)按单HDU图像处理, 不建立子帧
+ */
+static void load_extensions(fitsfile *fitsptr, FramePtr frame, int &status) {
+	int nhdu(0), hdutype, naxis, compressed(0);
+	long naxes[2];
+
+	fits_get_num_hdus(fitsptr, &nhdu, &status);
+	for (int i = 2; i <= nhdu && !status; ++i) {
+		fits_movabs_hdu(fitsptr, i, &hdutype, &status);
+		if (status || hdutype != IMAGE_HDU) continue;
+		fits_get_img_dim(fitsptr, &naxis, &status);
+		if (status || naxis != 2) continue;
+		fits_get_img_size(fitsptr, 2, naxes, &status);
+		if (status) continue;
+
+		FramePtr subfrm = boost::make_shared<OneFrame>();
+		subfrm->hdu  = i - 1;
+		subfrm->wimg = naxes[0];
+		subfrm->himg = naxes[1];
+		frame->subfrms.push_back(subfrm);
+	}
+	if (!status && frame->subfrms.empty()) status = -1;
+	if (!status && frame->subfrms.size() == 1) {
+		fits_movabs_hdu(fitsptr, frame->subfrms[0]->hdu + 1, &hdutype, &status);
+		fits_is_compressed_image(fitsptr, &compressed);
+		frame->compressed = compressed != 0;
+		frame->wimg = frame->subfrms[0]->wimg;
+		frame->himg = frame->subfrms[0]->himg;
+		frame->subfrms.clear();
+	}
+}
+
+/*!
+ * @brief 子帧继承主HDU的观测信息
+ */
+static void inherit_header(FramePtr frame) {
+	for (std::vector<FramePtr>::iterator it = frame->subfrms.begin(); it != frame->subfrms.end(); ++it) {
+		FramePtr subfrm = *it;
+		subfrm->filepath  = frame->filepath;
+		subfrm->filename  = frame->filename;
+		subfrm->tmobs     = frame->tmobs;
+		subfrm->tmmid     = frame->tmmid;
+		subfrm->typeTrack = frame->typeTrack;
+		subfrm->fno       = frame->fno;
+		subfrm->expdur    = frame->expdur;
+		subfrm->secofday  = frame->secofday;
+		subfrm->mjd       = frame->mjd;
+		subfrm->raobj     = frame->raobj;
+		subfrm->decobj    = frame->decobj;
+		subfrm->gid       = frame->gid;
+		subfrm->uid       = frame->uid;
+		subfrm->cid       = frame->cid;
+	}
+	// 帧尺寸取第一个图像扩展
+	frame->wimg = frame->subfrms[0]->wimg;
+	frame->himg = frame->subfrms[0]->himg;
+}
+
+void SetFrameTime(FramePtr frame, const string &tmobs) {
+	frame->tmobs = tmobs;
+	ptime tmstart = from_iso_extended_string(tmobs);
+	// QHY CMOS 4040的两个时标(毫秒)
+	// 300: 曝光指令执行延迟 => 低轨数据偏差约45毫秒, 修正为340
+	// 120: 读出时间延迟
+	ptime tmmid  = tmstart + millisec(int(frame->expdur * 500.0 + 340));
+	frame->tmmid = to_iso_extended_string(tmmid);
+	frame->secofday = tmmid.time_of_day().total_milliseconds() / 86400000.0;
+	frame->mjd      = tmmid.date().modjulian_day() + frame->secofday;
+}
+
+bool LoadFrameHeader(FramePtr frame) {
+	try {
+		// 读取文件头信息
+		fitsfile *fitsptr;	//< 基于cfitsio接口的文件操作接口
+		int status(0);
+		char dateobs[30], timeobs[30], temp[30], objname[30], plan_type[30], imgtype[FLEN_VALUE];
+		bool datefull;
+		double expdur;
+		int naxis(0);
+
+		fits_open_file(&fitsptr, frame->filepath.c_str(), 0, &status);
+		fits_read_key(fitsptr, TINT, "NAXIS", &naxis, NULL, &status);
+		if (naxis) {
+			fits_read_key(fitsptr, TINT, "NAXIS1", &frame->wimg, NULL, &status);
+			fits_read_key(fitsptr, TINT, "NAXIS2", &frame->himg, NULL, &status);
+		}
+		if (naxis == 3) {// 数据立方体
+			fits_read_key(fitsptr, TINT, "NAXIS3", &frame->nplane, NULL, &status);
+			if (frame->nplane < 2) frame->nplane = 0;
+		}
+		fits_read_key(fitsptr, TSTRING, "DATE-OBS", dateobs,  NULL, &status);
+		if (!(datefull = NULL != strstr(dateobs, "T")))
+			fits_read_key(fitsptr, TSTRING, "TIME-OBS", timeobs,  NULL, &status);
+		if (status) {// Andor Solis格式
+			status = 0;
+			fits_read_key(fitsptr, TSTRING, "DATE", dateobs,  NULL, &status);
+			datefull = true;
+		}
+		fits_read_key(fitsptr, TDOUBLE, "EXPTIME",  &expdur, NULL, &status);
+		if (status) {// Andor Solis格式
+			status = 0;
+			fits_read_key(fitsptr, TDOUBLE, "EXPOSURE",  &expdur, NULL, &status);
+		}
+		if (!status) {
+			fits_read_key(fitsptr, TINT, "FRAMENO",  &frame->fno, NULL, &status);
+			status = 0;
+		}
+		frame->expdur = expdur;
+		if (frame->nplane && !status) {// 平面间隔: 缺省与曝光时间相同
+			int status1(0);
+			fits_read_key(fitsptr, TDOUBLE, "CADENCE", &frame->cadence, NULL, &status1);
+			if (status1) {
+				status1 = 0;
+				fits_read_key(fitsptr, TDOUBLE, "FRAMETIM", &frame->cadence, NULL, &status1);
+			}
+			if (status1 || frame->cadence <= 0.0) frame->cadence = expdur;
+		}
+		fits_read_key(fitsptr, TSTRING, "PLANTYPE", plan_type, NULL, &status);
+		if (!status) {
+			frame->typeTrack = strcasecmp(plan_type, "TRACK") == 0;
+		}
+		else {
+			status = 0;
+			fits_read_key(fitsptr, TSTRING, "OBJECT", objname, NULL, &status);
+			frame->typeTrack = strcasecmp(objname, "point") != 0;
+		}
+		if (!status) {// 图像类型: 可选关键字
+			if (!fits_read_key(fitsptr, TSTRING, "IMAGETYP", imgtype, NULL, &status)) frame->imgtype = imgtype;
+			status = 0;
+		}
+		if (!status) {// 不存在关键字的特殊处理
+			fits_read_key(fitsptr, TSTRING, "GROUP_ID", temp, NULL, &status);
+			frame->gid = temp;
+			fits_read_key(fitsptr, TSTRING, "UNIT_ID", temp, NULL, &status);
+			frame->uid = temp;
+			fits_read_key(fitsptr, TSTRING, "CAM_ID", temp, NULL, &status);
+			frame->cid = temp;
+
+			fits_read_key(fitsptr, TDOUBLE, "OBJCTRA",  &frame->raobj,  NULL, &status);
+			fits_read_key(fitsptr, TDOUBLE, "OBJCTDEC", &frame->decobj, NULL, &status);
+
+			status = 0;
+		}
+		// 多扩展FITS: 主HDU不含图像, 观测信息记录在主HDU
+		if (!status && !naxis) load_extensions(fitsptr, frame, status);
+		fits_close_file(fitsptr, &status);
+
+		if (!status) {
+			path filepath(frame->filepath);
+			char tmfull[40];
+
+			frame->filename = filepath.filename().string();
+			if (!datefull) sprintf(tmfull, "%sT%s", dateobs, timeobs);
+			SetFrameTime(frame, datefull ? dateobs : tmfull);
+
+			if (frame->gid.empty() || frame->uid.empty() || frame->cid.empty()) {
+				_gLog->Write(LOG_FAULT, NULL, "File[%s] doesn't give right IDs[%s:%s:%s]",
+						frame->filename.c_str(),
+						frame->gid.c_str(), frame->uid.c_str(), frame->cid.c_str());
+				status = -1;
+			}
+			else if (frame->subfrms.size()) inherit_header(frame);
+		}
+		return (status == 0);
+	}
+	catch(...) {// 尝试捕获异常: 文件可能为空
+		return false;
+	}
+}
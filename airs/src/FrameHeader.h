@@ -0,0 +1,31 @@
+/*!
+ * @file FrameHeader.h 读取FITS文件头, 填充单帧图像的基本信息
+ * @version 0.1
+ * @date 2020-11-02
+ * @note
+ * - 由DoProcess和BatchReduct共用
+ * - 只读文件头, 不读取像素数据, 可由多个线程同时调用
+ * - 多扩展FITS: 为每个二维图像扩展建立子帧, 存储在OneFrame::subfrms
+ * - 数据立方体: 记录平面数量及平面间隔, 由CubeReduct展开为平面
+ */
+
+#ifndef FRAMEHEADER_H_
+#define FRAMEHEADER_H_
+
+#include "airsdata.h"
+
+/*!
+ * @brief 检查并读取FITS文件的基本信息
+ * @param frame 单帧图像. 调用前需设置filepath
+ * @return
+ * 文件头信息完整且有效时返回true
+ */
+extern bool LoadFrameHeader(FramePtr frame);
+/*!
+ * @brief 依据曝光起始时间计算曝光中间时刻、当日秒数及修正儒略日
+ * @param frame 单帧图像. 调用前需设置expdur
+ * @param tmobs 曝光起始时间, UTC. CCYY-MM-DDThh:mm:ss.ssssss
+ */
+extern void SetFrameTime(FramePtr frame, const string &tmobs);
+
+#endif /* FRAMEHEADER_H_ */
@@ -0,0 +1,123 @@
+/*!
+ * @file FrameReduct.cpp 单帧图像的同步处理流程
+ * @version 0.1
+ * @date 2020-11-02
+ */
+
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include "FrameReduct.h"
+#include "MosaicReduct.h"
+#include "CubeReduct.h"
+
+using namespace boost::placeholders;
+
+FrameReduct::FrameReduct(Parameter *param) {
+	param_    = param;
+	finished_ = false;
+	rslt_     = 0;
+
+	reduct_ = boost::make_shared<AstroDIP>(param_);
+	astro_  = boost::make_shared<AstroMetry>(param_);
+	match_  = boost::make_shared<MatchCatalog>(param_);
+	photo_  = boost::make_shared<PhotoMetry>(param_);
+
+	const AstroDIP::ReductResultSlot       &slot1 = boost::bind(&FrameReduct::StageResult, this, _1);
+	const AstroMetry::AstrometryResultSlot &slot2 = boost::bind(&FrameReduct::StageResult, this, _1);
+	const MatchCatalog::MatchResultSlot    &slot3 = boost::bind(&FrameReduct::StageResult, this, _1);
+	const PhotoMetry::PhotometryResultSlot &slot4 = boost::bind(&FrameReduct::StageResult, this, _1);
+	reduct_->RegisterReductResult(slot1);
+	astro_->RegisterAstrometryResult(slot2);
+	match_->RegisterMatchResult(slot3);
+	photo_->RegisterPhotometryResult(slot4);
+}
+
+FrameReduct::~FrameReduct() {
+}
+
+bool FrameReduct::DoIt(FramePtr frame) {
+	if (frame->hdu > 0) {// 多扩展图像的子帧: 拆分为单HDU文件后处理
+		if (!SplitFrameHDU(frame, param_->pathWork, param_->nThreadDip)) return false;
+		bool rslt = do_stages(frame);
+		boost::system::error_code ec;
+		boost::filesystem::remove(frame->filepath, ec);
+		return rslt;
+	}
+	return do_stages(frame);
+}
+
+bool FrameReduct::DoPlane(FramePtr plane, CubeAnchorPtr anchor) {
+	bool rslt(false);
+	wcsinfo wcs;
+	/*
+	 * SExtractor和天文定位读取二维图像文件, 需生成平面文件
+	 * 内置算法由立方体文件直接读取平面, 只在成为锚定平面时生成
+	 */
+	bool split = !param_->dipNative;
+
+	if (split && !WriteCubePlane(plane, param_->pathWork)) return false;
+	if (ImageReduct(plane) && param_->doAstrometry) {
+		if (anchor->acquire(wcs)) {// 沿用锚定平面的定位结果
+			wcs.apply_frame(plane);
+			rslt = true;
+		}
+		else {// 锚定平面: 执行天文定位, 无论结果如何均需通知其它平面
+			if (!split) split = WriteCubePlane(plane, param_->pathWork);
+			rslt = split && astrometry(plane);
+			anchor->set(rslt, rslt ? &astro_->GetWCS() : NULL);
+		}
+	}
+	rslt = rslt && param_->doPhotometry && photometry(plane);
+
+	if (split) {
+		boost::system::error_code ec;
+		boost::filesystem::remove(plane->filepath, ec);
+	}
+	return rslt;
+}
+
+bool FrameReduct::do_stages(FramePtr frame) {
+	return ImageReduct(frame)
+			&& param_->doAstrometry && astrometry(frame)
+			&& param_->doPhotometry && photometry(frame);
+}
+
+bool FrameReduct::astrometry(FramePtr frame) {
+	reset_result();
+	return wait_result(astro_->DoIt(frame)) != 0;
+}
+
+bool FrameReduct::photometry(FramePtr frame) {
+	reset_result();
+	if (!wait_result(match_->DoIt(frame))) return false;
+
+	reset_result();
+	return wait_result(photo_->DoIt(frame)) != 0;
+}
+
+bool FrameReduct::ImageReduct(FramePtr frame) {
+	reset_result();
+	return wait_result(reduct_->DoIt(frame)) != 0;
+}
+
+void FrameReduct::reset_result() {
+	mutex_lock lck(mtx_rslt_);
+	finished_ = false;
+	rslt_     = 0;
+}
+
+int FrameReduct::wait_result(bool started) {
+	if (!started) return 0;
+
+	mutex_lock lck(mtx_rslt_);
+	while (!finished_) cv_rslt_.wait(lck);
+	return rslt_;
+}
+
+void FrameReduct::StageResult(int rslt) {
+	mutex_lock lck(mtx_rslt_);
+	rslt_     = rslt;
+	finished_ = true;
+	cv_rslt_.notify_one();
+}
@@ -0,0 +1,109 @@
+/*!
+ * @file FrameReduct.h 单帧图像的同步处理流程
+ * @version 0.1
+ * @date 2020-11-02
+ * @note
+ * - 独占一套AstroDIP/AstroMetry/MatchCatalog/PhotoMetry接口
+ * - 在调用线程中依次执行图像处理、天文定位、匹配星表和测光, 返回时流程已结束
+ * - 多个FrameReduct对象可在不同线程中并行工作
+ */
+
+#ifndef FRAMEREDUCT_H_
+#define FRAMEREDUCT_H_
+
+#include <boost/thread.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+#include "AstroDIP.h"
+#include "AstroMetry.h"
+#include "MatchCatalog.h"
+#include "PhotoMetry.h"
+
+struct CubeAnchor;
+
+class FrameReduct {
+public:
+	FrameReduct(Parameter *param);
+	virtual ~FrameReduct();
+
+protected:
+	/* 数据类型 */
+	typedef boost::shared_ptr<AstroDIP> AstroDIPtr;
+	typedef boost::shared_ptr<AstroMetry> AstroMetryPtr;
+	typedef boost::shared_ptr<MatchCatalog> MatchCatPtr;
+	typedef boost::shared_ptr<PhotoMetry> PhotoMetryPtr;
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;		//< 配置参数
+	AstroDIPtr    reduct_;	//< 接口: 图像处理
+	AstroMetryPtr astro_;	//< 接口: 天文定位
+	MatchCatPtr   match_;	//< 接口: 匹配星表
+	PhotoMetryPtr photo_;	//< 接口: 测光
+	/* 等待处理结果 */
+	boost::mutex mtx_rslt_;			//< 互斥锁: 处理结果
+	boost::condition_variable cv_rslt_;	//< 条件: 处理结果
+	bool finished_;	//< 当前步骤结束标志
+	int rslt_;		//< 当前步骤处理结果
+
+public:
+	/*!
+	 * @brief 处理单帧图像
+	 * @param frame 图像信息. 已由LoadFrameHeader()加载文件头
+	 * @return
+	 * 完成测光时返回true. 未启用天文定位或测光时返回false, 与DoProcess的流程一致
+	 * @note
+	 * 多扩展图像的子帧(hdu > 0)先拆分至工作目录, 处理结束后删除拆分文件
+	 */
+	bool DoIt(FramePtr frame);
+	/*!
+	 * @brief 处理数据立方体的一个平面
+	 * @param plane  平面. 由ExpandCubePlanes()生成
+	 * @param anchor 锚定平面的定位结果. 锚定平面写入, 其它平面读取
+	 * @return
+	 * 完成测光时返回true
+	 * @note
+	 * SExtractor或锚定平面的天文定位需要平面文件时, 先写入工作目录, 处理结束后删除.
+	 * 内置算法直接读取立方体文件中的平面
+	 */
+	bool DoPlane(FramePtr plane, boost::shared_ptr<CubeAnchor> anchor);
+	/*!
+	 * @brief 只执行图像处理
+	 * @return
+	 * 图像处理结果
+	 */
+	bool ImageReduct(FramePtr frame);
+
+protected:
+	/*!
+	 * @brief 依次执行各处理步骤
+	 */
+	bool do_stages(FramePtr frame);
+	/*!
+	 * @brief 执行天文定位
+	 */
+	bool astrometry(FramePtr frame);
+	/*!
+	 * @brief 执行匹配星表和测光
+	 */
+	bool photometry(FramePtr frame);
+	/*!
+	 * @brief 处理步骤开始前复位结果标志
+	 */
+	void reset_result();
+	/*!
+	 * @brief 等待当前步骤结束
+	 * @param started 步骤启动结果
+	 * @return
+	 * 步骤处理结果. 0: 失败
+	 */
+	int wait_result(bool started);
+	/*!
+	 * @brief 回调函数: 各处理步骤的结果
+	 */
+	void StageResult(int rslt);
+};
+typedef boost::shared_ptr<FrameReduct> FrameReductPtr;
+
+#endif /* FRAMEREDUCT_H_ */
@@ -0,0 +1,149 @@
+/*!
+ * @file FrameStat.cpp 单帧图像的耗时与资源统计
+ * @version 0.1
+ * @date 2020-11-05
+ */
+
+#include <time.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "FrameStat.h"
+#include "ATrace.h"
+#include "GLog.h"
+
+static const char *stage_name[]  = {"reduct", "astro", "match", "photo"};
+static const char *stage_wait[]  = {"reduct.wait", "astro.wait", "match.wait", "photo.wait"};
+static const char *stage_child[] = {"sextractor", "solve-field", "match.child", "photo.child"};
+
+static boost::thread_specific_ptr<double> helper_cpu;	// 当前线程已汇合辅助线程的CPU时间
+
+static bool trace_enabled() {
+	return _gTrace.use_count() && _gTrace->IsEnabled();
+}
+
+static double timespec_sec(const struct timespec &ts) {
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+static double timeval_sec(const struct timeval &tv) {
+	return tv.tv_sec + tv.tv_usec * 1E-6;
+}
+
+double StatClock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_sec(ts);
+}
+
+double StatThreadCPU() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return timespec_sec(ts) + (helper_cpu.get() ? *helper_cpu : 0.0);
+}
+
+void StatHelperCPU(double cpu) {
+	if (!helper_cpu.get()) helper_cpu.reset(new double(0.0));
+	*helper_cpu += cpu;
+}
+
+void StageEnqueue(FramePtr frame, int stage) {
+	frame->stat[stage].tmenq = StatClock();
+}
+
+void StageBegin(FramePtr frame, int stage) {
+	StageStat &stat = frame->stat[stage];
+	stat.tmdeq = StatClock();
+	if (stat.tmenq == 0.0) stat.tmenq = stat.tmdeq;
+}
+
+void StageChild(FramePtr frame, int stage, const struct rusage &ru, double tmbegin) {
+	StageStat &stat = frame->stat[stage];
+	if (trace_enabled()) _gTrace->Complete(stage_child[stage], "child", tmbegin, StatClock(), frame.get());
+	stat.cpuusr   += timeval_sec(ru.ru_utime);
+	stat.cpusys   += timeval_sec(ru.ru_stime);
+	if (ru.ru_maxrss > stat.maxrss) stat.maxrss = ru.ru_maxrss;
+	// 块计数以512字节为单位
+	stat.bytesin  += ru.ru_inblock * 512L;
+	stat.bytesout += ru.ru_oublock * 512L;
+}
+
+void StageCPU(FramePtr frame, int stage, double cputhrd) {
+	frame->stat[stage].cputhrd += cputhrd;
+}
+
+void StageEnd(FramePtr frame, int stage, double cputhrd) {
+	StageStat &stat = frame->stat[stage];
+	stat.tmend    = StatClock();
+	stat.cputhrd += cputhrd;
+	if (trace_enabled()) {
+		_gTrace->Complete(stage_wait[stage], "queue", stat.tmenq, stat.tmdeq, frame.get());
+		_gTrace->Complete(stage_name[stage], "stage", stat.tmdeq, stat.tmend, frame.get());
+	}
+}
+
+void MergeFrameStat(FramePtr frame, FramePtr subfrm) {
+	for (int i = 0; i < STAGE_MAX; ++i) {
+		StageStat &dst = frame->stat[i];
+		const StageStat &src = subfrm->stat[i];
+		if (src.tmend == 0.0) continue;
+
+		if (dst.tmend == 0.0) {
+			dst = src;
+			continue;
+		}
+		if (src.tmenq < dst.tmenq) dst.tmenq = src.tmenq;
+		if (src.tmdeq < dst.tmdeq) dst.tmdeq = src.tmdeq;
+		if (src.tmend > dst.tmend) dst.tmend = src.tmend;
+		if (src.maxrss > dst.maxrss) dst.maxrss = src.maxrss;
+		dst.cpuusr   += src.cpuusr;
+		dst.cpusys   += src.cpusys;
+		dst.cputhrd  += src.cputhrd;
+		dst.bytesin  += src.bytesin;
+		dst.bytesout += src.bytesout;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+FrameStatSum::FrameStatSum() {
+	reset();
+}
+
+void FrameStatSum::Add(FramePtr frame) {
+	mutex_lock lck(mtx_);
+	++nframe_;
+	for (int i = 0; i < STAGE_MAX; ++i) {
+		const StageStat &stat = frame->stat[i];
+		StageSum &sum = sum_[i];
+		if (stat.tmend == 0.0) continue;
+
+		++sum.count;
+		sum.wait     += stat.tmdeq - stat.tmenq;
+		sum.wall     += stat.tmend - stat.tmdeq;
+		sum.cpuusr   += stat.cpuusr;
+		sum.cpusys   += stat.cpusys;
+		sum.cputhrd  += stat.cputhrd;
+		sum.bytesin  += stat.bytesin;
+		sum.bytesout += stat.bytesout;
+		if (stat.maxrss > sum.maxrss) sum.maxrss = stat.maxrss;
+	}
+}
+
+void FrameStatSum::Report(const char *title) {
+	mutex_lock lck(mtx_);
+
+	if (!nframe_) return;
+	_gLog->Write("%s: %d frames", title, nframe_);
+	for (int i = 0; i < STAGE_MAX; ++i) {
+		StageSum &sum = sum_[i];
+		if (!sum.count) continue;
+		_gLog->Write("  %-6s n=%d, mean wait=%.3f, wall=%.3f, child usr=%.3f, sys=%.3f, thread cpu=%.3f sec; max rss=%ld KB, in=%.1f MB, out=%.1f MB",
+				stage_name[i], sum.count, sum.wait / sum.count, sum.wall / sum.count,
+				sum.cpuusr / sum.count, sum.cpusys / sum.count, sum.cputhrd / sum.count,
+				sum.maxrss, sum.bytesin / 1048576., sum.bytesout / 1048576.);
+	}
+	reset();
+}
+
+void FrameStatSum::reset() {
+	nframe_ = 0;
+	memset(sum_, 0, sizeof(sum_));
+}
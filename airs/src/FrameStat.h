@@ -0,0 +1,160 @@
+/*!
+ * @file FrameStat.h 单帧图像的耗时与资源统计
+ * @version 0.1
+ * @date 2020-11-05
+ * @note
+ * - 各处理步骤记录进入队列、开始处理和结束时刻, 区分排队等待与处理耗时
+ * - 外部程序(SExtractor, solve-field)的CPU时间、最大驻留内存和I/O由wait4()取得
+ * - 本进程中处理线程的CPU时间由CLOCK_THREAD_CPUTIME_ID取得. 辅助线程由StatThreadGroup创建,
+ *   汇合时其CPU时间计入创建线程
+ * - 外部程序的时间段起始于fork/exec时刻
+ * - FrameStatSum累计多帧统计结果, 用于评估硬件配置和定位瓶颈
+ */
+
+#ifndef FRAMESTAT_H_
+#define FRAMESTAT_H_
+
+#include <sys/resource.h>
+#include <boost/thread.hpp>
+#include "airsdata.h"
+
+/*!
+ * @brief 单调时钟
+ * @return
+ * 时刻, 量纲: 秒
+ */
+extern double StatClock();
+/*!
+ * @brief 当前线程已占用的CPU时间, 含已汇合的辅助线程
+ * @return
+ * CPU时间, 量纲: 秒
+ */
+extern double StatThreadCPU();
+/*!
+ * @brief 将已汇合辅助线程的CPU时间计入当前线程
+ * @param cpu CPU时间, 量纲: 秒
+ */
+extern void StatHelperCPU(double cpu);
+/*!
+ * @brief 记录图像进入处理步骤的队列
+ */
+extern void StageEnqueue(FramePtr frame, int stage);
+/*!
+ * @brief 记录处理步骤开始. 未经队列时, 进入队列时刻与开始时刻相同
+ */
+extern void StageBegin(FramePtr frame, int stage);
+/*!
+ * @brief 记录外部程序的资源占用
+ * @param ru      wait4()返回的资源占用
+ * @param tmbegin 外部程序的fork/exec时刻, 由StatClock()取得
+ */
+extern void StageChild(FramePtr frame, int stage, const struct rusage &ru, double tmbegin);
+/*!
+ * @brief 记录步骤开始前在调用线程中的CPU时间, 如预处理、坏列检测等
+ * @param cputhrd CPU时间, 量纲: 秒
+ */
+extern void StageCPU(FramePtr frame, int stage, double cputhrd);
+/*!
+ * @brief 记录处理步骤结束
+ * @param cputhrd 处理线程在该步骤占用的CPU时间, 量纲: 秒
+ */
+extern void StageEnd(FramePtr frame, int stage, double cputhrd);
+/*!
+ * @brief 将子帧统计结果合并至多扩展图像
+ * @note
+ * 时刻取并集, CPU时间和I/O累加, 内存取最大值
+ */
+extern void MergeFrameStat(FramePtr frame, FramePtr subfrm);
+
+/*!
+ * @class StatThreadGroup 统计CPU时间的线程组
+ * @note
+ * 接口与boost::thread_group一致. 各线程结束时累加其CPU时间,
+ * join_all()时计入调用线程, 使处理步骤包含并行辅助线程的CPU时间
+ */
+class StatThreadGroup {
+public:
+	StatThreadGroup() {
+		cpu_ = 0.0;
+	}
+
+protected:
+	template <typename F>
+	struct Helper {
+		StatThreadGroup *grp;
+		F f;
+
+		void operator()() {
+			f();
+			double cpu = StatThreadCPU();
+			boost::unique_lock<boost::mutex> lck(grp->mtx_);
+			grp->cpu_ += cpu;
+		}
+	};
+
+protected:
+	boost::thread_group grp_;	//< 线程组
+	boost::mutex mtx_;	//< 互斥锁
+	double cpu_;		//< 已结束线程的CPU时间, 量纲: 秒
+
+public:
+	template <typename F>
+	void create_thread(F f) {
+		Helper<F> helper = { this, f };
+		grp_.create_thread(helper);
+	}
+
+	void join_all() {
+		grp_.join_all();
+		StatHelperCPU(cpu_);
+		cpu_ = 0.0;
+	}
+};
+
+/*!
+ * @class FrameStatSum 累计多帧图像的统计结果
+ */
+class FrameStatSum {
+public:
+	FrameStatSum();
+
+protected:
+	/* 数据类型 */
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+	struct StageSum {
+		int count;		//< 完成该步骤的帧数
+		double wait;	//< 累计排队时间, 量纲: 秒
+		double wall;	//< 累计处理时间, 量纲: 秒
+		double cpuusr;	//< 累计子进程用户态CPU时间
+		double cpusys;	//< 累计子进程内核态CPU时间
+		double cputhrd;	//< 累计处理线程CPU时间
+		long maxrss;	//< 子进程最大驻留内存峰值, 量纲: KB
+		double bytesin;	//< 累计读取字节数
+		double bytesout;//< 累计写入字节数
+	};
+
+protected:
+	boost::mutex mtx_;	//< 互斥锁
+	int nframe_;		//< 帧数
+	StageSum sum_[STAGE_MAX];	//< 各步骤的累计值
+
+public:
+	/*!
+	 * @brief 累加一帧图像
+	 */
+	void Add(FramePtr frame);
+	/*!
+	 * @brief 在日志中输出累计结果并清零
+	 * @param title 标题
+	 */
+	void Report(const char *title);
+
+protected:
+	/*!
+	 * @brief 清零
+	 */
+	void reset();
+};
+
+#endif /* FRAMESTAT_H_ */
@@ -11,43 +11,86 @@
 using namespace boost::posix_time;
 using namespace boost::filesystem;
 
+typedef boost::unique_lock<boost::mutex> mutex_lock;
+
 LogCalibrated::LogCalibrated(const string &pathroot) {
 	day_ = -1;
 	fp_  = NULL;
+	fpfrc_ = NULL;
 	pathroot_ = pathroot;
 }
 
 LogCalibrated::~LogCalibrated() {
+	Report();
 	if (fp_) fclose(fp_);
+	if (fpfrc_) fclose(fpfrc_);
 }
 
-// 输出内容: 文件名 曝光中间时间 中心指向 大气质量 星等拟合参数
+/*
+ * 输出内容: 文件名 曝光中间时间 中心指向 大气质量 星等拟合参数
+ * 耗时与资源统计: 依次为图像处理/天文定位/匹配星表/测光的
+ *   排队时间 处理时间 子进程用户态CPU 子进程内核态CPU 线程CPU, 量纲: 秒
+ * 及子进程最大驻留内存(KB) 读取量(KB) 写入量(KB)
+ */
 void LogCalibrated::Write(FramePtr frame) {
+	mutex_lock lck(mtx_);
+	statsum_.Add(frame);
 	if (invalid_file(frame->tmmid)) {
-		fprintf(fp_, "%s %s %5.2f %9.5f %9.5f %9.5f %9.5f %6.3f %7.3f %8.6f\n",
+		long maxrss(0);
+		double bytesin(0.0), bytesout(0.0);
+
+		fprintf(fp_, "%s %s %5.2f %9.5f %9.5f %9.5f %9.5f %6.3f %7.3f %8.6f",
 			frame->filename.c_str(), frame->tmmid.c_str(), frame->fwhm,
 			frame->rac, frame->decc, frame->azic, frame->altc,
 			frame->airmass,
 			frame->mag0, frame->magk);
+		for (int i = 0; i < STAGE_MAX; ++i) {
+			const StageStat &stat = frame->stat[i];
+			fprintf(fp_, " %.3f %.3f %.3f %.3f %.3f",
+				stat.tmdeq - stat.tmenq, stat.tmend - stat.tmdeq,
+				stat.cpuusr, stat.cpusys, stat.cputhrd);
+			if (stat.maxrss > maxrss) maxrss = stat.maxrss;
+			bytesin  += stat.bytesin;
+			bytesout += stat.bytesout;
+		}
+		fprintf(fp_, " %ld %.0f %.0f\n", maxrss, bytesin / 1024, bytesout / 1024);
+		if (frame->forced.size()) write_forced(frame);
 	}
 }
 
+void LogCalibrated::Account(FramePtr frame) {
+	mutex_lock lck(mtx_);
+	statsum_.Add(frame);
+}
+
+void LogCalibrated::Report() {
+	mutex_lock lck(mtx_);
+	statsum_.Report("frame statistics");
+}
+
 // 日志文件路径结构:
 // <path root>/Calibration/cal-CCYYMMDD.txt
+// <path root>/Calibration/forced-CCYYMMDD.txt
 bool LogCalibrated::invalid_file(const string &tmobs) {
 	ptime::date_type date = from_iso_extended_string(tmobs).date();
 	if (date.day() != day_) {
+		if (day_ >= 0) statsum_.Report("frame statistics"); // 按日输出累计统计结果
 		day_ = date.day();
 		if (fp_) {
 			fclose(fp_);
 			fp_ = NULL;
 		}
+		if (fpfrc_) {
+			fclose(fpfrc_);
+			fpfrc_ = NULL;
+		}
 
 		boost::system::error_code ec;
 		path filepath(pathroot_);
 		filepath /= string("Calibration");
 		if (exists(filepath, ec) || create_directories(filepath, ec)) {
 			string filename = string("cal-") + to_iso_string(date) + string(".txt");
+			pathfrc_ = (filepath / (string("forced-") + to_iso_string(date) + string(".txt"))).string();
 			filepath /= filename;
 			fp_ = fopen(filepath.c_str(), "a+");
 		}
@@ -57,3 +100,16 @@ bool LogCalibrated::invalid_file(const string &tmobs) {
 	}
 	return fp_ != NULL;
 }
+
+/*
+ * 输出内容: 文件名 曝光中间时间 X Y 流量 误差 背景 背景噪声 仪器星等 误差 拟合V星等 标志
+ */
+void LogCalibrated::write_forced(FramePtr frame) {
+	if (!fpfrc_ && !(fpfrc_ = fopen(pathfrc_.c_str(), "a+"))) return;
+	for (ForcedVec::iterator it = frame->forced.begin(); it != frame->forced.end(); ++it) {
+		fprintf(fpfrc_, "%s %s %8.2f %8.2f %12.2f %10.2f %9.2f %7.2f %7.3f %6.3f %7.3f %d\n",
+			frame->filename.c_str(), frame->tmmid.c_str(), it->x, it->y,
+			it->flux, it->fluxerr, it->back, it->backsig,
+			it->mag, it->magerr, it->mag_fit, it->flag);
+	}
+}
@@ -4,6 +4,8 @@
  * @date 2019-11-01
  * 日志文件路径结构:
  * <path root>/Calibration/cal-CCYYMMDD.txt
+ * <path root>/Calibration/forced-CCYYMMDD.txt: 强制测光结果, 有结果时创建
+ * 测光线程与图像处理线程(多扩展图像、数据立方体)同时输出, 各接口互斥
  */
 
 #ifndef SRC_LOGCALIBRATED_H_
@@ -11,7 +13,9 @@
 
 #include <string>
 #include <cstdio>
+#include <boost/thread/mutex.hpp>
 #include "airsdata.h"
+#include "FrameStat.h"
 
 using std::string;
 
@@ -24,18 +28,34 @@ protected:
 	string pathroot_;	//< 文件根目录
 	int day_;	//< 日期. 当日期不同时需创建文件
 	FILE *fp_;	//< 文件指针
+	FILE *fpfrc_;	//< 文件指针: 强制测光结果
+	string pathfrc_;	//< 强制测光结果文件路径
+	FrameStatSum statsum_;	//< 累计耗时与资源统计
+	boost::mutex mtx_;		//< 互斥锁: 文件与统计
 
 public:
 	/**
 	 * @brief 记录图像的定标结果
 	 */
 	void Write(FramePtr frame);
+	/**
+	 * @brief 累计未完成定标图像的耗时与资源统计
+	 */
+	void Account(FramePtr frame);
+	/**
+	 * @brief 在日志中输出累计统计结果
+	 */
+	void Report();
 
 protected:
 	/**
 	 * @brief 依据观测时间更新文件指针
 	 */
 	bool invalid_file(const string &tmobs);
+	/**
+	 * @brief 输出强制测光结果
+	 */
+	void write_forced(FramePtr frame);
 };
 
 #endif /* SRC_LOGCALIBRATED_H_ */
@@ -9,6 +9,7 @@
 #include <boost/filesystem.hpp>
 #include "MatchCatalog.h"
 #include "ADefine.h"
+#include "FrameStat.h"
 #include "GLog.h"
 
 using namespace boost::posix_time;
@@ -45,6 +46,7 @@ bool MatchCatalog::DoIt(FramePtr frame) {
 	if (working_) return false;
 	frame_   = frame;
 	working_ = true;
+	StageBegin(frame_, STAGE_MATCH);
 	model_.SetNormalRange(1, 1, frame->wimg, frame->himg);
 
 	thrd_proc_.reset(new boost::thread(boost::bind(&MatchCatalog::thread_process, this)));
@@ -57,8 +59,9 @@ void MatchCatalog::thread_process() {
 	 * 使用WCS拟合结果匹配星表, 匹配半径: 2.5x scale.
 	 * astrometry.net生成WCS时的xy与SEx生成的xy存在偏差, 标准差与0.7pixel.
 	 * 使用2.5/0.7≈3.6x作为匹配阈值, 将尽可能多的参考星加入拟合
+	 * 启用窗口质心时xy偏差减小, 缩小匹配半径以减少候选星与误匹配
 	 */
-	match_ucac4(2.5 * frame_->scale);
+	match_ucac4((param_->winEnable ? param_->winMatch : 2.5) * frame_->scale);
 	refstar_from_frame();
 	if (!wcstnx_.ProcessFit()) {
 		rd_from_tnx();
@@ -68,6 +71,8 @@ void MatchCatalog::thread_process() {
 	}
 	// 结束
 	working_ = false;
+	// 线程随任务创建, 线程CPU时间即为该步骤的CPU时间
+	StageEnd(frame_, STAGE_MATCH, StatThreadCPU());
 	rsltMatch_(success);
 }
 
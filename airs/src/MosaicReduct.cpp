@@ -0,0 +1,224 @@
+/*!
+ * @file MosaicReduct.cpp 多扩展(MEF)/拼接相机图像的并行处理
+ * @version 0.1
+ * @date 2020-11-03
+ */
+
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include "MosaicReduct.h"
+#include "FitsMMap.h"
+#include "FrameStat.h"
+#include "GLog.h"
+
+using namespace boost::filesystem;
+
+//////////////////////////////////////////////////////////////////////////////
+/*!
+ * @brief 解压瓦片压缩图像. RICE/GZIP压缩由FitsMMap多线程解压, 其它算法由cfitsio解压
+ */
+static void decompress_hdu(fitsfile *fitsin, fitsfile *fitsout, const string &filepath, int hdu,
+		int nthread, int &status) {
+	AstroUtil::FitsMMap fmap;
+	int type;
+
+	if (!fmap.Open(filepath, hdu)) {
+		fits_img_decompress(fitsin, fitsout, &status);
+		return;
+	}
+	switch (fmap.Bitpix()) {
+	case 8:   type = TBYTE;   break;
+	case 16:  type = TSHORT;  break;
+	case 32:  type = TINT;    break;
+	case -32: type = TFLOAT;  break;
+	default:  type = TDOUBLE; break;
+	}
+	LONGLONG npix = LONGLONG(fmap.Width()) * fmap.Height();
+	boost::shared_array<unsigned char> data(new unsigned char[npix * (abs(fmap.Bitpix()) / 8)]);
+	if (nthread <= 0) nthread = boost::thread::hardware_concurrency();
+	if (!fmap.ReadRaw(data.get(), nthread)) {
+		status = DATA_DECOMPRESSION_ERR;
+		return;
+	}
+	fmap.Close();
+	// 文件头与cfitsio解压结果一致, 像素写入存储值
+	fits_img_decompress_header(fitsin, fitsout, &status);
+	fits_set_hdustruc(fitsout, &status);
+	fits_set_bscale(fitsout, 1.0, 0.0, &status);
+	fits_write_img(fitsout, type, 1, npix, data.get(), &status);
+}
+
+/*!
+ * @brief 将图像扩展写入单HDU文件
+ * @param filepath  原文件
+ * @param hdu       图像扩展序号
+ * @param pathsplit 输出文件
+ */
+static bool split_hdu(const string &filepath, int hdu, const path &pathsplit, int nthread) {
+	fitsfile *fitsin, *fitsout;
+	int status(0), status1(0), hdutype, compressed(0);
+
+	fits_open_file(&fitsin, filepath.c_str(), READONLY, &status);
+	if (status) {
+		_gLog->Write(LOG_FAULT, "SplitFrameHDU()", "failed to open [%s]", filepath.c_str());
+		return false;
+	}
+	fits_movabs_hdu(fitsin, hdu + 1, &hdutype, &status);
+	// 文件名前缀'!': 覆盖已存在文件
+	fits_create_file(&fitsout, ("!" + pathsplit.string()).c_str(), &status);
+	if (!status) {
+		/*
+		 * 输出文件为空时, 图像扩展被复制为主HDU
+		 * 瓦片压缩图像需解压, SExtractor和solve-field不能读取压缩格式
+		 */
+		fits_is_compressed_image(fitsin, &compressed);
+		if (compressed) decompress_hdu(fitsin, fitsout, filepath, hdu, nthread, status);
+		else fits_copy_hdu(fitsin, fitsout, 0, &status);
+		fits_close_file(fitsout, &status1);
+	}
+	fits_close_file(fitsin, &status1);
+
+	if (status) {
+		_gLog->Write(LOG_FAULT, "SplitFrameHDU()", "failed to split HDU#%d of [%s]. status = %d",
+				hdu, filepath.c_str(), status);
+		remove(pathsplit);
+		return false;
+	}
+	return true;
+}
+
+bool SplitFrameHDU(FramePtr subfrm, const string &pathWork, int nthread) {
+	boost::format fmt("%s_%d.fit");
+	path filepath(subfrm->filepath);
+	path pathsplit(pathWork);
+
+	pathsplit /= (fmt % filepath.stem().string() % subfrm->hdu).str();
+	if (!split_hdu(subfrm->filepath, subfrm->hdu, pathsplit, nthread)) return false;
+	subfrm->filepath = pathsplit.string();
+	subfrm->filename = pathsplit.filename().string();
+	return true;
+}
+
+bool DecompressFrame(FramePtr frame, const string &pathWork, int nthread, string &filepath) {
+	path pathout(pathWork);
+
+	pathout /= path(frame->filename).stem().string() + "_z.fit";
+	if (!split_hdu(frame->filepath, 1, pathout, nthread)) return false;
+	filepath = pathout.string();
+	return true;
+}
+
+/*!
+ * @brief 角度x相对x0的偏差, 处理0/360度跳变
+ */
+static double angle_offset(double x, double x0) {
+	double dx = x - x0;
+	if (dx > 180.0) dx -= 360.0;
+	else if (dx < -180.0) dx += 360.0;
+	return dx;
+}
+
+bool MergeFrameHDU(FramePtr frame, const std::vector<char> &success) {
+	std::vector<FramePtr> &subfrms = frame->subfrms;
+	NFObjVec &nfobjs = frame->nfobjs;
+	std::vector<double> fwhm;
+	int n = subfrms.size(), nok(0), i;
+	double ra0(0.0), azi0(0.0);
+	double dra(0.0), dazi(0.0), decc(0.0), altc(0.0), airmass(0.0);
+	double scale(0.0), errastro(0.0), mag0(0.0), magk(0.0);
+
+	for (i = 0; i < n; ++i) MergeFrameStat(frame, subfrms[i]);
+	nfobjs.clear();
+	frame->notOt = 0;
+	for (i = 0; i < n; ++i) {
+		if (!success[i]) continue;
+		FramePtr subfrm = subfrms[i];
+		NFObjVec &objs = subfrm->nfobjs;
+		for (NFObjVec::iterator it = objs.begin(); it != objs.end(); ++it) {
+			(*it)->hdu = subfrm->hdu;
+			nfobjs.push_back(*it);
+		}
+		if (subfrm->fwhm > 0.0) fwhm.push_back(subfrm->fwhm);
+		if (!nok) {
+			ra0  = subfrm->rac;
+			azi0 = subfrm->azic;
+		}
+		dra      += angle_offset(subfrm->rac, ra0);
+		dazi     += angle_offset(subfrm->azic, azi0);
+		decc     += subfrm->decc;
+		altc     += subfrm->altc;
+		airmass  += subfrm->airmass;
+		scale    += subfrm->scale;
+		errastro += subfrm->errastro;
+		mag0     += subfrm->mag0;
+		magk     += subfrm->magk;
+		frame->notOt += subfrm->notOt;
+		++nok;
+	}
+	if (!nok) return false;
+
+	frame->rac      = cyclemod(ra0 + dra / nok, 360.0);
+	frame->azic     = cyclemod(azi0 + dazi / nok, 360.0);
+	frame->decc     = decc / nok;
+	frame->altc     = altc / nok;
+	frame->airmass  = airmass / nok;
+	frame->scale    = scale / nok;
+	frame->errastro = errastro / nok;
+	frame->mag0     = mag0 / nok;
+	frame->magk     = magk / nok;
+	frame->fwhm     = -1.0;
+	if ((n = fwhm.size())) {
+		std::nth_element(fwhm.begin(), fwhm.begin() + n / 2, fwhm.end());
+		frame->fwhm = fwhm[n / 2];
+	}
+	_gLog->Write("%s. %d of %d HDUs reduced, FWHM = %.2f", frame->filename.c_str(),
+			nok, int(subfrms.size()), frame->fwhm);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+MosaicReduct::MosaicReduct(Parameter *param, int nworker) {
+	param_   = param;
+	nextsub_ = 0;
+	if (nworker < 1) nworker = 1;
+	for (int i = 0; i < nworker; ++i)
+		workers_.push_back(boost::make_shared<FrameReduct>(param_));
+}
+
+MosaicReduct::~MosaicReduct() {
+}
+
+bool MosaicReduct::DoIt(FramePtr frame) {
+	int n = frame->subfrms.size(), nworker = workers_.size();
+	boost::thread_group thrds;
+
+	frame_   = frame;
+	nextsub_ = 0;
+	subok_.assign(n, 0);
+	for (int i = 0; i < nworker && i < n; ++i)
+		thrds.create_thread(boost::bind(&MosaicReduct::thread_reduct, this, workers_[i]));
+	thrds.join_all();
+
+	return MergeFrameHDU(frame, subok_);
+}
+
+const std::vector<char>& MosaicReduct::GetSubResult() {
+	return subok_;
+}
+
+void MosaicReduct::thread_reduct(FrameReductPtr reduct) {
+	int n = frame_->subfrms.size(), i;
+
+	while (1) {
+		{
+			mutex_lock lck(mtx_sub_);
+			if ((i = nextsub_) >= n) break;
+			++nextsub_;
+		}
+		subok_[i] = reduct->DoIt(frame_->subfrms[i]);
+	}
+}
@@ -0,0 +1,95 @@
+/*!
+ * @file MosaicReduct.h 多扩展(MEF)/拼接相机图像的并行处理
+ * @version 0.1
+ * @date 2020-11-03
+ * @note
+ * - 每个图像扩展对应一个子帧, 拆分为单HDU文件后独立执行图像处理、天文定位、匹配星表和测光
+ * - 各子帧并行处理, 结束后合并为帧级目标集合, 目标记录所在HDU编号
+ * - 运动目标关联以子帧为单位: 每个图像扩展有独立的像素坐标系
+ */
+
+#ifndef MOSAICREDUCT_H_
+#define MOSAICREDUCT_H_
+
+#include <vector>
+#include <boost/thread.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+#include "FrameReduct.h"
+
+/*!
+ * @brief 将子帧对应的图像扩展写入工作目录下的单HDU文件
+ * @param subfrm   子帧. 成功后filepath和filename指向拆分文件
+ * @param pathWork 工作目录
+ * @param nthread  解压瓦片压缩图像的并行线程数. <= 0: 与处理器核数一致
+ * @return
+ * 操作结果
+ */
+extern bool SplitFrameHDU(FramePtr subfrm, const string &pathWork, int nthread);
+/*!
+ * @brief 将瓦片压缩的单帧图像解压至工作目录, 供SExtractor和solve-field读取
+ * @param frame    图像, frame->compressed为true
+ * @param pathWork 工作目录
+ * @param nthread  并行线程数. <= 0: 与处理器核数一致
+ * @param filepath 解压文件路径
+ * @return
+ * 操作结果
+ */
+extern bool DecompressFrame(FramePtr frame, const string &pathWork, int nthread, string &filepath);
+/*!
+ * @brief 合并子帧的处理结果
+ * @param frame   多扩展图像
+ * @param success 各子帧的处理结果
+ * @return
+ * 至少一个子帧处理成功时返回true
+ * @note
+ * - 目标集合依HDU顺序拼接
+ * - FWHM取子帧中值, 指向、比例尺及星等零点等取子帧均值
+ */
+extern bool MergeFrameHDU(FramePtr frame, const std::vector<char> &success);
+
+class MosaicReduct {
+public:
+	/*!
+	 * @param param   配置参数
+	 * @param nworker 并行处理的子帧数量
+	 */
+	MosaicReduct(Parameter *param, int nworker);
+	virtual ~MosaicReduct();
+
+protected:
+	/* 数据类型 */
+	typedef boost::unique_lock<boost::mutex> mutex_lock;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;		//< 配置参数
+	std::vector<FrameReductPtr> workers_;	//< 子帧处理流程
+	boost::mutex mtx_sub_;	//< 互斥锁: 子帧分配
+	FramePtr frame_;		//< 当前处理的多扩展图像
+	int nextsub_;			//< 下一个待处理子帧
+	std::vector<char> subok_;	//< 子帧处理结果
+
+public:
+	/*!
+	 * @brief 处理多扩展图像
+	 * @return
+	 * 合并结果, 见MergeFrameHDU()
+	 * @note
+	 * 阻塞直至所有子帧处理结束
+	 */
+	bool DoIt(FramePtr frame);
+	/*!
+	 * @brief 查看子帧处理结果
+	 */
+	const std::vector<char>& GetSubResult();
+
+protected:
+	/*!
+	 * @brief 线程: 处理子帧
+	 */
+	void thread_reduct(FrameReductPtr reduct);
+};
+typedef boost::shared_ptr<MosaicReduct> MosaicReductPtr;
+
+#endif /* MOSAICREDUCT_H_ */
@@ -7,6 +7,7 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <stdlib.h>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -14,6 +15,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/foreach.hpp>
 #include <boost/smart_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 using std::string;
 
@@ -95,6 +97,52 @@ struct Parameter {// 软件配置参数
 	// 图像处理
 	string pathExeSex;		//< SExtractor执行文件路径
 	string pathCfgSex;		//< SExtractor配置文件目录
+	string sexCatType;		//< SExtractor输出星表格式: ASCII_HEAD, FITS_1.0或FITS_LDAC
+	int sexWorkers;			//< 预先启动的SExtractor工作进程数量. 0: 逐帧由主进程启动
+	int sexRecycle;			//< 工作进程处理该帧数后回收. 0: 不回收
+	int nThreadDip;			//< 内置算法并行处理线程数. 0: 使用处理器核数
+	int stripDip;			//< 内置算法流式处理的条带行数. 0: 整帧处理
+	int tileCols, tileRows;	//< SExtractor分块并行处理: 列数和行数. 1*1: 不分块
+	int tileOverlap;		//< SExtractor分块并行处理: 相邻分块重叠像素数
+	bool dipNative;			//< 使用内置算法(ADIReduct)处理图像. false: 调用SExtractor
+	int bkw, bkh;			//< 内置算法: 背景拟合网格大小
+	int bkfw, bkfh;			//< 内置算法: 背景滤波网格数量
+	double snrp;			//< 内置算法: 目标信噪比阈值
+	int area0, area1;		//< 内置算法: 构成目标的像素数阈值. 0: 不限制
+	bool ufo;				//< 内置算法: 在信号提取前滤波
+	string pathfo;			//< 内置算法: 信号提取滤波函数卷积核存储路径
+	bool ucs;				//< 内置算法: 剔除假信号
+	bool roiEnable;			//< 跟踪图像: 只在目标窗口内完整提取, 全图只提取用于天文定位的亮星
+	int roiWidth, roiHeight;	//< 跟踪图像: 目标窗口大小
+	int roiX, roiY;			//< 跟踪图像: 目标预测位置, 起始于1. 0: 图像中心
+	double roiShallow;		//< 跟踪图像: 内置算法在目标窗口外的检测阈值与信噪比下限, 量纲: 背景噪声
+	bool maskEnable;		//< 亮星掩模: 由上一次定位结果和星表预测亮星光晕与溢出列, 剔除其中的伪目标
+	double maskMag;			//< 亮星掩模: 参与掩模的星等上限, V波段
+	double maskRadius;		//< 亮星掩模: 星等上限对应的光晕半径, 量纲: 像素. 半径与流量的平方根成正比
+	double maskSatMag;		//< 亮星掩模: 饱和星等, 更亮的恒星产生溢出列
+	double maskBleed;		//< 亮星掩模: 溢出列半长度与饱和流量之比, 量纲: 像素
+	int maskAge;			//< 亮星掩模: 定位结果的有效期, 量纲: 秒
+	bool psfEnable;			//< 以经验PSF拟合测光替换图像处理给出的位置与流量
+	int psfRadius;			//< PSF拟合: PSF半宽度, 量纲: 像素
+	double psfFit;			//< PSF拟合: 拟合半径, 量纲: 像素
+	int psfStars;			//< PSF拟合: 构建PSF的恒星数量上限
+	int psfGroup;			//< PSF拟合: 同时拟合的目标数量上限
+	bool winEnable;			//< 以高斯加权窗口迭代改正目标质心(同XWIN/YWIN)
+	double winMatch;		//< 窗口质心: 启用后匹配星表的初始半径, 量纲: 像元比例尺
+	// 预处理
+	bool calibEnable;		//< 在图像处理前执行本底、暗场与平场改正
+	string pathCalib;		//< 合并本底、暗场与平场存储目录, 各相机使用子目录<gid>_<uid>_<cid>
+	int ovsx1, ovsy1;		//< 过扫区起始点, 起始于0
+	int ovsx2, ovsy2;		//< 过扫区结束点, 含该点. x2 <= x1或y2 <= y1: 无过扫区
+	bool flatMedian;		//< 平场合并方法. true: 中值; false: σ剔除均值
+	double flatClip;		//< 平场合并: σ剔除阈值
+	int flatIdle;			//< 平场合并: 相机停止接收平场该时长后合并, 量纲: 秒
+	int flatMin;			//< 平场合并: 最少帧数
+	bool defectEnable;		//< 在改正时修补缺陷: 合并暗场中的热像素与坏列, 以及坏元素标记
+	double defectHot;		//< 缺陷: 暗流或列均值的偏离阈值, 量纲: σ
+	bool badcolEnable;		//< 由抽样行的逐列中值与MAD识别坏列, 写入坏列标记
+	double badcolSigma;		//< 坏列识别: 与相邻列统计量的偏离阈值, 量纲: σ
+	int badcolFrames;		//< 坏列识别: 写入坏列标记所需的累计帧数
 	// 窗口大小
 	int sizeNear;			//< 以目标为中心的采样分析窗口大小
 	// 天文定位
@@ -105,11 +153,20 @@ struct Parameter {// 软件配置参数
 	// 流量定标
 	bool doPhotometry;		//< 执行流量定标
 	string pathCatalog;		//< 测光星表目录
+	bool forcedEnable;		//< 跟踪图像: 在目标预测位置强制孔径测光
+	double forcedAper;		//< 强制测光: 孔径半径, 量纲: 像素
+	double forcedInner;		//< 强制测光: 背景环内半径, 量纲: 像素
+	double forcedOuter;		//< 强制测光: 背景环外半径, 量纲: 像素
 	// 处理结果输出目录
 	string pathOutput;		//< 处理结果存储目录
 	string pathBadmark;		//< 坏列/点记录文件
 	// 工作目录
 	string pathWork;		//< 工作目录, Linux下使用/dev/shm
+	// 批处理
+	int nThreadBatch;		//< 离线批处理工作线程数. <= 0: 使用处理器核数
+	// 跟踪
+	bool traceEnable;		//< 输出处理流程跟踪记录
+	int tracePeriod;		//< 跟踪记录写入文件的周期, 量纲: 秒
 	// 数据库访问接口
 	bool dbEnable;		//< 数据库启用标志
 	string dbUrl;		//< 数据库访问地址
@@ -129,6 +186,8 @@ protected:
 	string filepath;
 	// 被修改标记
 	bool dirty;
+	boost::mutex mtxBadmark;	//< 互斥锁: 坏列/坏点
+	int revBadmark;				//< 坏列/坏点的修改次数
 
 public:
 	/*!
@@ -155,10 +214,68 @@ public:
 		pt.add("BadMark.<xmlattr>.Path", "/usr/local/etc/badmark_airs.xml");
 		pt.add("Work.<xmlattr>.Path",    "/dev/shm");	//< Linux下使用虚拟内存作为工作路径
 		pt.add("SampleWindow.<xmlattr>.Size", "512");
+		pt.add("Batch.<xmlattr>.Threads",     "0");	//< 0: 使用处理器核数
+		pt.add("Trace.<xmlattr>.Enable",      false);	//< 跟踪记录存储在<Output>/Trace目录
+		pt.add("Trace.<xmlattr>.Period",      "10");
 
 		ptree &pt1 = pt.add("Reduction", "");
 		pt1.add("<xmlattr>.PathExe",    "/usr/local/bin/sex");
 		pt1.add("<xmlattr>.PathConfig", "/usr/local/etc/sex-param/default.sex");
+		pt1.add("<xmlattr>.Backend",    "sex");	//< sex: SExtractor; native: 内置算法
+		pt1.add("<xmlattr>.Catalog",    "FITS_1.0");	//< SExtractor星表格式: ASCII_HEAD, FITS_1.0, FITS_LDAC
+		pt1.add("Workers.<xmlattr>.Number",       0);	//< 预先启动的SExtractor工作进程
+		pt1.add("Workers.<xmlattr>.Recycle",      200);
+		pt1.add("Threads.<xmlattr>.Number",       0);	//< 内置算法并行线程, 0: 使用处理器核数
+		pt1.add("Stream.<xmlattr>.Rows",          0);	//< 内置算法流式处理的条带行数, 0: 整帧处理
+		pt1.add("Tiles.<xmlattr>.Columns",        1);	//< SExtractor分块并行处理, 1*1: 不分块
+		pt1.add("Tiles.<xmlattr>.Rows",           1);
+		pt1.add("Tiles.<xmlattr>.Overlap",        100);
+		pt1.add("BackMesh.<xmlattr>.Width",       64);
+		pt1.add("BackMesh.<xmlattr>.Height",      64);
+		pt1.add("BackFilter.<xmlattr>.Width",     3);
+		pt1.add("BackFilter.<xmlattr>.Height",    3);
+		pt1.add("Detect.<xmlattr>.SNR",           3.0);
+		pt1.add("Area.<xmlattr>.Minimum",         3);
+		pt1.add("Area.<xmlattr>.Maximum",         0);
+		pt1.add("Filter.<xmlattr>.Enable",        true);
+		pt1.add("Filter.<xmlattr>.Filepath",      "/usr/local/etc/sex-param/default.conv");
+		pt1.add("CleanSpurious.<xmlattr>.Enable", true);
+		pt1.add("ROI.<xmlattr>.Enable",           false);	//< 跟踪图像: 窗口内使用low.sex, 全图使用high.sex
+		pt1.add("ROI.<xmlattr>.Width",            512);
+		pt1.add("ROI.<xmlattr>.Height",           512);
+		pt1.add("ROI.<xmlattr>.X",                0);	//< 目标预测位置, 0: 图像中心
+		pt1.add("ROI.<xmlattr>.Y",                0);
+		pt1.add("ROI.<xmlattr>.Shallow",          10.0);	//< 内置算法: 窗口外检测阈值
+		pt1.add("BrightMask.<xmlattr>.Enable",    false);	//< 亮星掩模: 剔除亮星光晕与溢出列中的伪目标
+		pt1.add("BrightMask.<xmlattr>.Magnitude", 9.0);
+		pt1.add("BrightMask.<xmlattr>.Radius",    8.0);
+		pt1.add("BrightMask.<xmlattr>.Saturate",  7.0);
+		pt1.add("BrightMask.<xmlattr>.Bleed",     20.0);
+		pt1.add("BrightMask.<xmlattr>.Age",       1800);
+		pt1.add("PSF.<xmlattr>.Enable", false);	//< 经验PSF拟合测光, 同时拟合相互重叠的目标
+		pt1.add("PSF.<xmlattr>.Radius", 7);		//< PSF半宽度, 量纲: 像素
+		pt1.add("PSF.<xmlattr>.Fit",    3.0);	//< 拟合半径, 量纲: 像素
+		pt1.add("PSF.<xmlattr>.Stars",  100);	//< 构建PSF的恒星数量上限
+		pt1.add("PSF.<xmlattr>.Group",  20);	//< 同时拟合的目标数量上限
+		pt1.add("Centroid.<xmlattr>.Enable", false);	//< 高斯加权窗口质心
+		pt1.add("Centroid.<xmlattr>.Match",  1.5);		//< 匹配星表的初始半径, 量纲: 像元比例尺. 未启用时为2.5
+
+		ptree &pt7 = pt.add("Calibration", "");
+		pt7.add("<xmlattr>.Enable", false);
+		pt7.add("<xmlattr>.Path",   "/data/calib");	//< 合并本底/暗场/平场: <Path>/<gid>_<uid>_<cid>/{bias,dark,flat}.fit
+		pt7.add("Overscan.<xmlattr>.X1", 0);	//< 过扫区, 含结束点. 0: 无过扫区
+		pt7.add("Overscan.<xmlattr>.Y1", 0);
+		pt7.add("Overscan.<xmlattr>.X2", 0);
+		pt7.add("Overscan.<xmlattr>.Y2", 0);
+		pt7.add("FlatCombine.<xmlattr>.Method",  "median");	//< median: 中值; mean: σ剔除均值
+		pt7.add("FlatCombine.<xmlattr>.Clip",    3.0);
+		pt7.add("FlatCombine.<xmlattr>.Idle",    600);	//< 相机停止接收平场该时长后合并, 量纲: 秒
+		pt7.add("FlatCombine.<xmlattr>.Minimum", 5);
+		pt7.add("Defect.<xmlattr>.Enable", false);	//< 修补合并暗场中的热像素与坏列, 以及坏元素标记
+		pt7.add("Defect.<xmlattr>.Hot",    5.0);	//< 暗流或列均值的偏离阈值, 量纲: σ
+		pt7.add("BadColumn.<xmlattr>.Enable", false);	//< 由逐列中值与MAD识别坏列
+		pt7.add("BadColumn.<xmlattr>.Sigma",  5.0);	//< 与相邻列统计量的偏离阈值, 量纲: σ
+		pt7.add("BadColumn.<xmlattr>.Frames", 3);	//< 写入坏列标记所需的累计帧数
 
 		ptree &pt2 = pt.add("Astrometry", "");
 		pt2.add("<xmlattr>.Enable", false);
@@ -169,6 +286,10 @@ public:
 		ptree &pt3 = pt.add("Photometry", "");
 		pt3.add("<xmlattr>.Enable", false);
 		pt3.add("Catalog.<xmlattr>.Path", "/Users/lxm/Catalogue/UCAC4");
+		pt3.add("Forced.<xmlattr>.Enable",   false);	//< 跟踪图像在目标预测位置强制孔径测光
+		pt3.add("Forced.<xmlattr>.Aperture", 3.0);		//< 孔径半径, 量纲: 像素
+		pt3.add("Forced.<xmlattr>.Inner",    6.0);		//< 背景环内外半径, 量纲: 像素
+		pt3.add("Forced.<xmlattr>.Outer",    10.0);
 
 		ptree& pt4 = pt.add("Database", "");
 		pt4.add("<xmlattr>.Enable",    false);
@@ -195,12 +316,64 @@ public:
 	 * @param filepath 文件路径
 	 */
 	void LoadFile(const std::string& filepath) {
+		revBadmark = 0;
 		try {
 			using boost::property_tree::ptree;
 
 			ptree pt;
 			read_xml(filepath, pt, boost::property_tree::xml_parser::trim_whitespace);
 
+			nThreadBatch = 0;
+			dipNative    = false;
+			sexCatType   = "ASCII_HEAD";
+			sexWorkers   = 0;
+			nThreadDip   = 0;
+			stripDip     = 0;
+			tileCols = tileRows = 1;
+			tileOverlap  = 100;
+			sexRecycle   = 200;
+			bkw   = bkh  = 64;
+			bkfw  = bkfh = 3;
+			snrp  = 3.0;
+			area0 = 3;
+			area1 = 0;
+			ufo   = true;
+			pathfo = "/usr/local/etc/sex-param/default.conv";
+			ucs   = true;
+			roiEnable    = false;
+			roiWidth = roiHeight = 512;
+			roiX  = roiY = 0;
+			roiShallow   = 10.0;
+			maskEnable   = false;
+			maskMag      = 9.0;
+			maskRadius   = 8.0;
+			maskSatMag   = 7.0;
+			maskBleed    = 20.0;
+			maskAge      = 1800;
+			psfEnable    = false;
+			psfRadius    = 7;
+			psfFit       = 3.0;
+			psfStars     = 100;
+			psfGroup     = 20;
+			winEnable    = false;
+			winMatch     = 1.5;
+			traceEnable  = false;
+			tracePeriod  = 10;
+			calibEnable  = false;
+			ovsx1 = ovsy1 = ovsx2 = ovsy2 = 0;
+			flatMedian   = true;
+			flatClip     = 3.0;
+			flatIdle     = 600;
+			flatMin      = 5;
+			defectEnable = false;
+			defectHot    = 5.0;
+			badcolEnable = false;
+			badcolSigma  = 5.0;
+			badcolFrames = 3;
+			forcedEnable = false;
+			forcedAper   = 3.0;
+			forcedInner  = 6.0;
+			forcedOuter  = 10.0;
 			BOOST_FOREACH(ptree::value_type const &child, pt.get_child("")) {
 				if (boost::iequals(child.first, "GeoSite")) {
 					sitename = child.second.get("<xmlattr>.Name",     "");
@@ -212,6 +385,62 @@ public:
 				else if (boost::iequals(child.first, "Reduction")) {
 					pathExeSex = child.second.get("<xmlattr>.PathExe",    "");
 					pathCfgSex = child.second.get("<xmlattr>.PathConfig", "");
+					dipNative  = boost::iequals(child.second.get("<xmlattr>.Backend", "sex"), "native");
+					sexCatType = boost::to_upper_copy(child.second.get("<xmlattr>.Catalog", string("ASCII_HEAD")));
+					if (sexCatType != "FITS_1.0" && sexCatType != "FITS_LDAC") sexCatType = "ASCII_HEAD";
+					sexWorkers = child.second.get("Workers.<xmlattr>.Number",   0);
+					sexRecycle = child.second.get("Workers.<xmlattr>.Recycle",  200);
+					nThreadDip = child.second.get("Threads.<xmlattr>.Number",   0);
+					stripDip   = child.second.get("Stream.<xmlattr>.Rows",      0);
+					tileCols   = child.second.get("Tiles.<xmlattr>.Columns",    1);
+					tileRows   = child.second.get("Tiles.<xmlattr>.Rows",       1);
+					tileOverlap = child.second.get("Tiles.<xmlattr>.Overlap",    100);
+					bkw    = child.second.get("BackMesh.<xmlattr>.Width",       64);
+					bkh    = child.second.get("BackMesh.<xmlattr>.Height",      64);
+					bkfw   = child.second.get("BackFilter.<xmlattr>.Width",     3);
+					bkfh   = child.second.get("BackFilter.<xmlattr>.Height",    3);
+					snrp   = child.second.get("Detect.<xmlattr>.SNR",           3.0);
+					area0  = child.second.get("Area.<xmlattr>.Minimum",         3);
+					area1  = child.second.get("Area.<xmlattr>.Maximum",         0);
+					ufo    = child.second.get("Filter.<xmlattr>.Enable",        true);
+					pathfo = child.second.get("Filter.<xmlattr>.Filepath",      "/usr/local/etc/sex-param/default.conv");
+					ucs    = child.second.get("CleanSpurious.<xmlattr>.Enable", true);
+					roiEnable  = child.second.get("ROI.<xmlattr>.Enable",   false);
+					roiWidth   = child.second.get("ROI.<xmlattr>.Width",    512);
+					roiHeight  = child.second.get("ROI.<xmlattr>.Height",   512);
+					roiX       = child.second.get("ROI.<xmlattr>.X",        0);
+					roiY       = child.second.get("ROI.<xmlattr>.Y",        0);
+					roiShallow = child.second.get("ROI.<xmlattr>.Shallow",  10.0);
+					maskEnable = child.second.get("BrightMask.<xmlattr>.Enable",    false);
+					maskMag    = child.second.get("BrightMask.<xmlattr>.Magnitude", 9.0);
+					maskRadius = child.second.get("BrightMask.<xmlattr>.Radius",    8.0);
+					maskSatMag = child.second.get("BrightMask.<xmlattr>.Saturate",  7.0);
+					maskBleed  = child.second.get("BrightMask.<xmlattr>.Bleed",     20.0);
+					maskAge    = child.second.get("BrightMask.<xmlattr>.Age",       1800);
+					psfEnable  = child.second.get("PSF.<xmlattr>.Enable", false);
+					psfRadius  = child.second.get("PSF.<xmlattr>.Radius", 7);
+					psfFit     = child.second.get("PSF.<xmlattr>.Fit",    3.0);
+					psfStars   = child.second.get("PSF.<xmlattr>.Stars",  100);
+					psfGroup   = child.second.get("PSF.<xmlattr>.Group",  20);
+					winEnable  = child.second.get("Centroid.<xmlattr>.Enable", false);
+					winMatch   = child.second.get("Centroid.<xmlattr>.Match",  1.5);
+				}
+				else if (boost::iequals(child.first, "Calibration")) {
+					calibEnable = child.second.get("<xmlattr>.Enable", false);
+					pathCalib   = child.second.get("<xmlattr>.Path",   "");
+					ovsx1 = child.second.get("Overscan.<xmlattr>.X1", 0);
+					ovsy1 = child.second.get("Overscan.<xmlattr>.Y1", 0);
+					ovsx2 = child.second.get("Overscan.<xmlattr>.X2", 0);
+					ovsy2 = child.second.get("Overscan.<xmlattr>.Y2", 0);
+					flatMedian = !boost::iequals(child.second.get("FlatCombine.<xmlattr>.Method", "median"), "mean");
+					flatClip   = child.second.get("FlatCombine.<xmlattr>.Clip",    3.0);
+					flatIdle   = child.second.get("FlatCombine.<xmlattr>.Idle",    600);
+					flatMin    = child.second.get("FlatCombine.<xmlattr>.Minimum", 5);
+					defectEnable = child.second.get("Defect.<xmlattr>.Enable", false);
+					defectHot    = child.second.get("Defect.<xmlattr>.Hot",    5.0);
+					badcolEnable = child.second.get("BadColumn.<xmlattr>.Enable", false);
+					badcolSigma  = child.second.get("BadColumn.<xmlattr>.Sigma",  5.0);
+					badcolFrames = child.second.get("BadColumn.<xmlattr>.Frames", 3);
 				}
 				else if (boost::iequals(child.first, "Astrometry")) {
 					doAstrometry   = child.second.get("<xmlattr>.Enable",   true);
@@ -222,6 +451,10 @@ public:
 				else if (boost::iequals(child.first, "Photometry")) {
 					doPhotometry = child.second.get("<xmlattr>.Enable",       true);
 					pathCatalog  = child.second.get("Catalog.<xmlattr>.Path", "");
+					forcedEnable = child.second.get("Forced.<xmlattr>.Enable",   false);
+					forcedAper   = child.second.get("Forced.<xmlattr>.Aperture", 3.0);
+					forcedInner  = child.second.get("Forced.<xmlattr>.Inner",    6.0);
+					forcedOuter  = child.second.get("Forced.<xmlattr>.Outer",    10.0);
 				}
 				else if (boost::iequals(child.first, "Output")) {
 					pathOutput = child.second.get("<xmlattr>.Path", "");
@@ -235,6 +468,13 @@ public:
 				else if (boost::iequals(child.first, "SampleWindow")) {
 					sizeNear = child.second.get("<xmlattr>.Size", 512);
 				}
+				else if (boost::iequals(child.first, "Batch")) {
+					nThreadBatch = child.second.get("<xmlattr>.Threads", 0);
+				}
+				else if (boost::iequals(child.first, "Trace")) {
+					traceEnable = child.second.get("<xmlattr>.Enable", false);
+					tracePeriod = child.second.get("<xmlattr>.Period", 10);
+				}
 				else if (boost::iequals(child.first, "Database")) {
 					dbEnable = child.second.get("<xmlattr>.Enable",    false);
 					dbUrl    = child.second.get("URL.<xmlattr>.Addr",  "http://172.28.8.8:8080/gwebend/");
@@ -252,6 +492,36 @@ public:
 			}
 
 			LoadBadmark();
+			if (tracePeriod < 1) tracePeriod = 1;
+			if (bkw < 8) bkw = 8;
+			if (bkh < 8) bkh = 8;
+			if (tileCols < 1) tileCols = 1;
+			if (tileRows < 1) tileRows = 1;
+			if (tileOverlap < 0) tileOverlap = 0;
+			if (roiWidth < 64) roiWidth = 64;
+			if (roiHeight < 64) roiHeight = 64;
+			if (roiShallow < 1.5) roiShallow = 1.5;
+			if (maskRadius < 1.0) maskRadius = 1.0;
+			if (maskBleed < 0.0) maskBleed = 0.0;
+			if (maskAge < 60) maskAge = 60;
+			if (psfRadius < 3) psfRadius = 3;
+			else if (psfRadius > 25) psfRadius = 25;
+			if (psfFit < 1.5) psfFit = 1.5;
+			else if (psfFit > psfRadius) psfFit = psfRadius;
+			if (psfStars < 10) psfStars = 10;
+			if (psfGroup < 1) psfGroup = 1;
+			else if (psfGroup > 50) psfGroup = 50;
+			if (winMatch < 0.5) winMatch = 0.5;
+			else if (winMatch > 2.5) winMatch = 2.5;
+			if (flatClip < 1.0) flatClip = 1.0;
+			if (flatMin < 3) flatMin = 3;
+			if (defectHot < 3.0) defectHot = 3.0;
+			if (badcolSigma < 3.0) badcolSigma = 3.0;
+			if (badcolFrames < 1) badcolFrames = 1;
+			else if (badcolFrames > 255) badcolFrames = 255;
+			if (forcedAper < 1.0) forcedAper = 1.0;
+			if (forcedInner < forcedAper) forcedInner = forcedAper;
+			if (forcedOuter < forcedInner + 2.0) forcedOuter = forcedInner + 2.0;
 			if (sizeNear < 128) sizeNear = 128;
 			else if (sizeNear > 1024) sizeNear = 1024;
 
@@ -263,6 +533,25 @@ public:
 		}
 	}
 
+	/*!
+	 * @brief 计算跟踪图像的目标窗口[x0, x1)*[y0, y1), 坐标起始于0
+	 * @param wimg 图像宽度
+	 * @param himg 图像高度
+	 * @return
+	 * 窗口与图像相交时返回true
+	 * @note
+	 * 跟踪计划使目标保持在预测位置, 窗口以预测位置为中心, 超出图像的部分被截除
+	 */
+	bool RoiWindow(int wimg, int himg, int &x0, int &y0, int &x1, int &y1) {
+		x0 = (roiX > 0 ? roiX - 1 : wimg / 2) - roiWidth / 2;
+		y0 = (roiY > 0 ? roiY - 1 : himg / 2) - roiHeight / 2;
+		x1 = std::min(x0 + roiWidth, wimg);
+		y1 = std::min(y0 + roiHeight, himg);
+		if (x0 < 0) x0 = 0;
+		if (y0 < 0) y0 = 0;
+		return x0 < x1 && y0 < y1;
+	}
+
 	/*!
 	 * @brief 加载坏元素标记
 	 * @return
@@ -323,6 +612,7 @@ public:
 	 * 操作结果
 	 */
 	bool SaveBadmark() {
+		boost::unique_lock<boost::mutex> lck(mtxBadmark);
 		if (!dirty || pathBadmark.empty()) return true;
 
 		using namespace boost::posix_time;
@@ -384,6 +674,7 @@ public:
 	}
 
 	void AddBadcol(const string& gid, const string& uid, const string& cid, int col) {
+		boost::unique_lock<boost::mutex> lck(mtxBadmark);
 		CameraBadcol* ptr = GetBadcol(gid, uid, cid);
 		if (!ptr) {
 			CameraBadcol badcol;
@@ -392,10 +683,11 @@ public:
 			badcol.cid = cid;
 			badcol.count = 0;
 			badColSet.push_back(badcol);
-			ptr = &badcol;
+			ptr = &badColSet.back();
 		}
 		ptr->add(col);
 		dirty = true;
+		++revBadmark;
 	}
 
 	CameraBadpix* GetBadpix(const string& gid, const string& uid, const string& cid) {
@@ -407,6 +699,7 @@ public:
 	}
 
 	void AddBadpix(const string& gid, const string& uid, const string& cid, int col, int row) {
+		boost::unique_lock<boost::mutex> lck(mtxBadmark);
 		CameraBadpix* ptr = GetBadpix(gid, uid, cid);
 		if (!ptr) {
 			CameraBadpix badpix;
@@ -415,10 +708,43 @@ public:
 			badpix.cid = cid;
 			badpix.count = 0;
 			badPixSet.push_back(badpix);
-			ptr = &badpix;
+			ptr = &badPixSet.back();
 		}
 		ptr->add(col, row);
 		dirty = true;
+		++revBadmark;
+	}
+
+	/*!
+	 * @brief 复制相机的坏列, 供其它线程使用
+	 * @return
+	 * 相机无坏列时返回false
+	 */
+	bool CopyBadcol(const string& gid, const string& uid, const string& cid, CameraBadcol& badcol) {
+		boost::unique_lock<boost::mutex> lck(mtxBadmark);
+		CameraBadcol* ptr = GetBadcol(gid, uid, cid);
+		if (ptr) badcol = *ptr;
+		return ptr != NULL;
+	}
+
+	/*!
+	 * @brief 复制相机的坏点, 供其它线程使用
+	 * @return
+	 * 相机无坏点时返回false
+	 */
+	bool CopyBadpix(const string& gid, const string& uid, const string& cid, CameraBadpix& badpix) {
+		boost::unique_lock<boost::mutex> lck(mtxBadmark);
+		CameraBadpix* ptr = GetBadpix(gid, uid, cid);
+		if (ptr) badpix = *ptr;
+		return ptr != NULL;
+	}
+
+	/*!
+	 * @brief 坏列/坏点的修改次数, 用于判断派生数据是否需要更新
+	 */
+	int BadmarkRevision() {
+		boost::unique_lock<boost::mutex> lck(mtxBadmark);
+		return revBadmark;
 	}
 };
 
@@ -11,6 +11,7 @@
 #include <math.h>
 #include <Eigen/Dense>
 #include "PhotoMetry.h"
+#include "FrameStat.h"
 #include "GLog.h"
 #include "AMath.h"
 
@@ -20,7 +21,8 @@ using namespace boost::filesystem;
 using namespace AstroUtil;
 using namespace Eigen;
 
-PhotoMetry::PhotoMetry(Parameter *param) {
+PhotoMetry::PhotoMetry(Parameter *param)
+	: forced_(param) {
 	param_     = param;
 	working_   = false;
 	fullframe_ = false;
@@ -48,6 +50,7 @@ bool PhotoMetry::DoIt(FramePtr frame) {
 	frame_         = frame;
 	fullframe_     = true;
 	working_       = true;
+	StageBegin(frame_, STAGE_PHOTO);
 
 	// 区域选择: 用于评估中心视场消光, 图像质量
 	int size = param_->sizeNear;
@@ -198,12 +201,28 @@ bool PhotoMetry::do_fit(MagVec &mags, double &med, double &sig) {
 	return true;
 }
 
+/*
+ * 目标预测位置与目标窗口一致: 配置位置, 或图像中心
+ */
+void PhotoMetry::forced_target() {
+	ForcedVec objs(1);
+	ForcedObject &obj = objs[0];
+	int nthread = param_->nThreadDip > 0 ? param_->nThreadDip : boost::thread::hardware_concurrency();
+
+	obj.x = param_->roiX > 0 ? param_->roiX : frame_->wimg / 2 + 1;
+	obj.y = param_->roiY > 0 ? param_->roiY : frame_->himg / 2 + 1;
+	if (!forced_.Measure(frame_, objs, nthread < 1 ? 1 : nthread)) return;
+	if (!(obj.flag & (FORCED_SKY | FORCED_FAINT))) obj.mag_fit = mag0_ + magk_ * obj.mag;
+	frame_->forced = objs;
+}
+
 void PhotoMetry::thread_match() {
 	bool rslt = do_match();
 	if (rslt) {
 		if (fullframe_) {
 			frame_->mag0 = mag0_;
 			frame_->magk = magk_;
+			if (param_->forcedEnable && frame_->typeTrack && !frame_->plane) forced_target();
 		}
 		else if (objptr_.use_count()) {
 			objptr_->mag_fit = mag0_ + magk_ * objptr_->features[NDX_MAG];
@@ -225,5 +244,7 @@ void PhotoMetry::thread_match() {
 		}
 	}
 	working_ = false;
+	// 线程随任务创建, 线程CPU时间即为该步骤的CPU时间
+	if (fullframe_) StageEnd(frame_, STAGE_PHOTO, StatThreadCPU());
 	rsltPhotometry_(rslt);
 }
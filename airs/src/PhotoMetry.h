@@ -15,6 +15,7 @@
 #include "ATimeSpace.h"
 #include "Parameter.h"
 #include "ACatUCAC4.h"
+#include "ForcedPhot.h"
 
 class PhotoMetry {
 public:
@@ -49,6 +50,7 @@ protected:
 	int x1_, y1_;	//< 定标区域
 	int x2_, y2_;
 	double mag0_, magk_;	//< 拟合系数
+	ForcedPhot forced_;		//< 强制测光
 
 public:
 	/*!
@@ -87,6 +89,10 @@ protected:
 	 */
 	void do_fit(MagVec &mags);
 	bool do_fit(MagVec &mags, double &mean, double &sig);
+	/*!
+	 * @brief 跟踪图像: 在目标预测位置强制测光, 结果存储在frame_->forced
+	 */
+	void forced_target();
 	/*!
 	 * @brief 线程: 匹配星表
 	 */
@@ -5,12 +5,853 @@
  *      Author: lxm
  */
 
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include "PreProcess.h"
+#include "ADISimd.h"
+#include "FitsMMap.h"
+#include "FrameStat.h"
+#include "GLog.h"
+
+using namespace boost::filesystem;
+using namespace AstroUtil;
+
+/*
+ * 3σ迭代剔除后的均值与σ
+ */
+static void clip_stat(const float *data, int n, double &mean, double &sig) {
+	float lo(-FLT_MAX), hi(FLT_MAX);
+	double sum, sum2;
+	int i, count;
+
+	mean = sig = 0.0;
+	for (i = 0; i < 5; ++i) {
+		sum = sum2 = 0.0;
+		if ((count = SimdRowStat(data, n, lo, hi, sum, sum2)) < 2) break;
+		mean = sum / count;
+		sig  = sqrt(std::max(sum2 / count - mean * mean, 0.0));
+		lo   = float(mean - 3.0 * sig);
+		hi   = float(mean + 3.0 * sig);
+	}
+}
 
 PreProcess::PreProcess(Parameter *param) {
 	param_ = param;
+	overscan_.x1 = param->ovsx1;
+	overscan_.y1 = param->ovsy1;
+	overscan_.x2 = param->ovsx2;
+	overscan_.y2 = param->ovsy2;
+	thrd_flatcmb_.reset(new boost::thread(boost::bind(&PreProcess::thread_flatcmb, this)));
 }
 
 PreProcess::~PreProcess() {
+	if (thrd_flatcmb_.unique()) {
+		thrd_flatcmb_->interrupt();
+		thrd_flatcmb_->join();
+		thrd_flatcmb_.reset();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool PreProcess::Prepare(FramePtr frame, int width, int height, CalibFrame &calib) {
+	int x0, y0, x1, y1;
+	calib.master = get_master(frame, width, height);
+	calib.kdark  = float(frame->expdur);
+	calib.offset = 0.0;
+	return (calib.master->bias || calib.master->dark || calib.master->flat || calib.master->defect
+			|| OverscanZone(width, height, x0, y0, x1, y1));
+}
+
+bool PreProcess::OverscanZone(int width, int height, int &x0, int &y0, int &x1, int &y1) {
+	if (overscan_.x2 <= overscan_.x1 || overscan_.y2 <= overscan_.y1) return false;
+	x0 = std::max(overscan_.x1, 0);
+	y0 = std::max(overscan_.y1, 0);
+	x1 = std::min(overscan_.x2 + 1, width);
+	y1 = std::min(overscan_.y2 + 1, height);
+	return (x1 > x0 && y1 > y0);
+}
+
+/*
+ * 过扫区电平: 3σ剔除后的均值. 有合并本底时取与本底过扫区电平之差, 仅修正电平漂移
+ */
+void PreProcess::SetOverscan(CalibFrame &calib, const float *zone, int n) {
+	double mea(0.0), sig(0.0), sum(0.0), lo, hi;
+	int i, count(0);
+
+	if (n <= 0) return;
+	for (i = 0; i < n; ++i) {
+		mea += zone[i];
+		sig += double(zone[i]) * zone[i];
+	}
+	mea /= n;
+	sig = sqrt(std::max(sig / n - mea * mea, 0.0));
+	lo = mea - 3.0 * sig;
+	hi = mea + 3.0 * sig;
+	for (i = 0; i < n; ++i) {
+		if (zone[i] >= lo && zone[i] <= hi) {
+			sum += zone[i];
+			++count;
+		}
+	}
+	if (count) mea = sum / count;
+	if (calib.master && calib.master->bias) mea -= calib.master->levelBias;
+	calib.offset = float(mea);
+}
+
+void PreProcess::Apply(const CalibFrame &calib, float *data, int y0, int y1, int nthread) {
+	apply_parallel(calib, data, NULL, 0.0, data, y0, y1, nthread);
+}
+
+bool PreProcess::Calibrate(FramePtr frame, float *data, int width, int height, int nthread) {
+	CalibFrame calib;
+	int x0, y0, x1, y1, x, y;
+
+	if (!Prepare(frame, width, height, calib)) return false;
+	if (OverscanZone(width, height, x0, y0, x1, y1)) {
+		std::vector<float> zone;
+		zone.reserve((x1 - x0) * (y1 - y0));
+		for (y = y0; y < y1; ++y) {
+			for (x = x0; x < x1; ++x) zone.push_back(data[y * width + x]);
+		}
+		SetOverscan(calib, zone.data(), int(zone.size()));
+	}
+	Apply(calib, data, 0, height, nthread);
+	return true;
+}
+
+/*
+ * 无符号16位图像直接由映射区存储值改正为浮点数, 不经中间转换
+ */
+bool PreProcess::CalibrateFile(FramePtr frame, const string &filepath, int nthread) {
+	FitsMMap fmap;
+	CalibFrame calib;
+	fltarr data;
+	int width(0), height(0), x0, y0, x1, y1, x, y;
+	bool loaded(false);
+
+	if (fmap.Open(frame->filepath)) {
+		width  = fmap.Width();
+		height = fmap.Height();
+		if (!Prepare(frame, width, height, calib)) return false;
+		data.reset(new float[width * height]);
+		if (fmap.Bitpix() == 16 && fmap.Bscale() == 1.0 && fmap.Bzero() == floor(fmap.Bzero())
+				&& fabs(fmap.Bzero()) <= 16744448.0) {// 2^24 - 2^15
+			boost::shared_array<short> raw(new short[width * height]);
+			float zero = float(fmap.Bzero());
+			if ((loaded = fmap.ReadRaw(raw.get(), nthread))) {
+				if (OverscanZone(width, height, x0, y0, x1, y1)) {
+					std::vector<float> zone;
+					zone.reserve((x1 - x0) * (y1 - y0));
+					for (y = y0; y < y1; ++y) {
+						for (x = x0; x < x1; ++x) zone.push_back(float(raw[y * width + x]) + zero);
+					}
+					SetOverscan(calib, zone.data(), int(zone.size()));
+				}
+				apply_parallel(calib, NULL, raw.get(), zero, data.get(), 0, height, nthread);
+			}
+		}
+		else if ((loaded = fmap.ReadImage(data.get(), nthread))) {
+			Calibrate(frame, data.get(), width, height, nthread);
+		}
+		fmap.Close();
+	}
+	if (!loaded) {// 其它图像或压缩数据损坏: 由cfitsio读取
+		fitsfile *fitsptr(NULL);
+		int status(0);
+		long naxes[2];
+
+		fits_open_image(&fitsptr, frame->filepath.c_str(), READONLY, &status);
+		fits_get_img_size(fitsptr, 2, naxes, &status);
+		if (!status) {
+			width  = int(naxes[0]);
+			height = int(naxes[1]);
+			data.reset(new float[width * height]);
+			fits_read_img(fitsptr, TFLOAT, 1, LONGLONG(width) * height, NULL, data.get(), NULL, &status);
+		}
+		if (fitsptr) fits_close_file(fitsptr, &status);
+		if (status) {
+			char txt[40];
+			fits_get_errstatus(status, txt);
+			_gLog->Write(LOG_FAULT, "PreProcess::CalibrateFile()", "failed to read [%s]: %s",
+					frame->filepath.c_str(), txt);
+			return false;
+		}
+		if (!Calibrate(frame, data.get(), width, height, nthread)) return false;
+	}
+	return write_image(frame, filepath, data.get(), width, height);
+}
+
+bool PreProcess::AddFlat(FramePtr frame) {
+	if (!boost::istarts_with(frame->imgtype, "flat")) return false;
+	if (frame->subfrms.size() || frame->nplane) {
+		_gLog->Write(LOG_WARN, "PreProcess::AddFlat()", "multi-extension or cube flat [%s] is ignored",
+				frame->filename.c_str());
+		return true;
+	}
+
+	boost::unique_lock<boost::mutex> lck(mtx_flat_);
+	FlatSet &flats = pathflat_[frame->gid + "_" + frame->uid + "_" + frame->cid];
+	flats.frames.push_back(frame);
+	flats.last = std::time(NULL);
+	return true;
+}
+
+void PreProcess::CombineFlats() {
+	combine_flats(true);
+}
+
+/*
+ * 平场合并:
+ * - 各帧改正本底与暗场, 以众数归一化, 消除光源强度变化
+ * - 按行分块, 每个分块读取全部帧的对应行, 逐像素合并. 分块由多个线程依次领取,
+ *   分块行数使每个线程的缓存区约为16MB
+ * - 结果先写入临时文件, 完成后更名替换, 读者不会看到不完整的平场
+ */
+bool PreProcess::CombineFlat(const FrameVec &frames, const string &filepath, int nthread) {
+	boost::this_thread::disable_interruption di;	// 合并期间不响应线程中断
+	FlatCombine cmb;
+	string filetmp = filepath + ".tmp";
+	int status(0), n, width, height, i;
+	double mode;
+
+	cmb.width  = cmb.height = 0;
+	cmb.fitsout = NULL;
+	cmb.ok = true;
+	for (FrameVec::const_iterator it = frames.begin(); it != frames.end(); ++it) {
+		FlatFrame flat;
+		flat.frame = *it;
+		if (!open_flat(flat, width, height)) continue;
+		if (!cmb.width) {
+			cmb.width  = width;
+			cmb.height = height;
+		}
+		if (width != cmb.width || height != cmb.height) {
+			_gLog->Write(LOG_WARN, "PreProcess::CombineFlat()", "size of [%s] is %d * %d, expected %d * %d",
+					flat.frame->filename.c_str(), width, height, cmb.width, cmb.height);
+			if (flat.fitsptr) fits_close_file(flat.fitsptr, &status);
+			continue;
+		}
+		cmb.frames.push_back(flat);
+	}
+	for (i = 0; i < int(cmb.frames.size()); ) {
+		FlatFrame &flat = cmb.frames[i];
+		if (flat_mode(&cmb, flat, mode) && mode > 0.0) {
+			flat.norm = float(1.0 / mode);
+			++i;
+		}
+		else {
+			_gLog->Write(LOG_WARN, "PreProcess::CombineFlat()", "flat [%s] is rejected: invalid mode",
+					flat.frame->filename.c_str());
+			if (flat.fitsptr) fits_close_file(flat.fitsptr, &status);
+			cmb.frames.erase(cmb.frames.begin() + i);
+		}
+	}
+
+	if ((n = int(cmb.frames.size())) < 3) {
+		_gLog->Write(LOG_FAULT, "PreProcess::CombineFlat()", "%d valid flats, at least 3 are required", n);
+		cmb.ok = false;
+	}
+	else {
+		long naxes[] = { cmb.width, cmb.height };
+		char imgtype[] = "FLAT";
+		char combtype[10];
+		cmb.median = param_->flatMedian || n < 4;	// σ剔除均值需要至少4帧
+		strcpy(combtype, cmb.median ? "MEDIAN" : "MEAN");
+		fits_create_file(&cmb.fitsout, ("!" + filetmp).c_str(), &status);
+		fits_create_img(cmb.fitsout, FLOAT_IMG, 2, naxes, &status);
+		fits_write_key(cmb.fitsout, TSTRING, "IMAGETYP", imgtype,  NULL, &status);
+		fits_write_key(cmb.fitsout, TINT,    "NCOMBINE", &n,       "number of combined flats", &status);
+		fits_write_key(cmb.fitsout, TSTRING, "COMBTYPE", combtype, "combination method", &status);
+		if (status) cmb.ok = false;
+		else {
+			cmb.rows = std::max(1, (4 << 20) / (n * cmb.width));
+			cmb.next = 0;
+			if (nthread > (cmb.height + cmb.rows - 1) / cmb.rows) nthread = (cmb.height + cmb.rows - 1) / cmb.rows;
+			boost::thread_group grp;
+			for (i = 0; i < nthread; ++i)
+				grp.create_thread(boost::bind(&PreProcess::combine_rows, this, &cmb));
+			grp.join_all();
+		}
+		if (cmb.fitsout) fits_close_file(cmb.fitsout, &status);
+		if (status) {
+			char txt[40];
+			fits_get_errstatus(status, txt);
+			_gLog->Write(LOG_FAULT, "PreProcess::CombineFlat()", "failed to write [%s]: %s",
+					filetmp.c_str(), txt);
+			cmb.ok = false;
+		}
+	}
+	for (FlatFrameVec::iterator it = cmb.frames.begin(); it != cmb.frames.end(); ++it) {
+		if (it->fitsptr) fits_close_file(it->fitsptr, &status);
+	}
+
+	boost::system::error_code ec;
+	if (cmb.ok) {
+		rename(path(filetmp), path(filepath), ec);
+		if (ec) {
+			_gLog->Write(LOG_FAULT, "PreProcess::CombineFlat()", "failed to replace [%s]: %s",
+					filepath.c_str(), ec.message().c_str());
+			cmb.ok = false;
+		}
+	}
+	if (!cmb.ok) remove(path(filetmp), ec);
+	else _gLog->Write("%d flats are combined into [%s]", n, filepath.c_str());
+	return cmb.ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+PreProcess::MasterPtr PreProcess::get_master(FramePtr frame, int width, int height) {
+	static const char *names[] = { "bias.fit", "dark.fit", "flat.fit" };
+	boost::unique_lock<boost::mutex> lck(mtx_master_);
+	string key = frame->gid + "_" + frame->uid + "_" + frame->cid;
+	path dirpath = param_->pathCalib;
+	std::time_t mtime[3];
+	boost::system::error_code ec;
+	int i, revision = param_->defectEnable ? param_->BadmarkRevision() : 0;
+
+	dirpath /= key;
+	for (i = 0; i < 3; ++i) {
+		mtime[i] = last_write_time(dirpath / names[i], ec);
+		if (ec) mtime[i] = 0;
+	}
+	// 多扩展图像各HDU的缺陷不同, 分别缓存
+	MasterPtr &master = masters_[frame->hdu ? key + "#" + std::to_string(frame->hdu) : key];
+	if (master && master->width == width && master->height == height
+			&& std::equal(mtime, mtime + 3, master->mtime)) {
+		if (master->revision != revision) {// 坏元素标记已修改: 重建缺陷掩模, 共享其它改正图像
+			MasterPtr newer = boost::make_shared<MasterFrame>(*master);
+			newer->defect   = mark_badmark(master->defect, frame, width, height);
+			newer->revision = revision;
+			master = newer;
+		}
+		return master;
+	}
+
+	/* 首次使用或文件已修改: 重新加载 */
+	MasterPtr newer = boost::make_shared<MasterFrame>();
+	int x0, y0, x1, y1, x, y, n(width * height), count(0);
+	double exptime(0.0), mean(0.0);
+	float *ptr;
+
+	newer->width  = width;
+	newer->height = height;
+	newer->levelBias = 0.0;
+	newer->revision  = revision;
+	memcpy(newer->mtime, mtime, sizeof(mtime));
+	if (mtime[0]) newer->bias = load_master((dirpath / names[0]).string(), width, height, NULL);
+	if (mtime[1]) newer->dark = load_master((dirpath / names[1]).string(), width, height, &exptime);
+	if (mtime[2]) newer->flat = load_master((dirpath / names[2]).string(), width, height, NULL);
+	if (newer->bias && OverscanZone(width, height, x0, y0, x1, y1)) {
+		std::vector<float> zone;
+		CalibFrame calib;
+		zone.reserve((x1 - x0) * (y1 - y0));
+		for (y = y0, ptr = newer->bias.get(); y < y1; ++y) {
+			for (x = x0; x < x1; ++x) zone.push_back(ptr[y * width + x]);
+		}
+		SetOverscan(calib, zone.data(), int(zone.size()));
+		newer->levelBias = calib.offset;
+	}
+	if (newer->dark && exptime > 0.0) {// 换算为单位曝光时间暗流
+		float k = float(1.0 / exptime);
+		for (x = 0, ptr = newer->dark.get(); x < n; ++x) ptr[x] *= k;
+	}
+	else if (newer->dark) {
+		_gLog->Write(LOG_WARN, "PreProcess::get_master()", "dark of %s lacks EXPTIME, ignored", key.c_str());
+		newer->dark.reset();
+	}
+	if (newer->flat) {// 以有效像素均值归一化, 存储倒数. 无效像素与过扫区不做平场改正
+		bool zone = OverscanZone(width, height, x0, y0, x1, y1);
+		int i;
+		for (y = i = 0, ptr = newer->flat.get(); y < height; ++y) {
+			for (x = 0; x < width; ++x, ++i) {
+				if (zone && x >= x0 && x < x1 && y >= y0 && y < y1) ptr[i] = 0.0f;
+				else if (ptr[i] > 0.0) {
+					mean += ptr[i];
+					++count;
+				}
+			}
+		}
+		if (count) mean /= count;
+		for (x = 0; x < n; ++x) ptr[x] = ptr[x] > 0.0 ? float(mean / ptr[x]) : 1.0f;
+	}
+	if (param_->defectEnable)
+		newer->defect = mark_badmark(newer->dark ? mark_dark(newer->dark.get(), width, height) : DefectPtr(),
+				frame, width, height);
+	if (newer->bias || newer->dark || newer->flat || newer->defect) {
+		_gLog->Write("calibration masters for %s: bias[%s], dark[%s], flat[%s], defect[%d]", key.c_str(),
+				newer->bias ? "Y" : "N", newer->dark ? "Y" : "N", newer->flat ? "Y" : "N",
+				newer->defect ? newer->defect->count : 0);
+	}
+	master = newer;
+	return master;
+}
+
+PreProcess::fltarr PreProcess::load_master(const string &filepath, int width, int height, double *exptime) {
+	fitsfile *fitsptr(NULL);
+	int status(0);
+	long naxes[2];
+	fltarr data;
+
+	fits_open_image(&fitsptr, filepath.c_str(), READONLY, &status);
+	fits_get_img_size(fitsptr, 2, naxes, &status);
+	if (!status && (naxes[0] != width || naxes[1] != height)) {
+		_gLog->Write(LOG_WARN, "PreProcess::load_master()", "size of [%s] is %ld * %ld, frame is %d * %d",
+				filepath.c_str(), naxes[0], naxes[1], width, height);
+		fits_close_file(fitsptr, &status);
+		return data;
+	}
+	if (!status) {
+		data.reset(new float[width * height]);
+		fits_read_img(fitsptr, TFLOAT, 1, LONGLONG(width) * height, NULL, data.get(), NULL, &status);
+	}
+	if (!status && exptime && fits_read_key(fitsptr, TDOUBLE, "EXPTIME", exptime, NULL, &status)) {
+		status = 0;
+		*exptime = 0.0;
+	}
+	if (fitsptr) fits_close_file(fitsptr, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "PreProcess::load_master()", "failed to read [%s]: %s",
+				filepath.c_str(), txt);
+		data.reset();
+	}
+	return data;
+}
+
+void PreProcess::apply_parallel(const CalibFrame &calib, const float *src, const short *raw, float zero,
+		float *dst, int y0, int y1, int nthread) {
+	int width = calib.master->width, rows = y1 - y0, r0, r1, i;
+
+	if (nthread > rows) nthread = rows;
+	if (nthread <= 1) {
+		apply_rows(&calib, src, raw, zero, dst, y0, y1);
+		return;
+	}
+
+	StatThreadGroup grp;
+	for (i = 0; i < nthread; ++i) {
+		r0 = rows * i / nthread;
+		r1 = rows * (i + 1) / nthread;
+		grp.create_thread(boost::bind(&PreProcess::apply_rows, this, &calib,
+				src ? src + r0 * width : NULL, raw ? raw + r0 * width : NULL, zero,
+				dst + r0 * width, y0 + r0, y0 + r1));
+	}
+	grp.join_all();
+}
+
+void PreProcess::apply_rows(const CalibFrame *calib, const float *src, const short *raw, float zero,
+		float *dst, int y0, int y1) {
+	MasterFrame *master = calib->master.get();
+	int offset = y0 * master->width, n = (y1 - y0) * master->width;
+	const float *bias = master->bias ? master->bias.get() + offset : NULL;
+	const float *dark = master->dark ? master->dark.get() + offset : NULL;
+	const float *flat = master->flat ? master->flat.get() + offset : NULL;
+
+	if (src) SimdCalibF32(src, n, bias, dark, calib->kdark, flat, calib->offset, dst);
+	else SimdCalibI16(raw, n, zero, bias, dark, calib->kdark, flat, calib->offset, dst);
+	if (master->defect) repair_rows(master->defect.get(), dst, master->width, y0, y1);
+}
+
+/*
+ * 暗流与列均值的中心与σ均经3σ迭代剔除. 暗流高于中心defectHot倍σ的像素为热像素;
+ * 列均值偏离中心defectHot倍σ的列为坏列, 包括偏低的死列. 计算列均值时暗流截断至热像素阈值,
+ * 孤立热像素不致使所在列被判为坏列
+ */
+PreProcess::DefectPtr PreProcess::mark_dark(const float *dark, int width, int height) {
+	DefectPtr defect = boost::make_shared<DefectMap>();
+	std::vector<float> colmean(width, 0.0f), row(width);
+	int n(width * height), x, y;
+	double mean, sig, k(param_->defectHot);
+	float lo, hi;
+	unsigned char *flags;
+
+	defect->flags.reset(new unsigned char[n]);
+	memset(flags = defect->flags.get(), 0, n);
+	clip_stat(dark, n, mean, sig);
+	hi = float(mean + k * sig);
+	for (x = 0; x < n; ++x) {
+		if (dark[x] > hi) flags[x] |= DEFECT_HOT;
+	}
+
+	for (y = 0; y < height; ++y) {
+		for (x = 0; x < width; ++x) row[x] = std::min(dark[y * width + x], hi);
+		SimdRowAxpy(colmean.data(), row.data(), width, 1.0f / height);
+	}
+	clip_stat(colmean.data(), width, mean, sig);
+	lo = float(mean - k * sig);
+	hi = float(mean + k * sig);
+	for (x = 0; x < width; ++x) {
+		if (colmean[x] >= lo && colmean[x] <= hi) continue;
+		for (y = 0; y < height; ++y) flags[y * width + x] |= DEFECT_COLUMN;
+	}
+	return defect;
+}
+
+/*
+ * 坏元素标记的坐标与目标质心一致, 起始于1, 相机标志与AFindPV一致.
+ * 坏列只标记该列; 坏点标记3*3邻域, 与CameraBadpix的判定范围一致
+ */
+PreProcess::DefectPtr PreProcess::mark_badmark(DefectPtr base, FramePtr frame, int width, int height) {
+	string cid = frame->hdu ? frame->cid + "#" + std::to_string(frame->hdu) : frame->cid;
+	DefectPtr defect = boost::make_shared<DefectMap>();
+	CameraBadcol badcol;
+	CameraBadpix badpix;
+	int n(width * height), x, y, x0, x1, y0, y1;
+	unsigned char *flags, keep = ~(DEFECT_BADCOL | DEFECT_BADPIX);
+
+	defect->flags.reset(new unsigned char[n]);
+	flags = defect->flags.get();
+	if (!base) memset(flags, 0, n);
+	else {
+		const unsigned char *old = base->flags.get();
+		for (x = 0; x < n; ++x) flags[x] = old[x] & keep;
+	}
+	if (param_->CopyBadcol(frame->gid, frame->uid, cid, badcol)) {
+		for (std::vector<int>::iterator it = badcol.cols.begin(); it != badcol.cols.end(); ++it) {
+			if ((x = *it - 1) < 0 || x >= width) continue;
+			for (y = 0; y < height; ++y) flags[y * width + x] |= DEFECT_BADCOL;
+		}
+	}
+	if (param_->CopyBadpix(frame->gid, frame->uid, cid, badpix)) {
+		for (std::vector<CameraBadpix::pixel>::iterator it = badpix.pixels.begin(); it != badpix.pixels.end(); ++it) {
+			x0 = std::max(it->col - 2, 0);
+			x1 = std::min(it->col + 1, width);
+			y0 = std::max(it->row - 2, 0);
+			y1 = std::min(it->row + 1, height);
+			for (y = y0; y < y1; ++y) {
+				for (x = x0; x < x1; ++x) flags[y * width + x] |= DEFECT_BADPIX;
+			}
+		}
+	}
+
+	std::vector<int> &rowptr = defect->rowptr;
+	std::vector<int> &runs = defect->runs;
+	rowptr.resize(height + 1);
+	defect->count = 0;
+	for (y = 0; y < height; ++y) {
+		const unsigned char *row = flags + y * width;
+		rowptr[y] = int(runs.size());
+		for (x = 0; x < width; ) {
+			if (!row[x]) {
+				++x;
+				continue;
+			}
+			for (x0 = x; x < width && row[x]; ++x);
+			runs.push_back(x0);
+			runs.push_back(x);
+			defect->count += x - x0;
+		}
+	}
+	rowptr[height] = int(runs.size());
+	if (!defect->count) defect.reset();
+	return defect;
+}
+
+/*
+ * 缺陷区段两侧均为有效像素, 沿行线性插值. 区段位于行首或行尾时取另一侧的值, 整行缺陷时不修补
+ */
+void PreProcess::repair_rows(const DefectMap *defect, float *dst, int width, int y0, int y1) {
+	const int *runs = defect->runs.data();
+	int y, i, i1, x, x0, x1;
+	float left, step;
+
+	for (y = y0; y < y1; ++y, dst += width) {
+		for (i = defect->rowptr[y], i1 = defect->rowptr[y + 1]; i < i1; i += 2) {
+			x0 = runs[i];
+			x1 = runs[i + 1];
+			if (x0 == 0 && x1 == width) continue;
+			if (x0 == 0) {
+				left = dst[x1];
+				step = 0.0f;
+			}
+			else if (x1 == width) {
+				left = dst[x0 - 1];
+				step = 0.0f;
+			}
+			else {
+				left = dst[x0 - 1];
+				step = (dst[x1] - left) / (x1 - x0 + 1);
+			}
+			for (x = x0; x < x1; ++x) dst[x] = left + step * (x - x0 + 1);
+		}
+	}
+}
+
+/*
+ * 改正结果为单精度浮点数图像. 复制原图像的非结构关键字, 供SExtractor等读取增益、饱和等参数
+ */
+bool PreProcess::write_image(FramePtr frame, const string &filepath, const float *data, int width, int height) {
+	fitsfile *fitsin(NULL), *fitsout(NULL);
+	int status(0), nkeys(0), keyclass, i;
+	long naxes[] = { width, height };
+	char card[FLEN_CARD];
+
+	fits_open_image(&fitsin, frame->filepath.c_str(), READONLY, &status);
+	fits_create_file(&fitsout, ("!" + filepath).c_str(), &status);
+	fits_create_img(fitsout, FLOAT_IMG, 2, naxes, &status);
+	fits_get_hdrspace(fitsin, &nkeys, NULL, &status);
+	for (i = 1; i <= nkeys && !status; ++i) {
+		fits_read_record(fitsin, i, card, &status);
+		keyclass = fits_get_keyclass(card);
+		if (keyclass > TYP_SCAL_KEY && keyclass != TYP_CKSUM_KEY)
+			fits_write_record(fitsout, card, &status);
+	}
+	fits_write_img(fitsout, TFLOAT, 1, LONGLONG(width) * height, (void*) data, &status);
+	if (fitsout) fits_close_file(fitsout, &status);
+	if (fitsin) fits_close_file(fitsin, &status);
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "PreProcess::write_image()", "failed to write [%s]: %s",
+				filepath.c_str(), txt);
+		return false;
+	}
+	return true;
+}
+
+int PreProcess::thread_count() {
+	int nthread = param_->nThreadDip > 0 ? param_->nThreadDip : int(boost::thread::hardware_concurrency());
+	return nthread < 1 ? 1 : nthread;
+}
+
+void PreProcess::combine_flats(bool all) {
+	boost::unique_lock<boost::mutex> lck(mtx_flatcmb_);
+	std::vector<std::pair<string, FrameVec> > ready;
+	std::time_t now = std::time(NULL);
+
+	{// 取出可合并的平场, 合并期间继续收集
+		boost::unique_lock<boost::mutex> lck1(mtx_flat_);
+		for (FlatSetMap::iterator it = pathflat_.begin(); it != pathflat_.end(); ) {
+			if (all || now - it->second.last >= param_->flatIdle) {
+				ready.push_back(std::make_pair(it->first, FrameVec()));
+				ready.back().second.swap(it->second.frames);
+				pathflat_.erase(it++);
+			}
+			else ++it;
+		}
+	}
+
+	for (std::vector<std::pair<string, FrameVec> >::iterator it = ready.begin(); it != ready.end(); ++it) {
+		int n = int(it->second.size());
+		if (n < param_->flatMin) {
+			_gLog->Write(LOG_WARN, "PreProcess::combine_flats()", "%s: %d flats are less than %d, discarded",
+					it->first.c_str(), n, param_->flatMin);
+			continue;
+		}
+
+		path dirpath = param_->pathCalib;
+		boost::system::error_code ec;
+		dirpath /= it->first;
+		create_directories(dirpath, ec);
+		CombineFlat(it->second, (dirpath / "flat.fit").string(), thread_count());
+	}
+}
+
+bool PreProcess::open_flat(FlatFrame &flat, int &width, int &height) {
+	int status(0), x0, y0, x1, y1;
+
+	flat.fitsptr = NULL;
+	flat.norm    = 1.0;
+	flat.fmap    = boost::make_shared<FitsMMap>();
+	if (flat.fmap->Open(flat.frame->filepath)) {
+		width  = flat.fmap->Width();
+		height = flat.fmap->Height();
+	}
+	else {
+		long naxes[2];
+		flat.fmap.reset();
+		fits_open_image(&flat.fitsptr, flat.frame->filepath.c_str(), READONLY, &status);
+		fits_get_img_size(flat.fitsptr, 2, naxes, &status);
+		if (!status) {
+			width  = int(naxes[0]);
+			height = int(naxes[1]);
+		}
+	}
+	if (!status) {// 合并平场不使用已有平场
+		Prepare(flat.frame, width, height, flat.calib);
+		if (flat.calib.master->flat) {
+			MasterPtr master = boost::make_shared<MasterFrame>(*flat.calib.master);
+			master->flat.reset();
+			flat.calib.master = master;
+		}
+	}
+	if (!status && OverscanZone(width, height, x0, y0, x1, y1)) {
+		std::vector<float> zone((x1 - x0) * (y1 - y0));
+		if (flat.fmap) {
+			if (!flat.fmap->ReadRect(x0, y0, x1, y1, zone.data())) status = DATA_DECOMPRESSION_ERR;
+		}
+		else {
+			long fpixel[] = { x0 + 1, y0 + 1 }, lpixel[] = { x1, y1 }, inc[] = { 1, 1 };
+			fits_read_subset(flat.fitsptr, TFLOAT, fpixel, lpixel, inc, NULL, zone.data(), NULL, &status);
+		}
+		if (!status) SetOverscan(flat.calib, zone.data(), int(zone.size()));
+	}
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "PreProcess::open_flat()", "failed to read [%s]: %s",
+				flat.frame->filepath.c_str(), txt);
+		if (flat.fitsptr) fits_close_file(flat.fitsptr, &status);
+		flat.fitsptr = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool PreProcess::read_flat(FlatCombine *cmb, FlatFrame &flat, int y0, int y1, float *data) {
+	int status(0);
+
+	if (flat.fmap) {
+		if (!flat.fmap->ReadRows(y0, y1, data)) status = DATA_DECOMPRESSION_ERR;
+	}
+	else {// cfitsio文件指针不能被多个线程同时使用
+		boost::unique_lock<boost::mutex> lck(cmb->mtx);
+		fits_read_img(flat.fitsptr, TFLOAT, LONGLONG(y0) * cmb->width + 1, LONGLONG(y1 - y0) * cmb->width,
+				NULL, data, NULL, &status);
+	}
+	if (status) {
+		char txt[40];
+		fits_get_errstatus(status, txt);
+		_gLog->Write(LOG_FAULT, "PreProcess::read_flat()", "failed to read [%s]: %s",
+				flat.frame->filepath.c_str(), txt);
+		return false;
+	}
+	apply_rows(&flat.calib, data, NULL, 0.0, data, y0, y1);
+	return true;
+}
+
+/*
+ * 众数: 3σ迭代剔除后, 按SExtractor背景估计规则由均值和中值换算
+ */
+bool PreProcess::flat_mode(FlatCombine *cmb, FlatFrame &flat, double &mode) {
+	const int nsample = 64;
+	int width(cmb->width), height(cmb->height), nrow = std::min(nsample, height);
+	int x0(0), y0(0), x1(0), y1(0), x, y, i, j, n;
+	bool zone = OverscanZone(width, height, x0, y0, x1, y1);
+	std::vector<float> row(width), sample;
+	double mean, sig, med, lo(-1E30), hi(1E30);
+
+	sample.reserve(nrow * width);
+	for (i = 0; i < nrow; ++i) {
+		y = int((i + 0.5) * height / nrow);
+		if (!read_flat(cmb, flat, y, y + 1, row.data())) return false;
+		for (x = 0; x < width; ++x) {// 剔除过扫区
+			if (!(zone && x >= x0 && x < x1 && y >= y0 && y < y1)) sample.push_back(row[x]);
+		}
+	}
+	for (j = 0; j < 3 && sample.size(); ++j) {
+		mean = sig = 0.0;
+		for (i = n = 0; i < int(sample.size()); ++i) {
+			if (sample[i] >= lo && sample[i] <= hi) {
+				sample[n++] = sample[i];
+				mean += sample[i];
+				sig  += double(sample[i]) * sample[i];
+			}
+		}
+		sample.resize(n);
+		if (!n) return false;
+		mean /= n;
+		sig = sqrt(std::max(sig / n - mean * mean, 0.0));
+		lo = mean - 3.0 * sig;
+		hi = mean + 3.0 * sig;
+	}
+	if (sample.empty()) return false;
+	std::nth_element(sample.begin(), sample.begin() + sample.size() / 2, sample.end());
+	med  = sample[sample.size() / 2];
+	mode = sig > 0.0 && fabs((mean - med) / sig) < 0.3 ? 2.5 * med - 1.5 * mean : med;
+	return true;
+}
+
+void PreProcess::combine_rows(FlatCombine *cmb) {
+	int width(cmb->width), n(int(cmb->frames.size())), rows(cmb->rows), npix(rows * width);
+	int y0, y1, i, k, m;
+	boost::shared_array<float> stack(new float[size_t(n) * npix]);	// 各帧的分块
+	boost::shared_array<float> rslt(new float[npix * 5]);	// 合并结果及中间量
+	float *mean = rslt.get(), *sum = mean + npix, *lo = sum + npix, *hi = lo + npix, *count = hi + npix;
+	std::vector<float> pixel(n);
+	float kappa = float(param_->flatClip), d;
+
+	while (1) {
+		{
+			boost::unique_lock<boost::mutex> lck(cmb->mtx);
+			if (!cmb->ok || cmb->next >= cmb->height) break;
+			y0 = cmb->next;
+			cmb->next = y1 = std::min(y0 + rows, cmb->height);
+		}
+		m = (y1 - y0) * width;
+		for (k = 0; k < n; ++k) {
+			if (!read_flat(cmb, cmb->frames[k], y0, y1, stack.get() + size_t(k) * npix)) {
+				boost::unique_lock<boost::mutex> lck(cmb->mtx);
+				cmb->ok = false;
+				return;
+			}
+		}
+
+		if (cmb->median) {
+			for (i = 0; i < m; ++i) {
+				for (k = 0; k < n; ++k) pixel[k] = cmb->frames[k].norm * stack[size_t(k) * npix + i];
+				std::nth_element(pixel.begin(), pixel.begin() + n / 2, pixel.end());
+				d = pixel[n / 2];
+				if (!(n % 2)) d = 0.5f * (d + *std::max_element(pixel.begin(), pixel.begin() + n / 2));
+				mean[i] = d;
+			}
+		}
+		else {// σ剔除均值: 逐帧按行向量化累加
+			/* 中心与σ由去除逐像素极值后的n-2帧计算, 避免单个异常值抬高σ而无法剔除 */
+			memset(sum, 0, sizeof(float) * m);
+			for (i = 0; i < m; ++i) lo[i] = hi[i] = cmb->frames[0].norm * stack[i];
+			for (k = 0; k < n; ++k) {
+				SimdRowAxpy(sum, stack.get() + size_t(k) * npix, m, cmb->frames[k].norm);
+				SimdStackRange(stack.get() + size_t(k) * npix, m, cmb->frames[k].norm, lo, hi);
+			}
+			for (i = 0; i < m; ++i) mean[i] = (sum[i] - lo[i] - hi[i]) / (n - 2);
+			memset(count, 0, sizeof(float) * m);
+			for (k = 0; k < n; ++k)
+				SimdStackDev(stack.get() + size_t(k) * npix, m, cmb->frames[k].norm, mean, count);
+			for (i = 0; i < m; ++i) {
+				d = count[i] - (lo[i] - mean[i]) * (lo[i] - mean[i]) - (hi[i] - mean[i]) * (hi[i] - mean[i]);
+				d = kappa * sqrt(std::max(d, 0.0f) / (n - 3));
+				lo[i] = mean[i] - d;
+				hi[i] = mean[i] + d;
+			}
+			memset(sum,   0, sizeof(float) * m);
+			memset(count, 0, sizeof(float) * m);
+			for (k = 0; k < n; ++k)
+				SimdStackClip(stack.get() + size_t(k) * npix, m, cmb->frames[k].norm, lo, hi, sum, count);
+			for (i = 0; i < m; ++i) {
+				if (count[i] > 0.0f) mean[i] = sum[i] / count[i];
+			}
+		}
+
+		boost::unique_lock<boost::mutex> lck(cmb->mtx);
+		int status(0);
+		fits_write_img(cmb->fitsout, TFLOAT, LONGLONG(y0) * width + 1, m, mean, &status);
+		if (status) {
+			char txt[40];
+			fits_get_errstatus(status, txt);
+			_gLog->Write(LOG_FAULT, "PreProcess::combine_rows()", "failed to write rows [%d, %d): %s",
+					y0, y1, txt);
+			cmb->ok = false;
+		}
+	}
+}
+
+void PreProcess::thread_flatcmb() {
+	boost::chrono::seconds period(10);
 
+	try {
+		while (1) {
+			boost::this_thread::sleep_for(period);
+			combine_flats(false);
+		}
+	}
+	catch(boost::thread_interrupted &ex) {
+	}
 }
@@ -1,10 +1,21 @@
 /**
  * @class PreProcess 图像预处理
- * @version 0.1
- * @date 2019-11-11
+ * @version 0.3
+ * @date 2020-11-16
  * @note
  * - 合并平场. 使用过扫区作为暗场
- * - 预处理: 减暗场, 除平场
+ * - 预处理: 减本底, 减暗场, 除平场
+ * - 合并本底、暗场和平场按相机缓存在内存中, 文件修改后重新加载:
+ *   <Calibration/Path>/<gid>_<uid>_<cid>/{bias,dark,flat}.fit
+ * - 合并暗场应已减本底, 以EXPTIME换算为单位曝光时间暗流; 合并平场归一化后存储其倒数
+ * - 过扫区由ZoneSensor定义: 有合并本底时修正本底电平漂移, 否则过扫区电平作为本底
+ * - 改正由ADISimd向量化执行, 按行分块多线程并行; 16位整数图像直接由存储值改正为浮点数
+ * - 平场合并: 按相机收集IMAGETYP为FLAT的图像, 相机停止接收平场一段时间后由线程合并,
+ *   结果替换该相机的合并平场. 离线批处理在处理其它图像前合并
+ * - 合并时按行分块流式读取全部平场, 多线程并行处理分块: 改正本底与暗场, 按各帧众数归一化,
+ *   逐像素取中值或σ剔除均值(中心与σ去除极值后计算), 逐分块写入结果. 内存占用与帧数和分块行数成正比, 与图像面积无关
+ * - 缺陷掩模: 按相机(及HDU)由合并暗场标记热像素与坏列, 并合入坏元素标记中的坏列与坏点.
+ *   坏点由AFindPV的可疑像元统计确认. 改正后沿行线性插值修补缺陷, 缺陷不再形成目标
  */
 
 #ifndef SRC_PREPROCESS_H_
@@ -12,9 +23,13 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <ctime>
 #include <boost/smart_ptr.hpp>
 #include <boost/thread.hpp>
 #include "Parameter.h"
+#include "airsdata.h"
+#include "FitsMMap.h"
 
 using std::string;
 
@@ -23,6 +38,15 @@ public:
 	/* 数据类型 */
 	typedef boost::shared_ptr<boost::thread> threadptr;	//< 线程指针
 	typedef std::vector<string> strvec;		//< 字符串矢量数组
+	typedef std::vector<FramePtr> FrameVec;	//< 图像集合
+	typedef boost::shared_array<float> fltarr;	//< 浮点数数组
+
+	enum {// 缺陷类型, 按位组合
+		DEFECT_HOT    = 0x01,	//< 热像素: 合并暗场中暗流异常
+		DEFECT_COLUMN = 0x02,	//< 坏列: 合并暗场中列均值异常
+		DEFECT_BADCOL = 0x04,	//< 坏元素标记中的坏列
+		DEFECT_BADPIX = 0x08	//< 坏元素标记中的坏点
+	};
 
 	/*!
 	 * @struct ZoneSensor 区域坐标
@@ -34,6 +58,77 @@ public:
 		int x2, y2;		//< 结束点
 	};
 
+	/*!
+	 * @struct DefectMap 一台相机的缺陷掩模
+	 */
+	struct DefectMap {
+		boost::shared_array<unsigned char> flags;	//< 逐像素缺陷标志, DEFECT_xxx按位组合
+		std::vector<int> rowptr;	//< 各行缺陷区段在runs中的起始位置, 共height + 1项
+		std::vector<int> runs;		//< 缺陷区段[x0, x1), 按行依次存储
+		int count;					//< 缺陷像素数量
+	};
+	typedef boost::shared_ptr<DefectMap> DefectPtr;
+
+	/*!
+	 * @struct MasterFrame 一台相机的合并改正图像
+	 */
+	struct MasterFrame {
+		int width, height;	//< 图像尺寸
+		fltarr bias;		//< 合并本底. 空: 不减本底
+		fltarr dark;		//< 单位曝光时间暗流. 空: 不减暗场
+		fltarr flat;		//< 归一化平场的倒数. 空: 不除平场
+		double levelBias;	//< 合并本底的过扫区电平
+		std::time_t mtime[3];	//< 本底、暗场、平场文件修改时间. 0: 文件不存在
+		DefectPtr defect;	//< 缺陷掩模. 空: 不修补缺陷
+		int revision;		//< 缺陷掩模对应的坏元素标记修改次数
+	};
+	typedef boost::shared_ptr<MasterFrame> MasterPtr;
+	typedef std::map<string, MasterPtr> MasterMap;
+
+	/*!
+	 * @struct CalibFrame 单帧图像的改正参数
+	 */
+	struct CalibFrame {
+		MasterPtr master;	//< 合并改正图像
+		float kdark;		//< 暗场系数: 曝光时间
+		float offset;		//< 标量偏置: 过扫区电平
+	};
+
+	/*!
+	 * @struct FlatSet 一台相机收集的平场
+	 */
+	struct FlatSet {
+		FrameVec frames;	//< 平场图像
+		std::time_t last;	//< 最后一帧的接收时间
+	};
+	typedef std::map<string, FlatSet> FlatSetMap;
+
+	/*!
+	 * @struct FlatFrame 参与合并的一帧平场
+	 */
+	struct FlatFrame {
+		FramePtr frame;		//< 图像
+		boost::shared_ptr<AstroUtil::FitsMMap> fmap;	//< 内存映射. 空: 由cfitsio读取
+		fitsfile *fitsptr;	//< cfitsio文件指针
+		CalibFrame calib;	//< 本底与暗场改正参数
+		float norm;			//< 归一化系数: 众数的倒数
+	};
+	typedef std::vector<FlatFrame> FlatFrameVec;
+
+	/*!
+	 * @struct FlatCombine 平场合并的共享状态
+	 */
+	struct FlatCombine {
+		FlatFrameVec frames;	//< 参与合并的平场
+		int width, height;		//< 图像尺寸
+		int rows;				//< 分块行数
+		int next;				//< 待处理分块的起始行
+		bool median;			//< 合并方法. true: 中值; false: σ剔除均值
+		bool ok;				//< 处理结果
+		fitsfile *fitsout;		//< 合并结果文件
+		boost::mutex mtx;		//< 互斥锁: 分配分块, 由cfitsio读取平场和写入结果
+	};
+
 public:
 	PreProcess(Parameter *param);
 	virtual ~PreProcess();
@@ -41,11 +136,166 @@ public:
 protected:
 	/* 成员变量 */
 	Parameter *param_;			//< 配置参数
-	strvec pathflat_;			//< 平场文件路径集合
+	FlatSetMap pathflat_;		//< 按相机收集的平场
 	ZoneSensor overscan_;		//< 过扫区
 	threadptr thrd_flatcmb_;	//< 线程: 监测平场图像时标, 启动平场处理流程
+	boost::mutex mtx_master_;	//< 互斥锁: 合并改正图像
+	boost::mutex mtx_flat_;		//< 互斥锁: 收集的平场
+	boost::mutex mtx_flatcmb_;	//< 互斥锁: 平场合并流程
+	MasterMap masters_;			//< 按相机缓存的合并改正图像
 
 public:
+	/*!
+	 * @brief 准备单帧图像的改正参数: 查找或加载相机的合并改正图像
+	 * @param frame  图像
+	 * @param width  图像宽度
+	 * @param height 图像高度
+	 * @param calib  改正参数. 偏置置零, 由SetOverscan()设置
+	 * @return
+	 * 既无合并改正图像、缺陷掩模又无过扫区时返回false, 图像不需要改正
+	 */
+	bool Prepare(FramePtr frame, int width, int height, CalibFrame &calib);
+	/*!
+	 * @brief 查看过扫区在图像内的范围[x0, x1)*[y0, y1)
+	 * @return
+	 * 未定义过扫区或过扫区位于图像外时返回false
+	 */
+	bool OverscanZone(int width, int height, int &x0, int &y0, int &x1, int &y1);
+	/*!
+	 * @brief 由过扫区像素设置改正偏置
+	 * @param calib 改正参数
+	 * @param zone  过扫区像素, 未经改正
+	 * @param n     像素数量
+	 */
+	void SetOverscan(CalibFrame &calib, const float *zone, int n);
+	/*!
+	 * @brief 改正图像[y0, y1)行
+	 * @param calib   改正参数
+	 * @param data    图像行, 首地址对应第y0行. 原位改正
+	 * @param y0      起始行
+	 * @param y1      结束行
+	 * @param nthread 并行线程数
+	 */
+	void Apply(const CalibFrame &calib, float *data, int y0, int y1, int nthread);
+	/*!
+	 * @brief 改正内存中的全图
+	 * @return
+	 * 图像不需要改正时返回false
+	 */
+	bool Calibrate(FramePtr frame, float *data, int width, int height, int nthread);
+	/*!
+	 * @brief 改正图像文件, 结果存储为单精度浮点数图像, 并复制非结构关键字
+	 * @param frame    图像
+	 * @param filepath 改正结果文件路径
+	 * @param nthread  并行线程数
+	 * @return
+	 * 图像不需要改正或改正失败时返回false
+	 */
+	bool CalibrateFile(FramePtr frame, const string &filepath, int nthread);
+	/*!
+	 * @brief 收集平场
+	 * @param frame 已加载文件头的图像
+	 * @return
+	 * 图像为平场时返回true, 该图像不再做其它处理
+	 */
+	bool AddFlat(FramePtr frame);
+	/*!
+	 * @brief 立即合并已收集的全部平场, 用于离线批处理
+	 */
+	void CombineFlats();
+	/*!
+	 * @brief 合并平场
+	 * @param frames   平场图像, 尺寸相同
+	 * @param filepath 合并结果文件路径
+	 * @param nthread  并行线程数
+	 * @return
+	 * 合并结果
+	 */
+	bool CombineFlat(const FrameVec &frames, const string &filepath, int nthread);
+
+protected:
+	/*!
+	 * @brief 查找相机的合并改正图像, 文件修改后重新加载
+	 */
+	MasterPtr get_master(FramePtr frame, int width, int height);
+	/*!
+	 * @brief 加载一幅合并改正图像
+	 * @param filepath 文件路径
+	 * @param width    图像宽度, 与待改正图像一致
+	 * @param height   图像高度
+	 * @param exptime  曝光时间. 非NULL时读取EXPTIME
+	 */
+	fltarr load_master(const string &filepath, int width, int height, double *exptime);
+	/*!
+	 * @brief 由合并暗场标记热像素与坏列
+	 * @param dark   单位曝光时间暗流
+	 * @return
+	 * 缺陷掩模, 尚未建立缺陷区段
+	 */
+	DefectPtr mark_dark(const float *dark, int width, int height);
+	/*!
+	 * @brief 合入坏元素标记, 建立缺陷区段
+	 * @param base  由合并暗场标记的缺陷掩模. 可为空
+	 * @param frame 图像, 提供相机标志
+	 * @return
+	 * 缺陷掩模. 无缺陷时为空
+	 */
+	DefectPtr mark_badmark(DefectPtr base, FramePtr frame, int width, int height);
+	/*!
+	 * @brief 沿行线性插值修补[y0, y1)行的缺陷
+	 * @param dst 改正结果, 首地址对应第y0行
+	 */
+	void repair_rows(const DefectMap *defect, float *dst, int width, int y0, int y1);
+	/*!
+	 * @brief 并行改正[y0, y1)行
+	 * @param src  待改正像素. NULL: 改正raw
+	 * @param raw  16位整数存储值
+	 * @param zero 存储值偏置
+	 * @param dst  改正结果
+	 */
+	void apply_parallel(const CalibFrame &calib, const float *src, const short *raw, float zero,
+			float *dst, int y0, int y1, int nthread);
+	/*!
+	 * @brief 线程: 改正[y0, y1)行
+	 */
+	void apply_rows(const CalibFrame *calib, const float *src, const short *raw, float zero,
+			float *dst, int y0, int y1);
+	/*!
+	 * @brief 将改正结果写入文件
+	 */
+	bool write_image(FramePtr frame, const string &filepath, const float *data, int width, int height);
+	/*!
+	 * @brief 并行线程数
+	 */
+	int thread_count();
+	/*!
+	 * @brief 合并收集的平场
+	 * @param all true: 全部相机; false: 停止接收平场超过时限的相机
+	 */
+	void combine_flats(bool all);
+	/*!
+	 * @brief 打开一帧平场, 准备本底与暗场改正参数
+	 */
+	bool open_flat(FlatFrame &flat, int &width, int &height);
+	/*!
+	 * @brief 读取平场[y0, y1)行, 并改正本底与暗场
+	 */
+	bool read_flat(FlatCombine *cmb, FlatFrame &flat, int y0, int y1, float *data);
+	/*!
+	 * @brief 由均匀间隔的采样行估算平场众数
+	 */
+	bool flat_mode(FlatCombine *cmb, FlatFrame &flat, double &mode);
+	/*!
+	 * @brief 线程: 依次领取分块, 合并后写入结果
+	 */
+	void combine_rows(FlatCombine *cmb);
+	/*!
+	 * @brief 线程: 监测平场图像时标, 启动平场合并
+	 */
+	void thread_flatcmb();
 };
+typedef boost::shared_ptr<PreProcess> PreProcPtr;
+
+extern PreProcPtr _gPreProc;	//< 图像预处理, 未启用时为空
 
 #endif /* SRC_PREPROCESS_H_ */
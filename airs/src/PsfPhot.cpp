@@ -0,0 +1,496 @@
+/*!
+ * @file PsfPhot.cpp 基于经验PSF的拟合测光
+ * @version 0.1
+ * @date 2020-11-28
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include <Eigen/Dense>
+#include "PsfPhot.h"
+#include "FrameStat.h"
+#include "ADISimd.h"
+
+using namespace boost::placeholders;
+using namespace Eigen;
+
+#define PSF_OVERSAMPLE	2		// PSF过采样倍数
+#define PSF_MINSTARS	10		// 构建PSF所需的最少恒星数
+#define PSF_MAXITER		8		// 拟合最大迭代次数
+#define PSF_CHUNKPASS	2		// 分段拟合的遍数
+
+/*
+ * 按网格索引目标, 网格边长不小于查找距离时, 只需检查相邻3*3个网格
+ */
+static void make_grid(const PsfPhot::FitStarVec &stars, double cell, int width, int height,
+		int &nx, int &ny, std::vector<PsfPhot::IntVec> &cells) {
+	int n(int(stars.size())), i, ix, iy;
+
+	nx = int(width / cell) + 1;
+	ny = int(height / cell) + 1;
+	cells.assign(nx * ny, PsfPhot::IntVec());
+	for (i = 0; i < n; ++i) {
+		ix = std::min(std::max(int(stars[i].x / cell), 0), nx - 1);
+		iy = std::min(std::max(int(stars[i].y / cell), 0), ny - 1);
+		cells[iy * nx + ix].push_back(i);
+	}
+}
+
+static int find_root(std::vector<int> &parent, int i) {
+	while (parent[i] != i) i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static bool more_members(const PsfPhot::IntVec &a, const PsfPhot::IntVec &b) {
+	return a.size() > b.size();
+}
+
+PsfPhot::PsfPhot(Parameter *param) {
+	param_  = param;
+	data_   = NULL;
+	width_  = height_ = 0;
+	radius_ = param->psfRadius;
+	half_   = radius_ * PSF_OVERSAMPLE;
+	dim_    = 2 * half_ + 1;
+}
+
+PsfPhot::~PsfPhot() {
+}
+
+//////////////////////////////////////////////////////////////////////////////
+bool PsfPhot::DoIt(const float *data, int width, int height, NFObjVec &objs, int nthread) {
+	FitStarVec stars, psfstars;
+	std::vector<IntVec> groups;
+	FitStar *ptr;
+	int i;
+
+	data_   = data;
+	width_  = width;
+	height_ = height;
+	stars.reserve(objs.size());
+	for (NFObjVec::iterator it = objs.begin(); it != objs.end(); ++it) {
+		FitStar star;
+		star.obj  = it->get();
+		star.x    = star.obj->features[NDX_X] - 1.0;
+		star.y    = star.obj->features[NDX_Y] - 1.0;
+		star.flux = star.obj->features[NDX_FLUX];
+		star.back = star.obj->features[NDX_BACK];
+		star.err  = 0.0;
+		star.ok   = false;
+		stars.push_back(star);
+	}
+
+	/* 构建PSF, 以初版PSF重新拟合参考星位置后再构建一次, 并作孔径改正 */
+	select_stars(stars, psfstars);
+	if (psfstars.size() < PSF_MINSTARS || !build_psf(psfstars)) {
+		data_ = NULL;
+		return false;
+	}
+	for (i = 0; i < int(psfstars.size()); ++i) {
+		ptr = &psfstars[i];
+		fit_group(&ptr, 1);
+	}
+	psfstars.erase(std::remove_if(psfstars.begin(), psfstars.end(),
+			[](const FitStar &star) { return !star.ok; }), psfstars.end());
+	if (psfstars.size() >= PSF_MINSTARS && build_psf(psfstars)) aperture_correct(psfstars);
+
+	/* 分组拟合: 大组优先, 交错分配以均衡负载 */
+	make_groups(stars, groups);
+	std::stable_sort(groups.begin(), groups.end(), more_members);
+	if (nthread > int(groups.size())) nthread = int(groups.size());
+	if (nthread <= 1) fit_groups(&stars, &groups, 0, 1);
+	else {
+		StatThreadGroup grp;
+		for (i = 0; i < nthread; ++i)
+			grp.create_thread(boost::bind(&PsfPhot::fit_groups, this, &stars, &groups, i, nthread));
+		grp.join_all();
+	}
+
+	for (FitStarVec::iterator it = stars.begin(); it != stars.end(); ++it) {
+		if (!it->ok) continue;
+		double *features = it->obj->features;
+		features[NDX_X]      = it->x + 1.0;
+		features[NDX_Y]      = it->y + 1.0;
+		features[NDX_FLUX]   = it->flux;
+		features[NDX_MAG]    = 25.0 - 2.5 * log10(it->flux);
+		features[NDX_MAGERR] = 1.0857 * it->err / it->flux;
+		features[NDX_BACK]   = it->back;
+	}
+	data_ = NULL;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/*
+ * 最亮的2%可能饱和, 不参与构建PSF
+ * 孤立: 两倍PSF半宽度内无流量超过其1%的目标
+ */
+void PsfPhot::select_stars(FitStarVec &stars, FitStarVec &psfstars) {
+	std::vector<double> fwhm;
+	std::vector<int> cand;
+	std::vector<IntVec> cells;
+	double fwhm0, dist(2.0 * radius_), dx, dy;
+	int n(int(stars.size())), i, j, k, m, ix, iy, nx, ny, skip;
+
+	psfstars.clear();
+	for (i = 0; i < n; ++i) {
+		if (stars[i].flux > 0.0 && stars[i].obj->features[NDX_FWHM] > 0.0)
+			fwhm.push_back(stars[i].obj->features[NDX_FWHM]);
+	}
+	if (fwhm.size() < PSF_MINSTARS) return;
+	std::nth_element(fwhm.begin(), fwhm.begin() + fwhm.size() / 2, fwhm.end());
+	fwhm0 = fwhm[fwhm.size() / 2];
+
+	for (i = 0; i < n; ++i) {
+		const FitStar &star = stars[i];
+		const double *features = star.obj->features;
+		if (star.flux > 0.0 && fabs(features[NDX_FWHM] - fwhm0) < 0.3 * fwhm0 && features[NDX_ELLIP] < 0.3
+				&& star.x >= radius_ + 1 && star.x < width_ - radius_ - 2
+				&& star.y >= radius_ + 1 && star.y < height_ - radius_ - 2)
+			cand.push_back(i);
+	}
+	std::sort(cand.begin(), cand.end(), [&stars](int a, int b) { return stars[a].flux > stars[b].flux; });
+
+	make_grid(stars, dist, width_, height_, nx, ny, cells);
+	skip = int(cand.size()) / 50;
+	for (k = 0; k < int(cand.size()) && int(psfstars.size()) < param_->psfStars; ++k) {
+		const FitStar &star = stars[i = cand[k]];
+		bool isolated(true);
+		if (k < skip) continue;
+
+		ix = std::min(int(star.x / dist), nx - 1);
+		iy = std::min(int(star.y / dist), ny - 1);
+		for (m = 0; m < 9 && isolated; ++m) {
+			int cx(ix + m % 3 - 1), cy(iy + m / 3 - 1);
+			if (cx < 0 || cx >= nx || cy < 0 || cy >= ny) continue;
+			const IntVec &cell = cells[cy * nx + cx];
+			for (IntVec::const_iterator it = cell.begin(); it != cell.end() && isolated; ++it) {
+				if ((j = *it) == i) continue;
+				dx = stars[j].x - star.x;
+				dy = stars[j].y - star.y;
+				if (dx * dx + dy * dy < dist * dist && stars[j].flux > 0.01 * star.flux) isolated = false;
+			}
+		}
+		if (isolated) psfstars.push_back(star);
+	}
+}
+
+/*
+ * 采样点(iu, iv)对应相对恒星中心的偏移((iu - half) / 2, (iv - half) / 2)像素
+ * 采样值为中心位于该偏移处的像素所含流量的比例. 整数偏移处的采样值之和归一化为1
+ */
+bool PsfPhot::build_psf(const FitStarVec &psfstars) {
+	std::vector<std::vector<float> > bins(dim_ * dim_);
+	int size(2 * radius_ + 1), x0, y0, px, py, iu, iv, k;
+	double back, flux, norm;
+	const float *row;
+
+	for (FitStarVec::const_iterator it = psfstars.begin(); it != psfstars.end(); ++it) {
+		if ((flux = box_flux(it->x, it->y, back)) <= 0.0) continue;
+		x0 = int(floor(it->x + 0.5)) - radius_;
+		y0 = int(floor(it->y + 0.5)) - radius_;
+		for (py = y0; py < y0 + size; ++py) {
+			row = data_ + size_t(py) * width_;
+			iv = int(floor((py - it->y) * PSF_OVERSAMPLE + half_ + 0.5));
+			if (iv < 0 || iv >= dim_) continue;
+			for (px = x0; px < x0 + size; ++px) {
+				iu = int(floor((px - it->x) * PSF_OVERSAMPLE + half_ + 0.5));
+				if (iu >= 0 && iu < dim_) bins[iv * dim_ + iu].push_back(float((row[px] - back) / flux));
+			}
+		}
+	}
+
+	psf_.assign(dim_ * dim_, 0.0f);
+	std::vector<char> empty(dim_ * dim_, 0);
+	for (k = 0; k < dim_ * dim_; ++k) {
+		std::vector<float> &bin = bins[k];
+		if (bin.empty()) empty[k] = 1;
+		else {
+			std::nth_element(bin.begin(), bin.begin() + bin.size() / 2, bin.end());
+			psf_[k] = bin[bin.size() / 2];
+		}
+	}
+	for (k = 0; k < dim_ * dim_; ++k) {// 空采样点取相邻采样点均值
+		if (!empty[k]) continue;
+		int cnt(0);
+		double sum(0.0);
+		iu = k % dim_;
+		iv = k / dim_;
+		if (iu > 0        && !empty[k - 1])    { sum += psf_[k - 1];    ++cnt; }
+		if (iu < dim_ - 1 && !empty[k + 1])    { sum += psf_[k + 1];    ++cnt; }
+		if (iv > 0        && !empty[k - dim_]) { sum += psf_[k - dim_]; ++cnt; }
+		if (iv < dim_ - 1 && !empty[k + dim_]) { sum += psf_[k + dim_]; ++cnt; }
+		if (cnt) psf_[k] = float(sum / cnt);
+	}
+
+	for (iv = 0, norm = 0.0; iv < dim_; iv += PSF_OVERSAMPLE) {
+		for (iu = 0; iu < dim_; iu += PSF_OVERSAMPLE) norm += psf_[iv * dim_ + iu];
+	}
+	if (norm <= 0.0) return false;
+	for (k = 0; k < dim_ * dim_; ++k) psf_[k] = float(psf_[k] / norm);
+	return true;
+}
+
+/*
+ * 背景取方框边缘像素的中值
+ */
+double PsfPhot::box_flux(double x, double y, double &back) {
+	std::vector<float> edge;
+	int size(2 * radius_ + 1), x0, y0, px, py;
+	double flux(0.0);
+	const float *row;
+
+	x0 = int(floor(x + 0.5)) - radius_;
+	y0 = int(floor(y + 0.5)) - radius_;
+	if (x0 < 0 || y0 < 0 || x0 + size > width_ || y0 + size > height_) return 0.0;
+	for (py = y0; py < y0 + size; ++py) {
+		row = data_ + size_t(py) * width_;
+		if (py == y0 || py == y0 + size - 1) edge.insert(edge.end(), row + x0, row + x0 + size);
+		else {
+			edge.push_back(row[x0]);
+			edge.push_back(row[x0 + size - 1]);
+		}
+	}
+	std::nth_element(edge.begin(), edge.begin() + edge.size() / 2, edge.end());
+	back = edge[edge.size() / 2];
+	for (py = y0; py < y0 + size; ++py) {
+		row = data_ + size_t(py) * width_ + x0;
+		for (px = 0; px < size; ++px) flux += row[px] - back;
+	}
+	return flux;
+}
+
+/*
+ * 采样点插值使PSF峰值略低, 拟合流量系统性偏高
+ * 以参考星拟合流量与方框流量之比的中值缩放PSF
+ */
+void PsfPhot::aperture_correct(FitStarVec &psfstars) {
+	std::vector<double> ratio;
+	FitStar *ptr;
+	double back, flux;
+
+	for (FitStarVec::iterator it = psfstars.begin(); it != psfstars.end(); ++it) {
+		ptr = &(*it);
+		fit_group(&ptr, 1);
+		if (it->ok && (flux = box_flux(it->x, it->y, back)) > 0.0) ratio.push_back(it->flux / flux);
+	}
+	if (ratio.size() < PSF_MINSTARS) return;
+	std::nth_element(ratio.begin(), ratio.begin() + ratio.size() / 2, ratio.end());
+	double scale = ratio[ratio.size() / 2];
+	if (scale > 0.8 && scale < 1.25) {
+		for (std::vector<float>::iterator it = psf_.begin(); it != psf_.end(); ++it) *it = float(*it * scale);
+	}
+}
+
+float PsfPhot::psf_value(double dx, double dy, float &gx, float &gy) {
+	double u(dx * PSF_OVERSAMPLE + half_), v(dy * PSF_OVERSAMPLE + half_);
+	if (u < 0.0 || v < 0.0 || u >= dim_ - 1 || v >= dim_ - 1) {
+		gx = gy = 0.0f;
+		return 0.0f;
+	}
+
+	int iu = int(u), iv = int(v);
+	float fu(float(u - iu)), fv(float(v - iv));
+	const float *p = psf_.data() + iv * dim_ + iu;
+	float v00(p[0]), v10(p[1]), v01(p[dim_]), v11(p[dim_ + 1]);
+
+	gx = PSF_OVERSAMPLE * ((1.0f - fv) * (v10 - v00) + fv * (v11 - v01));
+	gy = PSF_OVERSAMPLE * ((1.0f - fu) * (v01 - v00) + fu * (v11 - v10));
+	return (1.0f - fv) * ((1.0f - fu) * v00 + fu * v10) + fv * ((1.0f - fu) * v01 + fu * v11);
+}
+
+/*
+ * 目标的PSF延伸至另一目标的拟合区时, 两者同组
+ */
+void PsfPhot::make_groups(const FitStarVec &stars, std::vector<IntVec> &groups) {
+	std::vector<IntVec> cells;
+	std::vector<int> parent(stars.size()), index(stars.size(), -1);
+	double dist(param_->psfFit + radius_), dx, dy;
+	int n(int(stars.size())), i, j, m, ix, iy, nx, ny;
+
+	for (i = 0; i < n; ++i) parent[i] = i;
+	make_grid(stars, dist, width_, height_, nx, ny, cells);
+	for (i = 0; i < n; ++i) {
+		ix = std::min(std::max(int(stars[i].x / dist), 0), nx - 1);
+		iy = std::min(std::max(int(stars[i].y / dist), 0), ny - 1);
+		for (m = 0; m < 9; ++m) {
+			int cx(ix + m % 3 - 1), cy(iy + m / 3 - 1);
+			if (cx < 0 || cx >= nx || cy < 0 || cy >= ny) continue;
+			const IntVec &cell = cells[cy * nx + cx];
+			for (IntVec::const_iterator it = cell.begin(); it != cell.end(); ++it) {
+				if ((j = *it) <= i) continue;
+				dx = stars[j].x - stars[i].x;
+				dy = stars[j].y - stars[i].y;
+				if (dx * dx + dy * dy < dist * dist) parent[find_root(parent, j)] = find_root(parent, i);
+			}
+		}
+	}
+
+	groups.clear();
+	for (i = 0; i < n; ++i) {
+		j = find_root(parent, i);
+		if (index[j] < 0) {
+			index[j] = int(groups.size());
+			groups.push_back(IntVec());
+		}
+		groups[index[j]].push_back(i);
+	}
+}
+
+/*
+ * 超过上限的组按X坐标分段. 段外目标以当前参数扣除后保持不变,
+ * 多遍拟合使段边界两侧的目标以对方的拟合结果相互扣除
+ */
+void PsfPhot::fit_groups(FitStarVec *stars, const std::vector<IntVec> *groups, int first, int step) {
+	std::vector<FitStar*> members, others;
+	int cap(param_->psfGroup), n, m, i, j, pass;
+
+	for (i = first; i < int(groups->size()); i += step) {
+		const IntVec &group = (*groups)[i];
+		members.clear();
+		for (IntVec::const_iterator it = group.begin(); it != group.end(); ++it)
+			members.push_back(&(*stars)[*it]);
+		if ((n = int(members.size())) <= cap) {
+			fit_group(members.data(), n);
+			continue;
+		}
+
+		std::sort(members.begin(), members.end(), [](const FitStar *a, const FitStar *b) { return a->x < b->x; });
+		for (pass = 0; pass < PSF_CHUNKPASS; ++pass) {
+			for (j = 0; j < n; j += cap) {
+				m = std::min(cap, n - j);
+				others.assign(members.begin(), members.begin() + j);
+				others.insert(others.end(), members.begin() + j + m, members.end());
+				fit_group(members.data() + j, m, others.data(), int(others.size()));
+			}
+		}
+	}
+}
+
+/*
+ * 参数: 各目标的流量、X、Y, 以及公共背景
+ * 拟合像素: 以各目标为中心、拟合半径内的像素
+ * Levenberg-Marquardt阻尼; 位置每次迭代改正不超过1像素
+ */
+void PsfPhot::fit_group(FitStar **members, int n, FitStar **others, int nother) {
+	double rfit(param_->psfFit), r2(rfit * rfit), dx, dy, chi2, sig2, maxstep;
+	int np(3 * n + 1), npix, x0, y0, x1, y1, bw, bh, px, py, i, k, a, b, iter;
+	std::vector<int> pxs, pys;
+	std::vector<char> mark;
+
+	/* 拟合像素 */
+	x0 = width_;
+	y0 = height_;
+	x1 = y1 = 0;
+	for (k = 0; k < n; ++k) {
+		x0 = std::min(x0, std::max(int(ceil(members[k]->x - rfit)), 0));
+		y0 = std::min(y0, std::max(int(ceil(members[k]->y - rfit)), 0));
+		x1 = std::max(x1, std::min(int(floor(members[k]->x + rfit)), width_ - 1));
+		y1 = std::max(y1, std::min(int(floor(members[k]->y + rfit)), height_ - 1));
+	}
+	if (x0 > x1 || y0 > y1) return;
+	bw = x1 - x0 + 1;
+	bh = y1 - y0 + 1;
+	mark.assign(bw * bh, 0);
+	for (k = 0; k < n; ++k) {
+		int ya(std::max(int(ceil(members[k]->y - rfit)), y0)), yb(std::min(int(floor(members[k]->y + rfit)), y1));
+		int xa(std::max(int(ceil(members[k]->x - rfit)), x0)), xb(std::min(int(floor(members[k]->x + rfit)), x1));
+		for (py = ya; py <= yb; ++py) {
+			dy = py - members[k]->y;
+			for (px = xa; px <= xb; ++px) {
+				dx = px - members[k]->x;
+				char &m = mark[(py - y0) * bw + px - x0];
+				if (!m && dx * dx + dy * dy <= r2) {
+					m = 1;
+					pxs.push_back(px);
+					pys.push_back(py);
+				}
+			}
+		}
+	}
+	if ((npix = int(pxs.size())) <= np + 2) return;
+
+	/* 初值 */
+	std::vector<float> d(npix), r(npix), jac(size_t(np) * npix);
+	std::vector<double> flux(n), x(n), y(n);
+	double back;
+	float gx, gy;
+	for (i = 0; i < npix; ++i) d[i] = data_[size_t(pys[i]) * width_ + pxs[i]];
+	for (k = 0; k < nother; ++k) {// 扣除PSF延伸至拟合区的段外目标
+		const FitStar *star = others[k];
+		if (star->flux <= 0.0 || star->x < x0 - radius_ || star->x > x1 + radius_
+				|| star->y < y0 - radius_ || star->y > y1 + radius_)
+			continue;
+		for (i = 0; i < npix; ++i)
+			d[i] -= float(star->flux * psf_value(pxs[i] - star->x, pys[i] - star->y, gx, gy));
+	}
+	r = d;
+	std::nth_element(r.begin(), r.begin() + npix / 5, r.end());
+	back = r[npix / 5];
+	for (k = 0; k < n; ++k) {
+		x[k]    = members[k]->x;
+		y[k]    = members[k]->y;
+		flux[k] = members[k]->flux > 0.0 ? members[k]->flux : 1.0;
+	}
+
+	MatrixXd A(np, np);
+	VectorXd g(np), delta;
+	float *col, *colx, *coly;
+	for (iter = 0; iter < PSF_MAXITER; ++iter) {
+		for (i = 0; i < npix; ++i) r[i] = d[i] - back;
+		for (k = 0; k < n; ++k) {
+			col  = jac.data() + size_t(3 * k) * npix;
+			colx = col + npix;
+			coly = colx + npix;
+			for (i = 0; i < npix; ++i) {
+				col[i]  = psf_value(pxs[i] - x[k], pys[i] - y[k], gx, gy);
+				colx[i] = float(-flux[k] * gx);
+				coly[i] = float(-flux[k] * gy);
+				r[i]   -= float(flux[k] * col[i]);
+			}
+		}
+		col = jac.data() + size_t(3 * n) * npix;
+		std::fill(col, col + npix, 1.0f);
+
+		for (a = 0; a < np; ++a) {
+			const float *ja = jac.data() + size_t(a) * npix;
+			for (b = 0; b <= a; ++b) A(a, b) = A(b, a) = SimdDot(ja, jac.data() + size_t(b) * npix, npix);
+			g(a) = SimdDot(ja, r.data(), npix);
+		}
+		MatrixXd damped(A);
+		for (a = 0; a < np; ++a) damped(a, a) *= 1.0 + 1E-3;
+		delta = damped.ldlt().solve(g);
+		if (!delta.allFinite()) return;
+
+		for (k = 0, maxstep = 0.0; k < n; ++k) {
+			dx = std::min(std::max(delta(3 * k + 1), -1.0), 1.0);
+			dy = std::min(std::max(delta(3 * k + 2), -1.0), 1.0);
+			flux[k] += delta(3 * k);
+			if (flux[k] <= 0.0) flux[k] = 1.0;
+			x[k] += dx;
+			y[k] += dy;
+			maxstep = std::max(maxstep, std::max(fabs(dx), fabs(dy)));
+		}
+		back += delta(3 * n);
+		if (maxstep < 0.01) break;
+	}
+
+	/* 误差: 残差方差乘以法矩阵的逆 */
+	chi2 = SimdDot(r.data(), r.data(), npix);
+	sig2 = chi2 / (npix - np);
+	MatrixXd cov = A.ldlt().solve(MatrixXd::Identity(np, np));
+	for (k = 0; k < n; ++k) {
+		FitStar *star = members[k];
+		dx = x[k] - star->x;
+		dy = y[k] - star->y;
+		if (flux[k] <= 1.0 || dx * dx + dy * dy > r2 || !(cov(3 * k, 3 * k) > 0.0)) continue;
+		star->x    = x[k];
+		star->y    = y[k];
+		star->flux = flux[k];
+		star->err  = sqrt(sig2 * cov(3 * k, 3 * k));
+		star->back = back;
+		star->ok   = true;
+	}
+}
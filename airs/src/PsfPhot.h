@@ -0,0 +1,114 @@
+/**
+ * @class PsfPhot 基于经验PSF的拟合测光
+ * @version 0.1
+ * @date 2020-11-28
+ * @note
+ * - 由图像中孤立、形态正常的亮星构建经验PSF: 2倍过采样, 各采样点取归一化像素值的中值
+ * - 以初版PSF重新拟合参考星位置后再构建一次, 减小质心误差造成的展宽
+ * - 以参考星的方框流量作孔径改正, 消除采样点插值造成的流量偏差
+ * - 拟合区相互重叠的目标构成一组, 组内目标的流量、位置与公共背景同时拟合(阻尼高斯-牛顿)
+ * - 法方程由雅可比矩阵各列的内积构成, 以SIMD计算
+ * - 各组之间相互独立, 按线程数交错分配并行拟合
+ * - 拟合结果写回目标特征值: 位置、流量、仪器星等及误差、背景; 拟合失败的目标保持原值
+ * - 超过组大小上限的组按X坐标分段拟合, 段外目标以当前拟合结果扣除, 多遍迭代
+ */
+
+#ifndef SRC_PSFPHOT_H_
+#define SRC_PSFPHOT_H_
+
+#include <vector>
+#include <boost/smart_ptr.hpp>
+#include "Parameter.h"
+#include "airsdata.h"
+
+class PsfPhot {
+public:
+	PsfPhot(Parameter *param);
+	virtual ~PsfPhot();
+
+public:
+	/* 数据类型 */
+	/*!
+	 * @struct FitStar 参与拟合的目标
+	 */
+	struct FitStar {
+		ObjectInfo *obj;	//< 目标
+		double x, y;		//< 位置, 坐标起始于0
+		double flux;		//< 流量
+		double err;			//< 流量误差
+		double back;		//< 背景
+		bool ok;			//< 拟合成功
+	};
+	typedef std::vector<FitStar> FitStarVec;
+	typedef std::vector<int> IntVec;
+
+protected:
+	/* 成员变量 */
+	Parameter *param_;	//< 配置参数
+	const float *data_;	//< 图像数据
+	int width_, height_;	//< 图像尺寸
+	int radius_;		//< PSF半宽度, 量纲: 像素
+	int half_;			//< 过采样PSF半宽度, 量纲: 采样点
+	int dim_;			//< 过采样PSF边长
+	std::vector<float> psf_;	//< 过采样PSF: 采样点处像素占总流量的比例
+
+public:
+	/*!
+	 * @brief 构建PSF并拟合测光
+	 * @param data   图像数据
+	 * @param width  宽度
+	 * @param height 高度
+	 * @param objs   目标, 拟合结果写回特征值
+	 * @param nthread 并行线程数
+	 * @return
+	 * 可用于构建PSF的恒星不足时返回false
+	 */
+	bool DoIt(const float *data, int width, int height, NFObjVec &objs, int nthread);
+
+protected:
+	/*!
+	 * @brief 选择构建PSF的恒星: 孤立、非最亮、FWHM与椭率正常
+	 */
+	void select_stars(FitStarVec &stars, FitStarVec &psfstars);
+	/*!
+	 * @brief 由恒星构建过采样PSF
+	 */
+	bool build_psf(const FitStarVec &psfstars);
+	/*!
+	 * @brief 以目标为中心的方框内扣除背景后的流量
+	 * @param back 背景
+	 * @return
+	 * 方框超出图像时返回0
+	 */
+	double box_flux(double x, double y, double &back);
+	/*!
+	 * @brief 孔径改正: 使参考星的拟合流量与方框流量一致
+	 */
+	void aperture_correct(FitStarVec &psfstars);
+	/*!
+	 * @brief PSF及其对位置的偏导数
+	 * @param dx  像素中心相对目标的偏移, 量纲: 像素
+	 * @param dy  像素中心相对目标的偏移, 量纲: 像素
+	 * @param gx  偏导数: d/d(dx)
+	 * @param gy  偏导数: d/d(dy)
+	 */
+	float psf_value(double dx, double dy, float &gx, float &gy);
+	/*!
+	 * @brief 由重叠的拟合区将目标分组
+	 */
+	void make_groups(const FitStarVec &stars, std::vector<IntVec> &groups);
+	/*!
+	 * @brief 线程: 拟合编号为first, first + step, ...的组
+	 */
+	void fit_groups(FitStarVec *stars, const std::vector<IntVec> *groups, int first, int step);
+	/*!
+	 * @brief 同时拟合一组目标
+	 * @param members 参与拟合的目标
+	 * @param n       参与拟合的目标数量
+	 * @param others  同组但不参与拟合的目标, 以当前参数从拟合像素中扣除
+	 * @param nother  不参与拟合的目标数量
+	 */
+	void fit_group(FitStar **members, int n, FitStar **others = NULL, int nother = 0);
+};
+
+#endif /* SRC_PSFPHOT_H_ */
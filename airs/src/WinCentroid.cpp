@@ -0,0 +1,122 @@
+/*!
+ * @file WinCentroid.cpp 高斯加权窗口质心
+ * @version 0.1
+ * @date 2020-11-30
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include "WinCentroid.h"
+#include "FrameStat.h"
+#include "ADISimd.h"
+
+using namespace boost::placeholders;
+
+#define WIN_MAXITER		16		// 最大迭代次数
+#define WIN_EPSILON		2E-4	// 收敛判据: 位置改正量, 量纲: 像素
+#define WIN_MINTASK		64		// 每个线程最少改正的目标数
+
+WinCentroid::WinCentroid() {
+}
+
+WinCentroid::~WinCentroid() {
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int WinCentroid::Refine(const float *data, int width, int height, NFObjVec &objs, int nthread) {
+	int n(int(objs.size())), step, count(0);
+
+	if (nthread > n / WIN_MINTASK) nthread = n / WIN_MINTASK;
+	if (nthread <= 1) {
+		refine_range(data, width, height, objs.data(), n, &count);
+		return count;
+	}
+
+	StatThreadGroup grp;
+	std::vector<int> counts(nthread, 0);
+	step = (n + nthread - 1) / nthread;
+	for (int i = 0, j = 0; i < n; i += step, ++j) {
+		grp.create_thread(boost::bind(&WinCentroid::refine_range, this, data, width, height,
+				objs.data() + i, std::min(step, n - i), &counts[j]));
+	}
+	grp.join_all();
+	for (int i = 0; i < nthread; ++i) count += counts[i];
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void WinCentroid::refine_range(const float *data, int width, int height, NFObjPtr *objs, int n, int *count) {
+	std::vector<float> gx, gxdx;
+	for (int i = 0; i < n; ++i) {
+		if (refine_one(data, width, height, objs[i].get(), gx, gxdx)) ++*count;
+	}
+}
+
+/*
+ * 窗口σ = FWHM / 2.3548, 窗口半宽度4σ
+ * 每次迭代: x += 2 * Σ(w * (I - B) * dx) / Σ(w * (I - B)), y同理
+ * 权重w = gx(dx) * gy(dy), 行内求和Σgx * I即gx与像素行的内积, 背景项由Σgx扣除
+ * 累计偏移超过σ视为被邻近目标牵引, 保持原位置
+ */
+bool WinCentroid::refine_one(const float *data, int width, int height, ObjectInfo *obj,
+		std::vector<float> &gx, std::vector<float> &gxdx) {
+	double *features = obj->features;
+	double sig, inv, xc, yc, back, dx, dy, gy, s, sx, sgx, sgxdx, sum, sumx, sumy;
+	int radius, x0, y0, x1, y1, px, py, n, iter;
+	const float *row;
+
+	sig    = features[NDX_FWHM] / 2.3548;
+	if (sig < 0.5) sig = 0.5;
+	else if (sig > 10.0) sig = 10.0;
+	inv    = 0.5 / (sig * sig);
+	radius = int(ceil(4.0 * sig));
+	xc     = features[NDX_X] - 1.0;	// 坐标起始于0, 像素中心为整数
+	yc     = features[NDX_Y] - 1.0;
+	back   = features[NDX_BACK];
+
+	for (iter = 0; iter < WIN_MAXITER; ++iter) {
+		x0 = int(floor(xc + 0.5)) - radius;
+		y0 = int(floor(yc + 0.5)) - radius;
+		x1 = x0 + 2 * radius;
+		y1 = y0 + 2 * radius;
+		if (x0 < 0 || y0 < 0 || x1 >= width || y1 >= height) return false;
+
+		n = x1 - x0 + 1;
+		gx.resize(n);
+		gxdx.resize(n);
+		for (px = 0, sgx = sgxdx = 0.0; px < n; ++px) {
+			dx = x0 + px - xc;
+			gx[px]   = float(exp(-dx * dx * inv));
+			gxdx[px] = float(gx[px] * dx);
+			sgx   += gx[px];
+			sgxdx += gxdx[px];
+		}
+		for (py = y0, sum = sumx = sumy = 0.0; py <= y1; ++py) {
+			row = data + size_t(py) * width + x0;
+			dy  = py - yc;
+			gy  = exp(-dy * dy * inv);
+			s   = SimdDot(gx.data(), row, n) - back * sgx;
+			sx  = SimdDot(gxdx.data(), row, n) - back * sgxdx;
+			sum  += gy * s;
+			sumx += gy * sx;
+			sumy += gy * dy * s;
+		}
+		if (sum <= 0.0) return false;
+
+		dx = 2.0 * sumx / sum;
+		dy = 2.0 * sumy / sum;
+		xc += dx;
+		yc += dy;
+		if (dx * dx + dy * dy < WIN_EPSILON * WIN_EPSILON) break;
+	}
+	if (iter == WIN_MAXITER) return false;
+
+	dx = xc + 1.0 - features[NDX_X];
+	dy = yc + 1.0 - features[NDX_Y];
+	if (dx * dx + dy * dy > sig * sig) return false;
+	features[NDX_X] = xc + 1.0;
+	features[NDX_Y] = yc + 1.0;
+	return true;
+}
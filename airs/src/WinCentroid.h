@@ -0,0 +1,53 @@
+/**
+ * @class WinCentroid 高斯加权窗口质心
+ * @version 0.1
+ * @date 2020-11-30
+ * @note
+ * - 与SExtractor XWIN_IMAGE/YWIN_IMAGE相同: 以目标FWHM对应的高斯函数为权重, 迭代计算质心
+ * - 高斯权重可分离为行、列两个一维函数, 窗口内逐行加权求和即两次内积, 以SIMD计算
+ * - 目标按线程数分组并行改正
+ * - 改正失败(窗口超出图像、加权流量非正、不收敛或偏移过大)的目标保持原位置
+ */
+
+#ifndef SRC_WINCENTROID_H_
+#define SRC_WINCENTROID_H_
+
+#include <vector>
+#include "airsdata.h"
+
+class WinCentroid {
+public:
+	WinCentroid();
+	virtual ~WinCentroid();
+
+public:
+	/*!
+	 * @brief 改正目标质心
+	 * @param data    图像数据
+	 * @param width   宽度
+	 * @param height  高度
+	 * @param objs    目标, 改正结果写回NDX_X与NDX_Y
+	 * @param nthread 并行线程数
+	 * @return
+	 * 改正成功的目标数量
+	 */
+	int Refine(const float *data, int width, int height, NFObjVec &objs, int nthread);
+
+protected:
+	/*!
+	 * @brief 线程: 改正一组目标
+	 * @param count 改正成功的目标数量
+	 */
+	void refine_range(const float *data, int width, int height, NFObjPtr *objs, int n, int *count);
+	/*!
+	 * @brief 改正单个目标
+	 * @param gx   缓存: 列权重
+	 * @param gxdx 缓存: 列权重与列偏移之积
+	 * @return
+	 * 改正成功返回true
+	 */
+	bool refine_one(const float *data, int width, int height, ObjectInfo *obj,
+			std::vector<float> &gx, std::vector<float> &gxdx);
+};
+
+#endif /* SRC_WINCENTROID_H_ */
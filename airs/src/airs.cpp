@@ -15,6 +15,8 @@
  * @date 2020-10-20
  * - 根目录多级遍历
  * - 结束后自动退出
+ * @date 2020-11-02
+ * - 离线模式使用BatchReduct并行处理
  */
 
 #include <getopt.h>
@@ -25,11 +27,18 @@
 #include <boost/make_shared.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/bind/bind.hpp>
+#include <boost/algorithm/string.hpp>
 #include "globaldef.h"
 #include "Parameter.h"
 #include "daemon.h"
 #include "GLog.h"
+#include "ATrace.h"
+#include "ExtractPool.h"
+#include "PreProcess.h"
+#include "BrightMask.h"
+#include "BadColumn.h"
 #include "DoProcess.h"
+#include "BatchReduct.h"
 
 using namespace std;
 using namespace boost::posix_time;
@@ -38,6 +47,11 @@ using namespace boost::placeholders;
 
 typedef vector<string> vecstr;
 boost::shared_ptr<GLog> _gLog;
+boost::shared_ptr<ATrace> _gTrace;
+boost::shared_ptr<ExtractPool> _gExtract;
+PreProcPtr _gPreProc;
+BrightMaskPtr _gBrightMask;
+BadColumnPtr _gBadColumn;
 int _nProcess;
 
 /*!
@@ -52,32 +66,57 @@ void Usage() {
 	printf(" -s / --daemon  : run as daemon server\n\n");
 }
 
-void process_directory(const string &filepath) {
+/*!
+ * @brief 离线模式: 加载配置参数并创建全局服务
+ * @note
+ * 全局服务在所有目录间共享, 合并本底/平场、亮星定位结果与坏列计数不因目录边界丢失
+ */
+void start_batch(Parameter &param) {
+	param.LoadFile(gConfigPath);
+	if (param.traceEnable) _gTrace->Start(param.pathOutput, param.tracePeriod);
+	if (param.sexWorkers > 0 && !param.dipNative) _gExtract->Start(param.sexWorkers, param.sexRecycle);
+	if (param.calibEnable) _gPreProc = boost::make_shared<PreProcess>(&param);
+	if (param.maskEnable) _gBrightMask = boost::make_shared<BrightMask>(&param);
+	if (param.badcolEnable) _gBadColumn = boost::make_shared<BadColumn>(&param);
+}
+
+/*!
+ * @brief 检查文件名是否FITS图像, 包括压缩格式
+ * @note
+ * *.fits.fz的扩展名为.fz, 不能以扩展名判断
+ */
+bool is_fits_file(const path &filepath) {
+	string name = filepath.filename().string();
+	return boost::iends_with(name, ".fit") || boost::iends_with(name, ".fits")
+			|| boost::iends_with(name, ".fit.fz") || boost::iends_with(name, ".fits.fz");
+}
+
+/*!
+ * @brief 离线模式: 处理一组文件
+ */
+void process_files(vecstr &files, Parameter *param, boost::shared_ptr<LogCalibrated> logcal) {
+	// 等待其它处理完成
+	while (_nProcess) boost::this_thread::sleep_for(boost::chrono::seconds(30));
+
+	boost::shared_ptr<BatchReduct> batch = boost::make_shared<BatchReduct>(param, logcal);
+	++_nProcess;
+	sort(files.begin(), files.end(), [](const string &name1, const string &name2) {
+		return name1 < name2;
+	});
+	if (batch->Start()) batch->ProcessFiles(files);
+	--_nProcess;
+}
+
+void process_directory(const string &filepath, Parameter *param, boost::shared_ptr<LogCalibrated> logcal) {
 	vecstr files;
-	int n;
 
 	for (directory_iterator x = directory_iterator(filepath); x != directory_iterator(); ++x) {
-		if (is_directory(x->path().string())) process_directory(x->path().string());
-		else if (x->path().extension().string().rfind(".fit") != string::npos) {
+		if (is_directory(x->path().string())) process_directory(x->path().string(), param, logcal);
+		else if (is_fits_file(x->path())) {
 			files.push_back(x->path().string());
 		}
 	}
-	if ((n = files.size())) {
-		// 等待其它处理完成
-		while (_nProcess) boost::this_thread::sleep_for(boost::chrono::seconds(30));
-
-		boost::asio::io_service ios;
-		boost::shared_ptr<DoProcess> doProcess = boost::make_shared<DoProcess>();
-		++_nProcess;
-		sort(files.begin(), files.end(), [](const string &name1, const string &name2) {
-			return name1 < name2;
-		});
-		doProcess->StartService(false, &ios);
-		for (int i = 0; i < n; ++i) doProcess->ProcessImage(files[i]);
-		while (!doProcess->IsOver()) boost::this_thread::sleep_for(boost::chrono::seconds(30));
-		doProcess->StopService();
-		--_nProcess;
-	}
+	if (files.size()) process_files(files, param, logcal);
 }
 
 int main(int argc, char **argv) {
@@ -130,6 +169,8 @@ int main(int argc, char **argv) {
 	signals.async_wait(boost::bind(&boost::asio::io_service::stop, &ios));
 
 	_gLog = boost::make_shared<GLog>(is_daemon ? NULL : stdout);
+	_gTrace = boost::make_shared<ATrace>();
+	_gExtract = boost::make_shared<ExtractPool>();
 	boost::shared_ptr<DoProcess> doProcess = boost::make_shared<DoProcess>();
 	if (is_daemon) {
 		if (!MakeItDaemon(ios)) return 1;
@@ -150,29 +191,25 @@ int main(int argc, char **argv) {
 	else {
 		_nProcess = 0;
 
+		Parameter param;
+		start_batch(param);
+		boost::shared_ptr<LogCalibrated> logcal = boost::make_shared<LogCalibrated>(param.pathOutput);
 		vecstr files;
-		int n;
 		for (int i = 0; i < argc; ++i) {
 			path pathname(argv[i]);
-			if (is_directory(pathname)) process_directory(pathname.string());
-			else if (is_regular_file(pathname) && pathname.extension().string().rfind(".fit") != string::npos)
+			if (is_directory(pathname)) process_directory(pathname.string(), &param, logcal);
+			else if (is_regular_file(pathname) && is_fits_file(pathname))
 				files.push_back(argv[i]);
 		}
-		if ((n = files.size())) {
-			while(_nProcess) boost::this_thread::sleep_for(boost::chrono::seconds(30));
-			++_nProcess;
-			sort(files.begin(), files.end(), [](const string &name1, const string &name2) {
-				return name1 < name2;
-			});
-			doProcess->StartService(false, &ios);
-			for (int i = 0; i < n; ++i)
-				doProcess->ProcessImage(files[i]);
-			while (!doProcess->IsOver()) boost::this_thread::sleep_for(boost::chrono::seconds(30));
-			doProcess->StopService();
-			--_nProcess;
-		}
+		if (files.size()) process_files(files, &param, logcal);
 		while(_nProcess) boost::this_thread::sleep_for(boost::chrono::seconds(30));
+		// 全局服务引用param, 在其析构前释放
+		_gPreProc.reset();
+		_gBrightMask.reset();
+		_gBadColumn.reset();
 	}
+	_gExtract->Stop();
+	_gTrace->Stop();
 
 	return 0;
 }
@@ -38,6 +38,7 @@ enum {
 struct ObjectInfo {
 	/* 图像处理结果 */
 	int id;		//< 在图像中的编号
+	int hdu;	//< 所在HDU编号. 0: 单HDU图像; > 0: 多扩展FITS中的图像扩展序号
 	double features[NDX_MAX];	//< 天体测量特征值
 	/* 天文定位 */
 	double ra_fit;	//< 赤道坐标, J2000, 量纲: 角度
@@ -66,6 +67,72 @@ public:
 typedef boost::shared_ptr<ObjectInfo> NFObjPtr;
 typedef std::vector<NFObjPtr> NFObjVec;
 
+/*!
+ * @brief 强制测光标志
+ */
+enum {
+	FORCED_EDGE  = 1,	//< 孔径或背景环超出图像
+	FORCED_BACK  = 2,	//< 背景环内有效像素不足
+	FORCED_FAINT = 4,	//< 扣除背景后流量非正
+	FORCED_SKY   = 8	//< 赤道坐标无法换算为图像坐标
+};
+
+/*!
+ * @struct ForcedObject 强制测光: 指定位置与测量结果
+ */
+struct ForcedObject {
+	double x, y;		//< 图像坐标, 起始于1, 与目标特征值一致
+	double ra, dec;		//< 赤道坐标, J2000, 量纲: 角度. 由赤道坐标换算图像坐标时使用
+	double flux;		//< 孔径流量, 已扣除背景
+	double fluxerr;		//< 流量误差
+	double back;		//< 背景
+	double backsig;		//< 背景噪声
+	double area;		//< 孔径面积, 量纲: 像素
+	double mag;			//< 仪器星等, 零点与图像处理一致. 无效值: 99
+	double magerr;		//< 仪器星等误差
+	double mag_fit;		//< V星等: 拟合. 无效值: 20
+	int flag;			//< 强制测光标志
+
+public:
+	ForcedObject() {
+		memset(this, 0, sizeof(ForcedObject));
+		mag = magerr = 99.;
+		mag_fit = 20.;
+	}
+};
+typedef std::vector<ForcedObject> ForcedVec;
+
+/*!
+ * @brief 处理步骤
+ */
+enum {
+	STAGE_REDUCT,	//< 图像处理
+	STAGE_ASTRO,	//< 天文定位
+	STAGE_MATCH,	//< 匹配星表
+	STAGE_PHOTO,	//< 测光
+	STAGE_MAX
+};
+
+/*!
+ * @struct StageStat 单个处理步骤的耗时与资源占用
+ */
+struct StageStat {
+	double tmenq;	//< 进入队列时刻, 单调时钟, 量纲: 秒. 0: 未进入
+	double tmdeq;	//< 离开队列、开始处理时刻
+	double tmend;	//< 处理结束时刻
+	double cpuusr;	//< 子进程用户态CPU时间, 量纲: 秒
+	double cpusys;	//< 子进程内核态CPU时间, 量纲: 秒
+	double cputhrd;	//< 本进程中处理线程的CPU时间, 量纲: 秒
+	long maxrss;	//< 子进程最大驻留内存, 量纲: KB
+	long bytesin;	//< 子进程读取字节数
+	long bytesout;	//< 子进程写入字节数
+
+public:
+	StageStat() {
+		memset(this, 0, sizeof(StageStat));
+	}
+};
+
 /*!
  * @struct OneFrame 单帧图像的特征信息
  */
@@ -84,6 +151,14 @@ struct OneFrame {
 	double secofday;	//< 当日秒数
 	double mjd;			//< 修正儒略日: 曝光中间时刻
 	double raobj, decobj;//< 指向目标位置
+	/* 多扩展FITS(MEF) */
+	int hdu;			//< HDU编号. 0: 单HDU图像; > 0: 图像扩展序号, 即子帧
+	bool compressed;	//< 唯一图像扩展为瓦片压缩图像. SExtractor与solve-field读取解压副本
+	std::vector<boost::shared_ptr<OneFrame> > subfrms;	//< 子帧: 每个图像扩展对应一帧
+	/* 数据立方体(NAXIS3) */
+	int nplane;			//< 平面数量. 0: 二维图像
+	int plane;			//< 平面序号, 从1开始. 0: 不是立方体的平面
+	double cadence;		//< 相邻平面的时间间隔, 量纲: 秒
 	/* 网络标志 */
 	string gid;		//< 组标志
 	string uid;		//< 单元ID
@@ -97,6 +172,7 @@ struct OneFrame {
 	double errastro;	//< 天文定位拟合残差, 量纲: 角秒
 	int lastid;			//< 感兴趣目标的最后一个编号
 	NFObjVec nfobjs;	//< 集合: 目标特征
+	ForcedVec forced;	//< 集合: 强制测光结果
 	int notOt;			//< 非瞬变源的数量. 非瞬变源=恒星+坏点
 	/*
 	 * 仪器星等改正及大气消光
@@ -104,6 +180,8 @@ struct OneFrame {
 	 */
 	double mag0;	//< 星等零点. 仪器星等0时对应的视星等
 	double magk;	//< 拟合系数. magV=kmag*magInst+mag0
+	/* 耗时与资源占用 */
+	StageStat stat[STAGE_MAX];
 
 public:
 	OneFrame() {
@@ -113,6 +191,10 @@ public:
 		secofday = 0;
 		mjd  = 0;
 		raobj = decobj = 1E30;
+		hdu  = 0;
+		compressed = false;
+		nplane = plane = 0;
+		cadence  = 0.0;
 		expdur = 0.0;
 		fwhm = 0.0;
 		rac  = decc = 0.0;
@@ -128,6 +210,8 @@ public:
 
 	virtual ~OneFrame() {
 		nfobjs.clear();
+		forced.clear();
+		subfrms.clear();
 	}
 };
 typedef boost::shared_ptr<OneFrame> FramePtr;	//< 单帧图像特征信息访问指针